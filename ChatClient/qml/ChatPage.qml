@@ -208,9 +208,20 @@ Rectangle {
                 }
                 clip: true
                 ScrollBar.vertical: ScrollBar {}
-                onCountChanged: Qt.callLater(function() {
-                    messageListView.positionViewAtEnd();
-                })
+                // 正在插入更早的历史消息时不滚动到底部
+                property bool prepending: false
+                onCountChanged: {
+                    if (prepending) return;
+                    Qt.callLater(function() {
+                        messageListView.positionViewAtEnd();
+                    });
+                }
+                // 滚动到顶部时加载更早的一页
+                onAtYBeginningChanged: {
+                    if (atYBeginning && count > 0) {
+                        chatWindow.loadOlderMessages();
+                    }
+                }
             }
 
             Rectangle {
@@ -320,6 +331,18 @@ Rectangle {
                 "avatarSource": avatarSource
             });
         }
+        function onMessageInserted(row, sender, content, timestamp, avatarSource) {
+            messageListView.prepending = true;
+            messageModel.insert(row, {
+                "sender": sender,
+                "content": content,
+                "timestamp": timestamp,
+                "avatarSource": avatarSource
+            });
+            // 保持原来顶部的消息停在可见区域顶部
+            messageListView.positionViewAtIndex(row + 1, ListView.Beginning);
+            messageListView.prepending = false;
+        }
         function onChatDisplayCleared() {
             messageModel.clear();
         }
@@ -230,9 +230,20 @@ Rectangle {
                 }
                 clip: true
                 ScrollBar.vertical: ScrollBar {}
-                onCountChanged: Qt.callLater(function() {
-                    chatDisplay.positionViewAtEnd();
-                })
+                // 正在插入更早的历史消息时不滚动到底部
+                property bool prepending: false
+                onCountChanged: {
+                    if (prepending) return;
+                    Qt.callLater(function() {
+                        chatDisplay.positionViewAtEnd();
+                    });
+                }
+                // 滚动到顶部时加载更早的一页
+                onAtYBeginningChanged: {
+                    if (atYBeginning && count > 0) {
+                        chatWindow.loadOlderMessages();
+                    }
+                }
             }
 
             Rectangle {
@@ -631,6 +642,20 @@ Rectangle {
         }
     }
 
+    // 在列表前部插入一条更早的历史消息
+    function insertHistoryMessage(row, sender, content, timestamp, avatarSource) {
+        chatDisplay.prepending = true;
+        messageModel.insert(row, {
+            "sender": sender,
+            "content": content,
+            "timestamp": timestamp,
+            "avatarSource": avatarSource
+        });
+        // 保持原来顶部的消息停在可见区域顶部
+        chatDisplay.positionViewAtIndex(row + 1, ListView.Beginning);
+        chatDisplay.prepending = false;
+    }
+
     Connections {
         target: chatWindow
         function onMessageReceived(sender, content, timestamp, avatarSource) {
@@ -658,6 +683,16 @@ Rectangle {
             console.log("添加群聊消息到列表");
         }
 
+        function onMessageInserted(row, sender, content, timestamp, avatarSource) {
+            if (!chatWindow.isGroupChat) {
+                insertHistoryMessage(row, sender, content, timestamp, avatarSource);
+            }
+        }
+
+        function onGroupChatMessageInserted(row, sender, content, timestamp, avatarSource) {
+            insertHistoryMessage(row, sender, content, timestamp, avatarSource);
+        }
+
         function onChatDisplayCleared() {
             messageModel.clear();
             console.log("清空消息列表");
@@ -12,6 +12,7 @@
 #include <QTime>
 #include <QImage>
 #include <QUuid>
+#include <QCryptographicHash>
 
 ChatWindow::ChatWindow(QObject *parent)
     : QObject(parent), m_socket(new QTcpSocket(this)), m_isLoggedIn(false)
@@ -36,6 +37,14 @@ ChatWindow::ChatWindow(QObject *parent)
         }
     }
     settings.endGroup();
+    // 本地头像对应的服务器头像版本，请求头像时带上，未改变时服务器不再传输
+    settings.beginGroup("AvatarVersion");
+    for (const QString &nickname : settings.childKeys()) {
+        if (m_avatarCache.contains(nickname)) {
+            m_avatarVersions[nickname] = settings.value(nickname).toString();
+        }
+    }
+    settings.endGroup();
 
     // 初始化图片缓存
     initImageCache();
@@ -99,6 +108,8 @@ void ChatWindow::onDisconnected()
 {
     qDebug() << "与服务器断开连接。";
     m_isLoggedIn = false;
+    // 重新连接后需要重新确认头像版本
+    m_avatarChecked.clear();
     emit isLoggedInChanged();
     emit statusMessage("已断开连接");
 }
@@ -325,6 +336,16 @@ void ChatWindow::appendMessage(const QString &sender, const QString &content, co
     message["timestamp"] = timestamp.isEmpty() ? QTime::currentTime().toString("hh:mm") : timestamp;
     message["avatarSource"] = avatarPath;
 
+    if (m_historyInsertRow >= 0) {
+        // 向上翻页的历史消息按顺序插入到列表前部
+        emit messageInserted(m_historyInsertRow++,
+                             message["sender"].toString(),
+                             message["content"].toString(),
+                             message["timestamp"].toString(),
+                             message["avatarSource"].toString());
+        return;
+    }
+
     emit messageReceived(message["sender"].toString(),
                          message["content"].toString(),
                          message["timestamp"].toString(),
@@ -415,8 +436,17 @@ void ChatWindow::handleServerData()
 {
     if (m_socket->bytesAvailable() <= 0) return;
 
-    QByteArray data = m_socket->readAll();
+    // 一次读取可能包含多条消息或半条消息，交给分帧器切分
+    m_framer.append(m_socket->readAll());
 
+    QByteArray frame;
+    while (m_framer.next(frame)) {
+        processServerMessage(frame);
+    }
+}
+
+void ChatWindow::processServerMessage(const QByteArray &data)
+{
     // 检查是否是二进制图片数据
     if (data.size() > 16) { // 至少需要16字节来检查魔数和消息类型
         // 打印前几个字节用于调试
@@ -774,6 +804,7 @@ void ChatWindow::handleServerData()
         case MessageType::Login:
             if (msgData.value("status").toString() == "success") {
                 m_isLoggedIn = true;
+                m_receivedMessageIds.clear();
                 emit isLoggedInChanged();
                 emit statusMessage(QString("以 %1 身份登录").arg(m_currentNickname));
                 clearChatDisplay();
@@ -801,153 +832,11 @@ void ChatWindow::handleServerData()
             break;
 
         case MessageType::Message:
-            {
-                QString from = msgData.value("from").toString();
-                QString contentStr = msgData.value("content").toString();
-                QString timestamp = QDateTime::currentDateTime().toString("hh:mm");
-
-                // 尝试解析JSON内容
-                QJsonDocument contentDoc = QJsonDocument::fromJson(contentStr.toUtf8());
-
-                if (!contentDoc.isNull() && contentDoc.isObject()) {
-                    // 如果是JSON对象，根据类型处理
-                    QJsonObject contentObj = contentDoc.object();
-                    QString type = contentObj["type"].toString();
-
-                    if (type == "image") {
-                        // 图片消息
-                        QString imageId = contentObj["imageId"].toString();
-
-                        // 直接使用发送方提供的本地路径
-                        if (contentObj.contains("localPath")) {
-                            QString localPath = contentObj["localPath"].toString();
-                            int width = contentObj["width"].toInt();
-                            int height = contentObj["height"].toInt();
-
-                            qDebug() << "接收到图片消息，直接使用本地路径:" << localPath;
-
-                            // 检查文件是否存在
-                            QFileInfo fileInfo(localPath);
-                            if (fileInfo.exists() && fileInfo.isReadable()) {
-                                // 文件存在且可读，直接使用
-                                QJsonObject displayJson;
-                                displayJson["type"] = "image";
-                                displayJson["imageId"] = imageId;
-                                displayJson["localPath"] = localPath;
-                                displayJson["width"] = width > 0 ? width : 800;  // 默认宽度
-                                displayJson["height"] = height > 0 ? height : 600;  // 默认高度
-
-                                // 显示图片消息
-                                if (from == m_currentChatFriend) {
-                                    appendMessage(from, QString::fromUtf8(QJsonDocument(displayJson).toJson()), timestamp);
-                                } else {
-                                    emit statusMessage(QString("来自 %1 的新图片消息").arg(from));
-                                }
-
-                                // 保存到缓存映射，以便后续使用
-                                m_imageCacheMap[imageId] = localPath;
-                            } else {
-                                qDebug() << "本地图片文件不存在或不可读:" << localPath;
-
-                                // 先显示占位符
-                                if (from == m_currentChatFriend) {
-                                    appendMessage(from, "[图片加载中...]", timestamp);
-                                } else {
-                                    emit statusMessage(QString("来自 %1 的新图片消息").arg(from));
-                                }
-
-                                // 尝试从服务器下载（保留服务器下载逻辑）
-                                downloadImage(imageId);
-                            }
-                        } else {
-                            // 如果没有本地路径，尝试从缓存中获取
-                            if (m_imageCacheMap.contains(imageId)) {
-                                QString cachedPath = m_imageCacheMap[imageId];
-                                QFileInfo fileInfo(cachedPath);
-
-                                if (fileInfo.exists() && fileInfo.isReadable()) {
-                                    // 文件存在且可读，获取图片尺寸
-                                    QImage image(cachedPath);
-                                    int width = image.width();
-                                    int height = image.height();
-
-                                    if (width > 0 && height > 0) {
-                                        // 图片有效，创建JSON对象
-                                        QJsonObject displayJson;
-                                        displayJson["type"] = "image";
-                                        displayJson["imageId"] = imageId;
-                                        displayJson["localPath"] = cachedPath;
-                                        displayJson["width"] = width;
-                                        displayJson["height"] = height;
-
-                                        // 如果有缓存，直接显示
-                                        if (from == m_currentChatFriend) {
-                                            appendMessage(from, QString::fromUtf8(QJsonDocument(displayJson).toJson()), timestamp);
-                                        } else {
-                                            emit statusMessage(QString("来自 %1 的新图片消息").arg(from));
-                                        }
-                                    } else {
-                                        // 图片无效，尝试从服务器下载
-                                        qDebug() << "缓存的图片无效，尝试从服务器下载:" << imageId;
-                                        downloadImage(imageId);
-
-                                        // 先显示占位符
-                                        if (from == m_currentChatFriend) {
-                                            appendMessage(from, "[图片加载中...]", timestamp);
-                                        } else {
-                                            emit statusMessage(QString("来自 %1 的新图片消息").arg(from));
-                                        }
-                                    }
-                                } else {
-                                    // 文件不存在或不可读，尝试从服务器下载
-                                    qDebug() << "缓存的图片文件不存在或不可读，尝试从服务器下载:" << imageId;
-                                    downloadImage(imageId);
-
-                                    // 先显示占位符
-                                    if (from == m_currentChatFriend) {
-                                        appendMessage(from, "[图片加载中...]", timestamp);
-                                    } else {
-                                        emit statusMessage(QString("来自 %1 的新图片消息").arg(from));
-                                    }
-                                }
-                            } else {
-                                // 如果没有缓存，尝试从服务器下载
-                                qDebug() << "没有本地路径和缓存，尝试从服务器下载图片:" << imageId;
-                                downloadImage(imageId);
+            handlePrivateMessage(msgData);
+            break;
 
-                                // 先显示占位符
-                                if (from == m_currentChatFriend) {
-                                    appendMessage(from, "[图片加载中...]", timestamp);
-                                } else {
-                                    emit statusMessage(QString("来自 %1 的新图片消息").arg(from));
-                                }
-                            }
-                        }
-                    } else if (type == "text") {
-                        // 文本消息
-                        QString text = contentObj["text"].toString();
-                        if (from == m_currentChatFriend) {
-                            appendMessage(from, text, timestamp);
-                        } else {
-                            emit statusMessage(QString("来自 %1 的新消息: %2").arg(from, text));
-                        }
-                    } else {
-                        // 未知类型，显示原始内容
-                        if (from == m_currentChatFriend) {
-                            appendMessage(from, contentStr, timestamp);
-                        } else {
-                            emit statusMessage(QString("来自 %1 的新消息").arg(from));
-                        }
-                    }
-                } else {
-                    // 如果不是JSON对象，当作普通文本处理
-                    if (from == m_currentChatFriend) {
-                        appendMessage(from, contentStr, timestamp);
-                    } else {
-                        emit statusMessage(QString("来自 %1 的新消息").arg(from));
-                    }
-                }
-            }
+        case MessageType::OfflineMessages:
+            handleOfflineMessages(msgData);
             break;
 
         case MessageType::FriendList:
@@ -959,6 +848,11 @@ void ChatWindow::handleServerData()
                 }
                 friends.sort(Qt::CaseInsensitive);
                 qDebug() << "收到好友列表：" << friends;
+                // 好友列表附带头像版本，与本地缓存的版本比较
+                QJsonObject avatarVersions = msgData.value("avatar_versions").toObject();
+                for (auto it = avatarVersions.constBegin(); it != avatarVersions.constEnd(); ++it) {
+                    checkAvatarVersion(it.key(), it.value().toString());
+                }
                 if (m_friendList != friends) {
                     updateFriendList(friends);
                     qDebug() << "好友列表已更新！";
@@ -972,10 +866,21 @@ void ChatWindow::handleServerData()
 
         case MessageType::ChatHistory:
             if (msgData.value("status").toString() == "success") {
-                clearChatDisplay();
                 QJsonArray messages = msgData.value("messages").toArray();
+                // 切换会话后到达的旧翻页结果直接丢弃
+                if (msgData.contains("before_id") && msgData.value("friend").toString() != m_currentChatFriend) {
+                    break;
+                }
+                bool olderPage = updateHistoryState(msgData, messages);
+                if (olderPage) {
+                    m_historyInsertRow = 0;
+                } else {
+                    clearChatDisplay();
+                }
                 if (messages.isEmpty()) {
-                    appendMessage("", "尚无消息记录。", "");
+                    if (!olderPage) {
+                        appendMessage("", "尚无消息记录。", "");
+                    }
                 } else {
                     for (const QJsonValue &msgValue : messages) {
                         QJsonObject msgObj = msgValue.toObject();
@@ -983,8 +888,8 @@ void ChatWindow::handleServerData()
                         QString contentStr = msgObj.value("content").toString();
                         QString timestamp = QDateTime::fromString(msgObj.value("timestamp").toString(), Qt::ISODate).toString("hh:mm");
 
-                        // 如果缓存中没有该用户的头像，则尝试获取
-                        if (!m_avatarCache.contains(sender)) {
+                        // 如果缓存中没有该用户的头像或本次登录尚未确认版本，则尝试获取
+                        if (!m_avatarCache.contains(sender) || !m_avatarChecked.contains(sender)) {
                             requestAvatar(sender);
                         }
 
@@ -1051,7 +956,9 @@ void ChatWindow::handleServerData()
                         }
                     }
                 }
+                m_historyInsertRow = -1;
             } else {
+                m_historyLoading = false;
                 emit statusMessage("无法获取聊天记录。");
             }
             break;
@@ -1181,7 +1088,20 @@ void ChatWindow::handleServerData()
                 qDebug() << "收到群聊历史记录";
                 QJsonArray messages = msgData["messages"].toArray();
 
+                // 切换会话后到达的旧翻页结果直接丢弃
+                if (msgData.contains("before_id") && QString::number(msgData["group_id"].toInt()) != m_currentChatGroup) {
+                    break;
+                }
+                bool olderPage = updateHistoryState(msgData, messages);
+                if (olderPage) {
+                    m_historyInsertRow = 0;
+                }
+
                 if (messages.isEmpty()) {
+                    if (olderPage) {
+                        m_historyInsertRow = -1;
+                        break;
+                    }
                     qDebug() << "群聊历史记录为空，显示提示信息";
                     QString systemAvatarPath = "qrc:/images/default_avatar.png"; // 系统消息使用默认头像
                     emit groupChatMessageReceived("系统", "暂无群聊记录", QDateTime::currentDateTime().toString("hh:mm"), systemAvatarPath);
@@ -1192,8 +1112,8 @@ void ChatWindow::handleServerData()
                         QString contentStr = message["content"].toString();
                         QString timestamp = QDateTime::fromString(message["timestamp"].toString(), Qt::ISODate).toString("hh:mm");
 
-                        // 如果缓存中没有该用户的头像，则尝试获取
-                        if (!m_avatarCache.contains(sender)) {
+                        // 如果缓存中没有该用户的头像或本次登录尚未确认版本，则尝试获取
+                        if (!m_avatarCache.contains(sender) || !m_avatarChecked.contains(sender)) {
                             requestAvatar(sender);
                         }
 
@@ -1233,36 +1153,39 @@ void ChatWindow::handleServerData()
                                             displayJson["height"] = height;
 
                                             // 显示图片消息
-                                            emit groupChatMessageReceived(sender, QString::fromUtf8(QJsonDocument(displayJson).toJson()), timestamp, avatarPath);
+                                            emitGroupHistoryMessage(sender, QString::fromUtf8(QJsonDocument(displayJson).toJson()), timestamp, avatarPath);
                                         } else {
                                             // 图片无效，尝试从服务器下载
                                             downloadImage(imageId);
-                                            emit groupChatMessageReceived(sender, "[图片加载中...]", timestamp, avatarPath);
+                                            emitGroupHistoryMessage(sender, "[图片加载中...]", timestamp, avatarPath);
                                         }
                                     } else {
                                         // 文件不存在或不可读，尝试从服务器下载
                                         downloadImage(imageId);
-                                        emit groupChatMessageReceived(sender, "[图片加载中...]", timestamp, avatarPath);
+                                        emitGroupHistoryMessage(sender, "[图片加载中...]", timestamp, avatarPath);
                                     }
                                 } else {
                                     // 没有缓存，尝试从服务器下载
                                     downloadImage(imageId);
-                                    emit groupChatMessageReceived(sender, "[图片加载中...]", timestamp, avatarPath);
+                                    emitGroupHistoryMessage(sender, "[图片加载中...]", timestamp, avatarPath);
                                 }
                             } else if (type == "text") {
                                 // 文本消息
                                 QString text = contentObj["text"].toString();
-                                emit groupChatMessageReceived(sender, text, timestamp, avatarPath);
+                                emitGroupHistoryMessage(sender, text, timestamp, avatarPath);
                             } else {
                                 // 未知类型，显示原始内容
-                                emit groupChatMessageReceived(sender, contentStr, timestamp, avatarPath);
+                                emitGroupHistoryMessage(sender, contentStr, timestamp, avatarPath);
                             }
                         } else {
                             // 如果不是JSON对象，当作普通文本处理
-                            emit groupChatMessageReceived(sender, contentStr, timestamp, avatarPath);
+                            emitGroupHistoryMessage(sender, contentStr, timestamp, avatarPath);
                         }
                     }
                 }
+                m_historyInsertRow = -1;
+            } else {
+                m_historyLoading = false;
             }
             break;
 
@@ -1285,6 +1208,7 @@ void ChatWindow::handleServerData()
 
                 // 如果有头像信息，请求头像
                 if (msgData.contains("avatar") && !msgData["avatar"].toString().isEmpty()) {
+                    checkAvatarVersion(m_currentNickname, msgData["avatar_version"].toString());
                     requestAvatar(m_currentNickname);
                 }
             } else {
@@ -1307,7 +1231,11 @@ void ChatWindow::handleServerData()
             if (msgData["status"].toString() == "success") {
                 emit statusMessage("头像已更新");
                 emit avatarUploadSuccess();
-                // 请求最新的头像
+                // 上传的头像已保存在本地，记录服务器返回的新版本即可，不需要重新下载
+                if (msgData.contains("avatar_version")) {
+                    setAvatarVersion(m_currentNickname, msgData["avatar_version"].toString());
+                    m_avatarChecked.insert(m_currentNickname);
+                }
                 requestAvatar(m_currentNickname);
             } else {
                 emit statusMessage("上传头像失败：" + msgData["reason"].toString("未知错误"));
@@ -1317,6 +1245,12 @@ void ChatWindow::handleServerData()
         case MessageType::GetAvatar: {
             QString nickname = msgData["nickname"].toString();
 
+            // 本地缓存的头像仍是最新版本
+            if (msgData["status"].toString() == "not_modified") {
+                qDebug() << "用户" << nickname << "的头像未改变";
+                break;
+            }
+
             // 检查是否有头像数据
             if (msgData.contains("avatar_data")) {
                 QByteArray data = QByteArray::fromBase64(msgData["avatar_data"].toString().toLatin1());
@@ -1361,6 +1295,7 @@ void ChatWindow::handleServerData()
                             settings.setValue(nickname, filePath);
                             settings.endGroup();
                             settings.sync(); // 确保立即写入磁盘
+                            setAvatarVersion(nickname, msgData["avatar_version"].toString());
 
                             emit avatarReceived(nickname, filePath);
                             qDebug() << "已发送avatarReceived信号，路径:" << filePath;
@@ -1389,22 +1324,218 @@ void ChatWindow::handleServerData()
             handleDownloadImageResponse(msgData);
             break;
 
+        case MessageType::CheckImage:
+            handleCheckImageResponse(msgData);
+            break;
+
         case MessageType::ChunkedImageResponse:
             handleChunkedImageResponse(msgData);
             break;
 
+        case MessageType::MessageAck:
+            qDebug() << "消息已送达服务器，消息ID:" << msgData["message_id"].toVariant().toLongLong();
+            break;
+
         default:
             qDebug() << "未处理的消息类型:" << type;
             break;
     }
 }
 
+void ChatWindow::handlePrivateMessage(const QJsonObject &msgData)
+{
+    // 已显示过的消息（离线补发与实时转发重复）直接忽略
+    qint64 messageId = msgData.value("id").toInteger();
+    if (messageId > 0) {
+        if (m_receivedMessageIds.contains(messageId)) {
+            return;
+        }
+        m_receivedMessageIds.insert(messageId);
+    }
+
+    QString from = msgData.value("from").toString();
+    QString contentStr = msgData.value("content").toString();
+    // 使用服务器记录的发送时间（离线消息可能是很久以前发送的），没有时使用当前时间
+    QDateTime sentTime = QDateTime::fromString(msgData.value("timestamp").toString(), Qt::ISODateWithMs);
+    QString timestamp = (sentTime.isValid() ? sentTime : QDateTime::currentDateTime()).toString("hh:mm");
+
+    // 尝试解析JSON内容
+    QJsonDocument contentDoc = QJsonDocument::fromJson(contentStr.toUtf8());
+
+    if (!contentDoc.isNull() && contentDoc.isObject()) {
+        // 如果是JSON对象，根据类型处理
+        QJsonObject contentObj = contentDoc.object();
+        QString type = contentObj["type"].toString();
+
+        if (type == "image") {
+            // 图片消息
+            QString imageId = contentObj["imageId"].toString();
+
+            // 直接使用发送方提供的本地路径
+            if (contentObj.contains("localPath")) {
+                QString localPath = contentObj["localPath"].toString();
+                int width = contentObj["width"].toInt();
+                int height = contentObj["height"].toInt();
+
+                qDebug() << "接收到图片消息，直接使用本地路径:" << localPath;
+
+                // 检查文件是否存在
+                QFileInfo fileInfo(localPath);
+                if (fileInfo.exists() && fileInfo.isReadable()) {
+                    // 文件存在且可读，直接使用
+                    QJsonObject displayJson;
+                    displayJson["type"] = "image";
+                    displayJson["imageId"] = imageId;
+                    displayJson["localPath"] = localPath;
+                    displayJson["width"] = width > 0 ? width : 800;  // 默认宽度
+                    displayJson["height"] = height > 0 ? height : 600;  // 默认高度
+
+                    // 显示图片消息
+                    if (from == m_currentChatFriend) {
+                        appendMessage(from, QString::fromUtf8(QJsonDocument(displayJson).toJson()), timestamp);
+                    } else {
+                        emit statusMessage(QString("来自 %1 的新图片消息").arg(from));
+                    }
+
+                    // 保存到缓存映射，以便后续使用
+                    m_imageCacheMap[imageId] = localPath;
+                } else {
+                    qDebug() << "本地图片文件不存在或不可读:" << localPath;
+
+                    // 先显示占位符
+                    if (from == m_currentChatFriend) {
+                        appendMessage(from, "[图片加载中...]", timestamp);
+                    } else {
+                        emit statusMessage(QString("来自 %1 的新图片消息").arg(from));
+                    }
+
+                    // 尝试从服务器下载（保留服务器下载逻辑）
+                    downloadImage(imageId);
+                }
+            } else {
+                // 如果没有本地路径，尝试从缓存中获取
+                if (m_imageCacheMap.contains(imageId)) {
+                    QString cachedPath = m_imageCacheMap[imageId];
+                    QFileInfo fileInfo(cachedPath);
+
+                    if (fileInfo.exists() && fileInfo.isReadable()) {
+                        // 文件存在且可读，获取图片尺寸
+                        QImage image(cachedPath);
+                        int width = image.width();
+                        int height = image.height();
+
+                        if (width > 0 && height > 0) {
+                            // 图片有效，创建JSON对象
+                            QJsonObject displayJson;
+                            displayJson["type"] = "image";
+                            displayJson["imageId"] = imageId;
+                            displayJson["localPath"] = cachedPath;
+                            displayJson["width"] = width;
+                            displayJson["height"] = height;
+
+                            // 如果有缓存，直接显示
+                            if (from == m_currentChatFriend) {
+                                appendMessage(from, QString::fromUtf8(QJsonDocument(displayJson).toJson()), timestamp);
+                            } else {
+                                emit statusMessage(QString("来自 %1 的新图片消息").arg(from));
+                            }
+                        } else {
+                            // 图片无效，尝试从服务器下载
+                            qDebug() << "缓存的图片无效，尝试从服务器下载:" << imageId;
+                            downloadImage(imageId);
+
+                            // 先显示占位符
+                            if (from == m_currentChatFriend) {
+                                appendMessage(from, "[图片加载中...]", timestamp);
+                            } else {
+                                emit statusMessage(QString("来自 %1 的新图片消息").arg(from));
+                            }
+                        }
+                    } else {
+                        // 文件不存在或不可读，尝试从服务器下载
+                        qDebug() << "缓存的图片文件不存在或不可读，尝试从服务器下载:" << imageId;
+                        downloadImage(imageId);
+
+                        // 先显示占位符
+                        if (from == m_currentChatFriend) {
+                            appendMessage(from, "[图片加载中...]", timestamp);
+                        } else {
+                            emit statusMessage(QString("来自 %1 的新图片消息").arg(from));
+                        }
+                    }
+                } else {
+                    // 如果没有缓存，尝试从服务器下载
+                    qDebug() << "没有本地路径和缓存，尝试从服务器下载图片:" << imageId;
+                    downloadImage(imageId);
+
+                    // 先显示占位符
+                    if (from == m_currentChatFriend) {
+                        appendMessage(from, "[图片加载中...]", timestamp);
+                    } else {
+                        emit statusMessage(QString("来自 %1 的新图片消息").arg(from));
+                    }
+                }
+            }
+        } else if (type == "text") {
+            // 文本消息
+            QString text = contentObj["text"].toString();
+            if (from == m_currentChatFriend) {
+                appendMessage(from, text, timestamp);
+            } else {
+                emit statusMessage(QString("来自 %1 的新消息: %2").arg(from, text));
+            }
+        } else {
+            // 未知类型，显示原始内容
+            if (from == m_currentChatFriend) {
+                appendMessage(from, contentStr, timestamp);
+            } else {
+                emit statusMessage(QString("来自 %1 的新消息").arg(from));
+            }
+        }
+    } else {
+        // 如果不是JSON对象，当作普通文本处理
+        if (from == m_currentChatFriend) {
+            appendMessage(from, contentStr, timestamp);
+        } else {
+            emit statusMessage(QString("来自 %1 的新消息").arg(from));
+        }
+    }
+}
+
+void ChatWindow::handleOfflineMessages(const QJsonObject &msgData)
+{
+    // 按发送顺序显示离线期间收到的消息，然后确认这一批，服务器删除后发送下一批
+    // 已显示过的消息不再显示，但仍然确认，服务器才会删除收件箱中的条目
+    QJsonArray messages = msgData.value("messages").toArray();
+    QJsonArray deliveredIds;
+    int newMessages = 0;
+    for (const QJsonValue &value : messages) {
+        QJsonObject message = value.toObject();
+        if (!m_receivedMessageIds.contains(message.value("id").toInteger())) {
+            ++newMessages;
+        }
+        handlePrivateMessage(message);
+        deliveredIds.append(message.value("id"));
+    }
+    if (!messages.isEmpty()) {
+        if (newMessages > 0) {
+            emit statusMessage(QString("收到 %1 条离线消息").arg(newMessages));
+        }
+        m_socket->write(QJsonDocument(MessageProtocol::createMessage(
+            MessageType::AckDelivery, {{"message_ids", deliveredIds}})).toJson());
+    }
+}
+
 void ChatWindow::loadChatHistory(const QString &friendName)
 {
     if (!m_isLoggedIn) return;
     qDebug() << "请求与 " << friendName << " 的聊天记录";
     if (m_socket->state() == QAbstractSocket::ConnectedState) {
-        QJsonObject data{{"friend", friendName}};
+        // 只请求最新的一页，更早的消息在滚动到顶部时再加载
+        m_historyLoading = true;
+        m_historyHasMore = false;
+        m_oldestHistoryId = 0;
+        QJsonObject data{{"friend", friendName}, {"limit", Config::HistoryPageSize}};
         m_socket->write(QJsonDocument(MessageProtocol::createMessage(
             MessageType::ChatHistory, data)).toJson());
     } else {
@@ -1412,6 +1543,59 @@ void ChatWindow::loadChatHistory(const QString &friendName)
     }
 }
 
+bool ChatWindow::updateHistoryState(const QJsonObject &msgData, const QJsonArray &messages)
+{
+    bool olderPage = msgData.contains("before_id");
+    m_historyLoading = false;
+    m_historyHasMore = msgData.value("has_more").toBool();
+
+    // 消息按 id 升序排列，第一条是本页最早的消息
+    if (!messages.isEmpty()) {
+        m_oldestHistoryId = qint64(messages.first().toObject().value("id").toDouble());
+    } else if (!olderPage) {
+        m_oldestHistoryId = 0;
+    }
+    return olderPage;
+}
+
+void ChatWindow::emitGroupHistoryMessage(const QString &sender, const QString &content, const QString &timestamp, const QString &avatarSource)
+{
+    if (m_historyInsertRow >= 0) {
+        emit groupChatMessageInserted(m_historyInsertRow++, sender, content, timestamp, avatarSource);
+    } else {
+        emit groupChatMessageReceived(sender, content, timestamp, avatarSource);
+    }
+}
+
+void ChatWindow::loadOlderMessages()
+{
+    if (!m_isLoggedIn || m_historyLoading || !m_historyHasMore || m_oldestHistoryId <= 0) {
+        return;
+    }
+    if (m_socket->state() != QAbstractSocket::ConnectedState) {
+        return;
+    }
+
+    QJsonObject data;
+    data["before_id"] = m_oldestHistoryId;
+    data["limit"] = Config::HistoryPageSize;
+
+    MessageType type;
+    if (m_isGroupChat) {
+        if (m_currentChatGroup.isEmpty()) return;
+        data["group_id"] = m_currentChatGroup.toInt();
+        type = MessageType::GroupChatHistory;
+    } else {
+        if (m_currentChatFriend.isEmpty()) return;
+        data["friend"] = m_currentChatFriend;
+        type = MessageType::ChatHistory;
+    }
+
+    qDebug() << "加载更早的历史记录，before_id:" << m_oldestHistoryId;
+    m_historyLoading = true;
+    m_socket->write(QJsonDocument(MessageProtocol::createMessage(type, data)).toJson());
+}
+
 bool ChatWindow::isFriendOnline(const QString &friendName) const {
     return m_friendOnlineStatus.value(friendName, false).toBool();
 }
@@ -1589,6 +1773,10 @@ void ChatWindow::selectGroup(const QString &groupId)
                         // 2. 请求聊天历史
                         QJsonObject historyData;
                         historyData["group_id"] = groupId.toInt();
+                        historyData["limit"] = Config::HistoryPageSize;
+                        m_historyLoading = true;
+                        m_historyHasMore = false;
+                        m_oldestHistoryId = 0;
                         QByteArray historyRequest = QJsonDocument(MessageProtocol::createMessage(
                             MessageType::GroupChatHistory, historyData)).toJson();
 
@@ -1806,8 +1994,13 @@ void ChatWindow::loadGroupChatHistory(const QString &groupId)
 {
     if (!m_isLoggedIn) return;
 
+    m_historyLoading = true;
+    m_historyHasMore = false;
+    m_oldestHistoryId = 0;
+
     QJsonObject data;
     data["group_id"] = groupId.toInt();
+    data["limit"] = Config::HistoryPageSize;
 
     if (m_socket->state() == QAbstractSocket::ConnectedState) {
         QByteArray request = QJsonDocument(MessageProtocol::createMessage(
@@ -1855,8 +2048,8 @@ void ChatWindow::handleGroupChatMessage(const QJsonObject &msgData)
                  << "，当前群ID:" << m_currentChatGroup << "，是否为群聊模式:" << m_isGroupChat;
 
         // 尝试获取发送者的头像
-        if (!m_avatarCache.contains(from)) {
-            // 如果缓存中没有该用户的头像，则请求获取
+        if (!m_avatarCache.contains(from) || !m_avatarChecked.contains(from)) {
+            // 如果缓存中没有该用户的头像或本次登录尚未确认版本，则请求获取
             requestAvatar(from);
         }
 
@@ -2174,11 +2367,15 @@ void ChatWindow::requestAvatar(const QString &nickname) {
         if (fileInfo.exists() && fileInfo.isFile() && fileInfo.size() > 0) {
             qDebug() << "使用缓存的头像:" << cachedPath;
             emit avatarReceived(nickname, cachedPath);
-            return;
+            // 每次登录向服务器确认一次版本，未改变时服务器只返回 not_modified
+            if (m_avatarChecked.contains(nickname)) {
+                return;
+            }
         } else {
             // 缓存路径无效，从缓存和设置中移除
             qDebug() << "缓存的头像文件不存在或无效:" << cachedPath;
             m_avatarCache.remove(nickname);
+            setAvatarVersion(nickname, QString());
 
             // 从设置中也删除
             settings.beginGroup("AvatarCache");
@@ -2188,10 +2385,14 @@ void ChatWindow::requestAvatar(const QString &nickname) {
         }
     }
 
-    // 如果缓存中没有或缓存无效，则请求服务器的头像
+    // 缓存中没有、缓存无效或本次登录尚未确认版本时，请求服务器的头像
     if (m_socket && m_socket->state() == QAbstractSocket::ConnectedState) {
         QJsonObject data;
         data["nickname"] = nickname;
+        if (m_avatarCache.contains(nickname) && m_avatarVersions.contains(nickname)) {
+            data["if_none_match"] = m_avatarVersions[nickname];
+        }
+        m_avatarChecked.insert(nickname);
 
         QByteArray request = QJsonDocument(MessageProtocol::createMessage(
             MessageType::GetAvatar, data)).toJson();
@@ -2204,6 +2405,33 @@ void ChatWindow::requestAvatar(const QString &nickname) {
     }
 }
 
+void ChatWindow::setAvatarVersion(const QString &nickname, const QString &version) {
+    QSettings settings;
+    settings.beginGroup("AvatarVersion");
+    if (version.isEmpty()) {
+        m_avatarVersions.remove(nickname);
+        settings.remove(nickname);
+    } else {
+        m_avatarVersions[nickname] = version;
+        settings.setValue(nickname, version);
+    }
+    settings.endGroup();
+}
+
+void ChatWindow::checkAvatarVersion(const QString &nickname, const QString &version) {
+    if (version.isEmpty() || !m_avatarCache.contains(nickname)) {
+        return;
+    }
+    if (m_avatarVersions.value(nickname) == version) {
+        // 本地头像是最新版本，本次登录不再向服务器确认
+        m_avatarChecked.insert(nickname);
+    } else {
+        // 头像已更新，重新请求
+        m_avatarChecked.remove(nickname);
+        requestAvatar(nickname);
+    }
+}
+
 QString ChatWindow::getCachedAvatarPath(const QString &nickname) const {
     if (m_avatarCache.contains(nickname)) {
         return "file:///" + m_avatarCache[nickname];
@@ -2334,31 +2562,69 @@ void ChatWindow::sendImageMessage(const QString &localFilePath) {
     uploadData.fileExtension = format;
     uploadData.imageData = imageData;
 
+    // 上传前先按内容的 SHA-256 询问服务器是否已有该图片，已有时不再上传
+    if (m_socket->state() != QAbstractSocket::ConnectedState) {
+        emit statusMessage("未连接到服务器，无法上传图片");
+        return;
+    }
+    m_pendingImageUploads[tempId] = uploadData;
+
+    QJsonObject data;
+    data["sha256"] = QString::fromLatin1(QCryptographicHash::hash(imageData, QCryptographicHash::Sha256).toHex());
+    data["file_extension"] = format;
+    data["temp_id"] = tempId;
+    QByteArray request = QJsonDocument(MessageProtocol::createMessage(
+        MessageType::CheckImage, data)).toJson();
+    m_socket->write(request);
+    m_socket->flush();
+}
+
+void ChatWindow::handleCheckImageResponse(const QJsonObject &msgData) {
+    QString tempId = msgData["temp_id"].toString();
+    if (!m_pendingImageUploads.contains(tempId)) {
+        return;
+    }
+
+    if (msgData["status"].toString() == "success" && msgData["exists"].toBool()) {
+        // 服务器已有相同的图片，按上传成功处理（缓存图片并发送消息）
+        qDebug() << "服务器已有该图片，跳过上传:" << msgData["image_id"].toString();
+        QJsonObject uploaded;
+        uploaded["status"] = "success";
+        uploaded["image_id"] = msgData["image_id"].toString();
+        uploaded["temp_id"] = tempId;
+        handleChunkedImageResponse(uploaded);
+        return;
+    }
+
+    // 服务器没有该图片（或查询失败），正常上传
+    startImageUpload(tempId);
+}
+
+void ChatWindow::startImageUpload(const QString &tempId) {
+    ImageUploadData &uploadData = m_pendingImageUploads[tempId];
+
     // 检查图片大小，决定是否使用分块上传
     const int CHUNK_SIZE = 8 * 1024; // 8KB 每块 (减小块大小)
     const int MAX_DIRECT_SIZE = 32 * 1024; // 32KB 以下直接上传
 
-    if (imageData.size() > MAX_DIRECT_SIZE) {
+    if (uploadData.imageData.size() > MAX_DIRECT_SIZE) {
         // 使用分块上传
         uploadData.isChunked = true;
         uploadData.chunkSize = CHUNK_SIZE;
-        uploadData.totalChunks = (imageData.size() + CHUNK_SIZE - 1) / CHUNK_SIZE; // 向上取整
+        uploadData.totalChunks = (uploadData.imageData.size() + CHUNK_SIZE - 1) / CHUNK_SIZE; // 向上取整
         uploadData.currentChunk = 0;
 
-        m_pendingImageUploads[tempId] = uploadData;
-
         // 开始分块上传
         sendImageChunked(tempId);
     } else {
         // 小图片直接上传
         uploadData.isChunked = false;
-        m_pendingImageUploads[tempId] = uploadData;
 
         // 发送上传请求
         if (m_socket->state() == QAbstractSocket::ConnectedState) {
             QJsonObject data;
-            data["image_data_base64"] = QString::fromLatin1(imageData.toBase64());
-            data["file_extension"] = format;
+            data["image_data_base64"] = QString::fromLatin1(uploadData.imageData.toBase64());
+            data["file_extension"] = uploadData.fileExtension;
             data["temp_id"] = tempId;
 
             QByteArray request = QJsonDocument(MessageProtocol::createMessage(
@@ -2419,6 +2685,8 @@ void ChatWindow::downloadImage(const QString &imageId) {
     if (m_socket && m_socket->state() == QAbstractSocket::ConnectedState) {
         QJsonObject data;
         data["imageId"] = imageId;
+        // 消息气泡中的图片最宽 300 像素，只下载缩略图（服务器没有缩略图时返回原图）
+        data["variant"] = "thumbnail";
 
         QByteArray request = QJsonDocument(MessageProtocol::createMessage(
             MessageType::DownloadImageRequest, data)).toJson();
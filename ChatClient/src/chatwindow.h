@@ -6,11 +6,13 @@
 #include <QJsonArray>
 #include <QStringList>
 #include <QMap>
+#include <QSet>
 #include <QBuffer>
 #include <QTimer>
 #include <QImage>
 #include <QFileInfo>
 #include "../Common/messageprotocol.h"
+#include "../Common/messageframer.h"
 
 class ChatWindow : public QObject {
     Q_OBJECT
@@ -65,6 +67,9 @@ public:
     Q_INVOKABLE QString getGroupName(const QString &groupId) const;
     Q_INVOKABLE void clearChatType();
 
+    // 加载当前会话更早的一页历史记录（滚动到顶部时调用）
+    Q_INVOKABLE void loadOlderMessages();
+
     // 更新 QML 界面的方法
     Q_INVOKABLE void appendMessage(const QString &sender, const QString &content, const QString &timestamp);
     Q_INVOKABLE void clearChatDisplay();
@@ -110,6 +115,9 @@ signals:
     void isGroupChatChanged();
     void groupCreated(const QString &groupName);
     void groupChatMessageReceived(const QString &sender, const QString &content, const QString &timestamp, const QString &avatarSource);
+    // 更早的历史消息插入到列表的 row 位置
+    void messageInserted(int row, const QString &sender, const QString &content, const QString &timestamp, const QString &avatarSource);
+    void groupChatMessageInserted(int row, const QString &sender, const QString &content, const QString &timestamp, const QString &avatarSource);
     void userProfileChanged();
     void avatarReceived(const QString &nickname, const QString &localPath);
     void profileUpdateSuccess();
@@ -132,6 +140,9 @@ private slots:
     void handleDeleteFriendRequestMessage(const QJsonObject &msgData);
     void handleGroupChatMessage(const QJsonObject &msgData);
     void handleCreateGroupMessage(const QJsonObject &msgData);
+    // 私聊消息（实时转发的和离线期间的格式相同）
+    void handlePrivateMessage(const QJsonObject &msgData);
+    void handleOfflineMessages(const QJsonObject &msgData);
 
     // 图片相关消息处理函数
     void handleUploadImageResponse(const QJsonObject &msgData);
@@ -139,6 +150,7 @@ private slots:
 
 private:
     QTcpSocket *m_socket;
+    MessageFramer m_framer;  // 服务器数据分帧
     bool m_isLoggedIn = false;
     QString m_currentNickname;
     QString m_currentChatFriend;
@@ -155,8 +167,19 @@ private:
 
     QVariantMap m_userProfile;
 
+    // 历史记录分页状态（当前会话）
+    qint64 m_oldestHistoryId = 0;    // 已加载的最早一条消息的 id
+    bool m_historyHasMore = false;   // 服务器上是否还有更早的消息
+    bool m_historyLoading = false;   // 是否正在等待一页历史记录
+    int m_historyInsertRow = -1;     // 插入更早消息的位置，-1 表示追加到末尾
+
+    // 本次登录已显示的私聊消息 id：同一条消息可能既被实时转发、又作为离线消息补发，只显示一次
+    QSet<qint64> m_receivedMessageIds;
+
     // 头像缓存
     QMap<QString, QString> m_avatarCache; // nickname -> local file path
+    QMap<QString, QString> m_avatarVersions; // nickname -> 本地头像对应的服务器头像版本
+    QSet<QString> m_avatarChecked; // 本次登录已向服务器确认（或正在确认）头像版本的用户
 
     // 图片缓存
     QString m_imageCachePath; // 图片缓存目录
@@ -176,10 +199,21 @@ private:
     };
     QMap<QString, ImageUploadData> m_pendingImageUploads; // 临时存储上传中的图片信息
 
+    // 处理一条完整的服务器消息
+    void processServerMessage(const QByteArray &data);
+
     void loadChatHistory(const QString &friendName);
     void refreshFriendRequests();
     void updateFriendOnlineStatus(const QString &friendName, bool isOnline);
     void loadGroupChatHistory(const QString &groupId);
+    // 记录一页历史记录的分页信息，返回是否为向上翻页的结果
+    bool updateHistoryState(const QJsonObject &msgData, const QJsonArray &messages);
+    // 显示一条群聊历史消息（翻页时插入到列表前部）
+    void emitGroupHistoryMessage(const QString &sender, const QString &content, const QString &timestamp, const QString &avatarSource);
+    // 记录本地头像对应的服务器头像版本（同时保存到设置）
+    void setAvatarVersion(const QString &nickname, const QString &version);
+    // 服务器返回的头像版本与本地缓存比较，不同时重新请求头像
+    void checkAvatarVersion(const QString &nickname, const QString &version);
 
     // 图片处理相关私有方法
     void initImageCache();
@@ -189,6 +223,10 @@ private:
     void sendMessageInternal(const QJsonObject &contentJson);
     void sendGroupMessageInternal(const QJsonObject &contentJson);
 
+    // 上传前的去重查询：服务器已有相同内容的图片时直接发送消息，否则开始上传
+    void handleCheckImageResponse(const QJsonObject &msgData);
+    void startImageUpload(const QString &tempId);
+
     // 分块图片上传相关方法
     void sendImageChunked(const QString &tempId);
     void sendNextImageChunk(const QString &tempId);
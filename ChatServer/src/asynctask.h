@@ -0,0 +1,149 @@
+#ifndef ASYNCTASK_H
+#define ASYNCTASK_H
+
+#include <QByteArray>
+#include <QDebug>
+#include <QFuture>
+#include <QTcpSocket>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include "threadpool.h"
+#include "outboundqueue.h"
+
+// 基于 C++20 协程的请求处理
+// 处理函数返回 AsyncTask，遇到数据库、文件或发送操作时 co_await 对应的等待体：
+// 操作被投递到专用执行器上运行，处理线程随即返回线程池去处理其他请求，
+// 操作完成后协程在处理线程池上恢复执行。
+
+// 即发即弃的协程任务：调用后立即开始执行，结束时自动销毁协程帧
+struct AsyncTask {
+    struct promise_type {
+        AsyncTask get_return_object() noexcept { return AsyncTask(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept {
+            try {
+                throw;
+            } catch (const std::exception &e) {
+                qDebug() << "Unhandled exception in coroutine:" << e.what();
+            } catch (...) {
+                qDebug() << "Unknown exception in coroutine";
+            }
+        }
+    };
+};
+
+// 在协程恢复线程池上恢复协程，resumeOn 为空时直接在当前线程恢复
+inline void resumeCoroutine(ThreadPool *resumeOn, std::coroutine_handle<> handle) {
+    if (resumeOn) {
+        resumeOn->addTask([handle]() { handle.resume(); });
+    } else {
+        handle.resume();
+    }
+}
+
+// 在执行器上运行 fn，co_await 的结果为 fn 的返回值，fn 抛出的异常在协程中重新抛出
+template<typename Fn>
+class ExecutorAwaitable {
+public:
+    typedef std::invoke_result_t<Fn&> Result;
+
+    ExecutorAwaitable(ThreadPool *executor, ThreadPool *resumeOn, Fn fn)
+        : m_executor(executor), m_resumeOn(resumeOn), m_fn(std::move(fn)) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        m_executor->addTask([this, handle]() {
+            try {
+                if constexpr (std::is_void_v<Result>) {
+                    m_fn();
+                } else {
+                    m_result.emplace(m_fn());
+                }
+            } catch (...) {
+                m_exception = std::current_exception();
+            }
+            resumeCoroutine(m_resumeOn, handle);
+        });
+    }
+
+    Result await_resume() {
+        if (m_exception) {
+            std::rethrow_exception(m_exception);
+        }
+        if constexpr (!std::is_void_v<Result>) {
+            return std::move(*m_result);
+        }
+    }
+
+private:
+    struct Empty {};
+
+    ThreadPool *m_executor;
+    ThreadPool *m_resumeOn;
+    Fn m_fn;
+    std::conditional_t<std::is_void_v<Result>, Empty, std::optional<Result>> m_result;
+    std::exception_ptr m_exception;
+};
+
+// 经出站队列发送数据，数据写入 socket 后恢复协程
+// co_await 的结果表示数据是否已写入（socket 已断开时为 false）
+class SendAwaitable {
+public:
+    SendAwaitable(OutboundQueue *queue, ThreadPool *resumeOn, QTcpSocket *socket, const QByteArray &data)
+        : m_queue(queue), m_resumeOn(resumeOn), m_socket(socket), m_data(data), m_written(false) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        // push 之后协程可能已在其他线程恢复，不能再访问成员
+        bool *written = &m_written;
+        ThreadPool *resumeOn = m_resumeOn;
+        m_queue->push(m_socket, m_data, [written, resumeOn, handle](bool ok) {
+            *written = ok;
+            resumeCoroutine(resumeOn, handle);
+        });
+    }
+
+    bool await_resume() const noexcept { return m_written; }
+
+private:
+    OutboundQueue *m_queue;
+    ThreadPool *m_resumeOn;
+    QTcpSocket *m_socket;
+    QByteArray m_data;
+    bool m_written;
+};
+
+// 等待 QFuture 完成（如数据库写线程的提交结果），完成后在 resumeOn 线程池上恢复协程
+// co_await 的结果为 future 的结果
+template<typename T>
+class FutureAwaitable {
+public:
+    FutureAwaitable(const QFuture<T> &future, ThreadPool *resumeOn)
+        : m_future(future), m_resumeOn(resumeOn) {}
+
+    bool await_ready() const { return m_future.isFinished(); }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        // future 完成的回调可能在其他线程立即执行并恢复协程，这里不再访问成员
+        QFuture<T> future = m_future;
+        ThreadPool *resumeOn = m_resumeOn;
+        future.then(QtFuture::Launch::Sync, [resumeOn, handle](const QFuture<T> &) {
+            resumeCoroutine(resumeOn, handle);
+        });
+    }
+
+    T await_resume() { return m_future.result(); }
+
+private:
+    QFuture<T> m_future;
+    ThreadPool *m_resumeOn;
+};
+
+#endif // ASYNCTASK_H
@@ -0,0 +1,85 @@
+#include "avatartable.h"
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariant>
+
+// 文件名中保留的哈希长度（十六进制字符数）
+static const int FileNameHashLength = 16;
+
+AvatarTable::AvatarTable(QObject *parent) : QObject(parent) {
+    m_lock.init();
+}
+
+AvatarTable::~AvatarTable() {
+    m_lock.destroy();
+}
+
+bool AvatarTable::load(QSqlDatabase &db) {
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT id, avatar FROM users WHERE avatar IS NOT NULL AND avatar != ''")) {
+        qDebug() << "加载头像版本失败:" << query.lastError().text();
+        return false;
+    }
+
+    QHash<qint64, QString> versions;
+    while (query.next()) {
+        versions.insert(query.value(0).toLongLong(), query.value(1).toString());
+    }
+
+    WriteLocker locker(&m_lock);
+    m_versions.swap(versions);
+    qDebug() << "头像版本已加载，共" << m_versions.size() << "个用户设置了头像";
+    return true;
+}
+
+QString AvatarTable::versionOf(qint64 userId) const {
+    ReadLocker locker(&m_lock);
+    return m_versions.value(userId);
+}
+
+QHash<qint64, QString> AvatarTable::versionsOf(const QList<qint64> &userIds) const {
+    QHash<qint64, QString> versions;
+    ReadLocker locker(&m_lock);
+    for (qint64 userId : userIds) {
+        auto it = m_versions.constFind(userId);
+        if (it != m_versions.constEnd()) {
+            versions.insert(userId, it.value());
+        }
+    }
+    return versions;
+}
+
+void AvatarTable::set(qint64 userId, const QString &version) {
+    WriteLocker locker(&m_lock);
+    if (version.isEmpty()) {
+        m_versions.remove(userId);
+    } else {
+        m_versions.insert(userId, version);
+    }
+}
+
+QString AvatarTable::fileNameOf(qint64 userId, const QByteArray &avatarData) {
+    QByteArray hash = QCryptographicHash::hash(avatarData, QCryptographicHash::Sha256).toHex();
+    return QString("%1-%2.png").arg(userId).arg(QString::fromLatin1(hash.left(FileNameHashLength)));
+}
+
+bool AvatarTable::isValidFileName(const QString &fileName, const QString &nickname) {
+    if (fileName.isEmpty() || fileName.size() > 128 || fileName.startsWith('.')) {
+        return false;
+    }
+    // 旧数据的 <昵称>.png 只接受文件所属用户自己的昵称
+    if (!nickname.isEmpty() && fileName == nickname + ".png") {
+        return !fileName.contains('/') && !fileName.contains('\\') && !fileName.contains(QChar(0));
+    }
+    for (QChar c : fileName) {
+        bool allowed = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+                       || c == '_' || c == '-' || c == '.';
+        if (!allowed) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,46 @@
+#ifndef AVATARTABLE_H
+#define AVATARTABLE_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QSqlDatabase>
+#include <QString>
+#include "readwritelock.h"
+
+// 头像版本表
+// users.avatar 保存头像文件名，文件名由用户 ID 和头像内容的 SHA-256 前缀组成（<用户 ID>-<哈希前 16 位>.png），
+// 头像内容改变时文件名随之改变，因此文件名本身就是头像的版本（旧数据中的 <昵称>.png 在重新上传前同样作为版本）。
+// 启动时加载所有已设置头像的用户，上传头像后更新；好友列表、个人资料和获取头像都从这里取版本，不访问数据库。
+class AvatarTable : public QObject {
+    Q_OBJECT
+public:
+    explicit AvatarTable(QObject *parent = nullptr);
+    ~AvatarTable();
+
+    // 从 users 表加载（启动时在建表和迁移之后调用）
+    bool load(QSqlDatabase &db);
+
+    // 用户头像的版本（即头像文件名），没有头像时返回空字符串
+    QString versionOf(qint64 userId) const;
+
+    // 批量查询，只返回已设置头像的用户，只加一次读锁
+    QHash<qint64, QString> versionsOf(const QList<qint64> &userIds) const;
+
+    // 头像更新提交后记录新版本
+    void set(qint64 userId, const QString &version);
+
+    // 由用户 ID 和头像内容生成头像文件名
+    static QString fileNameOf(qint64 userId, const QByteArray &avatarData);
+
+    // 头像文件名是否可以作为文件名使用：新格式只能包含字母、数字、'_'、'-'、'.'，且不能以 '.' 开头；
+    // 旧格式必须正好是所属用户的昵称（可以是中文等任意文字）加 ".png"，且不含路径分隔符
+    static bool isValidFileName(const QString &fileName, const QString &nickname);
+
+private:
+    mutable ReadWriteLock m_lock;
+    QHash<qint64, QString> m_versions;
+};
+
+#endif // AVATARTABLE_H
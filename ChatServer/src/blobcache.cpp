@@ -0,0 +1,183 @@
+#include "blobcache.h"
+#include <QtGlobal>
+
+// 计数器上限（相当于 4 位计数器）
+static const quint8 MaxCount = 15;
+// Count-Min Sketch 的行数
+static const int SketchRows = 4;
+// 估计分片中的条目数时假定的平均文件大小（字节），决定 Sketch 的宽度
+static const qint64 AssumedBlobBytes = 8 * 1024;
+// 单个文件最多占分片大小的比例（分母）
+static const int MaxItemShardFraction = 4;
+
+static size_t nextPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+BlobCache::FrequencySketch::FrequencySketch(int width)
+    : m_additions(0) {
+    size_t rowWidth = nextPowerOfTwo(size_t(qMax(16, width)));
+    m_counters.assign(rowWidth * SketchRows, 0);
+    m_width = rowWidth;
+    m_shift = 64;
+    for (size_t w = rowWidth; w > 1; w >>= 1) {
+        --m_shift;
+    }
+    m_sampleSize = int(qMin<size_t>(rowWidth * 10, size_t(1) << 30));
+}
+
+size_t BlobCache::FrequencySketch::indexOf(size_t hash, int row) const {
+    // 双重哈希：每行使用 hash + row * h2（h2 取奇数），再乘以黄金比例常数取乘积的高位作为下标。
+    // 分片按哈希值取模选出，同一分片内哈希值的低位相关，乘积的低位也随之相关，只有高位混合了所有输入位
+    quint64 h2 = (quint64(hash) >> 17) | 1;
+    quint64 h = (quint64(hash) + quint64(row) * h2) * 0x9E3779B97F4A7C15ULL;
+    return size_t(row) * m_width + size_t(h >> m_shift);
+}
+
+void BlobCache::FrequencySketch::increment(size_t hash) {
+    bool added = false;
+    for (int row = 0; row < SketchRows; ++row) {
+        quint8 &counter = m_counters[indexOf(hash, row)];
+        if (counter < MaxCount) {
+            ++counter;
+            added = true;
+        }
+    }
+    // 定期减半，让频率反映最近一段时间的访问
+    if (added && ++m_additions >= m_sampleSize) {
+        for (quint8 &counter : m_counters) {
+            counter >>= 1;
+        }
+        m_additions /= 2;
+    }
+}
+
+int BlobCache::FrequencySketch::estimate(size_t hash) const {
+    int frequency = MaxCount;
+    for (int row = 0; row < SketchRows; ++row) {
+        frequency = qMin(frequency, int(m_counters[indexOf(hash, row)]));
+    }
+    return frequency;
+}
+
+BlobCache::BlobCache(qint64 maxBytes, int shardCount, bool admissionFilter, QObject *parent)
+    : QObject(parent),
+      m_admissionFilter(admissionFilter),
+      m_hits(0),
+      m_misses(0),
+      m_bytesSaved(0),
+      m_admitted(0),
+      m_rejected(0),
+      m_evictions(0) {
+    shardCount = qMax(1, shardCount);
+    m_shardBytes = qMax<qint64>(1, maxBytes / shardCount);
+    int sketchWidth = int(qBound<qint64>(256, m_shardBytes / AssumedBlobBytes, 1 << 20));
+    m_shards.reserve(shardCount);
+    for (int i = 0; i < shardCount; ++i) {
+        m_shards.push_back(std::make_unique<Shard>(sketchWidth));
+    }
+}
+
+bool BlobCache::get(const QString &key, QByteArray &data) {
+    size_t hash = qHash(key);
+    Shard &shard = shardOf(hash);
+    QMutexLocker locker(&shard.mutex);
+    shard.sketch.increment(hash);
+    auto it = shard.entries.find(key);
+    if (it == shard.entries.end()) {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->lru);
+    data = it->data;
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+    m_bytesSaved.fetch_add(quint64(data.size()), std::memory_order_relaxed);
+    return true;
+}
+
+void BlobCache::put(const QString &key, const QByteArray &data) {
+    qint64 size = data.size();
+    if (size == 0 || size > m_shardBytes / MaxItemShardFraction) {
+        m_rejected.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    size_t hash = qHash(key);
+    Shard &shard = shardOf(hash);
+    QMutexLocker locker(&shard.mutex);
+    auto existing = shard.entries.find(key);
+    if (existing != shard.entries.end()) {
+        removeEntry(shard, existing);
+    }
+
+    // 先确定需要淘汰哪些条目：任何一个比新文件访问更频繁时不放入缓存
+    qint64 freed = 0;
+    int victims = 0;
+    int candidateFrequency = shard.sketch.estimate(hash);
+    for (auto victim = shard.lru.rbegin(); victim != shard.lru.rend() && shard.bytes - freed + size > m_shardBytes;
+         ++victim) {
+        auto entry = shard.entries.constFind(*victim);
+        if (m_admissionFilter && shard.sketch.estimate(entry->hash) > candidateFrequency) {
+            m_rejected.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        freed += entry->data.size();
+        ++victims;
+    }
+    for (int i = 0; i < victims; ++i) {
+        removeEntry(shard, shard.entries.find(shard.lru.back()));
+        m_evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    shard.lru.push_front(key);
+    Entry entry;
+    entry.data = data;
+    entry.hash = hash;
+    entry.lru = shard.lru.begin();
+    shard.entries.insert(key, entry);
+    shard.bytes += size;
+    m_admitted.fetch_add(1, std::memory_order_relaxed);
+}
+
+void BlobCache::remove(const QString &key) {
+    Shard &shard = shardOf(qHash(key));
+    QMutexLocker locker(&shard.mutex);
+    auto it = shard.entries.find(key);
+    if (it != shard.entries.end()) {
+        removeEntry(shard, it);
+    }
+}
+
+void BlobCache::removeEntry(Shard &shard, QHash<QString, Entry>::iterator it) {
+    shard.bytes -= it->data.size();
+    shard.lru.erase(it->lru);
+    shard.entries.erase(it);
+}
+
+QString BlobCache::statsReport() const {
+    quint64 hitCount = hits();
+    quint64 lookups = hitCount + misses();
+    qint64 bytes = 0;
+    qint64 entries = 0;
+    for (const auto &shard : m_shards) {
+        QMutexLocker locker(&shard->mutex);
+        bytes += shard->bytes;
+        entries += shard->entries.size();
+    }
+    return QString("[blob_cache] entries=%1 bytes=%2/%3 hits=%4 misses=%5 hit_rate=%6% bytes_saved=%7 "
+                   "admitted=%8 rejected=%9 evictions=%10")
+        .arg(entries)
+        .arg(bytes)
+        .arg(m_shardBytes * qint64(m_shards.size()))
+        .arg(hitCount)
+        .arg(misses())
+        .arg(lookups ? 100.0 * hitCount / lookups : 0.0, 0, 'f', 1)
+        .arg(bytesSaved())
+        .arg(m_admitted.load(std::memory_order_relaxed))
+        .arg(m_rejected.load(std::memory_order_relaxed))
+        .arg(m_evictions.load(std::memory_order_relaxed));
+}
@@ -0,0 +1,92 @@
+#ifndef BLOBCACHE_H
+#define BLOBCACHE_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <vector>
+
+// 图片和头像的内存缓存
+// 以文件路径为键缓存最近读取的文件内容，按字节数限制总大小。键按哈希分到多个分片，
+// 每个分片有自己的锁、LRU 链表和大小上限，并发下载不同的文件时互不等待。
+// 可选的准入过滤（TinyLFU）：每个分片用 Count-Min Sketch 估计键最近的访问频率（计数定期减半），
+// 分片已满时，新文件只有比将被淘汰的文件访问更频繁才会放入缓存，
+// 偶尔下载一次的大文件不会把经常访问的头像和群聊图片挤出缓存。
+// 超过分片大小四分之一的文件不缓存。
+class BlobCache : public QObject {
+    Q_OBJECT
+public:
+    BlobCache(qint64 maxBytes, int shardCount, bool admissionFilter, QObject *parent = nullptr);
+
+    // 读取缓存，未命中返回 false（命中和未命中都计入访问频率）
+    bool get(const QString &key, QByteArray &data);
+
+    // 从磁盘读取后放入缓存（可能被准入过滤拒绝）
+    void put(const QString &key, const QByteArray &data);
+
+    // 文件被覆盖后移除缓存
+    void remove(const QString &key);
+
+    // 统计
+    quint64 hits() const { return m_hits.load(std::memory_order_relaxed); }
+    quint64 misses() const { return m_misses.load(std::memory_order_relaxed); }
+    // 命中时省去的磁盘读取字节数
+    quint64 bytesSaved() const { return m_bytesSaved.load(std::memory_order_relaxed); }
+    QString statsReport() const;
+
+private:
+    // Count-Min Sketch：4 行计数器，每个计数器最大 15，累计增加 10 倍宽度次后全部减半
+    class FrequencySketch {
+    public:
+        explicit FrequencySketch(int width);
+        void increment(size_t hash);
+        int estimate(size_t hash) const;
+
+    private:
+        size_t indexOf(size_t hash, int row) const;
+
+        std::vector<quint8> m_counters;
+        size_t m_width;
+        int m_shift;    // 64 - log2(m_width)，下标取 64 位乘积的高位
+        int m_additions;
+        int m_sampleSize;
+    };
+
+    struct Entry {
+        QByteArray data;
+        size_t hash;
+        std::list<QString>::iterator lru;
+    };
+
+    struct Shard {
+        explicit Shard(int sketchWidth) : sketch(sketchWidth) {}
+
+        QMutex mutex;
+        QHash<QString, Entry> entries;
+        std::list<QString> lru;     // 头部为最近访问
+        qint64 bytes = 0;
+        FrequencySketch sketch;
+    };
+
+    Shard &shardOf(size_t hash) { return *m_shards[hash % m_shards.size()]; }
+    // 移除条目（调用者持有分片的锁）
+    void removeEntry(Shard &shard, QHash<QString, Entry>::iterator it);
+
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    qint64 m_shardBytes;
+    bool m_admissionFilter;
+
+    std::atomic<quint64> m_hits;
+    std::atomic<quint64> m_misses;
+    std::atomic<quint64> m_bytesSaved;
+    std::atomic<quint64> m_admitted;
+    std::atomic<quint64> m_rejected;
+    std::atomic<quint64> m_evictions;
+};
+
+#endif // BLOBCACHE_H
@@ -0,0 +1,23 @@
+#ifndef CONVERSATION_H
+#define CONVERSATION_H
+
+#include <QtGlobal>
+
+// 会话键
+// 私聊消息按会话存储：两个用户 ID 中较小的放在高 32 位、较大的放在低 32 位，与消息方向无关。
+// 数据库迁移在 SQL 中用 MIN(a, b) * 4294967296 + MAX(a, b) 生成相同的键。
+// 群聊的会话键为负的群 ID，与私聊会话键（正数）不会冲突；group_messages 表本身仍按 group_id 存储，
+// 负数键只用于同时存放两类会话的结构（归档块、分段日志、历史缓存）。
+namespace Conversation {
+    inline qint64 privateKey(qint64 user1, qint64 user2) {
+        qint64 low = qMin(user1, user2);
+        qint64 high = qMax(user1, user2);
+        return (low << 32) + high;
+    }
+
+    inline qint64 groupKey(int groupId) {
+        return -qint64(groupId);
+    }
+}
+
+#endif // CONVERSATION_H
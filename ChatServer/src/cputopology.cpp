@@ -0,0 +1,265 @@
+#include "cputopology.h"
+#include "threadpool.h"
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSet>
+#include <QStringList>
+#include <QThread>
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+// 读取 sysfs 中的单行文本
+static QString readSysfs(const QString &path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QString();
+    }
+    return QString::fromLatin1(file.readAll()).trimmed();
+}
+
+CpuTopology::CpuTopology() {
+}
+
+QList<int> CpuTopology::parseCpuList(const QString &text) {
+    QList<int> cpus;
+    const QStringList ranges = text.trimmed().split(',', Qt::SkipEmptyParts);
+    for (const QString &range : ranges) {
+        int dash = range.indexOf('-');
+        bool ok1 = false, ok2 = false;
+        int first, last;
+        if (dash < 0) {
+            first = last = range.trimmed().toInt(&ok1);
+            ok2 = ok1;
+        } else {
+            first = range.left(dash).trimmed().toInt(&ok1);
+            last = range.mid(dash + 1).trimmed().toInt(&ok2);
+        }
+        if (!ok1 || !ok2 || first < 0 || last < first) {
+            continue;
+        }
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.append(cpu);
+        }
+    }
+    return cpus;
+}
+
+bool CpuTopology::load(const QString &sysfsRoot) {
+    m_cpus.clear();
+    m_nodeCpus.clear();
+
+    QList<int> online = parseCpuList(readSysfs(sysfsRoot + "/cpu/online"));
+    bool ok = !online.isEmpty();
+    if (!ok) {
+        qDebug() << "无法读取CPU拓扑，按单节点处理";
+        int count = QThread::idealThreadCount();
+        for (int i = 0; i < count; ++i) {
+            online.append(i);
+        }
+    }
+
+    // CPU 所属的 NUMA 节点
+    QMap<int, int> cpuNode;
+    QDir nodeDir(sysfsRoot + "/node");
+    const QStringList nodeEntries = nodeDir.entryList(QStringList() << "node*", QDir::Dirs);
+    for (const QString &entry : nodeEntries) {
+        bool isNumber = false;
+        int node = entry.mid(4).toInt(&isNumber);
+        if (!isNumber) {
+            continue;
+        }
+        const QList<int> nodeCpus = parseCpuList(readSysfs(nodeDir.filePath(entry + "/cpulist")));
+        for (int cpu : nodeCpus) {
+            cpuNode[cpu] = node;
+        }
+    }
+
+    // 同一物理核上的超线程按出现顺序编号
+    QMap<QPair<int, int>, int> coreThreads;
+    for (int id : online) {
+        QString topologyDir = QString("%1/cpu/cpu%2/topology/").arg(sysfsRoot).arg(id);
+        Cpu cpu;
+        cpu.id = id;
+        bool hasPackage = false, hasCore = false;
+        cpu.package = readSysfs(topologyDir + "physical_package_id").toInt(&hasPackage);
+        cpu.core = readSysfs(topologyDir + "core_id").toInt(&hasCore);
+        if (!hasPackage) cpu.package = 0;
+        if (!hasCore) cpu.core = id;
+        cpu.node = cpuNode.value(id, 0);
+        cpu.smtRank = coreThreads[qMakePair(cpu.package, cpu.core)]++;
+        m_cpus.append(cpu);
+    }
+
+    // 每个节点内先排各物理核的第一个超线程
+    QList<Cpu> sorted = m_cpus;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Cpu &a, const Cpu &b) {
+        if (a.smtRank != b.smtRank) return a.smtRank < b.smtRank;
+        return a.id < b.id;
+    });
+    for (const Cpu &cpu : sorted) {
+        m_nodeCpus[cpu.node].append(cpu.id);
+    }
+
+    return ok;
+}
+
+int CpuTopology::nodeOfCpu(int cpu) const {
+    for (const Cpu &c : m_cpus) {
+        if (c.id == cpu) {
+            return c.node;
+        }
+    }
+    return -1;
+}
+
+QString CpuTopology::describe() const {
+    QSet<int> packages;
+    QSet<QPair<int, int>> cores;
+    for (const Cpu &cpu : m_cpus) {
+        packages.insert(cpu.package);
+        cores.insert(qMakePair(cpu.package, cpu.core));
+    }
+
+    QStringList nodeParts;
+    for (auto it = m_nodeCpus.constBegin(); it != m_nodeCpus.constEnd(); ++it) {
+        nodeParts << QString("node%1=%2cpu").arg(it.key()).arg(it.value().size());
+    }
+
+    return QString("%1 CPU, %2 物理核, %3 插槽, %4 NUMA 节点 (%5)")
+        .arg(m_cpus.size())
+        .arg(cores.size())
+        .arg(packages.size())
+        .arg(nodeCount())
+        .arg(nodeParts.join(", "));
+}
+
+bool CpuTopology::pinCurrentThread(const QList<int> &cpus) {
+    if (cpus.isEmpty()) {
+        return false;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (ret != 0) {
+        qDebug() << "设置线程CPU亲和性失败:" << strerror(ret);
+        return false;
+    }
+    return true;
+}
+
+int CpuTopology::currentCpu() {
+    return sched_getcpu();
+}
+
+CpuPlacement::CpuPlacement(const CpuTopology &topology, Layout layout)
+    : m_topology(topology), m_layout(layout), m_homeNode(0) {
+    QList<int> nodes = m_topology.nodes();
+    if (!nodes.isEmpty()) {
+        m_homeNode = nodes.first();
+    }
+}
+
+bool CpuPlacement::parseLayout(const QString &text, Layout &layout) {
+    QString name = text.trimmed().toLower();
+    if (name.isEmpty() || name == "none") {
+        layout = None;
+    } else if (name == "node") {
+        layout = Node;
+    } else if (name == "core") {
+        layout = Core;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+QString CpuPlacement::layoutName(Layout layout) {
+    switch (layout) {
+    case Node: return "node";
+    case Core: return "core";
+    default: return "none";
+    }
+}
+
+QList<int> CpuPlacement::allocate(int node) {
+    QList<int> nodeCpus = m_topology.cpusOfNode(node);
+    if (nodeCpus.isEmpty() || m_layout == None) {
+        return QList<int>();
+    }
+
+    if (m_layout == Node) {
+        return nodeCpus;
+    }
+
+    // Core：在节点内依次分配，用完后从头复用
+    int &next = m_nextCpu[node];
+    int cpu = nodeCpus.at(next % nodeCpus.size());
+    ++next;
+    return QList<int>() << cpu;
+}
+
+bool CpuPlacement::pinIoThread() {
+    if (m_layout == None) {
+        return true;
+    }
+
+    QList<int> cpus = allocate(m_homeNode);
+    bool ok = CpuTopology::pinCurrentThread(cpus);
+    qDebug() << "I/O 线程绑定到节点" << m_homeNode << "CPU" << cpus << (ok ? "成功" : "失败");
+    return ok;
+}
+
+void CpuPlacement::placePool(ThreadPool *pool, int threadCount, int node) {
+    if (m_layout == None || !pool) {
+        return;
+    }
+
+    // 在当前线程预先算好每个工作线程的 CPU 集合，工作线程启动时只需绑定
+    QList<int> nodes = m_topology.nodes();
+    QList<QList<int>> assignments;
+    for (int i = 0; i < threadCount; ++i) {
+        int target = (node == SpreadNodes && !nodes.isEmpty()) ? nodes.at(i % nodes.size()) : node;
+        assignments.append(allocate(target));
+    }
+
+    QString poolName = pool->name();
+    pool->setThreadInitializer([assignments, poolName](int index) {
+        if (index < 0 || index >= assignments.size()) {
+            return;
+        }
+        if (!CpuTopology::pinCurrentThread(assignments.at(index))) {
+            qDebug() << "线程池" << poolName << "工作线程" << index << "绑定CPU失败";
+        }
+    });
+}
+
+std::function<void()> CpuPlacement::threadInitializer(const QString &name, int node) {
+    if (m_layout == None) {
+        return std::function<void()>();
+    }
+
+    QList<int> cpus;
+    if (node == SpreadNodes) {
+        for (int n : m_topology.nodes()) {
+            cpus += m_topology.cpusOfNode(n);
+        }
+    } else {
+        cpus = allocate(node);
+    }
+
+    return [cpus, name]() {
+        if (!CpuTopology::pinCurrentThread(cpus)) {
+            qDebug() << "线程" << name << "绑定CPU失败";
+        }
+    };
+}
@@ -0,0 +1,100 @@
+#ifndef CPUTOPOLOGY_H
+#define CPUTOPOLOGY_H
+
+#include <QList>
+#include <QMap>
+#include <QString>
+#include <functional>
+
+class ThreadPool;
+
+// CPU 拓扑（从 /sys/devices/system 读取）
+class CpuTopology {
+public:
+    struct Cpu {
+        int id;
+        int package;    // 物理封装（插槽）编号
+        int core;       // 封装内的物理核编号
+        int node;       // NUMA 节点编号
+        int smtRank;    // 同一物理核上的第几个超线程（0 为第一个）
+    };
+
+    CpuTopology();
+
+    // 读取拓扑，失败时退化为单节点、所有 CPU 各自独立
+    bool load(const QString &sysfsRoot = "/sys/devices/system");
+
+    const QList<Cpu> &cpus() const { return m_cpus; }
+    int cpuCount() const { return m_cpus.size(); }
+    int nodeCount() const { return m_nodeCpus.size(); }
+    QList<int> nodes() const { return m_nodeCpus.keys(); }
+
+    // 节点上的 CPU，先列出各物理核的第一个超线程，再列出其余超线程
+    QList<int> cpusOfNode(int node) const { return m_nodeCpus.value(node); }
+    int nodeOfCpu(int cpu) const;
+
+    // 拓扑描述，用于日志
+    QString describe() const;
+
+    // 解析 "0-3,8-11" 格式的 CPU 列表
+    static QList<int> parseCpuList(const QString &text);
+
+    // 将当前线程绑定到给定的 CPU 集合
+    static bool pinCurrentThread(const QList<int> &cpus);
+
+    // 当前线程所在的 CPU
+    static int currentCpu();
+
+private:
+    QList<Cpu> m_cpus;
+    QMap<int, QList<int>> m_nodeCpus;
+};
+
+// 线程放置策略
+// 根据 CPU 拓扑把 I/O 线程和各线程池的工作线程绑定到节点或核心上。
+// 内存采用 Linux 默认的本地优先分配策略：线程先绑定再分配和首次写入，
+// 其缓存（SQLite 页缓存、socket 缓冲、线程局部数据）就落在所在节点上。
+class CpuPlacement {
+public:
+    enum Layout {
+        None,   // 不绑定，由内核调度
+        Node,   // 按 NUMA 节点绑定：线程可在节点内的所有 CPU 上运行
+        Core    // 按核心绑定：每个线程独占一个 CPU（优先使用不同的物理核）
+    };
+
+    // 所有节点轮流分布
+    static const int SpreadNodes = -1;
+
+    CpuPlacement(const CpuTopology &topology, Layout layout);
+
+    static bool parseLayout(const QString &text, Layout &layout);
+    static QString layoutName(Layout layout);
+
+    Layout layout() const { return m_layout; }
+
+    // 主节点：I/O 反应器、数据库执行器等共享同一份缓存的线程放在这里
+    int homeNode() const { return m_homeNode; }
+
+    // 绑定当前线程（I/O 反应器）
+    bool pinIoThread();
+
+    // 为线程池设置放置方式，必须在 pool->init() 之前调用
+    // node 为 SpreadNodes 时工作线程按节点轮流分布，否则全部放在该节点
+    void placePool(ThreadPool *pool, int threadCount, int node);
+
+    // 为单独创建的线程（数据库写线程、分段日志写线程、启动时的加载线程）分配 CPU，必须在线程启动之前调用
+    // 返回线程启动时执行的绑定函数；node 为 SpreadNodes 时线程可在所有节点的 CPU 上运行
+    // 这些线程由已绑定的 I/O 线程创建，不重新绑定就会继承 I/O 线程的 CPU 集合
+    std::function<void()> threadInitializer(const QString &name, int node);
+
+private:
+    // 为一个线程分配 CPU 集合
+    QList<int> allocate(int node);
+
+    CpuTopology m_topology;
+    Layout m_layout;
+    int m_homeNode;
+    QMap<int, int> m_nextCpu;   // Core 模式下每个节点的下一个待分配 CPU
+};
+
+#endif // CPUTOPOLOGY_H
@@ -0,0 +1,140 @@
+#include "dbconnection.h"
+#include "../Common/config.h"
+#include <QDebug>
+#include <QSqlError>
+#include <QStringList>
+#include <QThread>
+
+DbConnection::DbConnection(const QString &connectionName, const QString &dbPath, Role role)
+    : m_connectionName(connectionName), m_role(role), m_open(false), m_hits(0), m_misses(0) {
+    m_db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    m_db.setDatabaseName(dbPath);
+    // 写锁冲突时由 SQLite 等待，而不是立即返回 SQLITE_BUSY
+    m_db.setConnectOptions(QString("QSQLITE_BUSY_TIMEOUT=%1").arg(Config::DbConnectionWaitMs));
+
+    if (!m_db.open()) {
+        qDebug() << "Error: Failed to open database connection" << connectionName << ":" << m_db.lastError().text();
+        return;
+    }
+    m_open = applyPragmas(m_db, role);
+}
+
+DbConnection::~DbConnection() {
+    // 预编译语句必须在连接关闭前释放
+    qDeleteAll(m_statements);
+    m_statements.clear();
+    m_overflow.reset();
+    m_db.close();
+    m_db = QSqlDatabase();
+    QSqlDatabase::removeDatabase(m_connectionName);
+}
+
+bool DbConnection::applyPragmas(QSqlDatabase &db, Role role) {
+    QStringList pragmas;
+    if (role == Writer) {
+        // WAL 模式保存在数据库文件中，由写连接设置一次即可
+        pragmas << "PRAGMA journal_mode=WAL";
+    }
+    // WAL 模式下 NORMAL 只在检查点时 fsync，断电最多丢失最近提交的事务，不会损坏数据库
+    pragmas << "PRAGMA synchronous=NORMAL"
+            << QString("PRAGMA cache_size=-%1").arg(Config::DbCacheSizeKb)
+            << QString("PRAGMA mmap_size=%1").arg(Config::DbMmapSizeBytes)
+            << "PRAGMA temp_store=MEMORY";
+    if (role == Reader) {
+        pragmas << "PRAGMA query_only=1";
+    }
+
+    QSqlQuery query(db);
+    for (const QString &pragma : pragmas) {
+        if (!query.exec(pragma)) {
+            qDebug() << "设置数据库参数失败:" << pragma << query.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+QSqlQuery &DbConnection::prepare(const QString &sql) {
+    QSqlQuery *query = m_statements.value(sql);
+    if (query) {
+        ++m_hits;
+        query->finish();
+        return *query;
+    }
+
+    ++m_misses;
+    query = new QSqlQuery(m_db);
+    if (!query->prepare(sql)) {
+        qDebug() << "预编译语句失败:" << sql << query->lastError().text();
+    }
+    if (m_statements.size() < Config::DbStatementCacheSize) {
+        m_statements.insert(sql, query);
+    } else {
+        // 缓存已满（通常是传入了动态 SQL）时不再缓存，返回的语句在下一次溢出前有效
+        qDebug() << "预编译语句缓存已满:" << m_connectionName;
+        m_overflow.reset(query);
+    }
+    return *query;
+}
+
+void DbConnection::finishAll() {
+    for (QSqlQuery *query : std::as_const(m_statements)) {
+        if (query->isActive()) {
+            query->finish();
+        }
+    }
+}
+
+DbConnectionPool::ThreadConnection::~ThreadConnection() {
+    connection.reset();
+    state->open.fetch_sub(1, std::memory_order_relaxed);
+    state->free.release();
+}
+
+DbConnectionPool::DbConnectionPool(QObject *parent)
+    : QObject(parent), m_maxConnections(0), m_waitTimeoutMs(0),
+      m_slots(std::make_shared<SlotState>(0)), m_nextId(0) {
+}
+
+DbConnectionPool::~DbConnectionPool() {
+}
+
+bool DbConnectionPool::init(const QString &dbPath, int maxConnections, int waitTimeoutMs) {
+    m_dbPath = dbPath;
+    m_maxConnections = qMax(1, maxConnections);
+    m_waitTimeoutMs = waitTimeoutMs;
+    m_slots = std::make_shared<SlotState>(m_maxConnections);
+
+    qDebug() << "数据库读连接池已初始化，最多" << m_maxConnections << "个读连接";
+    return true;
+}
+
+DbConnection *DbConnectionPool::connection() {
+    if (m_connections.hasLocalData()) {
+        return m_connections.localData()->connection.get();
+    }
+
+    // 占用一个名额，用完时等待其他线程退出归还
+    if (!m_slots->free.tryAcquire(1, m_waitTimeoutMs)) {
+        qDebug() << "数据库读连接已达上限" << m_maxConnections << "，线程" << QThread::currentThreadId() << "获取连接超时";
+        return nullptr;
+    }
+
+    ThreadConnection *local = new ThreadConnection;
+    local->state = m_slots;
+    local->state->open.fetch_add(1, std::memory_order_relaxed);
+    local->connection.reset(new DbConnection(QString("db_read_%1").arg(m_nextId.fetch_add(1)),
+                                             m_dbPath, DbConnection::Reader));
+    m_connections.setLocalData(local);
+
+    if (!local->connection->isOpen()) {
+        qDebug() << "Error: Failed to open read connection for thread" << QThread::currentThreadId();
+    }
+    return local->connection.get();
+}
+
+void DbConnectionPool::finishStatements() {
+    if (m_connections.hasLocalData()) {
+        m_connections.localData()->connection->finishAll();
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef DBCONNECTION_H
+#define DBCONNECTION_H
+
+#include <QObject>
+#include <QHash>
+#include <QSemaphore>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QString>
+#include <QThreadStorage>
+#include <atomic>
+#include <memory>
+
+// 数据库连接
+// 封装一个 QSQLITE 连接及其预编译语句缓存。连接只能在创建它的线程中使用。
+// 数据库使用 WAL 日志模式：读连接读取快照，不会阻塞写连接，也不会被写连接阻塞。
+class DbConnection {
+public:
+    enum Role {
+        Reader,     // 只读连接（query_only）
+        Writer      // 唯一的写连接
+    };
+
+    DbConnection(const QString &connectionName, const QString &dbPath, Role role);
+    ~DbConnection();
+
+    bool isOpen() const { return m_open; }
+    Role role() const { return m_role; }
+    QSqlDatabase &database() { return m_db; }
+
+    // 获取缓存的预编译语句（按 SQL 文本缓存，首次使用时 prepare）
+    // 返回前会结束该语句上一次的执行状态，调用者只需绑定参数并执行
+    // 只应传入固定的 SQL 文本，动态拼接的语句请直接使用 QSqlQuery
+    QSqlQuery &prepare(const QString &sql);
+
+    // 结束所有语句的执行状态，释放读事务持有的快照
+    void finishAll();
+
+    int cachedStatementCount() const { return m_statements.size(); }
+    quint64 statementHits() const { return m_hits; }
+    quint64 statementMisses() const { return m_misses; }
+
+    // 设置连接参数（WAL、同步级别、页缓存、内存映射等）
+    static bool applyPragmas(QSqlDatabase &db, Role role);
+
+private:
+    Q_DISABLE_COPY(DbConnection)
+
+    QString m_connectionName;
+    Role m_role;
+    QSqlDatabase m_db;
+    bool m_open;
+
+    QHash<QString, QSqlQuery*> m_statements;
+    std::unique_ptr<QSqlQuery> m_overflow;
+    quint64 m_hits;
+    quint64 m_misses;
+};
+
+// 读连接池
+// 每个线程首次读取时获得一个自己的读连接，线程退出时关闭并归还名额。
+// 读连接总数不超过 maxConnections，名额用完时等待其他线程归还，超时返回 nullptr。
+// 写操作不使用读连接，统一交给数据库写线程（DbWriter）。
+class DbConnectionPool : public QObject {
+    Q_OBJECT
+public:
+    explicit DbConnectionPool(QObject *parent = nullptr);
+    ~DbConnectionPool();
+
+    // 初始化读连接池
+    bool init(const QString &dbPath, int maxConnections, int waitTimeoutMs);
+
+    // 当前线程的读连接，名额不足且等待超时时返回 nullptr
+    DbConnection *connection();
+
+    // 结束当前线程读连接上所有语句的执行状态（当前线程没有读连接时什么都不做）
+    void finishStatements();
+
+    int maxConnections() const { return m_maxConnections; }
+    int openConnections() const { return m_slots->open.load(std::memory_order_relaxed); }
+
+private:
+    // 连接名额，线程退出时可能晚于连接池析构，因此共享持有
+    struct SlotState {
+        explicit SlotState(int n) : free(n), open(0) {}
+        QSemaphore free;
+        std::atomic<int> open;
+    };
+
+    // 线程退出时关闭连接并归还名额
+    struct ThreadConnection {
+        std::unique_ptr<DbConnection> connection;
+        std::shared_ptr<SlotState> state;
+        ~ThreadConnection();
+    };
+
+    QString m_dbPath;
+    int m_maxConnections;
+    int m_waitTimeoutMs;
+    std::shared_ptr<SlotState> m_slots;
+    QThreadStorage<ThreadConnection*> m_connections;
+    std::atomic<int> m_nextId;
+};
+
+// 作用域结束时结束当前线程读连接上的语句，避免读事务跨任务持有旧快照
+class DbReadScope {
+public:
+    explicit DbReadScope(DbConnectionPool *pool) : m_pool(pool) {}
+    ~DbReadScope() { if (m_pool) m_pool->finishStatements(); }
+
+private:
+    Q_DISABLE_COPY(DbReadScope)
+    DbConnectionPool *m_pool;
+};
+
+#endif // DBCONNECTION_H
@@ -0,0 +1,286 @@
+#include "dbwriter.h"
+#include "threadpool.h"
+#include "conversation.h"
+#include <QDebug>
+#include <QDeadlineTimer>
+#include <QSqlError>
+#include <QVariant>
+#include <QVector>
+
+DbWriter::DbWriter(QObject *parent)
+    : QThread(parent), m_connectionName("db_writer"), m_maxBatchRows(256), m_batchWindowMs(2),
+      m_stop(false), m_openOk(false), m_queueLength(0), m_committedRows(0), m_commitCount(0),
+      m_failedRows(0) {
+}
+
+DbWriter::~DbWriter() {
+    stop();
+    wait();
+}
+
+bool DbWriter::init(const QString &dbPath, int maxBatchRows, int batchWindowMs) {
+    if (isRunning()) {
+        return m_openOk;
+    }
+
+    m_dbPath = dbPath;
+    m_maxBatchRows = qMax(1, maxBatchRows);
+    m_batchWindowMs = qMax(0, batchWindowMs);
+    m_stop = false;
+
+    start();
+
+    // 等待写线程打开连接
+    m_ready.acquire();
+    if (!m_openOk) {
+        qDebug() << "Failed to start database writer";
+        return false;
+    }
+
+    qDebug() << "数据库写线程已启动，每批最多" << m_maxBatchRows << "条，等待窗口" << m_batchWindowMs << "毫秒";
+    return true;
+}
+
+void DbWriter::stop() {
+    QMutexLocker locker(&m_mutex);
+    m_stop = true;
+    m_condition.wakeAll();
+}
+
+QFuture<qint64> DbWriter::finished(qint64 result) {
+    QPromise<qint64> promise;
+    promise.start();
+    promise.addResult(result);
+    promise.finish();
+    return promise.future();
+}
+
+QFuture<qint64> DbWriter::submit(const Job &job, const CommitHook &committed) {
+    std::unique_ptr<PendingWrite> write(new PendingWrite);
+    write->job = job;
+    write->committed = committed;
+    write->promise.start();
+    QFuture<qint64> future = write->promise.future();
+
+    QMutexLocker locker(&m_mutex);
+    if (m_stop && !isRunning()) {
+        // 写线程已退出，直接失败
+        locker.unlock();
+        write->promise.addResult(-1);
+        write->promise.finish();
+        return future;
+    }
+
+    m_queue.push_back(std::move(write));
+    int length = int(m_queue.size());
+    m_queueLength.store(length, std::memory_order_relaxed);
+
+    // 只在写线程可能在等待第一条或批次已满时唤醒，避免每条消息都唤醒一次
+    if (length == 1 || length >= m_maxBatchRows) {
+        m_condition.wakeOne();
+    }
+    return future;
+}
+
+// 从 first 开始绑定内容列 kind, text, image_id, width, height
+static void bindContent(QSqlQuery &query, int first, const MessageContent &content) {
+    const QVariantList values = content.columnValues();
+    for (int i = 0; i < values.size(); ++i) {
+        query.bindValue(first + i, values[i]);
+    }
+}
+
+// 会话的下一个序号：走 (会话, seq) 唯一索引取最大值，写操作都在写线程中串行执行，不会分配重复的序号
+// 写操作失败回滚时序号也随之撤销，同一会话的序号保持连续
+static qint64 nextSeq(DbConnection &conn, const char *sql, qint64 conversation) {
+    QSqlQuery &query = conn.prepare(sql);
+    query.bindValue(0, conversation);
+    if (!query.exec() || !query.next()) {
+        qDebug() << "分配消息序号失败:" << query.lastError().text();
+        return -1;
+    }
+    qint64 seq = query.value(0).toLongLong();
+    query.finish();
+    return seq;
+}
+
+QFuture<qint64> DbWriter::insertMessage(qint64 fromId, qint64 toId, const MessageContent &content, qint64 sentAt,
+                                        const std::shared_ptr<qint64> &seqOut, const InsertFollowup &followup) {
+    qint64 conversationId = Conversation::privateKey(fromId, toId);
+    return submit([fromId, toId, content, sentAt, conversationId, seqOut, followup](DbConnection &conn) -> qint64 {
+        qint64 seq = nextSeq(conn, "SELECT IFNULL(MAX(seq), 0) + 1 FROM messages WHERE conversation_id = ?", conversationId);
+        if (seq < 0) {
+            return -1;
+        }
+        QSqlQuery &query = conn.prepare("INSERT INTO messages (from_id, to_id, sent_at, conversation_id, seq, "
+                                        "kind, text, image_id, width, height) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+        query.bindValue(0, fromId);
+        query.bindValue(1, toId);
+        query.bindValue(2, sentAt);
+        query.bindValue(3, conversationId);
+        query.bindValue(4, seq);
+        bindContent(query, 5, content);
+        if (!query.exec()) {
+            qDebug() << "保存消息失败:" << query.lastError().text();
+            return -1;
+        }
+        qint64 id = query.lastInsertId().toLongLong();
+        if (followup && followup(conn, id, seq) < 0) {
+            return -1;
+        }
+        if (seqOut) {
+            *seqOut = seq;
+        }
+        return id;
+    });
+}
+
+QFuture<qint64> DbWriter::insertGroupMessage(int groupId, qint64 fromId, const MessageContent &content, qint64 sentAt,
+                                             const std::shared_ptr<qint64> &seqOut) {
+    return submit([groupId, fromId, content, sentAt, seqOut](DbConnection &conn) -> qint64 {
+        qint64 seq = nextSeq(conn, "SELECT IFNULL(MAX(seq), 0) + 1 FROM group_messages WHERE group_id = ?", groupId);
+        if (seq < 0) {
+            return -1;
+        }
+        QSqlQuery &query = conn.prepare("INSERT INTO group_messages (group_id, from_id, sent_at, seq, "
+                                        "kind, text, image_id, width, height) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)");
+        query.bindValue(0, groupId);
+        query.bindValue(1, fromId);
+        query.bindValue(2, sentAt);
+        query.bindValue(3, seq);
+        bindContent(query, 4, content);
+        if (!query.exec()) {
+            qDebug() << "保存群聊消息失败:" << query.lastError().text();
+            return -1;
+        }
+        if (seqOut) {
+            *seqOut = seq;
+        }
+        return query.lastInsertId().toLongLong();
+    });
+}
+
+void DbWriter::run() {
+    if (m_threadInitializer) {
+        m_threadInitializer();
+    }
+
+    DbConnection conn(m_connectionName, m_dbPath, DbConnection::Writer);
+    m_openOk = conn.isOpen();
+    if (!m_openOk) {
+        qDebug() << "Error: Failed to open database for writer";
+    }
+    m_ready.release();
+
+    while (true) {
+        WriteQueue batch;
+        {
+            QMutexLocker locker(&m_mutex);
+
+            // 等待第一条写操作
+            while (!m_stop && m_queue.empty()) {
+                m_condition.wait(&m_mutex);
+            }
+            if (m_queue.empty()) {
+                break;  // 已停止且队列已清空
+            }
+
+            // 组提交：最多再等待一个窗口期，凑够一批再提交
+            QDeadlineTimer deadline(m_batchWindowMs);
+            while (!m_stop && int(m_queue.size()) < m_maxBatchRows && !deadline.hasExpired()) {
+                m_condition.wait(&m_mutex, deadline);
+            }
+
+            int count = qMin(int(m_queue.size()), m_maxBatchRows);
+            for (int i = 0; i < count; ++i) {
+                batch.push_back(std::move(m_queue.front()));
+                m_queue.pop_front();
+            }
+            m_queueLength.store(int(m_queue.size()), std::memory_order_relaxed);
+        }
+
+        commitBatch(conn, batch);
+    }
+}
+
+qint64 DbWriter::runJob(DbConnection &conn, const Job &job) {
+    if (!conn.prepare("SAVEPOINT write_job").exec()) {
+        qDebug() << "创建保存点失败:" << conn.database().lastError().text();
+        return -1;
+    }
+
+    qint64 result = -1;
+    try {
+        result = job(conn);
+    } catch (const std::exception &e) {
+        qDebug() << "Exception in database write:" << e.what();
+    } catch (...) {
+        qDebug() << "Unknown exception in database write";
+    }
+
+    // 失败的写操作只撤销自己的修改，不影响同批的其他写操作
+    conn.finishAll();
+    if (result < 0) {
+        conn.prepare("ROLLBACK TO write_job").exec();
+    }
+    conn.prepare("RELEASE write_job").exec();
+    return result;
+}
+
+void DbWriter::commitBatch(DbConnection &conn, WriteQueue &batch) {
+    qint64 start = ThreadPool::nowNs();
+    QSqlDatabase &db = conn.database();
+
+    QVector<qint64> results;
+    results.reserve(int(batch.size()));
+
+    if (!m_openOk) {
+        results.fill(-1, int(batch.size()));
+    } else {
+        bool inTransaction = db.transaction();
+        if (!inTransaction) {
+            qDebug() << "开始写事务失败，逐条提交:" << db.lastError().text();
+        }
+
+        for (const std::unique_ptr<PendingWrite> &write : batch) {
+            results.append(runJob(conn, write->job));
+        }
+
+        if (inTransaction && !db.commit()) {
+            qDebug() << "提交写事务失败:" << db.lastError().text();
+            db.rollback();
+            results.fill(-1);
+        }
+    }
+
+    // 事务提交之后才通知提交者
+    int failed = 0;
+    for (int i = 0; i < int(batch.size()); ++i) {
+        if (results[i] < 0) {
+            ++failed;
+        } else if (batch[i]->committed) {
+            batch[i]->committed(results[i]);
+        }
+        batch[i]->promise.addResult(results[i]);
+        batch[i]->promise.finish();
+    }
+
+    m_commitLatency.record(quint64(ThreadPool::nowNs() - start));
+    m_batchSize.record(quint64(batch.size()));
+    m_commitCount.fetch_add(1, std::memory_order_relaxed);
+    m_committedRows.fetch_add(batch.size() - failed, std::memory_order_relaxed);
+    m_failedRows.fetch_add(failed, std::memory_order_relaxed);
+}
+
+QString DbWriter::statsReport() const {
+    LatencyHistogram::Snapshot batches = m_batchSize.snapshot();
+    return QString("[db_writer] commits=%1 rows=%2 failed=%3 queue=%4 avg_batch=%5 max_batch=%6\n"
+                   "  commit_latency: %7")
+        .arg(commitCount())
+        .arg(committedRows())
+        .arg(failedRows())
+        .arg(queueLength())
+        .arg(batches.meanNs())
+        .arg(batches.maxNs)
+        .arg(m_commitLatency.snapshot().toString());
+}
@@ -0,0 +1,115 @@
+#ifndef DBWRITER_H
+#define DBWRITER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QSemaphore>
+#include "dbconnection.h"
+#include <QFuture>
+#include <QPromise>
+#include <QString>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include "latencyhistogram.h"
+#include "messagecontent.h"
+
+// 数据库写线程
+// 独占唯一的写连接，所有写操作通过队列提交，按组提交（group commit）方式批量执行：
+// 第一条写操作到达后最多再等待 batchWindowMs 毫秒或凑满 maxBatchRows 条，然后在一个事务中执行并提交。
+// 每次提交只需一次 fsync，提交者通过 QFuture 在事务提交之后得到结果。
+// 每个写操作在自己的保存点中执行，返回 -1 时只回滚它自己的修改。
+class DbWriter : public QThread {
+    Q_OBJECT
+public:
+    // 写操作：在写线程中以写连接执行，返回新行的 id（或受影响行数），失败返回 -1
+    // 写操作内不要自行开始或提交事务
+    typedef std::function<qint64(DbConnection &conn)> Job;
+
+    // 提交回调：写操作成功且事务提交后在写线程中调用（参数为写操作的结果），调用顺序与提交顺序一致
+    // 用于同步更新与数据库保持一致的内存结构，回调内不要执行耗时操作
+    typedef std::function<void(qint64 result)> CommitHook;
+
+    // 插入消息后在同一保存点中执行的写操作（参数为新消息的 id 和序号），返回 -1 时消息一起回滚
+    typedef std::function<qint64(DbConnection &conn, qint64 id, qint64 seq)> InsertFollowup;
+
+    explicit DbWriter(QObject *parent = nullptr);
+    ~DbWriter();
+
+    // 设置写线程启动时执行的初始化函数（绑定 CPU 等），必须在 init() 之前调用
+    void setThreadInitializer(const std::function<void()> &initializer) { m_threadInitializer = initializer; }
+
+    // 打开写连接并启动写线程，连接打开失败时返回 false
+    bool init(const QString &dbPath, int maxBatchRows, int batchWindowMs);
+
+    // 停止写线程（队列中剩余的写操作会先提交）
+    void stop();
+
+    // 提交一个写操作（任意线程可调用），事务提交后先调用 committed（如果有），再完成 future
+    QFuture<qint64> submit(const Job &job, const CommitHook &committed = CommitHook());
+
+    // 已完成的结果：提交前就能确定结果（如参数无效）的写操作直接返回，调用方按同样的方式等待
+    static QFuture<qint64> finished(qint64 result);
+
+    // 插入私聊消息（发送者和接收者为用户 ID，sentAt 为纪元微秒），返回消息 id
+    // 消息的会话内序号在写线程中分配（会话的最大序号加一），写入 seq 后才完成 future
+    QFuture<qint64> insertMessage(qint64 fromId, qint64 toId, const MessageContent &content, qint64 sentAt,
+                                  const std::shared_ptr<qint64> &seq = nullptr,
+                                  const InsertFollowup &followup = InsertFollowup());
+
+    // 插入群聊消息，返回消息 id
+    QFuture<qint64> insertGroupMessage(int groupId, qint64 fromId, const MessageContent &content, qint64 sentAt,
+                                       const std::shared_ptr<qint64> &seq = nullptr);
+
+    // 统计
+    quint64 committedRows() const { return m_committedRows.load(std::memory_order_relaxed); }
+    quint64 commitCount() const { return m_commitCount.load(std::memory_order_relaxed); }
+    quint64 failedRows() const { return m_failedRows.load(std::memory_order_relaxed); }
+    int queueLength() const { return m_queueLength.load(std::memory_order_relaxed); }
+    LatencyHistogram::Snapshot commitLatency() const { return m_commitLatency.snapshot(); }
+
+    // 生成统计报告
+    QString statsReport() const;
+
+protected:
+    void run() override;
+
+private:
+    struct PendingWrite {
+        Job job;
+        CommitHook committed;
+        QPromise<qint64> promise;
+    };
+    typedef std::deque<std::unique_ptr<PendingWrite>> WriteQueue;
+
+    // 在一个事务中执行并提交一批写操作
+    void commitBatch(DbConnection &conn, WriteQueue &batch);
+
+    // 在保存点中执行一个写操作
+    qint64 runJob(DbConnection &conn, const Job &job);
+
+    QString m_dbPath;
+    QString m_connectionName;
+    int m_maxBatchRows;
+    int m_batchWindowMs;
+    std::function<void()> m_threadInitializer;
+
+    QMutex m_mutex;
+    QWaitCondition m_condition;
+    WriteQueue m_queue;
+    bool m_stop;
+
+    QSemaphore m_ready;
+    bool m_openOk;
+
+    std::atomic<int> m_queueLength;
+    std::atomic<quint64> m_committedRows;
+    std::atomic<quint64> m_commitCount;
+    std::atomic<quint64> m_failedRows;
+    LatencyHistogram m_commitLatency;   // 从开始执行一批到提交完成的时间
+    LatencyHistogram m_batchSize;       // 每批的写操作数
+};
+
+#endif // DBWRITER_H
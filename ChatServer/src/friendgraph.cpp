@@ -0,0 +1,171 @@
+#include "friendgraph.h"
+#include "dbconnection.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QSqlError>
+#include <QThread>
+#include <QVariant>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+FriendGraph::FriendGraph(QObject *parent) : QObject(parent), m_edges(0) {
+    m_lock.init();
+}
+
+FriendGraph::~FriendGraph() {
+    m_lock.destroy();
+}
+
+bool FriendGraph::load(const QString &dbPath, int threads, const std::function<void()> &threadInitializer) {
+    QElapsedTimer timer;
+    timer.start();
+
+    // 先取 user_id 的范围，再按范围均分给各个线程
+    qint64 minId = 0;
+    qint64 maxId = -1;
+    {
+        DbConnection conn("friend_graph_range", dbPath, DbConnection::Reader);
+        if (!conn.isOpen()) {
+            return false;
+        }
+        QSqlQuery &query = conn.prepare("SELECT MIN(user_id), MAX(user_id) FROM friends");
+        if (!query.exec()) {
+            qDebug() << "加载好友关系失败:" << query.lastError().text();
+            return false;
+        }
+        if (query.next() && !query.value(0).isNull()) {
+            minId = query.value(0).toLongLong();
+            maxId = query.value(1).toLongLong();
+        }
+    }
+
+    Adjacency adjacency;
+    if (maxId >= minId) {
+        int shards = int(qBound<qint64>(1, threads, maxId - minId + 1));
+        qint64 span = (maxId - minId) / shards + 1;
+        std::vector<Adjacency> parts(shards);
+        std::vector<char> results(shards, 0);
+
+        std::vector<std::unique_ptr<QThread>> workers;
+        for (int i = 0; i < shards; ++i) {
+            qint64 firstId = minId + i * span;
+            qint64 lastId = qMin(maxId, firstId + span - 1);
+            workers.emplace_back(QThread::create([&, i, firstId, lastId]() {
+                if (threadInitializer) {
+                    threadInitializer();
+                }
+                results[i] = loadRange(dbPath, i, firstId, lastId, parts[i]);
+            }));
+            workers.back()->start();
+        }
+        for (const std::unique_ptr<QThread> &worker : workers) {
+            worker->wait();
+        }
+
+        // 各分片的用户互不重叠，直接合并
+        for (int i = 0; i < shards; ++i) {
+            if (!results[i]) {
+                return false;
+            }
+            adjacency.insert(parts[i]);
+        }
+    }
+
+    qint64 edges = 0;
+    for (const QList<qint64> &friends : std::as_const(adjacency)) {
+        edges += friends.size();
+    }
+
+    WriteLocker locker(&m_lock);
+    m_adjacency.swap(adjacency);
+    m_edges = edges;
+    qDebug() << "好友关系已加载，" << m_adjacency.size() << "个用户，" << m_edges << "条关系，耗时"
+             << timer.elapsed() << "毫秒";
+    return true;
+}
+
+bool FriendGraph::loadRange(const QString &dbPath, int shard, qint64 firstId, qint64 lastId, Adjacency &adjacency) {
+    DbConnection conn(QString("friend_graph_load_%1").arg(shard), dbPath, DbConnection::Reader);
+    if (!conn.isOpen()) {
+        return false;
+    }
+
+    // 按主键 (user_id, friend_id) 顺序扫描，每个用户的好友 ID 已经有序
+    QSqlQuery &query = conn.prepare("SELECT user_id, friend_id FROM friends "
+                                    "WHERE user_id BETWEEN ? AND ? ORDER BY user_id, friend_id");
+    query.setForwardOnly(true);
+    query.addBindValue(firstId);
+    query.addBindValue(lastId);
+    if (!query.exec()) {
+        qDebug() << "加载好友关系失败:" << query.lastError().text();
+        return false;
+    }
+
+    qint64 currentId = 0;
+    QList<qint64> *friends = nullptr;
+    while (query.next()) {
+        qint64 userId = query.value(0).toLongLong();
+        if (!friends || userId != currentId) {
+            currentId = userId;
+            friends = &adjacency[userId];
+        }
+        friends->append(query.value(1).toLongLong());
+    }
+    for (QList<qint64> &list : adjacency) {
+        list.squeeze();
+    }
+    return true;
+}
+
+QList<qint64> FriendGraph::friendsOf(qint64 userId) const {
+    ReadLocker locker(&m_lock);
+    return m_adjacency.value(userId);
+}
+
+bool FriendGraph::hasFriend(qint64 userId, qint64 friendId) const {
+    ReadLocker locker(&m_lock);
+    auto it = m_adjacency.constFind(userId);
+    if (it == m_adjacency.constEnd()) {
+        return false;
+    }
+    return std::binary_search(it->constBegin(), it->constEnd(), friendId);
+}
+
+void FriendGraph::addFriend(qint64 userId, qint64 friendId) {
+    WriteLocker locker(&m_lock);
+    QList<qint64> &friends = m_adjacency[userId];
+    auto pos = std::lower_bound(friends.begin(), friends.end(), friendId);
+    if (pos != friends.end() && *pos == friendId) {
+        return;
+    }
+    friends.insert(pos, friendId);
+    ++m_edges;
+}
+
+void FriendGraph::removeFriend(qint64 userId, qint64 friendId) {
+    WriteLocker locker(&m_lock);
+    auto it = m_adjacency.find(userId);
+    if (it == m_adjacency.end()) {
+        return;
+    }
+    auto pos = std::lower_bound(it->begin(), it->end(), friendId);
+    if (pos == it->end() || *pos != friendId) {
+        return;
+    }
+    it->erase(pos);
+    --m_edges;
+    if (it->isEmpty()) {
+        m_adjacency.erase(it);
+    }
+}
+
+int FriendGraph::userCount() const {
+    ReadLocker locker(&m_lock);
+    return m_adjacency.size();
+}
+
+qint64 FriendGraph::edgeCount() const {
+    ReadLocker locker(&m_lock);
+    return m_edges;
+}
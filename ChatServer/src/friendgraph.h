@@ -0,0 +1,51 @@
+#ifndef FRIENDGRAPH_H
+#define FRIENDGRAPH_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <functional>
+#include "readwritelock.h"
+
+// 好友关系图
+// friends 表在内存中的副本：用户 ID → 按 ID 升序排列的好友 ID 数组（与表相同，关系是有向的）。
+// 启动时按 user_id 范围分片，多个线程各用一个读连接并行加载。
+// 修改好友关系的写操作提交后，由数据库写线程按提交顺序更新（见 DbWriter::submit 的提交回调），
+// 内存中的关系与数据库始终一致。好友列表查询和上下线通知的接收者计算都不再访问数据库。
+class FriendGraph : public QObject {
+    Q_OBJECT
+public:
+    explicit FriendGraph(QObject *parent = nullptr);
+    ~FriendGraph();
+
+    // 从 friends 表加载（启动时在建表和迁移之后调用），threads 为并行加载的线程数
+    // threadInitializer 在每个加载线程启动时执行（绑定 CPU 等）
+    bool load(const QString &dbPath, int threads,
+              const std::function<void()> &threadInitializer = std::function<void()>());
+
+    // 用户的好友 ID（按 ID 升序）
+    QList<qint64> friendsOf(qint64 userId) const;
+
+    // friendId 是否在 userId 的好友列表中
+    bool hasFriend(qint64 userId, qint64 friendId) const;
+
+    // 添加 / 删除一条关系（已存在或不存在时忽略）
+    void addFriend(qint64 userId, qint64 friendId);
+    void removeFriend(qint64 userId, qint64 friendId);
+
+    int userCount() const;
+    qint64 edgeCount() const;
+
+private:
+    typedef QHash<qint64, QList<qint64>> Adjacency;
+
+    // 加载 user_id 在 [firstId, lastId] 范围内的关系
+    static bool loadRange(const QString &dbPath, int shard, qint64 firstId, qint64 lastId, Adjacency &adjacency);
+
+    mutable ReadWriteLock m_lock;
+    Adjacency m_adjacency;
+    qint64 m_edges;
+};
+
+#endif // FRIENDGRAPH_H
@@ -0,0 +1,148 @@
+#include "groupmembership.h"
+#include "useridtable.h"
+
+GroupMembership::GroupMembership(SessionRegistry *sessions, UserIdTable *userIds, QObject *parent)
+    : QObject(parent),
+      m_sessions(sessions),
+      m_userIds(userIds),
+      m_version(0),
+      m_hits(0),
+      m_misses(0),
+      m_fills(0) {
+    m_lock.init();
+}
+
+GroupMembership::~GroupMembership() {
+    m_lock.destroy();
+}
+
+bool GroupMembership::contains(int groupId) const {
+    ReadLocker locker(&m_lock);
+    return m_groups.contains(groupId);
+}
+
+bool GroupMembership::members(int groupId, QList<qint64> &memberIds) const {
+    ReadLocker locker(&m_lock);
+    auto it = m_groups.constFind(groupId);
+    if (it == m_groups.constEnd()) {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    memberIds = it->members;
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool GroupMembership::onlineMembers(int groupId, qint64 excludeUserId, QList<SessionPtr> &sessions) const {
+    ReadLocker locker(&m_lock);
+    auto it = m_groups.constFind(groupId);
+    if (it == m_groups.constEnd()) {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    sessions.reserve(it->online.size());
+    for (auto online = it->online.constBegin(); online != it->online.constEnd(); ++online) {
+        if (online.key() != excludeUserId) {
+            sessions.append(online.value());
+        }
+    }
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void GroupMembership::fill(int groupId, const QList<qint64> &memberIds, quint64 version) {
+    WriteLocker locker(&m_lock);
+    if (version != m_version.load(std::memory_order_acquire) || m_groups.contains(groupId)) {
+        return;
+    }
+
+    // 在写锁内查找在线会话：登录回调在注册表绑定之后才会拿到写锁，不会漏掉同时登录的成员
+    Group group;
+    group.members = memberIds;
+    for (qint64 memberId : memberIds) {
+        SessionPtr session = m_sessions->findByNickname(m_userIds->nicknameOf(memberId));
+        if (session) {
+            group.online.insert(memberId, session);
+        }
+    }
+    // 读取期间访问者已下线、群内没有在线成员时不缓存（没有成员上线就不会再被移出）
+    if (group.online.isEmpty()) {
+        return;
+    }
+    for (qint64 memberId : memberIds) {
+        m_groupsOf[memberId].append(groupId);
+    }
+    m_groups.insert(groupId, group);
+    m_fills.fetch_add(1, std::memory_order_relaxed);
+}
+
+void GroupMembership::invalidate(int groupId) {
+    WriteLocker locker(&m_lock);
+    m_version.fetch_add(1, std::memory_order_release);
+    removeGroup(groupId);
+}
+
+void GroupMembership::removeGroup(int groupId) {
+    auto it = m_groups.find(groupId);
+    if (it == m_groups.end()) {
+        return;
+    }
+    for (qint64 memberId : std::as_const(it->members)) {
+        auto groups = m_groupsOf.find(memberId);
+        if (groups != m_groupsOf.end()) {
+            groups->removeOne(groupId);
+            if (groups->isEmpty()) {
+                m_groupsOf.erase(groups);
+            }
+        }
+    }
+    m_groups.erase(it);
+}
+
+void GroupMembership::sessionBound(const QString &nickname, const SessionPtr &session) {
+    qint64 userId = m_userIds->idOf(nickname);
+    WriteLocker locker(&m_lock);
+    // 回调可能晚于之后的登出到达，以注册表中当前绑定的会话为准
+    if (m_sessions->findByNickname(nickname) != session) {
+        return;
+    }
+    const QList<int> groups = m_groupsOf.value(userId);
+    for (int groupId : groups) {
+        m_groups[groupId].online.insert(userId, session);
+    }
+}
+
+void GroupMembership::sessionUnbound(const QString &nickname, const SessionPtr &session) {
+    qint64 userId = m_userIds->idOf(nickname);
+    WriteLocker locker(&m_lock);
+    const QList<int> groups = m_groupsOf.value(userId);
+    for (int groupId : groups) {
+        Group &group = m_groups[groupId];
+        auto it = group.online.find(userId);
+        if (it != group.online.end() && it.value() == session) {
+            group.online.erase(it);
+            // 最后一个在线成员下线后群不会再有消息分发，移出缓存，下次访问时重新读取
+            if (group.online.isEmpty()) {
+                removeGroup(groupId);
+            }
+        }
+    }
+}
+
+QString GroupMembership::statsReport() const {
+    int groups;
+    int online = 0;
+    {
+        ReadLocker locker(&m_lock);
+        groups = m_groups.size();
+        for (const Group &group : m_groups) {
+            online += group.online.size();
+        }
+    }
+    return QString("[group_members] groups=%1 online_memberships=%2 hits=%3 misses=%4 fills=%5")
+        .arg(groups)
+        .arg(online)
+        .arg(m_hits.load(std::memory_order_relaxed))
+        .arg(m_misses.load(std::memory_order_relaxed))
+        .arg(m_fills.load(std::memory_order_relaxed));
+}
@@ -0,0 +1,69 @@
+#ifndef GROUPMEMBERSHIP_H
+#define GROUPMEMBERSHIP_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <atomic>
+#include "readwritelock.h"
+#include "sessionregistry.h"
+
+class UserIdTable;
+
+// 群成员缓存
+// 缓存 群 ID → 成员用户 ID，以及每个群当前在线成员的会话，群消息分发只遍历在线成员，不访问数据库。
+// 群第一次被访问时由调用者从数据库读取成员后填充；成员变更提交后使该群失效。
+// 在线成员列表由会话注册表的登录 / 登出回调维护（只维护已缓存的群）。
+// 只缓存有在线成员的群：最后一个在线成员下线时移除该群，缓存大小随在线用户所在的群数增减。
+class GroupMembership : public QObject, public SessionListener {
+    Q_OBJECT
+public:
+    GroupMembership(SessionRegistry *sessions, UserIdTable *userIds, QObject *parent = nullptr);
+    ~GroupMembership();
+
+    // 群成员是否已缓存
+    bool contains(int groupId) const;
+
+    // 缓存中的群成员 ID，未缓存返回 false
+    bool members(int groupId, QList<qint64> &memberIds) const;
+
+    // 群内在线成员的会话（不含 excludeUserId），未缓存返回 false
+    bool onlineMembers(int groupId, qint64 excludeUserId, QList<SessionPtr> &sessions) const;
+
+    // 从数据库读取成员之前取得当前版本，填充时版本已变化（期间有成员变更）则放弃
+    quint64 version() const { return m_version.load(std::memory_order_acquire); }
+    void fill(int groupId, const QList<qint64> &memberIds, quint64 version);
+
+    // 群成员变更提交后调用
+    void invalidate(int groupId);
+
+    // 会话注册表回调
+    void sessionBound(const QString &nickname, const SessionPtr &session) override;
+    void sessionUnbound(const QString &nickname, const SessionPtr &session) override;
+
+    QString statsReport() const;
+
+private:
+    struct Group {
+        QList<qint64> members;
+        QHash<qint64, SessionPtr> online;   // 在线成员 ID → 会话
+    };
+
+    // 从缓存中移除一个群（调用者持有写锁）
+    void removeGroup(int groupId);
+
+    SessionRegistry *m_sessions;
+    UserIdTable *m_userIds;
+
+    mutable ReadWriteLock m_lock;
+    QHash<int, Group> m_groups;
+    QHash<qint64, QList<int>> m_groupsOf;   // 用户 ID → 已缓存的所属群
+    std::atomic<quint64> m_version;
+
+    mutable std::atomic<quint64> m_hits;
+    mutable std::atomic<quint64> m_misses;
+    std::atomic<quint64> m_fills;
+};
+
+#endif // GROUPMEMBERSHIP_H
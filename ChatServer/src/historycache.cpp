@@ -0,0 +1,167 @@
+#include "historycache.h"
+
+HistoryCache::HistoryCache(qint64 maxBytes, int maxMessagesPerConversation, QObject *parent)
+    : QObject(parent),
+      m_maxBytes(maxBytes),
+      m_maxMessages(qMax(1, maxMessagesPerConversation)),
+      m_bytes(0),
+      m_hits(0),
+      m_misses(0),
+      m_evictions(0),
+      m_staleFills(0) {
+}
+
+bool HistoryCache::latestPage(qint64 key, int limit, QJsonArray &messages, bool &hasMore) {
+    QMutexLocker locker(&m_mutex);
+    auto it = m_entries.find(key);
+    if (it == m_entries.end()) {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    Entry &entry = it.value();
+    int count = int(entry.messages.size());
+    if (count < limit && !entry.complete) {
+        // 缓存的消息不够一页，且更早的消息不在缓存中
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    int first = qMax(0, count - limit);
+    for (int i = first; i < count; ++i) {
+        messages.append(entry.messages[i].json);
+    }
+    hasMore = first > 0 || !entry.complete;
+
+    m_lru.splice(m_lru.begin(), m_lru, entry.lru);
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void HistoryCache::beginFill(qint64 key) {
+    QMutexLocker locker(&m_mutex);
+    ++m_fills[key].active;
+}
+
+void HistoryCache::fill(qint64 key, const QJsonArray &messages, bool hasMore) {
+    QMutexLocker locker(&m_mutex);
+    auto state = m_fills.find(key);
+    if (state == m_fills.end()) {
+        return;
+    }
+    bool stale = state->dirty;
+    if (--state->active == 0) {
+        m_fills.erase(state);
+    }
+    if (stale) {
+        m_staleFills.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    // 空会话不缓存（也可能是读取失败）
+    if (messages.isEmpty()) {
+        return;
+    }
+
+    auto it = m_entries.find(key);
+    if (it != m_entries.end()) {
+        removeEntry(it);
+    }
+
+    Entry entry;
+    int first = qMax(0, int(messages.size()) - m_maxMessages);
+    for (int i = first; i < messages.size(); ++i) {
+        QJsonObject json = messages.at(i).toObject();
+        CachedMessage message{json["id"].toInteger(), json, estimateBytes(json)};
+        entry.bytes += message.bytes;
+        entry.messages.push_back(message);
+    }
+    entry.complete = !hasMore && first == 0;
+    m_lru.push_front(key);
+    entry.lru = m_lru.begin();
+    m_bytes += entry.bytes;
+    m_entries.insert(key, entry);
+    evict();
+}
+
+void HistoryCache::append(qint64 key, qint64 id, const QJsonObject &message) {
+    QMutexLocker locker(&m_mutex);
+    auto state = m_fills.find(key);
+    if (state != m_fills.end()) {
+        state->dirty = true;
+    }
+
+    auto it = m_entries.find(key);
+    if (it == m_entries.end()) {
+        return;
+    }
+
+    // 持久化完成的顺序与协程恢复的顺序可能不同，按 id 插入到正确位置
+    Entry &entry = it.value();
+    auto pos = entry.messages.end();
+    while (pos != entry.messages.begin() && std::prev(pos)->id > id) {
+        --pos;
+    }
+    // 提交之后、追加之前开始的填充已经从存储读到了这条消息，不再重复追加
+    if (pos != entry.messages.begin() && std::prev(pos)->id == id) {
+        return;
+    }
+    CachedMessage cached{id, message, estimateBytes(message)};
+    entry.messages.insert(pos, cached);
+    entry.bytes += cached.bytes;
+    m_bytes += cached.bytes;
+
+    // 只保留最后 N 条
+    while (int(entry.messages.size()) > m_maxMessages) {
+        entry.bytes -= entry.messages.front().bytes;
+        m_bytes -= entry.messages.front().bytes;
+        entry.messages.pop_front();
+        entry.complete = false;
+    }
+
+    m_lru.splice(m_lru.begin(), m_lru, entry.lru);
+    evict();
+}
+
+qint64 HistoryCache::estimateBytes(const QJsonObject &message) {
+    // 字符串按 UTF-16 计算，另加对象和节点的固定开销
+    qint64 bytes = 128;
+    for (auto it = message.begin(); it != message.end(); ++it) {
+        bytes += (it.key().size() + it.value().toString().size()) * qint64(sizeof(QChar)) + 16;
+    }
+    return bytes;
+}
+
+void HistoryCache::evict() {
+    while (m_bytes > m_maxBytes && !m_lru.empty()) {
+        auto it = m_entries.find(m_lru.back());
+        removeEntry(it);
+        m_evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void HistoryCache::removeEntry(QHash<qint64, Entry>::iterator it) {
+    m_bytes -= it->bytes;
+    m_lru.erase(it->lru);
+    m_entries.erase(it);
+}
+
+QString HistoryCache::statsReport() const {
+    quint64 hitCount = hits();
+    quint64 lookups = hitCount + misses();
+    int entries;
+    qint64 bytes;
+    {
+        QMutexLocker locker(&m_mutex);
+        entries = m_entries.size();
+        bytes = m_bytes;
+    }
+    return QString("[history_cache] conversations=%1 bytes=%2/%3 hits=%4 misses=%5 hit_rate=%6% evictions=%7 stale_fills=%8")
+        .arg(entries)
+        .arg(bytes)
+        .arg(m_maxBytes)
+        .arg(hitCount)
+        .arg(misses())
+        .arg(lookups ? 100.0 * hitCount / lookups : 0.0, 0, 'f', 1)
+        .arg(evictions())
+        .arg(m_staleFills.load(std::memory_order_relaxed));
+}
@@ -0,0 +1,85 @@
+#ifndef HISTORYCACHE_H
+#define HISTORYCACHE_H
+
+#include <QObject>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QMutex>
+#include <QString>
+#include <atomic>
+#include <deque>
+#include <list>
+
+// 热点会话缓存
+// 为最近访问的会话在内存中保存最后 N 条消息，消息已转换为响应格式（昵称已解析、content 已规范化），
+// 命中时直接返回历史记录的第一页（最新一页），不访问数据库、不重新解析 content。
+// 缓存按估算的字节数限制总大小，超出时淘汰最久未访问的会话。
+// 未命中的第一页由存储读取后填充；新消息持久化后追加到已缓存的会话（写穿）。
+// 填充期间若该会话有新消息写入，读取结果可能已过时，放弃本次填充。
+class HistoryCache : public QObject {
+    Q_OBJECT
+public:
+    HistoryCache(qint64 maxBytes, int maxMessagesPerConversation, QObject *parent = nullptr);
+
+    // 读取会话最新的 limit 条消息（按 id 升序），未命中返回 false
+    bool latestPage(qint64 key, int limit, QJsonArray &messages, bool &hasMore);
+
+    // 未命中时在读取存储之前调用，之后必须调用 fill 结束填充
+    void beginFill(qint64 key);
+
+    // 用从存储读取的最新一页（按 id 升序）填充缓存，读取期间有新消息写入或结果为空时不填充
+    void fill(qint64 key, const QJsonArray &messages, bool hasMore);
+
+    // 消息持久化后追加到已缓存的会话，已在缓存中的消息（填充时已读到）忽略
+    void append(qint64 key, qint64 id, const QJsonObject &message);
+
+    // 统计
+    quint64 hits() const { return m_hits.load(std::memory_order_relaxed); }
+    quint64 misses() const { return m_misses.load(std::memory_order_relaxed); }
+    quint64 evictions() const { return m_evictions.load(std::memory_order_relaxed); }
+    QString statsReport() const;
+
+private:
+    struct CachedMessage {
+        qint64 id;
+        QJsonObject json;
+        qint64 bytes;
+    };
+
+    struct Entry {
+        std::deque<CachedMessage> messages;    // 按 id 升序
+        qint64 bytes = 0;
+        bool complete = false;                  // 是否包含会话的全部消息
+        std::list<qint64>::iterator lru;
+    };
+
+    // 正在填充的会话：填充数和期间是否有新消息写入
+    struct FillState {
+        int active = 0;
+        bool dirty = false;
+    };
+
+    // 估算一条消息占用的内存
+    static qint64 estimateBytes(const QJsonObject &message);
+
+    // 淘汰最久未访问的会话直到总大小不超过上限（调用者持有 m_mutex）
+    void evict();
+    void removeEntry(QHash<qint64, Entry>::iterator it);
+
+    qint64 m_maxBytes;
+    int m_maxMessages;
+
+    mutable QMutex m_mutex;
+    QHash<qint64, Entry> m_entries;
+    std::list<qint64> m_lru;        // 头部为最近访问
+    QHash<qint64, FillState> m_fills;
+    qint64 m_bytes;
+
+    std::atomic<quint64> m_hits;
+    std::atomic<quint64> m_misses;
+    std::atomic<quint64> m_evictions;
+    std::atomic<quint64> m_staleFills;
+};
+
+#endif // HISTORYCACHE_H
@@ -0,0 +1,78 @@
+#include "historypage.h"
+#include "../Common/config.h"
+
+HistoryPage::HistoryPage()
+    : m_direction(Latest), m_anchor(0), m_anchorIsSeq(false), m_limit(Config::HistoryPageSize) {
+}
+
+HistoryPage HistoryPage::fromRequest(const QJsonObject &msgData) {
+    HistoryPage page;
+
+    int limit = msgData.value("limit").toInt(Config::HistoryPageSize);
+    page.m_limit = qBound(1, limit, Config::HistoryMaxPageSize);
+
+    // JSON 数字为 double，消息 id 和序号在 2^53 以内可以精确表示；序号游标优先
+    // after_seq 为 0 表示从会话的第一条消息开始
+    const struct {
+        const char *key;
+        Direction direction;
+        bool seq;
+    } anchors[] = {
+        {"before_seq", Before, true},
+        {"after_seq", After, true},
+        {"before_id", Before, false},
+        {"after_id", After, false},
+    };
+    for (const auto &anchor : anchors) {
+        QJsonValue value = msgData.value(anchor.key);
+        qint64 position = qint64(value.toDouble(-1));
+        if (position > 0 || (anchor.direction == After && anchor.seq && position == 0)) {
+            page.m_direction = anchor.direction;
+            page.m_anchor = position;
+            page.m_anchorIsSeq = anchor.seq;
+            break;
+        }
+    }
+    return page;
+}
+
+HistoryPage HistoryPage::withSeqAnchor(qint64 seq) const {
+    HistoryPage page = *this;
+    page.m_anchor = seq;
+    page.m_anchorIsSeq = true;
+    return page;
+}
+
+QString HistoryPage::buildQuery(const QString &columns, const QString &table, const QString &where) const {
+    QString sql = QString("SELECT %1 FROM %2 WHERE (%3)").arg(columns, table, where);
+    // 消息 id 游标先按主键查出该消息的序号，不存在时结果为空
+    QString anchor = m_anchorIsSeq ? QString(":anchor")
+                                   : QString("(SELECT seq FROM %1 WHERE id = :anchor)").arg(table);
+    switch (m_direction) {
+    case Before:
+        sql += " AND seq < " + anchor + " ORDER BY seq DESC";
+        break;
+    case After:
+        sql += " AND seq > " + anchor + " ORDER BY seq ASC";
+        break;
+    default:
+        sql += " ORDER BY seq DESC";
+        break;
+    }
+    return sql + " LIMIT :limit";
+}
+
+void HistoryPage::writeResponse(QJsonObject &response, bool hasMore) const {
+    switch (m_direction) {
+    case Before:
+        response[m_anchorIsSeq ? "before_seq" : "before_id"] = m_anchor;
+        break;
+    case After:
+        response[m_anchorIsSeq ? "after_seq" : "after_id"] = m_anchor;
+        break;
+    default:
+        break;
+    }
+    response["limit"] = m_limit;
+    response["has_more"] = hasMore;
+}
@@ -0,0 +1,67 @@
+#ifndef HISTORYPAGE_H
+#define HISTORYPAGE_H
+
+#include <QJsonObject>
+#include <QList>
+#include <QString>
+#include <algorithm>
+
+// 历史记录分页（按会话内序号的游标分页）
+// 请求参数：limit 为每页条数；before_seq / after_seq 取该序号之前 / 之后的 N 条，
+// 也可以用消息 id 作为游标（before_id / after_id，先查出该消息的序号），都不带时取最新的 N 条。
+// 每页都是 (会话, seq) 索引上的一次范围扫描，代价与会话长度无关。
+// 返回的消息按序号升序排列，has_more 表示该方向上是否还有消息。
+class HistoryPage {
+public:
+    enum Direction {
+        Latest,     // 最新的 N 条
+        Before,     // 游标之前的 N 条（向上翻页）
+        After       // 游标之后的 N 条（补齐新消息、补齐序号间断）
+    };
+
+    HistoryPage();
+
+    // 从请求中解析分页参数，条数限制在 [1, HistoryMaxPageSize]
+    static HistoryPage fromRequest(const QJsonObject &msgData);
+
+    Direction direction() const { return m_direction; }
+    // 游标：anchorIsSeq() 为 true 时是序号，否则是消息 id
+    qint64 anchor() const { return m_anchor; }
+    bool anchorIsSeq() const { return m_anchorIsSeq; }
+    int limit() const { return m_limit; }
+
+    // 方向和条数不变、游标换成序号的分页（消息 id 游标已换算为序号时使用）
+    HistoryPage withSeqAnchor(qint64 seq) const;
+
+    // 生成分页查询：columns 为查询的列，table 为消息表，where 为会话条件
+    // 绑定参数 :anchor（Latest 时没有）和 :limit
+    QString buildQuery(const QString &columns, const QString &table, const QString &where) const;
+
+    // :limit 的绑定值（多取一条用于判断 has_more）
+    int fetchLimit() const { return m_limit + 1; }
+
+    // 整理查询结果：截断到 limit 条、按序号升序排列，并计算 has_more
+    // rows 为按扫描方向取出的 fetchLimit() 条以内的记录
+    template<typename T>
+    void finish(QList<T> &rows, bool &hasMore) const {
+        hasMore = rows.size() > m_limit;
+        if (hasMore) {
+            rows.erase(rows.begin() + m_limit, rows.end());
+        }
+        // Latest 和 Before 按序号降序扫描，翻转为升序
+        if (m_direction != After) {
+            std::reverse(rows.begin(), rows.end());
+        }
+    }
+
+    // 在响应中写入分页信息
+    void writeResponse(QJsonObject &response, bool hasMore) const;
+
+private:
+    Direction m_direction;
+    qint64 m_anchor;
+    bool m_anchorIsSeq;
+    int m_limit;
+};
+
+#endif // HISTORYPAGE_H
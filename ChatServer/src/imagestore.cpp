@@ -0,0 +1,250 @@
+#include "imagestore.h"
+#include "dbconnection.h"
+#include "messagecontent.h"
+#include "messagetime.h"
+#include "../Common/config.h"
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageReader>
+#include <QSaveFile>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariant>
+
+// SHA-256 十六进制串的长度
+static const int HashLength = 64;
+// 扩展名的最大长度
+static const int MaxExtensionLength = 8;
+// 缩小版本的 JPEG 质量
+static const int VariantJpegQuality = 80;
+
+// 各版本文件名的后缀（原图没有后缀）
+static const char *variantSuffix(ImageStore::Variant variant) {
+    switch (variant) {
+    case ImageStore::Medium: return ".medium";
+    case ImageStore::Thumbnail: return ".thumb";
+    default: return "";
+    }
+}
+
+ImageStore::ImageStore(const QString &rootPath) : m_rootPath(rootPath) {
+    if (!m_rootPath.endsWith('/')) {
+        m_rootPath += '/';
+    }
+}
+
+QString ImageStore::hashOf(const QByteArray &data) {
+    return QString::fromLatin1(QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex());
+}
+
+bool ImageStore::isHash(const QString &hash) {
+    if (hash.size() != HashLength) {
+        return false;
+    }
+    for (QChar c : hash) {
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QString ImageStore::normalizeExtension(const QString &extension) {
+    QString normalized = extension.toLower();
+    if (normalized.startsWith('.')) {
+        normalized.remove(0, 1);
+    }
+    if (normalized.isEmpty() || normalized.size() > MaxExtensionLength) {
+        return QString();
+    }
+    for (QChar c : normalized) {
+        if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9'))) {
+            return QString();
+        }
+    }
+    return normalized;
+}
+
+QString ImageStore::imageIdOf(const QString &hash, const QString &extension) {
+    return hash + "." + extension;
+}
+
+QString ImageStore::hashOfImageId(const QString &imageId) {
+    QString hash = imageId.left(HashLength);
+    if (imageId.size() > HashLength && imageId[HashLength] == '.' && isHash(hash)) {
+        return hash;
+    }
+    return QString();
+}
+
+bool ImageStore::parseVariant(const QString &name, Variant &variant) {
+    if (name.isEmpty() || name == "original") {
+        variant = Original;
+    } else if (name == "medium") {
+        variant = Medium;
+    } else if (name == "thumbnail") {
+        variant = Thumbnail;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+QString ImageStore::pathOf(const QString &imageId, Variant variant) const {
+    // 图片 ID 会作为文件名使用，先校验
+    if (!MessageContent::isValidImageId(imageId)) {
+        return QString();
+    }
+    QString hash = hashOfImageId(imageId);
+    if (hash.isEmpty()) {
+        // 旧的图片只有原图
+        return variant == Original ? m_rootPath + imageId : QString();
+    }
+    return pathOfHash(hash, variant);
+}
+
+QString ImageStore::pathOfHash(const QString &hash, Variant variant) const {
+    return m_rootPath + hash.left(2) + "/" + hash.mid(2, 2) + "/" + hash + variantSuffix(variant);
+}
+
+bool ImageStore::write(const QString &hash, const QByteArray &data) const {
+    if (!isHash(hash)) {
+        return false;
+    }
+    QString path = pathOfHash(hash);
+    // 内容相同的文件已经存在，不再写入
+    QFileInfo info(path);
+    if (info.exists() && info.size() == data.size()) {
+        return true;
+    }
+    if (!QDir().mkpath(info.absolutePath())) {
+        qDebug() << "Error: Failed to create image directory:" << info.absolutePath();
+        return false;
+    }
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Error: Failed to open image file for writing:" << file.errorString();
+        return false;
+    }
+    if (file.write(data) != data.size()) {
+        qDebug() << "Error: Failed to write image data:" << file.errorString();
+        file.cancelWriting();
+        return false;
+    }
+    if (!file.commit()) {
+        qDebug() << "Error: Failed to commit image file:" << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+QByteArray ImageStore::read(const QString &imageId, Variant variant) const {
+    QString path = pathOf(imageId, variant);
+    if (path.isEmpty()) {
+        return QByteArray();
+    }
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        // 缩小版本不存在是正常情况
+        if (variant == Original) {
+            qDebug() << "Error: Failed to open image file for reading:" << file.errorString();
+        }
+        return QByteArray();
+    }
+    return file.readAll();
+}
+
+bool ImageStore::writeVariants(const QString &hash, const QByteArray &data) const {
+    if (!isHash(hash)) {
+        return false;
+    }
+    // 从大到小生成，缩略图存在说明之前已经处理过
+    struct Target {
+        Variant variant;
+        int maxSide;
+    };
+    const Target targets[] = {
+        {Medium, Config::ImageMediumSize},
+        {Thumbnail, Config::ImageThumbnailSize},
+    };
+    if (QFile::exists(pathOfHash(hash, Thumbnail))) {
+        return true;
+    }
+
+    // 先只读取尺寸，不超过最大版本的小图不需要解码
+    QBuffer buffer;
+    buffer.setData(data);
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader reader(&buffer);
+    QSize size = reader.size();
+    if (size.isValid() && qMax(size.width(), size.height()) <= Config::ImageThumbnailSize) {
+        return true;
+    }
+    QImage image = reader.read();
+    if (image.isNull()) {
+        qDebug() << "Error: Failed to decode image for variants:" << hash << reader.errorString();
+        return false;
+    }
+
+    bool alpha = image.hasAlphaChannel();
+    for (const Target &target : targets) {
+        if (qMax(image.width(), image.height()) <= target.maxSide) {
+            continue;
+        }
+        // 逐级缩小：缩略图由中等尺寸的版本生成，代价更小
+        image = image.scaled(target.maxSide, target.maxSide, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+
+        QSaveFile file(pathOfHash(hash, target.variant));
+        if (!file.open(QIODevice::WriteOnly)) {
+            qDebug() << "Error: Failed to open image variant for writing:" << file.errorString();
+            return false;
+        }
+        bool saved = alpha ? image.save(&file, "PNG") : image.save(&file, "JPG", VariantJpegQuality);
+        if (!saved || !file.commit()) {
+            qDebug() << "Error: Failed to write image variant:" << hash << variantSuffix(target.variant);
+            file.cancelWriting();
+            return false;
+        }
+    }
+    return true;
+}
+
+qint64 ImageStore::record(DbConnection &conn, const QString &hash, qint64 size) {
+    QSqlQuery &query = conn.prepare("INSERT OR IGNORE INTO images (hash, size, ref_count, created_at) VALUES (?, ?, 0, ?)");
+    query.addBindValue(hash);
+    query.addBindValue(size);
+    query.addBindValue(MessageTime::nowUs());
+    if (!query.exec()) {
+        qDebug() << "记录图片失败:" << query.lastError().text();
+        return -1;
+    }
+    return query.numRowsAffected();
+}
+
+qint64 ImageStore::addReference(DbConnection &conn, const QString &hash) {
+    QSqlQuery &query = conn.prepare("UPDATE images SET ref_count = ref_count + 1 WHERE hash = ?");
+    query.addBindValue(hash);
+    if (!query.exec()) {
+        qDebug() << "更新图片引用计数失败:" << query.lastError().text();
+        return -1;
+    }
+    return query.numRowsAffected();
+}
+
+bool ImageStore::contains(DbConnection &conn, const QString &hash) {
+    QSqlQuery &query = conn.prepare("SELECT 1 FROM images WHERE hash = ?");
+    query.addBindValue(hash);
+    if (!query.exec()) {
+        qDebug() << "查询图片失败:" << query.lastError().text();
+        return false;
+    }
+    bool found = query.next();
+    query.finish();
+    return found;
+}
@@ -0,0 +1,78 @@
+#ifndef IMAGESTORE_H
+#define IMAGESTORE_H
+
+#include <QByteArray>
+#include <QString>
+
+class DbConnection;
+
+// 内容寻址的图片存储
+// 图片按内容的 SHA-256 保存，文件位于 <根目录>/<哈希前两位>/<哈希第三、四位>/<哈希>，
+// 相同的图片不论上传多少次、扩展名是否相同都只保存一份，每个目录中的文件数也保持在较小的范围。
+// 图片 ID 为 "<哈希>.<扩展名>"，扩展名只用于客户端的缓存文件名。
+// images 表记录每个哈希的大小和引用计数（引用该图片的消息条数）；表中有记录说明文件已经完整写入，
+// 客户端上传前先按哈希查询，服务器已有时直接使用返回的图片 ID，不再上传。
+// 旧的图片 ID（UUID + 扩展名）仍按原来的方式保存在根目录中，读取时兼容。
+// 上传后在图片处理执行器中生成缩略图和中等尺寸两个版本，与原图放在同一目录（<哈希>.thumb、<哈希>.medium），
+// 下载时可以指定版本；版本不存在（尚未生成、原图本身不超过该尺寸或旧的图片）时返回原图。
+class ImageStore {
+public:
+    // 图片版本
+    enum Variant {
+        Original = 0,
+        Medium = 1,
+        Thumbnail = 2
+    };
+
+    explicit ImageStore(const QString &rootPath);
+
+    QString rootPath() const { return m_rootPath; }
+
+    // 图片内容的 SHA-256（小写十六进制）
+    static QString hashOf(const QByteArray &data);
+
+    // 是否为合法的 SHA-256 十六进制串
+    static bool isHash(const QString &hash);
+
+    // 规范化客户端提供的扩展名（转为小写，只允许字母和数字），非法时返回空字符串
+    static QString normalizeExtension(const QString &extension);
+
+    // 由哈希和扩展名生成图片 ID
+    static QString imageIdOf(const QString &hash, const QString &extension);
+
+    // 内容寻址的图片 ID 中的哈希，旧的图片 ID 返回空字符串
+    static QString hashOfImageId(const QString &imageId);
+
+    // 协议中的版本名（"original"、"medium"、"thumbnail"，空字符串为原图），无法识别时返回 false
+    static bool parseVariant(const QString &name, Variant &variant);
+
+    // 图片文件的路径（图片 ID 非法时返回空字符串）
+    QString pathOf(const QString &imageId, Variant variant = Original) const;
+
+    // 写入图片文件（已存在时不再写入），先写临时文件再改名，不会留下不完整的文件；在文件 I/O 执行器中调用
+    bool write(const QString &hash, const QByteArray &data) const;
+
+    // 读取图片文件的指定版本，不存在或失败时返回空数据（调用者再读取原图）；在文件 I/O 执行器中调用
+    QByteArray read(const QString &imageId, Variant variant = Original) const;
+
+    // 由原图生成缩略图和中等尺寸版本（已生成的跳过，长边不超过目标尺寸时不生成），
+    // 有透明通道的保存为 PNG，其余保存为 JPEG；在图片处理执行器中调用
+    bool writeVariants(const QString &hash, const QByteArray &data) const;
+
+    // 记录已写入的图片（已存在时忽略），作为写操作在数据库写线程中执行
+    static qint64 record(DbConnection &conn, const QString &hash, qint64 size);
+
+    // 一条消息引用了图片，引用计数加一，作为写操作在数据库写线程中执行
+    static qint64 addReference(DbConnection &conn, const QString &hash);
+
+    // 服务器是否已有该图片
+    static bool contains(DbConnection &conn, const QString &hash);
+
+private:
+    // 哈希对应的两级目录下的文件路径
+    QString pathOfHash(const QString &hash, Variant variant = Original) const;
+
+    QString m_rootPath;
+};
+
+#endif // IMAGESTORE_H
@@ -0,0 +1,85 @@
+#include "latencyhistogram.h"
+#include <cmath>
+
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+void LatencyHistogram::reset() {
+    for (int i = 0; i < BucketCount; ++i) {
+        m_buckets[i].store(0, std::memory_order_relaxed);
+    }
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+quint64 LatencyHistogram::bucketLowerBound(int index) {
+    if (index < LinearCount) {
+        return quint64(index);
+    }
+    int msb = (index - LinearCount) / SubBucketCount + LinearBits;
+    int sub = (index - LinearCount) % SubBucketCount;
+    return quint64(SubBucketCount + sub) << (msb - SubBucketBits);
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+    Snapshot snap;
+    snap.buckets.resize(BucketCount);
+    quint64 total = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        snap.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+        total += snap.buckets[i];
+    }
+    // 以桶内计数之和为准，避免与 m_count 读取时刻不一致
+    snap.count = total;
+    snap.sumNs = m_sum.load(std::memory_order_relaxed);
+    snap.maxNs = m_max.load(std::memory_order_relaxed);
+    return snap;
+}
+
+quint64 LatencyHistogram::Snapshot::percentile(double p) const {
+    if (count == 0) {
+        return 0;
+    }
+
+    quint64 target = quint64(std::ceil(count * qBound(0.0, p, 100.0) / 100.0));
+    if (target == 0) {
+        target = 1;
+    }
+
+    quint64 seen = 0;
+    for (int i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= target) {
+            // 返回桶的上界（不超过最大值），偏保守
+            quint64 upper = i + 1 < buckets.size() ? bucketLowerBound(i + 1) - 1 : maxNs;
+            return qMin(upper, maxNs);
+        }
+    }
+    return maxNs;
+}
+
+QString LatencyHistogram::Snapshot::toString() const {
+    return QString("n=%1 mean=%2 p50=%3 p90=%4 p99=%5 p99.9=%6 max=%7")
+        .arg(count)
+        .arg(formatNs(meanNs()))
+        .arg(formatNs(percentile(50)))
+        .arg(formatNs(percentile(90)))
+        .arg(formatNs(percentile(99)))
+        .arg(formatNs(percentile(99.9)))
+        .arg(formatNs(maxNs));
+}
+
+QString LatencyHistogram::formatNs(quint64 ns) {
+    if (ns < 1000) {
+        return QString("%1ns").arg(ns);
+    }
+    if (ns < 1000 * 1000) {
+        return QString("%1us").arg(ns / 1000.0, 0, 'f', 1);
+    }
+    if (ns < quint64(1000) * 1000 * 1000) {
+        return QString("%1ms").arg(ns / 1000000.0, 0, 'f', 1);
+    }
+    return QString("%1s").arg(ns / 1000000000.0, 0, 'f', 2);
+}
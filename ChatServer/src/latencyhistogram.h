@@ -0,0 +1,78 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QVector>
+#include <atomic>
+
+// 延迟直方图（HDR 风格的对数-线性分桶）
+// 小于 64ns 的值精确计数，更大的值每个 2 的幂区间再均分为 32 个子桶，相对误差约 3%。
+// record() 只做几次无锁原子加法，可在任意线程调用；snapshot() 可在运行中随时读取。
+class LatencyHistogram {
+public:
+    // 直方图快照，用于计算百分位数
+    struct Snapshot {
+        quint64 count = 0;
+        quint64 sumNs = 0;
+        quint64 maxNs = 0;
+        QVector<quint64> buckets;
+
+        // 返回第 p 百分位（0~100）的近似值（纳秒）
+        quint64 percentile(double p) const;
+        quint64 meanNs() const { return count ? sumNs / count : 0; }
+
+        // 格式化为 "n=… mean=… p50=… p90=… p99=… p99.9=… max=…"
+        QString toString() const;
+    };
+
+    LatencyHistogram();
+
+    // 记录一个样本（纳秒）
+    void record(quint64 ns) {
+        m_buckets[bucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(ns, std::memory_order_relaxed);
+        quint64 max = m_max.load(std::memory_order_relaxed);
+        while (ns > max && !m_max.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    Snapshot snapshot() const;
+
+    // 清空所有计数
+    void reset();
+
+    // 格式化纳秒值（ns/us/ms/s）
+    static QString formatNs(quint64 ns);
+
+private:
+    static const int LinearBits = 6;                        // 0~63 精确计数
+    static const int SubBucketBits = 5;                     // 每个 2 的幂区间 32 个子桶
+    static const int LinearCount = 1 << LinearBits;
+    static const int SubBucketCount = 1 << SubBucketBits;
+    static const int MaxExponent = 48;                      // 最大约 78 小时
+    static const int BucketCount = LinearCount + (MaxExponent - LinearBits) * SubBucketCount;
+
+    static int bucketIndex(quint64 ns) {
+        if (ns < quint64(LinearCount)) {
+            return int(ns);
+        }
+        int msb = 63 - __builtin_clzll(ns);
+        if (msb >= MaxExponent) {
+            return BucketCount - 1;
+        }
+        int shift = msb - SubBucketBits;
+        return LinearCount + (msb - LinearBits) * SubBucketCount + int((ns >> shift) - SubBucketCount);
+    }
+
+    // 桶的下界（纳秒）
+    static quint64 bucketLowerBound(int index);
+
+    std::atomic<quint64> m_buckets[BucketCount];
+    std::atomic<quint64> m_count;
+    std::atomic<quint64> m_sum;
+    std::atomic<quint64> m_max;
+};
+
+#endif // LATENCYHISTOGRAM_H
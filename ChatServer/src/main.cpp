@@ -3,6 +3,7 @@
 #include "config.h"
 #include "processmanager.h"
 #include <QCoreApplication>
+#include <QCommandLineParser>
 #include <QDir>
 #include <QDateTime>
 #include <signal.h>
@@ -13,6 +14,43 @@ int main(int argc, char *argv[]) {
 
     QCoreApplication a(argc, argv);
 
+    // 解析启动参数
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Chat server");
+    parser.addHelpOption();
+    QCommandLineOption cpuLayoutOption("cpu-layout",
+        "Thread placement: none, node (pin to NUMA nodes) or core (pin to cores).",
+        "layout", Config::DefaultCpuLayout);
+    parser.addOption(cpuLayoutOption);
+    QCommandLineOption messageStoreOption("message-store",
+        "Message storage engine: sqlite or segmentlog (append-only segmented log).",
+        "engine", Config::MessageStoreEngine);
+    parser.addOption(messageStoreOption);
+    QCommandLineOption archiveAfterDaysOption("archive-after-days",
+        "Move messages older than this many days into the compressed archive (sqlite engine, 0 disables).",
+        "days", QString::number(Config::ArchiveAfterDays));
+    parser.addOption(archiveAfterDaysOption);
+    parser.process(a);
+
+    CpuPlacement::Layout cpuLayout;
+    if (!CpuPlacement::parseLayout(parser.value(cpuLayoutOption), cpuLayout)) {
+        fprintf(stderr, "Invalid --cpu-layout: %s\n", qPrintable(parser.value(cpuLayoutOption)));
+        return 1;
+    }
+
+    MessageStore::Engine storeEngine;
+    if (!MessageStore::parseEngine(parser.value(messageStoreOption), storeEngine)) {
+        fprintf(stderr, "Invalid --message-store: %s\n", qPrintable(parser.value(messageStoreOption)));
+        return 1;
+    }
+
+    bool archiveDaysValid = false;
+    int archiveAfterDays = parser.value(archiveAfterDaysOption).toInt(&archiveDaysValid);
+    if (!archiveDaysValid || archiveAfterDays < 0) {
+        fprintf(stderr, "Invalid --archive-after-days: %s\n", qPrintable(parser.value(archiveAfterDaysOption)));
+        return 1;
+    }
+
     // 初始化日志系统
     QString logPath = QCoreApplication::applicationDirPath() + "/" + Config::Logging::ServerLogDir;
     QDir logDir(logPath);
@@ -33,7 +71,7 @@ int main(int argc, char *argv[]) {
     signal(SIGPIPE, SIG_IGN);
 
     // 启动服务器
-    Server server;
+    Server server(cpuLayout, storeEngine, archiveAfterDays);
     server.start();
 
     int ret = a.exec();
@@ -0,0 +1,339 @@
+#include "messagearchive.h"
+#include "dbconnection.h"
+#include "conversation.h"
+#include <QDebug>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariant>
+
+// 块格式版本（压缩前的第一个字节）
+static const char BlockVersion = 1;
+// 压缩级别：归档块只写一次，读取时解压的代价与级别无关
+static const int CompressionLevel = 9;
+
+static void writeVarint(QByteArray &out, quint64 value) {
+    while (value >= 0x80) {
+        out.append(char(value | 0x80));
+        value >>= 7;
+    }
+    out.append(char(value));
+}
+
+static bool readVarint(const QByteArray &in, qsizetype &pos, quint64 &value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < in.size(); shift += 7) {
+        quint8 byte = quint8(in[pos++]);
+        value |= quint64(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 差分可能为负（旧数据的发送时间不一定单调），用 zigzag 编码
+static quint64 zigzag(qint64 value) {
+    return (quint64(value) << 1) ^ quint64(value >> 63);
+}
+
+static qint64 unzigzag(quint64 value) {
+    return qint64(value >> 1) ^ -qint64(value & 1);
+}
+
+static void writeString(QByteArray &out, const QString &text) {
+    QByteArray utf8 = text.toUtf8();
+    writeVarint(out, quint64(utf8.size()));
+    out.append(utf8);
+}
+
+static bool readString(const QByteArray &in, qsizetype &pos, QString &text) {
+    quint64 length = 0;
+    if (!readVarint(in, pos, length) || length > quint64(in.size() - pos)) {
+        return false;
+    }
+    text = QString::fromUtf8(in.constData() + pos, qsizetype(length));
+    pos += qsizetype(length);
+    return true;
+}
+
+QByteArray MessageArchive::encode(const QList<StoredMessage> &rows) {
+    // 按列存放：同一列的值相邻，差分后大多只占一两个字节，压缩效果也更好
+    QByteArray raw;
+    raw.append(BlockVersion);
+    writeVarint(raw, quint64(rows.size()));
+    qint64 previous = 0;
+    for (const StoredMessage &row : rows) {
+        writeVarint(raw, zigzag(row.id - previous));
+        previous = row.id;
+    }
+    previous = 0;
+    for (const StoredMessage &row : rows) {
+        writeVarint(raw, zigzag(row.seq - previous));
+        previous = row.seq;
+    }
+    for (const StoredMessage &row : rows) {
+        writeVarint(raw, quint64(row.fromId));
+    }
+    previous = 0;
+    for (const StoredMessage &row : rows) {
+        writeVarint(raw, zigzag(row.sentAt - previous));
+        previous = row.sentAt;
+    }
+    for (const StoredMessage &row : rows) {
+        raw.append(char(row.content.kind()));
+    }
+    for (const StoredMessage &row : rows) {
+        if (row.content.kind() == MessageContent::Image) {
+            writeString(raw, row.content.imageId());
+            writeVarint(raw, quint64(row.content.width()));
+            writeVarint(raw, quint64(row.content.height()));
+        } else {
+            writeString(raw, row.content.text());
+        }
+    }
+    return qCompress(raw, CompressionLevel);
+}
+
+bool MessageArchive::decode(const QByteArray &block, qint64 conversation, QList<StoredMessage> &rows) {
+    QByteArray raw = qUncompress(block);
+    qsizetype pos = 0;
+    quint64 count = 0;
+    if (raw.isEmpty() || raw[pos++] != BlockVersion || !readVarint(raw, pos, count) || count > quint64(raw.size())) {
+        qDebug() << "归档块格式错误，会话" << conversation;
+        return false;
+    }
+
+    QList<StoredMessage> decoded(qsizetype(count), StoredMessage());
+    quint64 value = 0;
+    qint64 previous = 0;
+    bool ok = true;
+    for (StoredMessage &row : decoded) {
+        ok = ok && readVarint(raw, pos, value);
+        row.id = previous += unzigzag(value);
+    }
+    previous = 0;
+    for (StoredMessage &row : decoded) {
+        ok = ok && readVarint(raw, pos, value);
+        row.seq = previous += unzigzag(value);
+    }
+    // 私聊的接收者是会话中的另一个用户，群聊的“接收者”为群 ID
+    qint64 low = conversation >> 32;
+    qint64 high = conversation & 0xFFFFFFFFLL;
+    for (StoredMessage &row : decoded) {
+        ok = ok && readVarint(raw, pos, value);
+        row.fromId = qint64(value);
+        row.toId = conversation < 0 ? -conversation : (row.fromId == low ? high : low);
+    }
+    previous = 0;
+    for (StoredMessage &row : decoded) {
+        ok = ok && readVarint(raw, pos, value);
+        row.sentAt = previous += unzigzag(value);
+    }
+    if (!ok || raw.size() - pos < qsizetype(count)) {
+        qDebug() << "归档块格式错误，会话" << conversation;
+        return false;
+    }
+    QList<int> kinds;
+    kinds.reserve(qsizetype(count));
+    for (quint64 i = 0; i < count; ++i) {
+        kinds.append(int(raw[pos++]));
+    }
+    for (qsizetype i = 0; i < decoded.size(); ++i) {
+        QString text;
+        ok = ok && readString(raw, pos, text);
+        if (kinds[i] == MessageContent::Image) {
+            quint64 width = 0;
+            quint64 height = 0;
+            ok = ok && readVarint(raw, pos, width) && readVarint(raw, pos, height);
+            decoded[i].content = MessageContent::image(text, int(width), int(height));
+        } else {
+            decoded[i].content = MessageContent::text(text);
+        }
+    }
+    if (!ok) {
+        qDebug() << "归档块格式错误，会话" << conversation;
+        return false;
+    }
+    rows = decoded;
+    return true;
+}
+
+qint64 MessageArchive::archiveBlock(DbConnection &conn, bool group, qint64 cutoffUs, int blockRows, qint64 &cursor) {
+    const QString table = group ? "group_messages" : "messages";
+    const QString keyColumn = group ? "group_id" : "conversation_id";
+
+    // 按主键取 cursor 之后最早的一条消息；它还没有过期时，更晚写入的消息也都没有过期
+    qint64 oldestId = 0;
+    qint64 key = 0;
+    {
+        QSqlQuery &oldest = conn.prepare(QString("SELECT id, %1, sent_at, kind FROM %2 WHERE id > ? ORDER BY id LIMIT 1")
+                                             .arg(keyColumn, table));
+        oldest.addBindValue(cursor);
+        if (!oldest.exec()) {
+            qDebug() << "归档消息失败:" << oldest.lastError().text();
+            return -1;
+        }
+        if (!oldest.next() || oldest.value(2).toLongLong() >= cutoffUs) {
+            return 0;
+        }
+        oldestId = oldest.value(0).toLongLong();
+        if (oldest.value(1).isNull() || oldest.value(3).isNull()) {
+            // 会话键或内容列还没有回填，等回填完成后再归档
+            cursor = oldestId;
+            return 1;
+        }
+        key = oldest.value(1).toLongLong();
+        oldest.finish();
+    }
+
+    // 会话中序号最小的 blockRows + 1 条：多取的一条说明后面还有消息
+    QList<StoredMessage> rows;
+    bool hasNewer = false;
+    {
+        QSqlQuery &select = conn.prepare(QString("SELECT id, from_id, seq, sent_at, kind, text, image_id, width, height "
+                                                 "FROM %1 WHERE %2 = ? ORDER BY seq LIMIT ?").arg(table, keyColumn));
+        select.addBindValue(key);
+        select.addBindValue(blockRows + 1);
+        if (!select.exec()) {
+            qDebug() << "归档消息失败:" << select.lastError().text();
+            return -1;
+        }
+        while (select.next()) {
+            // 只归档连续的一段已过期的消息
+            if (rows.size() == blockRows || select.value(4).isNull() || select.value(3).toLongLong() >= cutoffUs) {
+                hasNewer = true;
+                break;
+            }
+            StoredMessage message;
+            message.id = select.value(0).toLongLong();
+            message.fromId = select.value(1).toLongLong();
+            message.seq = select.value(2).toLongLong();
+            message.sentAt = select.value(3).toLongLong();
+            message.content = MessageContent::fromColumns(select.value(4).toInt(), select.value(5).toString(),
+                                                          select.value(6).toString(), select.value(7).toInt(),
+                                                          select.value(8).toInt());
+            rows.append(message);
+        }
+        select.finish();
+    }
+    // 会话的最新一条消息留在热表中，新消息的序号由它接着分配
+    if (!hasNewer && !rows.isEmpty()) {
+        rows.removeLast();
+    }
+    if (rows.isEmpty()) {
+        cursor = oldestId;
+        return 1;
+    }
+
+    qint64 conversation = group ? Conversation::groupKey(int(key)) : key;
+    qint64 firstSeq = rows.first().seq;
+    qint64 lastSeq = rows.last().seq;
+    QSqlQuery &insert = conn.prepare("INSERT INTO message_archive (conversation_id, first_seq, last_seq, first_id, last_id, "
+                                     "row_count, block) VALUES (?, ?, ?, ?, ?, ?, ?)");
+    insert.addBindValue(conversation);
+    insert.addBindValue(firstSeq);
+    insert.addBindValue(lastSeq);
+    insert.addBindValue(rows.first().id);
+    insert.addBindValue(rows.last().id);
+    insert.addBindValue(int(rows.size()));
+    insert.addBindValue(encode(rows));
+    if (!insert.exec()) {
+        qDebug() << "写入归档块失败:" << insert.lastError().text();
+        return -1;
+    }
+
+    // 按 (会话, 序号) 索引删除已归档的一段
+    QSqlQuery &remove = conn.prepare(QString("DELETE FROM %1 WHERE %2 = ? AND seq BETWEEN ? AND ?").arg(table, keyColumn));
+    remove.addBindValue(key);
+    remove.addBindValue(firstSeq);
+    remove.addBindValue(lastSeq);
+    if (!remove.exec() || remove.numRowsAffected() != rows.size()) {
+        qDebug() << "删除已归档的消息失败:" << remove.lastError().text();
+        return -1;
+    }
+    return rows.size();
+}
+
+bool MessageArchive::readBefore(DbConnection &conn, qint64 conversation, qint64 beforeSeq, int count,
+                                QList<StoredMessage> &rows) {
+    // 从最新的块往前读，块内从后往前取
+    QSqlQuery &query = conn.prepare("SELECT block FROM message_archive WHERE conversation_id = ? AND first_seq < ? "
+                                    "ORDER BY last_seq DESC");
+    query.addBindValue(conversation);
+    query.addBindValue(beforeSeq);
+    if (!query.exec()) {
+        qDebug() << "读取归档失败:" << query.lastError().text();
+        return false;
+    }
+    int taken = 0;
+    while (taken < count && query.next()) {
+        QList<StoredMessage> block;
+        if (!decode(query.value(0).toByteArray(), conversation, block)) {
+            query.finish();
+            return false;
+        }
+        for (qsizetype i = block.size() - 1; i >= 0 && taken < count; --i) {
+            if (block[i].seq < beforeSeq) {
+                rows.append(block[i]);
+                ++taken;
+            }
+        }
+    }
+    query.finish();
+    return true;
+}
+
+bool MessageArchive::readAfter(DbConnection &conn, qint64 conversation, qint64 afterSeq, int count,
+                               QList<StoredMessage> &rows) {
+    QSqlQuery &query = conn.prepare("SELECT block FROM message_archive WHERE conversation_id = ? AND last_seq > ? "
+                                    "ORDER BY last_seq ASC");
+    query.addBindValue(conversation);
+    query.addBindValue(afterSeq);
+    if (!query.exec()) {
+        qDebug() << "读取归档失败:" << query.lastError().text();
+        return false;
+    }
+    int taken = 0;
+    while (taken < count && query.next()) {
+        QList<StoredMessage> block;
+        if (!decode(query.value(0).toByteArray(), conversation, block)) {
+            query.finish();
+            return false;
+        }
+        for (const StoredMessage &row : std::as_const(block)) {
+            if (taken == count) {
+                break;
+            }
+            if (row.seq > afterSeq) {
+                rows.append(row);
+                ++taken;
+            }
+        }
+    }
+    query.finish();
+    return true;
+}
+
+qint64 MessageArchive::seqOf(DbConnection &conn, qint64 conversation, qint64 messageId) {
+    // 同一会话中 id 与序号同序，块的 id 范围互不重叠
+    QSqlQuery &query = conn.prepare("SELECT block FROM message_archive WHERE conversation_id = ? "
+                                    "AND first_id <= ? AND last_id >= ? LIMIT 1");
+    query.addBindValue(conversation);
+    query.addBindValue(messageId);
+    query.addBindValue(messageId);
+    if (!query.exec()) {
+        qDebug() << "读取归档失败:" << query.lastError().text();
+        return 0;
+    }
+    QList<StoredMessage> block;
+    bool found = query.next() && decode(query.value(0).toByteArray(), conversation, block);
+    query.finish();
+    if (found) {
+        for (const StoredMessage &row : std::as_const(block)) {
+            if (row.id == messageId) {
+                return row.seq;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef MESSAGEARCHIVE_H
+#define MESSAGEARCHIVE_H
+
+#include <QByteArray>
+#include <QList>
+#include <QSqlDatabase>
+#include <QString>
+#include "messagestore.h"
+
+class DbConnection;
+
+// 冷消息归档（SQLite 引擎）
+// 发送时间早于保留期限的消息按会话从最早的一端成块移出 messages / group_messages，
+// 每块最多 blockRows 条，按列编码（id、序号、发送者、发送时间各自差分 + 变长整数，内容列连续存放）后压缩，
+// 存入 message_archive 表；表中只记录块的会话键、序号范围和 id 范围，作为块的索引。
+// 归档的总是每个会话序号最小的一段，会话的最新一条消息始终留在热表中（写入时由热表的最大序号分配下一个序号），
+// 因此同一会话中归档的序号都小于热表中的序号：读历史记录时热表不足一页，再从归档块中按序号接着读。
+// 会话键与热点会话缓存相同：私聊为 Conversation::privateKey，群聊为群 ID 的相反数。
+class MessageArchive {
+public:
+    // 归档一块：找出 id 大于 cursor 的最早一条消息所在的会话，把它最早的一段已过期的消息移入归档。
+    // 会话只剩一条消息、会话键或内容列尚未回填时跳过该消息（cursor 前进到它的 id）。
+    // 返回归档和跳过的条数（0 表示没有更多过期的消息，失败返回 -1），作为写操作在数据库写线程中执行
+    static qint64 archiveBlock(DbConnection &conn, bool group, qint64 cutoffUs, int blockRows, qint64 &cursor);
+
+    // 读取归档中序号小于 beforeSeq 的最多 count 条消息，按序号降序追加到 rows
+    static bool readBefore(DbConnection &conn, qint64 conversation, qint64 beforeSeq, int count, QList<StoredMessage> &rows);
+
+    // 读取归档中序号大于 afterSeq 的最多 count 条消息，按序号升序追加到 rows
+    static bool readAfter(DbConnection &conn, qint64 conversation, qint64 afterSeq, int count, QList<StoredMessage> &rows);
+
+    // 已归档的消息 id 对应的序号，不在归档中时返回 0
+    static qint64 seqOf(DbConnection &conn, qint64 conversation, qint64 messageId);
+
+    // 归档块的编码和解码（会话键用于还原私聊消息的接收者和群聊的群 ID）
+    static QByteArray encode(const QList<StoredMessage> &rows);
+    static bool decode(const QByteArray &block, qint64 conversation, QList<StoredMessage> &rows);
+};
+
+#endif // MESSAGEARCHIVE_H
@@ -0,0 +1,119 @@
+#include "messagecontent.h"
+#include <QJsonDocument>
+
+// 图片尺寸只用于客户端预留显示区域，超出范围的值按 0（未知）处理
+static const int MaxImageDimension = 65535;
+
+static int clampDimension(int value) {
+    return (value > 0 && value <= MaxImageDimension) ? value : 0;
+}
+
+MessageContent::MessageContent() : m_kind(Text), m_width(0), m_height(0) {
+}
+
+MessageContent MessageContent::text(const QString &text) {
+    MessageContent content;
+    content.m_kind = Text;
+    content.m_text = text;
+    return content;
+}
+
+MessageContent MessageContent::image(const QString &imageId, int width, int height) {
+    MessageContent content;
+    content.m_kind = Image;
+    content.m_imageId = imageId;
+    content.m_width = clampDimension(width);
+    content.m_height = clampDimension(height);
+    return content;
+}
+
+MessageContent MessageContent::fromColumns(int kind, const QString &text, const QString &imageId, int width, int height) {
+    if (kind == Image) {
+        return image(imageId, width, height);
+    }
+    return MessageContent::text(text);
+}
+
+bool MessageContent::parse(const QString &raw, MessageContent &content, QString *reason) {
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(raw.toUtf8(), &error);
+    QJsonObject object = doc.object();
+    QString type = object["type"].toString();
+    if (error.error != QJsonParseError::NoError || !doc.isObject() || (type != "text" && type != "image")) {
+        // 不是带已知类型标记的 JSON 对象，按纯文本处理（用户发送的文本本身可能恰好是 JSON）
+        if (raw.isEmpty()) {
+            if (reason) *reason = "Empty message";
+            return false;
+        }
+        content = MessageContent::text(raw);
+        return true;
+    }
+
+    if (type == "text") {
+        QString text = object["text"].toString();
+        if (text.isEmpty()) {
+            if (reason) *reason = "Empty message";
+            return false;
+        }
+        content = MessageContent::text(text);
+        return true;
+    }
+    // 图片消息
+    QString imageId = object["imageId"].toString();
+    if (!isValidImageId(imageId)) {
+        if (reason) *reason = "Invalid image id";
+        return false;
+    }
+    // 只保留图片 ID 和尺寸，客户端本地路径等其他字段不保存
+    content = MessageContent::image(imageId, object["width"].toInt(), object["height"].toInt());
+    return true;
+}
+
+MessageContent MessageContent::fromLegacy(const QString &raw) {
+    MessageContent content;
+    if (parse(raw, content)) {
+        return content;
+    }
+    return MessageContent::text(raw);
+}
+
+bool MessageContent::isValidImageId(const QString &imageId) {
+    if (imageId.isEmpty() || imageId.size() > 128 || imageId.startsWith('.')) {
+        return false;
+    }
+    for (QChar c : imageId) {
+        bool allowed = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+                       || c == '_' || c == '-' || c == '.';
+        if (!allowed) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QVariantList MessageContent::columnValues() const {
+    bool image = m_kind == Image;
+    return QVariantList() << int(m_kind)
+                          << (image ? QVariant() : QVariant(m_text))
+                          << (image ? QVariant(m_imageId) : QVariant())
+                          << (image ? QVariant(m_width) : QVariant())
+                          << (image ? QVariant(m_height) : QVariant());
+}
+
+QJsonObject MessageContent::toJsonObject() const {
+    QJsonObject object;
+    if (m_kind == Image) {
+        object["type"] = "image";
+        object["imageId"] = m_imageId;
+        object["width"] = m_width;
+        object["height"] = m_height;
+    } else {
+        object["type"] = "text";
+        object["text"] = m_text;
+    }
+    return object;
+}
+
+QString MessageContent::toWireString() const {
+    return QString::fromUtf8(QJsonDocument(toJsonObject()).toJson(QJsonDocument::Compact));
+}
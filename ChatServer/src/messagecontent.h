@@ -0,0 +1,59 @@
+#ifndef MESSAGECONTENT_H
+#define MESSAGECONTENT_H
+
+#include <QJsonObject>
+#include <QString>
+#include <QVariantList>
+
+// 消息内容
+// 协议中的 content 是 JSON 字符串：{"type":"text","text":...} 或 {"type":"image","imageId":...,"width":...,"height":...}，
+// 不是 JSON 对象的字符串按纯文本处理。收到消息时解析、校验并规范化一次，之后以类型化的字段保存
+// （数据库中的 kind / text / image_id / width / height 列），读取历史记录时直接由字段生成 content，不再解析 JSON。
+class MessageContent {
+public:
+    enum Kind {
+        Text = 0,
+        Image = 1
+    };
+
+    MessageContent();
+
+    static MessageContent text(const QString &text);
+    static MessageContent image(const QString &imageId, int width, int height);
+
+    // 由数据库列构造（kind 无法识别时按文本处理）
+    static MessageContent fromColumns(int kind, const QString &text, const QString &imageId, int width, int height);
+
+    // 解析客户端发来的 content，内容为空或图片 ID 非法时返回 false，reason 为失败原因
+    // 只有带已知类型标记（text、image）的 JSON 对象按类型解析，其余内容（包括类型未知的 JSON）按纯文本保存
+    static bool parse(const QString &raw, MessageContent &content, QString *reason = nullptr);
+
+    // 旧数据中的 content 字符串：无法识别的内容按纯文本保留，不会失败
+    static MessageContent fromLegacy(const QString &raw);
+
+    // 图片 ID 只能包含字母、数字、'_'、'-'、'.'，且不能以 '.' 开头（图片 ID 会作为文件名使用）
+    static bool isValidImageId(const QString &imageId);
+
+    Kind kind() const { return m_kind; }
+    QString text() const { return m_text; }
+    QString imageId() const { return m_imageId; }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+    // 数据库内容列 kind, text, image_id, width, height 的值，不适用的列为 NULL
+    QVariantList columnValues() const;
+
+    QJsonObject toJsonObject() const;
+
+    // 协议中使用的 content 字符串（紧凑 JSON）
+    QString toWireString() const;
+
+private:
+    Kind m_kind;
+    QString m_text;
+    QString m_imageId;
+    int m_width;
+    int m_height;
+};
+
+#endif // MESSAGECONTENT_H
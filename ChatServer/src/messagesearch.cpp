@@ -0,0 +1,346 @@
+#include "messagesearch.h"
+#include "dbconnection.h"
+#include "messagecontent.h"
+#include <QDebug>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QStringList>
+#include <QVariant>
+#include <limits>
+
+// 摘要中的高亮标记（私用区字符，索引时从文本中去掉，不会与消息内容混淆）
+static const char32_t HighlightOpen = 0xE000;
+static const char32_t HighlightClose = 0xE001;
+// 摘要的最大词数
+static const int SnippetTokens = 24;
+// 一次搜索最多使用的查询词数，限制单次查询的代价
+static const int MaxQueryTerms = 16;
+// rowid 中 sent_at 以下的位数：9 位消息 id + 1 位是否群聊；sent_at（纪元微秒）左移后到 2255 年才会溢出
+static const int KeyLowBits = 10;
+// 索引表按发送时间分配 rowid 的标记（记在补建状态表中），没有标记的旧索引表启动时重建一次
+static const char *const KeyFormatMarker = "rowid:sent_at";
+
+static bool isCjk(char32_t c) {
+    QChar::Script script = QChar::script(c);
+    return script == QChar::Script_Han || script == QChar::Script_Hiragana || script == QChar::Script_Katakana;
+}
+
+static void appendCodePoint(QString &out, char32_t c) {
+    if (QChar::requiresSurrogates(c)) {
+        out.append(QChar(QChar::highSurrogate(c)));
+        out.append(QChar(QChar::lowSurrogate(c)));
+    } else {
+        out.append(QChar(char16_t(c)));
+    }
+}
+
+QString MessageSearch::segment(const QString &text) {
+    QString out;
+    out.reserve(text.size() * 2);
+    bool previousCjk = false;
+    for (char32_t c : text.toUcs4()) {
+        if (c == HighlightOpen || c == HighlightClose) {
+            continue;
+        }
+        bool cjk = isCjk(c);
+        // 中日韩文字与前后任何非空白字符之间都要分开
+        if ((cjk || previousCjk) && !out.isEmpty() && !out.back().isSpace() && !QChar::isSpace(c)) {
+            out.append(' ');
+        }
+        appendCodePoint(out, c);
+        previousCjk = cjk;
+    }
+    return out;
+}
+
+QString MessageSearch::restoreSnippet(const QString &snippet) {
+    const QList<char32_t> chars = snippet.toUcs4();
+    auto isMarker = [](char32_t c) { return c == HighlightOpen || c == HighlightClose; };
+
+    // 去掉两侧（跳过高亮标记）都是中日韩文字的空格，它们是分词时插入的
+    QList<char32_t> kept;
+    kept.reserve(chars.size());
+    for (int i = 0; i < chars.size(); ++i) {
+        if (chars[i] == ' ') {
+            int left = int(kept.size()) - 1;
+            while (left >= 0 && isMarker(kept[left])) {
+                --left;
+            }
+            int right = i + 1;
+            while (right < chars.size() && isMarker(chars[right])) {
+                ++right;
+            }
+            if (left >= 0 && right < chars.size() && isCjk(kept[left]) && isCjk(chars[right])) {
+                continue;
+            }
+        }
+        kept.append(chars[i]);
+    }
+
+    // 转义后再换成 HTML 高亮，相邻的两段高亮合并为一段
+    QString text = QString::fromUcs4(kept.constData(), kept.size()).toHtmlEscaped();
+    QString open;
+    QString close;
+    appendCodePoint(open, HighlightOpen);
+    appendCodePoint(close, HighlightClose);
+    text.replace(close + open, QString());
+    text.replace(open, "<b>");
+    text.replace(close, "</b>");
+    return text;
+}
+
+bool MessageSearch::createIndex(QSqlDatabase &db) {
+    QSqlQuery query(db);
+    if (!query.exec("SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'message_search'")) {
+        qDebug() << "检查消息索引表失败:" << query.lastError().text();
+        return false;
+    }
+    bool exists = query.next();
+    query.finish();
+    if (exists) {
+        query.prepare("SELECT 1 FROM message_search_backfill WHERE source = ?");
+        query.addBindValue(QString(KeyFormatMarker));
+        if (query.exec() && query.next()) {
+            return true;
+        }
+        query.finish();
+        // 旧索引表按写入顺序分配 rowid，补建的旧消息排在新消息之后，删除后重新补建
+        qDebug() << "消息全文索引的 rowid 格式已变化，重建索引";
+    }
+
+    if (!db.transaction()) {
+        qDebug() << "创建消息索引失败：无法开始事务" << db.lastError().text();
+        return false;
+    }
+    // 首次创建时，已有消息的 id 上界之内的消息由后台补建索引，之后的新消息在保存后直接索引
+    QStringList steps;
+    if (exists) {
+        steps << "DROP TABLE message_search";
+    }
+    steps << "CREATE VIRTUAL TABLE message_search USING fts5("
+             "text, scope, message_id UNINDEXED, group_id UNINDEXED, from_id UNINDEXED, to_id UNINDEXED, "
+             "seq UNINDEXED, sent_at UNINDEXED, tokenize = 'unicode61 remove_diacritics 2')"
+          << "CREATE TABLE IF NOT EXISTS message_search_backfill ("
+             "source TEXT PRIMARY KEY, next_id INTEGER NOT NULL, end_id INTEGER NOT NULL) WITHOUT ROWID"
+          << "INSERT OR REPLACE INTO message_search_backfill SELECT 'messages', 0, IFNULL(MAX(id), 0) FROM messages"
+          << "INSERT OR REPLACE INTO message_search_backfill SELECT 'group_messages', 0, IFNULL(MAX(id), 0) FROM group_messages"
+          << QString("INSERT OR REPLACE INTO message_search_backfill VALUES ('%1', 0, 0)").arg(KeyFormatMarker);
+    for (const QString &sql : std::as_const(steps)) {
+        if (!query.exec(sql)) {
+            // 最常见的原因是 SQLite 没有编译 FTS5
+            qDebug() << "Warning: 创建消息索引失败，消息搜索不可用:" << query.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+    if (!db.commit()) {
+        qDebug() << "创建消息索引失败：提交事务失败" << db.lastError().text();
+        db.rollback();
+        return false;
+    }
+    qDebug() << "已创建消息全文索引";
+    return true;
+}
+
+qint64 MessageSearch::keyOf(const Document &document) {
+    return (qMax<qint64>(document.sentAt, 0) << KeyLowBits)
+         | ((document.messageId & ((1 << (KeyLowBits - 1)) - 1)) << 1)
+         | (document.groupId != 0 ? 1 : 0);
+}
+
+qint64 MessageSearch::index(DbConnection &conn, const Document &document) {
+    // 同一微秒内低位也相同的消息极少，遇到时顺延到下一微秒的位置
+    qint64 key = keyOf(document);
+    QSqlQuery &exists = conn.prepare("SELECT 1 FROM message_search WHERE rowid = ?");
+    while (true) {
+        exists.bindValue(0, key);
+        if (!exists.exec()) {
+            qDebug() << "索引消息失败:" << exists.lastError().text();
+            return -1;
+        }
+        bool taken = exists.next();
+        exists.finish();
+        if (!taken) {
+            break;
+        }
+        key += qint64(1) << KeyLowBits;
+    }
+
+    QSqlQuery &query = conn.prepare("INSERT INTO message_search (rowid, text, scope, message_id, group_id, from_id, to_id, seq, sent_at) "
+                                    "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)");
+    query.bindValue(0, key);
+    query.bindValue(1, segment(document.text));
+    query.bindValue(2, document.groupId != 0 ? QString("g%1").arg(document.groupId)
+                                             : QString("u%1 u%2").arg(document.fromId).arg(document.toId));
+    query.bindValue(3, document.messageId);
+    query.bindValue(4, document.groupId != 0 ? QVariant(document.groupId) : QVariant());
+    query.bindValue(5, document.fromId);
+    query.bindValue(6, document.groupId != 0 ? QVariant() : QVariant(document.toId));
+    query.bindValue(7, document.seq);
+    query.bindValue(8, document.sentAt);
+    if (!query.exec()) {
+        qDebug() << "索引消息失败:" << query.lastError().text();
+        return -1;
+    }
+    return key;
+}
+
+qint64 MessageSearch::backfill(DbConnection &conn, const QString &table, int batchRows) {
+    bool group = table == "group_messages";
+    qint64 nextId = 0;
+    qint64 endId = 0;
+    {
+        QSqlQuery &state = conn.prepare("SELECT next_id, end_id FROM message_search_backfill WHERE source = ?");
+        state.addBindValue(table);
+        if (!state.exec()) {
+            qDebug() << "补建消息索引失败:" << state.lastError().text();
+            return -1;
+        }
+        if (!state.next()) {
+            return 0;
+        }
+        nextId = state.value(0).toLongLong();
+        endId = state.value(1).toLongLong();
+        state.finish();
+    }
+    if (nextId >= endId) {
+        return 0;
+    }
+
+    // 按主键范围扫描一批；内容列尚未回填的旧行（kind 为 NULL）解析 content 字符串
+    QList<Document> documents;
+    qint64 lastId = nextId;
+    int scanned = 0;
+    {
+        QSqlQuery &select = conn.prepare(group
+            ? "SELECT id, group_id, from_id, 0, seq, sent_at, kind, text, content FROM group_messages "
+              "WHERE id > ? AND id <= ? ORDER BY id LIMIT ?"
+            : "SELECT id, 0, from_id, to_id, seq, sent_at, kind, text, content FROM messages "
+              "WHERE id > ? AND id <= ? ORDER BY id LIMIT ?");
+        select.addBindValue(nextId);
+        select.addBindValue(endId);
+        select.addBindValue(batchRows);
+        if (!select.exec()) {
+            qDebug() << "补建消息索引失败:" << select.lastError().text();
+            return -1;
+        }
+        while (select.next()) {
+            ++scanned;
+            lastId = select.value(0).toLongLong();
+            QVariant kind = select.value(6);
+            MessageContent content = kind.isNull()
+                ? MessageContent::fromLegacy(select.value(8).toString())
+                : MessageContent::fromColumns(kind.toInt(), select.value(7).toString(), QString(), 0, 0);
+            if (content.kind() != MessageContent::Text || content.text().isEmpty()) {
+                continue;
+            }
+            Document document;
+            document.messageId = lastId;
+            document.groupId = select.value(1).toInt();
+            document.fromId = select.value(2).toLongLong();
+            document.toId = select.value(3).toLongLong();
+            document.seq = select.value(4).toLongLong();
+            document.sentAt = select.value(5).toLongLong();
+            document.text = content.text();
+            documents.append(document);
+        }
+        select.finish();
+    }
+
+    for (const Document &document : std::as_const(documents)) {
+        if (index(conn, document) < 0) {
+            return -1;
+        }
+    }
+
+    // 范围内已没有消息时直接推进到上界
+    QSqlQuery &update = conn.prepare("UPDATE message_search_backfill SET next_id = ? WHERE source = ?");
+    update.addBindValue(scanned > 0 ? lastId : endId);
+    update.addBindValue(table);
+    if (!update.exec()) {
+        qDebug() << "补建消息索引失败:" << update.lastError().text();
+        return -1;
+    }
+    return scanned;
+}
+
+bool MessageSearch::backfillPending(QSqlDatabase &db) {
+    QSqlQuery query(db);
+    if (!query.exec("SELECT 1 FROM message_search_backfill WHERE next_id < end_id LIMIT 1")) {
+        return false;
+    }
+    return query.next();
+}
+
+QString MessageSearch::buildQuery(const QString &query, qint64 userId, const QList<int> &groupIds) {
+    // 每个查询词作为一个短语（中文按单字切分后仍是连续的短语），最后一个词按前缀匹配，词之间为 AND
+    QStringList phrases;
+    const QStringList terms = query.simplified().split(' ', Qt::SkipEmptyParts);
+    for (const QString &term : terms) {
+        bool searchable = false;
+        for (QChar c : term) {
+            if (c.isLetterOrNumber()) {
+                searchable = true;
+                break;
+            }
+        }
+        if (!searchable) {
+            continue;
+        }
+        QString phrase = segment(term);
+        phrase.replace('"', "\"\"");
+        phrases << "\"" + phrase + "\"";
+        if (phrases.size() == MaxQueryTerms) {
+            break;
+        }
+    }
+    if (phrases.isEmpty()) {
+        return QString();
+    }
+    phrases.last() += "*";
+
+    QStringList scopes;
+    scopes << QString("u%1").arg(userId);
+    for (int groupId : groupIds) {
+        scopes << QString("g%1").arg(groupId);
+    }
+    return QString("scope : (%1) AND text : (%2)").arg(scopes.join(" OR "), phrases.join(" "));
+}
+
+QList<MessageSearch::Hit> MessageSearch::search(DbConnection &conn, const QString &match, qint64 before,
+                                                int limit, bool &hasMore) {
+    QList<Hit> hits;
+    hasMore = false;
+
+    // rowid 以发送时间为高位，FTS5 按 rowid 倒序直接遍历匹配结果，顺序即从新到旧，取到 limit + 1 条即停止，摘要只为返回的结果生成
+    QSqlQuery &query = conn.prepare(QString(
+        "SELECT rowid, message_id, group_id, from_id, to_id, seq, sent_at, "
+        "snippet(message_search, 0, char(%1), char(%2), '…', %3) FROM message_search "
+        "WHERE message_search MATCH ? AND rowid < ? ORDER BY rowid DESC LIMIT ?")
+        .arg(uint(HighlightOpen)).arg(uint(HighlightClose)).arg(SnippetTokens));
+    query.addBindValue(match);
+    query.addBindValue(before > 0 ? before : std::numeric_limits<qint64>::max());
+    query.addBindValue(limit + 1);
+    if (!query.exec()) {
+        qDebug() << "搜索消息失败:" << query.lastError().text();
+        return hits;
+    }
+    while (query.next()) {
+        if (hits.size() == limit) {
+            hasMore = true;
+            break;
+        }
+        Hit hit;
+        hit.cursor = query.value(0).toLongLong();
+        hit.document.messageId = query.value(1).toLongLong();
+        hit.document.groupId = query.value(2).toInt();
+        hit.document.fromId = query.value(3).toLongLong();
+        hit.document.toId = query.value(4).toLongLong();
+        hit.document.seq = query.value(5).toLongLong();
+        hit.document.sentAt = query.value(6).toLongLong();
+        hit.snippet = restoreSnippet(query.value(7).toString());
+        hits.append(hit);
+    }
+    query.finish();
+    return hits;
+}
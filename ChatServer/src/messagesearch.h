@@ -0,0 +1,70 @@
+#ifndef MESSAGESEARCH_H
+#define MESSAGESEARCH_H
+
+#include <QList>
+#include <QSqlDatabase>
+#include <QString>
+
+class DbConnection;
+
+// 消息全文搜索
+// 文本消息写入 SQLite FTS5 表 message_search：text 列为消息文本，scope 列为可见范围
+// （私聊为 "u<发送者 ID> u<接收者 ID>"，群聊为 "g<群 ID>"），其余列只保存不索引，结果不需要回表。
+// 搜索时把范围限定为调用者本人（u<ID>）和所在的群（g<ID>），与文本条件一起交给 FTS5 求交集。
+// unicode61 分词器不会切分连续的中日韩文字，索引和查询前在这些字符之间插入空格（单字切分），
+// 查询词按短语匹配，任意长度的中文词都能搜到；生成摘要后再去掉这些空格。
+// 索引表的 rowid 由发送时间和消息 id 组成（见 keyOf），与写入顺序无关，后台补建的旧消息和新消息一样按发送时间排序；
+// 结果按 rowid 从新到旧返回，分页游标就是 rowid。
+// 新消息保存后由调用者把索引作为写操作提交给数据库写线程；已有的消息由 backfill() 分批补建索引。
+class MessageSearch {
+public:
+    // 一条待索引的文本消息，groupId 为 0 表示私聊
+    struct Document {
+        qint64 messageId = 0;
+        int groupId = 0;
+        qint64 fromId = 0;
+        qint64 toId = 0;
+        qint64 seq = 0;
+        qint64 sentAt = 0;
+        QString text;
+    };
+
+    // 一条搜索结果，snippet 为带 <b></b> 高亮的摘要
+    struct Hit {
+        qint64 cursor = 0;
+        Document document;
+        QString snippet;
+    };
+
+    // 创建索引表（在 upgrade 之后调用）；首次创建时记录需要补建索引的已有消息范围
+    // SQLite 没有编译 FTS5 时返回 false，搜索不可用
+    static bool createIndex(QSqlDatabase &db);
+
+    // 索引一条消息，作为写操作在数据库写线程中执行
+    static qint64 index(DbConnection &conn, const Document &document);
+
+    // 为 table（messages 或 group_messages）中的已有消息补建一批索引，返回本批处理的行数
+    // （0 表示已全部完成，失败返回 -1），作为写操作在数据库写线程中执行
+    static qint64 backfill(DbConnection &conn, const QString &table, int batchRows);
+
+    // 是否还有已有消息没有补建索引
+    static bool backfillPending(QSqlDatabase &db);
+
+    // 生成 MATCH 表达式：文本条件限定在用户本人和 groupIds 的范围内，query 中没有可搜索的词时返回空
+    static QString buildQuery(const QString &query, qint64 userId, const QList<int> &groupIds);
+
+    // 执行搜索：返回 rowid 小于 before（0 表示从最新开始）的最多 limit 条结果，从新到旧
+    static QList<Hit> search(DbConnection &conn, const QString &match, qint64 before, int limit, bool &hasMore);
+
+    // 在连续的中日韩文字之间插入空格
+    static QString segment(const QString &text);
+
+private:
+    // 文档的 rowid：sent_at 在高位，低位为消息 id 的低位和是否群聊
+    static qint64 keyOf(const Document &document);
+
+    // 把摘要中分词时插入的空格去掉，并把高亮标记换成 <b></b>
+    static QString restoreSnippet(const QString &snippet);
+};
+
+#endif // MESSAGESEARCH_H
@@ -0,0 +1,80 @@
+#ifndef MESSAGESTORE_H
+#define MESSAGESTORE_H
+
+#include <QFuture>
+#include <functional>
+#include <QList>
+#include <QString>
+#include "historypage.h"
+#include "messagecontent.h"
+
+// 一条已保存的消息
+struct StoredMessage {
+    qint64 id = 0;
+    qint64 fromId = 0;      // 发送者用户 ID
+    qint64 toId = 0;        // 私聊为接收者用户 ID，群聊为群 ID
+    qint64 seq = 0;         // 会话内序号，从 1 开始连续递增
+    qint64 sentAt = 0;      // 发送时间（纪元微秒）
+    MessageContent content;
+};
+
+// 保存结果：消息 id 和分配的会话内序号，失败时 id 为 -1
+struct SavedMessage {
+    qint64 id = -1;
+    qint64 seq = 0;
+    bool queuedOffline = false;     // 已与消息在同一事务中放入接收者的离线收件箱
+};
+
+// 消息存储接口
+// 服务器通过该接口保存和读取私聊、群聊消息，存储引擎可替换：
+//   sqlite     - 默认引擎，消息保存在 messages / group_messages 表中，由数据库写线程组提交
+//   segmentlog - 追加写的分段日志文件，按会话建立稀疏索引，通过内存映射读取历史记录
+// 保存时分配会话内序号，在消息持久化之后完成 future；读取可在任意线程调用，返回按序号升序的一页消息。
+class MessageStore {
+public:
+    enum Engine {
+        Sqlite,
+        SegmentLog
+    };
+
+    // 生成放入离线收件箱的消息（参数为分配的 id 和序号），在存储的写线程中调用
+    typedef std::function<QString(const SavedMessage &saved)> InboxPayload;
+
+    virtual ~MessageStore() {}
+
+    // 保存私聊消息（sentAt 为纪元微秒），返回消息 id 和序号
+    // 给出 inbox 时（接收者不在线）支持的引擎把消息同时放入接收者的离线收件箱，与消息一起提交，并设置 queuedOffline
+    virtual QFuture<SavedMessage> saveChatMessage(qint64 fromId, qint64 toId,
+                                                  const MessageContent &content, qint64 sentAt,
+                                                  const InboxPayload &inbox = InboxPayload()) = 0;
+
+    // 保存群聊消息，返回消息 id 和序号
+    virtual QFuture<SavedMessage> saveGroupChatMessage(int groupId, qint64 fromId,
+                                                       const MessageContent &content, qint64 sentAt) = 0;
+
+    // 读取两个用户之间的一页私聊记录
+    virtual QList<StoredMessage> getChatHistory(qint64 userId1, qint64 userId2,
+                                                const HistoryPage &page, bool &hasMore) = 0;
+
+    // 读取一页群聊记录
+    virtual QList<StoredMessage> getGroupChatHistory(int groupId, const HistoryPage &page, bool &hasMore) = 0;
+
+    // 引擎名称和统计报告
+    virtual QString engineName() const = 0;
+    virtual QString statsReport() const = 0;
+
+    // 解析引擎名称（sqlite、segmentlog），无法识别时返回 false
+    static bool parseEngine(const QString &text, Engine &engine) {
+        QString name = text.trimmed().toLower();
+        if (name.isEmpty() || name == "sqlite") {
+            engine = Sqlite;
+        } else if (name == "segmentlog") {
+            engine = SegmentLog;
+        } else {
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif // MESSAGESTORE_H
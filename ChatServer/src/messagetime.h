@@ -0,0 +1,32 @@
+#ifndef MESSAGETIME_H
+#define MESSAGETIME_H
+
+#include <QDateTime>
+#include <QJsonObject>
+#include <QString>
+#include <chrono>
+
+// 消息时间
+// 消息的发送时间以 UTC 纪元微秒（sent_at，整数）保存和比较，只在协议边界格式化为 ISO 8601 字符串。
+// 消息的先后顺序由会话内序号（seq）决定：同一会话中从 1 开始连续递增，在写入时分配，
+// 客户端可以用它排序，也可以根据序号的间断发现缺失的消息。
+namespace MessageTime {
+    inline qint64 nowUs() {
+        using namespace std::chrono;
+        return duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+    }
+
+    // 协议中的 timestamp 字段（本地时间，精确到毫秒）
+    inline QString toWireString(qint64 sentAtUs) {
+        return QDateTime::fromMSecsSinceEpoch(sentAtUs / 1000).toString(Qt::ISODateWithMs);
+    }
+
+    // 在协议消息中写入 timestamp、sent_at 和 seq
+    inline void write(QJsonObject &message, qint64 sentAtUs, qint64 seq) {
+        message["timestamp"] = toWireString(sentAtUs);
+        message["sent_at"] = sentAtUs;
+        message["seq"] = seq;
+    }
+}
+
+#endif // MESSAGETIME_H
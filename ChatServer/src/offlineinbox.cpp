@@ -0,0 +1,63 @@
+#include "offlineinbox.h"
+#include "dbconnection.h"
+#include <QDebug>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariant>
+
+qint64 OfflineInbox::push(DbConnection &conn, qint64 userId, qint64 messageId, const QString &payload) {
+    QSqlQuery &query = conn.prepare("INSERT OR IGNORE INTO offline_inbox (user_id, message_id, payload) VALUES (?, ?, ?)");
+    query.addBindValue(userId);
+    query.addBindValue(messageId);
+    query.addBindValue(payload);
+    if (!query.exec()) {
+        qDebug() << "保存离线消息失败:" << query.lastError().text();
+        return -1;
+    }
+    return query.numRowsAffected();
+}
+
+QJsonArray OfflineInbox::fetch(DbConnection &conn, qint64 userId, qint64 afterId, int limit, bool &hasMore) {
+    QJsonArray messages;
+    hasMore = false;
+
+    // 主键 (user_id, message_id) 上的范围扫描，多取一条判断是否还有下一批
+    QSqlQuery &query = conn.prepare("SELECT payload FROM offline_inbox WHERE user_id = ? AND message_id > ? "
+                                    "ORDER BY message_id LIMIT ?");
+    query.addBindValue(userId);
+    query.addBindValue(afterId);
+    query.addBindValue(limit + 1);
+    if (!query.exec()) {
+        qDebug() << "读取离线消息失败:" << query.lastError().text();
+        return messages;
+    }
+    while (query.next()) {
+        if (messages.size() == limit) {
+            hasMore = true;
+            break;
+        }
+        QJsonDocument doc = QJsonDocument::fromJson(query.value(0).toByteArray());
+        if (doc.isObject()) {
+            messages.append(doc.object());
+        }
+    }
+    query.finish();
+    return messages;
+}
+
+qint64 OfflineInbox::acknowledge(DbConnection &conn, qint64 userId, const QList<qint64> &messageIds) {
+    QSqlQuery &query = conn.prepare("DELETE FROM offline_inbox WHERE user_id = ? AND message_id = ?");
+    qint64 deleted = 0;
+    for (qint64 messageId : messageIds) {
+        query.bindValue(0, userId);
+        query.bindValue(1, messageId);
+        if (!query.exec()) {
+            qDebug() << "删除离线消息失败:" << query.lastError().text();
+            return -1;
+        }
+        deleted += query.numRowsAffected();
+    }
+    return deleted;
+}
@@ -0,0 +1,26 @@
+#ifndef OFFLINEINBOX_H
+#define OFFLINEINBOX_H
+
+#include <QJsonArray>
+#include <QList>
+#include <QString>
+
+class DbConnection;
+
+// 离线收件箱
+// 私聊消息的接收者不在线时，转发的消息（与历史记录中的格式相同）按 (接收者 ID, 消息 ID) 存入 offline_inbox 表。
+// 用户登录后按消息 ID 顺序分批取出发送，每批不超过一页；客户端确认收到的消息 ID 后删除这些条目，再发送下一批。
+// 没有确认的消息在下次登录时重新发送（至少送达一次），客户端按消息 ID 去重。
+class OfflineInbox {
+public:
+    // 把一条消息放入用户的收件箱（已存在时忽略），作为写操作在数据库写线程中执行
+    static qint64 push(DbConnection &conn, qint64 userId, qint64 messageId, const QString &payload);
+
+    // 取出消息 ID 大于 afterId 的最多 limit 条消息
+    static QJsonArray fetch(DbConnection &conn, qint64 userId, qint64 afterId, int limit, bool &hasMore);
+
+    // 删除已确认的消息，返回删除的条数，作为写操作在数据库写线程中执行
+    static qint64 acknowledge(DbConnection &conn, qint64 userId, const QList<qint64> &messageIds);
+};
+
+#endif // OFFLINEINBOX_H
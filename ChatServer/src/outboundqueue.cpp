@@ -0,0 +1,152 @@
+#include "outboundqueue.h"
+#include <QDebug>
+#include <QSet>
+#include <QList>
+#include <QPair>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+OutboundQueue::OutboundQueue(QObject *parent)
+    : QObject(parent), m_head(&m_stub), m_tail(&m_stub), m_wakeupPending(false),
+      m_delivered(0), m_eventFd(-1), m_notifier(nullptr) {
+}
+
+OutboundQueue::~OutboundQueue() {
+    // 丢弃尚未投递的消息
+    while (Node *node = dequeueNode()) {
+        delete node;
+    }
+
+    if (m_eventFd >= 0) {
+        ::close(m_eventFd);
+        m_eventFd = -1;
+    }
+}
+
+bool OutboundQueue::init() {
+    if (m_eventFd >= 0) {
+        return true;
+    }
+
+    m_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_eventFd < 0) {
+        qDebug() << "Failed to create eventfd:" << strerror(errno);
+        return false;
+    }
+
+    m_notifier = new QSocketNotifier(m_eventFd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &OutboundQueue::onWakeup);
+    return true;
+}
+
+void OutboundQueue::setDeliveryHandler(const DeliveryHandler &handler) {
+    m_handler = handler;
+}
+
+void OutboundQueue::push(QTcpSocket *socket, const QByteArray &data) {
+    push(socket, data, Completion());
+}
+
+void OutboundQueue::push(QTcpSocket *socket, const QByteArray &data, const Completion &completion) {
+    Node *node = new Node;
+    node->socket = socket;
+    node->data = data;
+    node->completion = completion;
+    enqueueNode(node);
+
+    // 只有第一个生产者负责唤醒 I/O 线程，其余消息由同一次 drain 一并取走
+    if (!m_wakeupPending.exchange(true, std::memory_order_acq_rel)) {
+        quint64 one = 1;
+        if (::write(m_eventFd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN) {
+            qDebug() << "Failed to signal outbound queue:" << strerror(errno);
+        }
+    }
+}
+
+int OutboundQueue::drain() {
+    // 先清除唤醒标志再取消息，保证之后入队的生产者会重新唤醒
+    m_wakeupPending.store(false, std::memory_order_release);
+
+    QSet<QTcpSocket*> touched;
+    QList<QPair<Completion, bool>> completions;
+    int count = 0;
+    while (Node *node = dequeueNode()) {
+        QTcpSocket *socket = node->socket.data();
+        bool written = false;
+        if (m_handler) {
+            m_handler(socket, node->data);
+            written = true;
+        } else if (socket && socket->isOpen()) {
+            written = socket->write(node->data) == node->data.size();
+            touched.insert(socket);
+        }
+        if (node->completion) {
+            completions.append(qMakePair(node->completion, written));
+        }
+        delete node;
+        ++count;
+    }
+
+    // 每个 socket 每轮只 flush 一次
+    for (QTcpSocket *socket : touched) {
+        socket->flush();
+    }
+
+    // flush 之后再通知等待发送完成的协程
+    for (const auto &completion : completions) {
+        completion.first(completion.second);
+    }
+
+    m_delivered.fetch_add(count, std::memory_order_relaxed);
+    return count;
+}
+
+void OutboundQueue::onWakeup() {
+    quint64 value = 0;
+    if (::read(m_eventFd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        qDebug() << "Failed to read outbound queue eventfd:" << strerror(errno);
+    }
+    drain();
+}
+
+void OutboundQueue::enqueueNode(Node *node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node *prev = m_head.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+}
+
+OutboundQueue::Node *OutboundQueue::dequeueNode() {
+    Node *tail = m_tail;
+    Node *next = tail->next.load(std::memory_order_acquire);
+
+    // 跳过哨兵节点
+    if (tail == &m_stub) {
+        if (!next) {
+            return nullptr;
+        }
+        m_tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next) {
+        m_tail = next;
+        return tail;
+    }
+
+    // 有生产者正在入队（已交换 head 但尚未链接 next），等待它的唤醒
+    if (tail != m_head.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+
+    // 队列中只剩最后一个节点，重新放入哨兵以便取出它
+    enqueueNode(&m_stub);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next) {
+        m_tail = next;
+        return tail;
+    }
+    return nullptr;
+}
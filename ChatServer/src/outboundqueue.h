@@ -0,0 +1,74 @@
+#ifndef OUTBOUNDQUEUE_H
+#define OUTBOUNDQUEUE_H
+
+#include <QObject>
+#include <QPointer>
+#include <QTcpSocket>
+#include <QByteArray>
+#include <QSocketNotifier>
+#include <atomic>
+#include <functional>
+
+// 出站消息队列（多生产者单消费者，无锁）
+// 工作线程调用 push() 投递 (socket, 数据)，I/O 线程在 eventfd 唤醒后一次性取出全部消息写入 socket。
+// 用于替代逐条 QMetaObject::invokeMethod 投递的方式。
+class OutboundQueue : public QObject {
+    Q_OBJECT
+public:
+    // 投递处理函数：在 I/O 线程中为每条消息调用一次，socket 已被销毁时为 nullptr
+    typedef std::function<void(QTcpSocket *socket, const QByteArray &data)> DeliveryHandler;
+    // 投递完成回调：在 I/O 线程中调用，written 表示数据是否已写入 socket
+    typedef std::function<void(bool written)> Completion;
+
+    explicit OutboundQueue(QObject *parent = nullptr);
+    ~OutboundQueue();
+
+    // 创建 eventfd 并注册到当前线程的事件循环，必须在 I/O 线程中调用
+    bool init();
+
+    // 设置投递处理函数，默认直接写入 socket
+    void setDeliveryHandler(const DeliveryHandler &handler);
+
+    // 投递一条消息（任意线程可调用）
+    void push(QTcpSocket *socket, const QByteArray &data);
+
+    // 投递一条消息，写入 socket（并 flush）后调用 completion（任意线程可调用）
+    void push(QTcpSocket *socket, const QByteArray &data, const Completion &completion);
+
+    // 取出并投递当前队列中的全部消息，返回投递条数（仅 I/O 线程调用）
+    int drain();
+
+    // 已投递消息总数
+    quint64 deliveredCount() const { return m_delivered.load(std::memory_order_relaxed); }
+
+    // 检查队列是否有效
+    bool isValid() const { return m_eventFd >= 0; }
+
+private slots:
+    void onWakeup();
+
+private:
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+        QPointer<QTcpSocket> socket;
+        QByteArray data;
+        Completion completion;
+    };
+
+    // 生产者端（Vyukov MPSC 队列）
+    void enqueueNode(Node *node);
+    // 消费者端，队列暂时不一致或为空时返回 nullptr
+    Node *dequeueNode();
+
+    std::atomic<Node*> m_head;      // 生产者交换的队尾
+    Node *m_tail;                   // 消费者持有的队头
+    Node m_stub;                    // 哨兵节点
+
+    std::atomic<bool> m_wakeupPending;
+    std::atomic<quint64> m_delivered;
+    int m_eventFd;
+    QSocketNotifier *m_notifier;
+    DeliveryHandler m_handler;
+};
+
+#endif // OUTBOUNDQUEUE_H
@@ -0,0 +1,533 @@
+#include "schemamigration.h"
+#include "dbconnection.h"
+#include "messagecontent.h"
+#include "../Common/config.h"
+#include <QDebug>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QStringList>
+#include <QVariant>
+
+// 以昵称为键的旧表，迁移时先改名为 legacy_<表名>
+static const char *const LegacyTables[] = {
+    "users", "friends", "messages", "friend_requests", "groups", "group_members", "group_messages"
+};
+
+// 保存消息内容的表
+static const char *const MessageTables[] = { "messages", "group_messages" };
+
+bool SchemaMigration::hasColumn(QSqlDatabase &db, const QString &table, const QString &column) {
+    QSqlQuery query(db);
+    if (!query.exec(QString("PRAGMA table_info(%1)").arg(table))) {
+        return false;
+    }
+    while (query.next()) {
+        if (query.value("name").toString() == column) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SchemaMigration::exec(QSqlDatabase &db, const QString &sql) {
+    QSqlQuery query(db);
+    if (!query.exec(sql)) {
+        qDebug() << "数据库迁移失败:" << sql << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool SchemaMigration::createTables(QSqlDatabase &db) {
+    QSqlQuery query(db);
+    QString createUsersTable = R"(
+        CREATE TABLE IF NOT EXISTS users (
+            id INTEGER PRIMARY KEY AUTOINCREMENT,
+            email TEXT UNIQUE NOT NULL,
+            nickname TEXT UNIQUE,
+            password TEXT NOT NULL,
+            is_online INTEGER DEFAULT 0,
+            signature TEXT DEFAULT '',
+            avatar TEXT DEFAULT '',
+            gender TEXT DEFAULT '',
+            birthday TEXT DEFAULT '',
+            location TEXT DEFAULT '',
+            phone TEXT DEFAULT '',
+            register_time DATETIME DEFAULT CURRENT_TIMESTAMP,
+            last_login_time DATETIME,
+            friend_count INTEGER DEFAULT 0,
+            group_count INTEGER DEFAULT 0,
+            reserved1 TEXT DEFAULT '',
+            reserved2 TEXT DEFAULT ''
+        )
+    )";
+    if (!query.exec(createUsersTable)) {
+        qDebug() << "Error: Failed to create users table:" << query.lastError().text();
+        return false;
+    }
+
+    // 关系表只有主键列，不需要单独的 rowid
+    QString createFriendsTable = R"(
+        CREATE TABLE IF NOT EXISTS friends (
+            user_id INTEGER NOT NULL,
+            friend_id INTEGER NOT NULL,
+            PRIMARY KEY (user_id, friend_id),
+            FOREIGN KEY (user_id) REFERENCES users(id),
+            FOREIGN KEY (friend_id) REFERENCES users(id)
+        ) WITHOUT ROWID
+    )";
+    if (!query.exec(createFriendsTable)) {
+        qDebug() << "Error: Failed to create friends table:" << query.lastError().text();
+        return false;
+    }
+
+    QString createMessagesTable = R"(
+        CREATE TABLE IF NOT EXISTS messages (
+            id INTEGER PRIMARY KEY AUTOINCREMENT,
+            from_id INTEGER,
+            to_id INTEGER,
+            content TEXT,
+            timestamp DATETIME DEFAULT CURRENT_TIMESTAMP,
+            conversation_id INTEGER,
+            seq INTEGER,
+            sent_at INTEGER,
+            kind INTEGER,
+            text TEXT,
+            image_id TEXT,
+            width INTEGER,
+            height INTEGER,
+            FOREIGN KEY (from_id) REFERENCES users(id),
+            FOREIGN KEY (to_id) REFERENCES users(id)
+        )
+    )";
+    if (!query.exec(createMessagesTable)) {
+        qDebug() << "Error: Failed to create messages table:" << query.lastError().text();
+        return false;
+    }
+
+    QString createFriendRequestsTable = R"(
+        CREATE TABLE IF NOT EXISTS friend_requests (
+            from_id INTEGER NOT NULL,
+            to_id INTEGER NOT NULL,
+            status TEXT DEFAULT 'pending',
+            timestamp DATETIME DEFAULT CURRENT_TIMESTAMP,
+            PRIMARY KEY (from_id, to_id),
+            FOREIGN KEY (from_id) REFERENCES users(id),
+            FOREIGN KEY (to_id) REFERENCES users(id)
+        ) WITHOUT ROWID
+    )";
+    if (!query.exec(createFriendRequestsTable)) {
+        qDebug() << "Error: Failed to create friend_requests table:" << query.lastError().text();
+        return false;
+    }
+
+    // 创建群聊表
+    QString createGroupsTable = R"(
+        CREATE TABLE IF NOT EXISTS groups (
+            id INTEGER PRIMARY KEY AUTOINCREMENT,
+            name TEXT NOT NULL,
+            creator_id INTEGER,
+            create_time DATETIME DEFAULT CURRENT_TIMESTAMP,
+            FOREIGN KEY (creator_id) REFERENCES users(id)
+        )
+    )";
+    if (!query.exec(createGroupsTable)) {
+        qDebug() << "Error: Failed to create groups table:" << query.lastError().text();
+        return false;
+    }
+
+    // 创建群成员表
+    QString createGroupMembersTable = R"(
+        CREATE TABLE IF NOT EXISTS group_members (
+            group_id INTEGER NOT NULL,
+            member_id INTEGER NOT NULL,
+            join_time DATETIME DEFAULT CURRENT_TIMESTAMP,
+            PRIMARY KEY (group_id, member_id),
+            FOREIGN KEY (group_id) REFERENCES groups(id),
+            FOREIGN KEY (member_id) REFERENCES users(id)
+        ) WITHOUT ROWID
+    )";
+    if (!query.exec(createGroupMembersTable)) {
+        qDebug() << "Error: Failed to create group_members table:" << query.lastError().text();
+        return false;
+    }
+
+    // 创建群消息表
+    QString createGroupMessagesTable = R"(
+        CREATE TABLE IF NOT EXISTS group_messages (
+            id INTEGER PRIMARY KEY AUTOINCREMENT,
+            group_id INTEGER,
+            from_id INTEGER,
+            content TEXT,
+            timestamp DATETIME DEFAULT CURRENT_TIMESTAMP,
+            seq INTEGER,
+            sent_at INTEGER,
+            kind INTEGER,
+            text TEXT,
+            image_id TEXT,
+            width INTEGER,
+            height INTEGER,
+            FOREIGN KEY (group_id) REFERENCES groups(id),
+            FOREIGN KEY (from_id) REFERENCES users(id)
+        )
+    )";
+    if (!query.exec(createGroupMessagesTable)) {
+        qDebug() << "Error: Failed to create group_messages table:" << query.lastError().text();
+        return false;
+    }
+
+    // 创建离线收件箱表（接收者不在线时的私聊消息，确认后删除）
+    QString createOfflineInboxTable = R"(
+        CREATE TABLE IF NOT EXISTS offline_inbox (
+            user_id INTEGER NOT NULL,
+            message_id INTEGER NOT NULL,
+            payload TEXT NOT NULL,
+            PRIMARY KEY (user_id, message_id),
+            FOREIGN KEY (user_id) REFERENCES users(id)
+        ) WITHOUT ROWID
+    )";
+    if (!query.exec(createOfflineInboxTable)) {
+        qDebug() << "Error: Failed to create offline_inbox table:" << query.lastError().text();
+        return false;
+    }
+
+    // 创建冷消息归档表（每行为一个会话中一段连续序号的压缩消息块，会话键与热点会话缓存相同）
+    QString createMessageArchiveTable = R"(
+        CREATE TABLE IF NOT EXISTS message_archive (
+            id INTEGER PRIMARY KEY,
+            conversation_id INTEGER NOT NULL,
+            first_seq INTEGER NOT NULL,
+            last_seq INTEGER NOT NULL,
+            first_id INTEGER NOT NULL,
+            last_id INTEGER NOT NULL,
+            row_count INTEGER NOT NULL,
+            block BLOB NOT NULL
+        )
+    )";
+    if (!query.exec(createMessageArchiveTable)) {
+        qDebug() << "Error: Failed to create message_archive table:" << query.lastError().text();
+        return false;
+    }
+
+    // 创建图片表（内容寻址的图片存储，每个 SHA-256 一行，ref_count 为引用该图片的消息条数）
+    QString createImagesTable = R"(
+        CREATE TABLE IF NOT EXISTS images (
+            hash TEXT PRIMARY KEY,
+            size INTEGER NOT NULL,
+            ref_count INTEGER NOT NULL DEFAULT 0,
+            created_at INTEGER NOT NULL
+        ) WITHOUT ROWID
+    )";
+    if (!query.exec(createImagesTable)) {
+        qDebug() << "Error: Failed to create images table:" << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool SchemaMigration::migrateToUserIds(QSqlDatabase &db) {
+    qDebug() << "数据库迁移：以昵称为键的表迁移为以用户 ID 为键";
+    if (!db.transaction()) {
+        qDebug() << "数据库迁移失败：无法开始事务" << db.lastError().text();
+        return false;
+    }
+
+    // 旧表的索引随表改名，先删除以免占用新索引的名字
+    QStringList steps;
+    steps << "DROP INDEX IF EXISTS idx_messages_conversation"
+          << "DROP INDEX IF EXISTS idx_messages_unkeyed"
+          << "DROP INDEX IF EXISTS idx_group_messages_group";
+    for (const char *table : LegacyTables) {
+        steps << QString("ALTER TABLE %1 RENAME TO legacy_%1").arg(table);
+    }
+    for (const QString &sql : steps) {
+        if (!exec(db, sql)) {
+            db.rollback();
+            return false;
+        }
+    }
+    if (!createTables(db)) {
+        db.rollback();
+        return false;
+    }
+
+    // 用户沿用旧表的 rowid 作为 ID；其余表按昵称换成 ID，引用不存在用户的行被丢弃
+    struct CopyStep {
+        const char *table;
+        const char *sql;
+    };
+    const CopyStep copies[] = {
+        {"users",
+         "INSERT INTO users (id, email, nickname, password, is_online, signature, avatar, gender, birthday, "
+         "location, phone, register_time, last_login_time, friend_count, group_count, reserved1, reserved2) "
+         "SELECT rowid, email, nickname, password, is_online, signature, avatar, gender, birthday, "
+         "location, phone, register_time, last_login_time, friend_count, group_count, reserved1, reserved2 "
+         "FROM legacy_users ORDER BY rowid"},
+        {"friends",
+         "INSERT OR IGNORE INTO friends (user_id, friend_id) "
+         "SELECT u.id, f.id FROM legacy_friends l "
+         "JOIN users u ON u.nickname = l.user_nickname JOIN users f ON f.nickname = l.friend_nickname"},
+        {"messages",
+         "INSERT INTO messages (id, from_id, to_id, content, timestamp, conversation_id) "
+         "SELECT l.id, f.id, t.id, l.content, l.timestamp, MIN(f.id, t.id) * 4294967296 + MAX(f.id, t.id) "
+         "FROM legacy_messages l "
+         "JOIN users f ON f.nickname = l.from_nickname JOIN users t ON t.nickname = l.to_nickname ORDER BY l.id"},
+        {"friend_requests",
+         "INSERT OR IGNORE INTO friend_requests (from_id, to_id, status, timestamp) "
+         "SELECT f.id, t.id, l.status, l.timestamp FROM legacy_friend_requests l "
+         "JOIN users f ON f.nickname = l.from_nickname JOIN users t ON t.nickname = l.to_nickname"},
+        {"groups",
+         "INSERT INTO groups (id, name, creator_id, create_time) "
+         "SELECT l.id, l.name, u.id, l.create_time FROM legacy_groups l "
+         "LEFT JOIN users u ON u.nickname = l.creator_nickname ORDER BY l.id"},
+        {"group_members",
+         "INSERT OR IGNORE INTO group_members (group_id, member_id, join_time) "
+         "SELECT l.group_id, u.id, l.join_time FROM legacy_group_members l "
+         "JOIN users u ON u.nickname = l.member_nickname"},
+        {"group_messages",
+         "INSERT INTO group_messages (id, group_id, from_id, content, timestamp) "
+         "SELECT l.id, l.group_id, u.id, l.content, l.timestamp FROM legacy_group_messages l "
+         "JOIN users u ON u.nickname = l.from_nickname ORDER BY l.id"},
+    };
+
+    QSqlQuery query(db);
+    for (const CopyStep &copy : copies) {
+        if (!query.exec(QString("SELECT COUNT(*) FROM legacy_%1").arg(copy.table)) || !query.next()) {
+            qDebug() << "数据库迁移失败:" << copy.table << query.lastError().text();
+            db.rollback();
+            return false;
+        }
+        qint64 legacyRows = query.value(0).toLongLong();
+        if (!query.exec(copy.sql)) {
+            qDebug() << "数据库迁移失败:" << copy.table << query.lastError().text();
+            db.rollback();
+            return false;
+        }
+        qint64 copied = query.numRowsAffected();
+        qDebug() << "数据库迁移：" << copy.table << "迁移" << copied << "行";
+        if (copied < legacyRows) {
+            qDebug() << "数据库迁移：" << copy.table << "跳过" << legacyRows - copied << "行重复或引用不存在用户的记录";
+        }
+    }
+
+    for (const char *table : LegacyTables) {
+        if (!exec(db, QString("DROP TABLE legacy_%1").arg(table))) {
+            db.rollback();
+            return false;
+        }
+    }
+
+    if (!db.commit()) {
+        qDebug() << "数据库迁移失败：提交事务失败" << db.lastError().text();
+        db.rollback();
+        return false;
+    }
+
+    // 回收旧表释放的页，数据库文件和索引随之缩小（只在迁移时执行一次）
+    if (!exec(db, "VACUUM")) {
+        qDebug() << "Warning: VACUUM after migration failed, free pages will be reused later";
+    }
+    qDebug() << "数据库迁移完成：已改用整数用户 ID";
+    return true;
+}
+
+bool SchemaMigration::upgrade(QSqlDatabase &db) {
+    // 旧版 users 表以 email 为主键，没有整数 ID
+    bool legacy = hasColumn(db, "users", "email") && !hasColumn(db, "users", "id");
+    if (legacy ? !migrateToUserIds(db) : !createTables(db)) {
+        return false;
+    }
+
+    // 没有会话内序号的旧消息（包括刚从旧表迁移过来的）在启动时分批编号，上次启动中断时继续编号剩下的行
+    if (legacy || !hasColumn(db, "messages", "seq") || numberingPending(db)) {
+        if (!numberMessages(db)) {
+            return false;
+        }
+    }
+
+    // 消息内容以类型化的列保存（content 列只保留给尚未回填的旧数据），旧表补充这些列
+    for (const char *table : MessageTables) {
+        if (hasColumn(db, table, "kind")) {
+            continue;
+        }
+        QStringList columns;
+        columns << "kind INTEGER" << "text TEXT" << "image_id TEXT" << "width INTEGER" << "height INTEGER";
+        for (const QString &column : columns) {
+            if (!exec(db, QString("ALTER TABLE %1 ADD COLUMN %2").arg(table, column))) {
+                return false;
+            }
+        }
+    }
+
+    // 历史记录按 (会话, 序号) 范围扫描，按序号顺序返回，代价与消息总数无关；写入时也用它取会话的最大序号，
+    // 取代原来的 (会话, id) 索引。会话键在编号时已全部补齐，不再需要查找未回填行的部分索引
+    // 内容列回填时按 id 查找未回填的行，部分索引只包含这些行，回填完成后为空
+    // 好友请求按接收者查询，群列表按成员查询，归档块按 (会话, 最大序号) 查找
+    return exec(db, "DROP INDEX IF EXISTS idx_messages_conversation")
+        && exec(db, "DROP INDEX IF EXISTS idx_messages_unkeyed")
+        && exec(db, "DROP INDEX IF EXISTS idx_group_messages_group")
+        && exec(db, "CREATE UNIQUE INDEX IF NOT EXISTS idx_messages_seq ON messages (conversation_id, seq)")
+        && exec(db, "CREATE INDEX IF NOT EXISTS idx_messages_untyped ON messages (id) WHERE kind IS NULL")
+        && exec(db, "CREATE INDEX IF NOT EXISTS idx_group_messages_untyped ON group_messages (id) WHERE kind IS NULL")
+        && exec(db, "CREATE UNIQUE INDEX IF NOT EXISTS idx_group_messages_seq ON group_messages (group_id, seq)")
+        && exec(db, "CREATE INDEX IF NOT EXISTS idx_friend_requests_to ON friend_requests (to_id)")
+        && exec(db, "CREATE INDEX IF NOT EXISTS idx_group_members_member ON group_members (member_id)")
+        && exec(db, "CREATE UNIQUE INDEX IF NOT EXISTS idx_message_archive ON message_archive (conversation_id, last_seq)");
+}
+
+bool SchemaMigration::numberMessages(QSqlDatabase &db) {
+    // 序号必须在服务开始写入之前分配完：新消息的序号接在会话的最大序号之后，
+    // 没有会话键和序号的旧消息不在 (会话, 序号) 索引中，新消息会拿到与它们重复的序号，因此不能交给写线程在线回填，
+    // 私聊消息的会话键也在这里一并补齐。
+    // 按 id 顺序分批编号，每批一个事务：每条消息的序号为会话中已编号消息的最大序号加上它在本批同一会话中的名次，
+    // 结果与整表一次编号相同（与原来的显示顺序一致），而每个事务只改写一批行。
+    // 未编号的行由部分索引记录，中断后下次启动从剩下的行继续，全部编号后删除该索引。
+    // 旧的 timestamp 为字符串：私聊是本地时间的 ISO 8601，群聊是 UTC（CURRENT_TIMESTAMP 格式）
+    const char *const privateKey = "MIN(IFNULL(from_id, 0), IFNULL(to_id, 0)) * 4294967296 + MAX(IFNULL(from_id, 0), IFNULL(to_id, 0))";
+    struct NumberStep {
+        const char *table;
+        const char *keyColumn;
+        QString conversation;
+        QString sentAt;
+        QString extraSet;
+    };
+    const NumberStep numberSteps[] = {
+        {"messages", "conversation_id", QString("IFNULL(conversation_id, %1)").arg(privateKey),
+         "CAST(strftime('%s', timestamp, 'utc') AS INTEGER) * 1000000",
+         QString(", conversation_id = IFNULL(conversation_id, %1)").arg(privateKey)},
+        {"group_messages", "group_id", "group_id",
+         "CAST(strftime('%s', timestamp) AS INTEGER) * 1000000", QString()},
+    };
+
+    // 补充列，建立记录编号进度的部分索引，以及取会话已编号最大序号用的 (会话, 序号) 索引
+    if (!db.transaction()) {
+        qDebug() << "消息编号失败：无法开始事务" << db.lastError().text();
+        return false;
+    }
+    QStringList columns;
+    columns << "seq INTEGER" << "sent_at INTEGER";
+    for (const NumberStep &step : numberSteps) {
+        QStringList steps;
+        for (const QString &column : columns) {
+            if (!hasColumn(db, step.table, column.section(' ', 0, 0))) {
+                steps << QString("ALTER TABLE %1 ADD COLUMN %2").arg(step.table, column);
+            }
+        }
+        steps << QString("CREATE INDEX IF NOT EXISTS idx_%1_unnumbered ON %1 (id) WHERE seq IS NULL").arg(step.table)
+              << QString("CREATE UNIQUE INDEX IF NOT EXISTS idx_%1_seq ON %1 (%2, seq)").arg(step.table, step.keyColumn);
+        for (const QString &sql : steps) {
+            if (!exec(db, sql)) {
+                db.rollback();
+                return false;
+            }
+        }
+    }
+    if (!db.commit()) {
+        qDebug() << "消息编号失败：提交事务失败" << db.lastError().text();
+        db.rollback();
+        return false;
+    }
+
+    // 每批的编号先算到带主键的临时表中，更新时按 id 查找
+    if (!exec(db, "DROP TABLE IF EXISTS temp.message_seq")
+        || !exec(db, "CREATE TEMP TABLE message_seq (id INTEGER PRIMARY KEY, seq INTEGER NOT NULL)")) {
+        return false;
+    }
+    for (const NumberStep &step : numberSteps) {
+        const QString numberBatch = QString(
+            "INSERT INTO temp.message_seq (id, seq) "
+            "SELECT id, IFNULL((SELECT MAX(seq) FROM %1 m WHERE m.%2 = b.conversation), 0) "
+            "+ ROW_NUMBER() OVER (PARTITION BY b.conversation ORDER BY b.id) "
+            "FROM (SELECT id, %3 AS conversation FROM %1 WHERE seq IS NULL ORDER BY id LIMIT %4) b")
+            .arg(step.table, step.keyColumn, step.conversation).arg(Config::MessageNumberBatchRows);
+        const QString updateBatch = QString(
+            "UPDATE %1 SET seq = (SELECT seq FROM temp.message_seq s WHERE s.id = %1.id), "
+            "sent_at = IFNULL(sent_at, IFNULL(%2, 0))%3 WHERE id IN (SELECT id FROM temp.message_seq)")
+            .arg(step.table, step.sentAt, step.extraSet);
+
+        qint64 numbered = 0;
+        while (true) {
+            if (!db.transaction()) {
+                qDebug() << "消息编号失败：无法开始事务" << db.lastError().text();
+                return false;
+            }
+            QSqlQuery query(db);
+            if (!exec(db, "DELETE FROM temp.message_seq")) {
+                db.rollback();
+                return false;
+            }
+            if (!query.exec(numberBatch)) {
+                qDebug() << "消息编号失败:" << step.table << query.lastError().text();
+                db.rollback();
+                return false;
+            }
+            qint64 rows = query.numRowsAffected();
+            // 最后一批（没有未编号的行）删除进度索引，编号完成
+            QString finish = rows > 0 ? updateBatch : QString("DROP INDEX idx_%1_unnumbered").arg(step.table);
+            if (!exec(db, finish)) {
+                db.rollback();
+                return false;
+            }
+            if (!db.commit()) {
+                qDebug() << "消息编号失败：提交事务失败" << db.lastError().text();
+                db.rollback();
+                return false;
+            }
+            if (rows <= 0) {
+                break;
+            }
+            numbered += rows;
+        }
+        qDebug() << "消息编号：" << step.table << "已为" << numbered << "条旧消息分配会话内序号和整数时间戳";
+    }
+    return exec(db, "DROP TABLE temp.message_seq");
+}
+
+bool SchemaMigration::numberingPending(QSqlDatabase &db) {
+    QSqlQuery query(db);
+    return !query.exec("SELECT 1 FROM sqlite_master WHERE type = 'index' "
+                       "AND name IN ('idx_messages_unnumbered', 'idx_group_messages_unnumbered')")
+        || query.next();
+}
+
+qint64 SchemaMigration::backfillMessageContent(DbConnection &conn, const QString &table, int batchRows) {
+    // 旧数据的 content 在这里解析一次，拆分到内容列后清空 content
+    QList<QPair<qint64, MessageContent>> rows;
+    {
+        QSqlQuery &select = conn.prepare(QString("SELECT id, content FROM %1 WHERE kind IS NULL ORDER BY id LIMIT ?").arg(table));
+        select.addBindValue(batchRows);
+        if (!select.exec()) {
+            qDebug() << "回填消息内容失败:" << select.lastError().text();
+            return -1;
+        }
+        while (select.next()) {
+            rows.append(qMakePair(select.value(0).toLongLong(), MessageContent::fromLegacy(select.value(1).toString())));
+        }
+        select.finish();
+    }
+
+    QSqlQuery &update = conn.prepare(QString("UPDATE %1 SET kind = ?, text = ?, image_id = ?, width = ?, height = ?, "
+                                             "content = NULL WHERE id = ?").arg(table));
+    for (const QPair<qint64, MessageContent> &row : rows) {
+        const QVariantList values = row.second.columnValues();
+        for (int i = 0; i < values.size(); ++i) {
+            update.bindValue(i, values[i]);
+        }
+        update.bindValue(int(values.size()), row.first);
+        if (!update.exec()) {
+            qDebug() << "回填消息内容失败:" << update.lastError().text();
+            return -1;
+        }
+    }
+    return rows.size();
+}
+
+bool SchemaMigration::contentBackfillPending(QSqlDatabase &db) {
+    for (const char *table : MessageTables) {
+        QSqlQuery query(db);
+        if (!query.exec(QString("SELECT 1 FROM %1 WHERE kind IS NULL LIMIT 1").arg(table)) || query.next()) {
+            return true;
+        }
+    }
+    return false;
+}
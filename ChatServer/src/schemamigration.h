@@ -0,0 +1,43 @@
+#ifndef SCHEMAMIGRATION_H
+#define SCHEMAMIGRATION_H
+
+#include <QSqlDatabase>
+#include <QString>
+
+class DbConnection;
+
+// 数据库结构迁移
+// upgrade() 在启动时执行：建表、把旧版以昵称为键的表迁移为以用户 ID 为键、为旧消息编号、补齐索引。
+// 以昵称为键的旧表只能通过重建去掉昵称列，在一个事务中完成，只会执行一次。
+// 消息序号必须在写入新消息之前分配，在启动时分批编号，每批一个事务，中断后下次启动继续。
+// 其余已有数据的搬迁（回填）由调用者分批提交给数据库写线程在线执行，不阻塞服务启动。
+class SchemaMigration {
+public:
+    // 执行结构变更
+    static bool upgrade(QSqlDatabase &db);
+
+    // 把一批旧消息的 content 字符串拆分到内容列（table 为 messages 或 group_messages），返回本批处理的行数
+    // 作为写操作在数据库写线程中执行
+    static qint64 backfillMessageContent(DbConnection &conn, const QString &table, int batchRows);
+
+    // 是否还有内容列未回填的消息
+    static bool contentBackfillPending(QSqlDatabase &db);
+
+private:
+    // 创建所有表（已存在的表不变）
+    static bool createTables(QSqlDatabase &db);
+
+    // 把以昵称为键的旧表迁移为以用户 ID 为键
+    static bool migrateToUserIds(QSqlDatabase &db);
+
+    // 为旧消息分配会话内序号（seq）、补齐私聊的会话键，并把字符串时间戳换算为纪元微秒（sent_at），每批一个事务
+    static bool numberMessages(QSqlDatabase &db);
+
+    // 上次启动的编号是否未完成（未编号行的部分索引还在）
+    static bool numberingPending(QSqlDatabase &db);
+
+    static bool hasColumn(QSqlDatabase &db, const QString &table, const QString &column);
+    static bool exec(QSqlDatabase &db, const QString &sql);
+};
+
+#endif // SCHEMAMIGRATION_H
@@ -0,0 +1,654 @@
+#include "segmentlogstore.h"
+#include "conversation.h"
+#include "threadpool.h"
+#include <QDebug>
+#include <QDeadlineTimer>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QtEndian>
+#include <algorithm>
+#include <limits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+// 记录格式（小端）：
+//   头部    magic(4) payload_length(4) crc32(4)
+//   负载    id(8) conversation(8) from(8) to(8) prev_pos(8) seq(8) sent_at(8)
+//           kind(1) width(4) height(4) text_length(4) image_id_length(2)
+//           text(UTF-8) image_id(UTF-8)
+// 内容以类型化的字段保存，读取时不需要解析 JSON；发送时间为纪元微秒。
+// 分段文件预分配后未写入的部分为 0，魔数为 0 即表示分段数据结束。
+static const quint32 RecordMagic = 0x3347534D;      // "MSG3"
+static const qint64 HeaderBytes = 12;
+static const qint64 FixedPayloadBytes = 71;
+// 位置的低 32 位是分段内偏移，分段不能超过 4GB
+static const qint64 MaxSegmentBytes = Q_INT64_C(0xFFFFFFFF);
+
+// CRC32（IEEE 802.3 多项式，与 zlib 的 crc32 相同）
+static quint32 crc32(const uchar *data, qint64 length) {
+    static const QVector<quint32> table = []() {
+        QVector<quint32> t(256);
+        for (quint32 i = 0; i < 256; ++i) {
+            quint32 c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[int(i)] = c;
+        }
+        return t;
+    }();
+
+    quint32 crc = 0xFFFFFFFFu;
+    for (qint64 i = 0; i < length; ++i) {
+        crc = table[int((crc ^ data[i]) & 0xFF)] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+SegmentLogStore::SegmentLogStore(QObject *parent)
+    : QThread(parent), m_segmentBytes(64 * 1024 * 1024), m_indexInterval(32), m_maxBatchRows(256),
+      m_batchWindowMs(2), m_nextId(1), m_stop(false), m_openOk(false), m_queueLength(0),
+      m_appendedRecords(0), m_appendedBytes(0), m_syncCount(0), m_failedRecords(0) {
+    m_lock.init();
+}
+
+SegmentLogStore::~SegmentLogStore() {
+    stop();
+    wait();
+
+    for (Segment *segment : std::as_const(m_segments)) {
+        closeSegment(*segment);
+        delete segment;
+    }
+    m_segments.clear();
+    m_lock.destroy();
+}
+
+bool SegmentLogStore::init(const QString &dirPath, qint64 segmentBytes, int indexInterval,
+                           int maxBatchRows, int batchWindowMs) {
+    if (isRunning()) {
+        return m_openOk;
+    }
+
+    m_dirPath = dirPath;
+    m_segmentBytes = qBound(qint64(HeaderBytes + FixedPayloadBytes), segmentBytes, MaxSegmentBytes);
+    m_indexInterval = qMax(1, indexInterval);
+    m_maxBatchRows = qMax(1, maxBatchRows);
+    m_batchWindowMs = qMax(0, batchWindowMs);
+    m_stop = false;
+
+    if (!QDir().mkpath(m_dirPath)) {
+        qDebug() << "无法创建消息日志目录:" << m_dirPath;
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    m_openOk = recover() && (!m_segments.isEmpty() || rollSegment(0));
+    if (!m_openOk) {
+        qDebug() << "Failed to open message log:" << m_dirPath;
+        return false;
+    }
+
+    qDebug() << "消息日志已打开：" << m_dirPath << "，分段" << m_segments.size() << "个，会话" << m_index.size()
+             << "个，下一条消息 id" << m_nextId << "，恢复耗时" << timer.elapsed() << "毫秒";
+    start();
+    return true;
+}
+
+void SegmentLogStore::stop() {
+    QMutexLocker locker(&m_mutex);
+    m_stop = true;
+    m_condition.wakeAll();
+}
+
+int SegmentLogStore::segmentCount() const {
+    ReadLocker locker(&m_lock);
+    return m_segments.size();
+}
+
+QFuture<SavedMessage> SegmentLogStore::saveChatMessage(qint64 fromId, qint64 toId,
+                                                       const MessageContent &content, qint64 sentAt,
+                                                       const InboxPayload &) {
+    return append(Conversation::privateKey(fromId, toId), fromId, toId, content, sentAt);
+}
+
+QFuture<SavedMessage> SegmentLogStore::saveGroupChatMessage(int groupId, qint64 fromId,
+                                                            const MessageContent &content, qint64 sentAt) {
+    return append(Conversation::groupKey(groupId), fromId, groupId, content, sentAt);
+}
+
+QFuture<SavedMessage> SegmentLogStore::append(qint64 conversation, qint64 fromId, qint64 toId,
+                                              const MessageContent &content, qint64 sentAt) {
+    std::unique_ptr<PendingAppend> pending(new PendingAppend);
+    pending->conversation = conversation;
+    pending->fromId = fromId;
+    pending->toId = toId;
+    pending->content = content;
+    pending->sentAt = sentAt;
+    pending->promise.start();
+    QFuture<SavedMessage> future = pending->promise.future();
+
+    QMutexLocker locker(&m_mutex);
+    if (!m_openOk || (m_stop && !isRunning())) {
+        // 日志未打开或写线程已退出，直接失败
+        locker.unlock();
+        pending->promise.addResult(SavedMessage());
+        pending->promise.finish();
+        return future;
+    }
+
+    m_queue.push_back(std::move(pending));
+    int length = int(m_queue.size());
+    m_queueLength.store(length, std::memory_order_relaxed);
+
+    // 只在写线程可能在等待第一条或批次已满时唤醒
+    if (length == 1 || length >= m_maxBatchRows) {
+        m_condition.wakeOne();
+    }
+    return future;
+}
+
+bool SegmentLogStore::openSegment(const QString &path, int sequence, qint64 minCapacity, Segment &segment) {
+    segment.sequence = sequence;
+    segment.fd = ::open(path.toLocal8Bit().constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (segment.fd < 0) {
+        qDebug() << "打开消息日志分段失败:" << path << strerror(errno);
+        return false;
+    }
+
+    struct stat st;
+    if (::fstat(segment.fd, &st) != 0) {
+        qDebug() << "读取消息日志分段大小失败:" << path << strerror(errno);
+        closeSegment(segment);
+        return false;
+    }
+
+    // 预分配到分段大小（稀疏文件，未写入的部分读出为 0）
+    segment.capacity = qMax(qint64(st.st_size), minCapacity);
+    if (segment.capacity > st.st_size && ::ftruncate(segment.fd, segment.capacity) != 0) {
+        qDebug() << "预分配消息日志分段失败:" << path << strerror(errno);
+        closeSegment(segment);
+        return false;
+    }
+    if (segment.capacity == 0) {
+        return true;    // 空文件（只可能是旧的中间分段），没有可读的记录
+    }
+
+    void *data = ::mmap(nullptr, size_t(segment.capacity), PROT_READ, MAP_SHARED, segment.fd, 0);
+    if (data == MAP_FAILED) {
+        qDebug() << "映射消息日志分段失败:" << path << strerror(errno);
+        closeSegment(segment);
+        return false;
+    }
+    segment.data = static_cast<uchar*>(data);
+    return true;
+}
+
+void SegmentLogStore::closeSegment(Segment &segment) {
+    if (segment.data) {
+        ::munmap(segment.data, size_t(segment.capacity));
+        segment.data = nullptr;
+    }
+    if (segment.fd >= 0) {
+        ::close(segment.fd);
+        segment.fd = -1;
+    }
+}
+
+bool SegmentLogStore::recover() {
+    QDir dir(m_dirPath);
+    QStringList files = dir.entryList(QStringList() << "seg_*.log", QDir::Files, QDir::Name);
+
+    for (int i = 0; i < files.size(); ++i) {
+        bool ok = false;
+        int sequence = files[i].mid(4, files[i].size() - 8).toInt(&ok);
+        if (!ok) {
+            qDebug() << "忽略无法识别的消息日志文件:" << files[i];
+            continue;
+        }
+
+        bool last = (i == files.size() - 1);
+        std::unique_ptr<Segment> segment(new Segment);
+        if (!openSegment(dir.filePath(files[i]), sequence, last ? m_segmentBytes : 0, *segment)) {
+            return false;
+        }
+
+        // 以其他魔数开头的分段是旧版本的记录格式（内容为 JSON 字符串或没有序号），不再支持
+        if (segment->data && segment->capacity >= 4) {
+            quint32 magic = qFromLittleEndian<quint32>(segment->data);
+            if (magic != 0 && magic != RecordMagic) {
+                qDebug() << "消息日志" << files[i] << "是不再支持的旧格式，请移走日志目录后重新启动";
+                closeSegment(*segment);
+                return false;
+            }
+        }
+
+        int segmentIndex = m_segments.size();
+        qint64 offset = 0;
+        qint64 recordBytes = 0;
+        Record record;
+        while (decodeRecord(*segment, offset, record, &recordBytes)) {
+            indexRecord(record.conversation, record.id, record.message.seq, makePos(segmentIndex, offset));
+            m_nextId = qMax(m_nextId, record.id + 1);
+            offset += recordBytes;
+        }
+        segment->size = offset;
+
+        // offset 处不是 0 说明有写了一半或损坏的记录
+        bool dirty = offset + 4 <= segment->capacity && qFromLittleEndian<quint32>(segment->data + offset) != 0;
+        if (dirty) {
+            if (last) {
+                // 崩溃时写了一半的批次：截断后重新扩展，丢弃的部分读出为 0，之后从这里继续写入
+                qDebug() << "消息日志" << files[i] << "在偏移" << offset << "处有不完整的记录，已截断";
+                qint64 capacity = segment->capacity;
+                ::munmap(segment->data, size_t(capacity));
+                segment->data = nullptr;
+                if (::ftruncate(segment->fd, offset) != 0 || ::ftruncate(segment->fd, capacity) != 0) {
+                    qDebug() << "截断消息日志失败:" << strerror(errno);
+                    closeSegment(*segment);
+                    return false;
+                }
+                void *data = ::mmap(nullptr, size_t(capacity), PROT_READ, MAP_SHARED, segment->fd, 0);
+                if (data == MAP_FAILED) {
+                    qDebug() << "映射消息日志分段失败:" << strerror(errno);
+                    segment->data = nullptr;
+                    closeSegment(*segment);
+                    return false;
+                }
+                segment->data = static_cast<uchar*>(data);
+            } else {
+                // 中间分段不会被继续写入，校验失败之后的记录无法使用
+                qDebug() << "Warning: 消息日志" << files[i] << "在偏移" << offset << "处校验失败，之后的记录已忽略";
+            }
+        }
+
+        m_segments.append(segment.release());
+    }
+    return true;
+}
+
+bool SegmentLogStore::rollSegment(qint64 minCapacity) {
+    int sequence = m_segments.isEmpty() ? 1 : m_segments.last()->sequence + 1;
+    QString path = QDir(m_dirPath).filePath(QString("seg_%1.log").arg(sequence, 8, 10, QChar('0')));
+
+    std::unique_ptr<Segment> segment(new Segment);
+    if (!openSegment(path, sequence, qMax(m_segmentBytes, minCapacity), *segment)) {
+        return false;
+    }
+
+    // 新文件的目录项也要落盘，否则崩溃后可能找不到已同步的分段
+    int dirFd = ::open(m_dirPath.toLocal8Bit().constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd >= 0) {
+        ::fsync(dirFd);
+        ::close(dirFd);
+    }
+
+    WriteLocker locker(&m_lock);
+    m_segments.append(segment.release());
+    return true;
+}
+
+QByteArray SegmentLogStore::encodeRecord(qint64 id, qint64 seq, const PendingAppend &append, qint64 prevPos) {
+    QByteArray text = append.content.text().toUtf8();
+    QByteArray imageId = append.content.imageId().toUtf8().left(0xFFFF);
+    qint64 payloadBytes = FixedPayloadBytes + text.size() + imageId.size();
+
+    QByteArray record(int(HeaderBytes + payloadBytes), Qt::Uninitialized);
+    uchar *p = reinterpret_cast<uchar*>(record.data());
+    uchar *payload = p + HeaderBytes;
+
+    uchar *q = payload;
+    qToLittleEndian<qint64>(id, q);                      q += 8;
+    qToLittleEndian<qint64>(append.conversation, q);     q += 8;
+    qToLittleEndian<qint64>(append.fromId, q);           q += 8;
+    qToLittleEndian<qint64>(append.toId, q);             q += 8;
+    qToLittleEndian<qint64>(prevPos, q);                 q += 8;
+    qToLittleEndian<qint64>(seq, q);                     q += 8;
+    qToLittleEndian<qint64>(append.sentAt, q);           q += 8;
+    *q = uchar(append.content.kind());                   q += 1;
+    qToLittleEndian<qint32>(append.content.width(), q);  q += 4;
+    qToLittleEndian<qint32>(append.content.height(), q); q += 4;
+    qToLittleEndian<quint32>(quint32(text.size()), q);      q += 4;
+    qToLittleEndian<quint16>(quint16(imageId.size()), q);   q += 2;
+    memcpy(q, text.constData(), size_t(text.size()));
+    q += text.size();
+    memcpy(q, imageId.constData(), size_t(imageId.size()));
+
+    qToLittleEndian<quint32>(RecordMagic, p);
+    qToLittleEndian<quint32>(quint32(payloadBytes), p + 4);
+    qToLittleEndian<quint32>(crc32(payload, payloadBytes), p + 8);
+    return record;
+}
+
+bool SegmentLogStore::decodeRecord(const Segment &segment, qint64 offset, Record &record, qint64 *recordBytes) const {
+    if (!segment.data || offset < 0 || offset + HeaderBytes > segment.capacity) {
+        return false;
+    }
+
+    const uchar *p = segment.data + offset;
+    if (qFromLittleEndian<quint32>(p) != RecordMagic) {
+        return false;
+    }
+    qint64 payloadBytes = qFromLittleEndian<quint32>(p + 4);
+    if (payloadBytes < FixedPayloadBytes || offset + HeaderBytes + payloadBytes > segment.capacity) {
+        return false;
+    }
+    const uchar *payload = p + HeaderBytes;
+    if (crc32(payload, payloadBytes) != qFromLittleEndian<quint32>(p + 8)) {
+        return false;
+    }
+
+    const uchar *q = payload;
+    record.id = qFromLittleEndian<qint64>(q);                   q += 8;
+    record.conversation = qFromLittleEndian<qint64>(q);         q += 8;
+    record.message.fromId = qFromLittleEndian<qint64>(q);       q += 8;
+    record.message.toId = qFromLittleEndian<qint64>(q);         q += 8;
+    record.prevPos = qFromLittleEndian<qint64>(q);              q += 8;
+    record.message.seq = qFromLittleEndian<qint64>(q);          q += 8;
+    record.message.sentAt = qFromLittleEndian<qint64>(q);       q += 8;
+    int kind = *q;                                              q += 1;
+    qint32 width = qFromLittleEndian<qint32>(q);                q += 4;
+    qint32 height = qFromLittleEndian<qint32>(q);               q += 4;
+    qint64 textBytes = qFromLittleEndian<quint32>(q);           q += 4;
+    qint64 imageIdBytes = qFromLittleEndian<quint16>(q);        q += 2;
+    if (FixedPayloadBytes + textBytes + imageIdBytes != payloadBytes) {
+        return false;
+    }
+    record.message.id = record.id;
+    const char *strings = reinterpret_cast<const char*>(q);
+    QString text = QString::fromUtf8(strings, int(textBytes));
+    strings += textBytes;
+    QString imageId = QString::fromUtf8(strings, int(imageIdBytes));
+    record.message.content = MessageContent::fromColumns(kind, text, imageId, width, height);
+
+    if (recordBytes) {
+        *recordBytes = HeaderBytes + payloadBytes;
+    }
+    return true;
+}
+
+bool SegmentLogStore::readRecord(qint64 pos, Record &record) const {
+    int segmentIndex = int(pos >> 32);
+    if (pos < 0 || segmentIndex >= m_segments.size()) {
+        return false;
+    }
+    if (!decodeRecord(*m_segments[segmentIndex], pos & MaxSegmentBytes, record, nullptr)) {
+        qDebug() << "消息日志记录校验失败，位置" << segmentIndex << ":" << (pos & MaxSegmentBytes);
+        return false;
+    }
+    return true;
+}
+
+void SegmentLogStore::indexRecord(qint64 conversation, qint64 id, qint64 seq, qint64 pos) {
+    ConversationIndex &index = m_index[conversation];
+    index.lastPos = pos;
+    index.lastId = id;
+    index.lastSeq = seq;
+    if (index.count % m_indexInterval == 0) {
+        index.sparse.append(SparseEntry{id, seq, pos});
+    }
+    ++index.count;
+}
+
+void SegmentLogStore::run() {
+    if (m_threadInitializer) {
+        m_threadInitializer();
+    }
+
+    while (true) {
+        AppendQueue batch;
+        {
+            QMutexLocker locker(&m_mutex);
+
+            // 等待第一条消息
+            while (!m_stop && m_queue.empty()) {
+                m_condition.wait(&m_mutex);
+            }
+            if (m_queue.empty()) {
+                break;  // 已停止且队列已清空
+            }
+
+            // 组提交：最多再等待一个窗口期，凑够一批再写入
+            QDeadlineTimer deadline(m_batchWindowMs);
+            while (!m_stop && int(m_queue.size()) < m_maxBatchRows && !deadline.hasExpired()) {
+                m_condition.wait(&m_mutex, deadline);
+            }
+
+            int count = qMin(int(m_queue.size()), m_maxBatchRows);
+            for (int i = 0; i < count; ++i) {
+                batch.push_back(std::move(m_queue.front()));
+                m_queue.pop_front();
+            }
+            m_queueLength.store(int(m_queue.size()), std::memory_order_relaxed);
+        }
+
+        appendBatch(batch);
+    }
+}
+
+bool SegmentLogStore::flushBuffer(Segment &segment, const QByteArray &buffer) {
+    if (buffer.isEmpty()) {
+        return true;
+    }
+
+    const char *data = buffer.constData();
+    qint64 remaining = buffer.size();
+    qint64 offset = segment.size;
+    while (remaining > 0) {
+        ssize_t written = ::pwrite(segment.fd, data, size_t(remaining), off_t(offset));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            qDebug() << "写入消息日志失败:" << strerror(errno);
+            return false;
+        }
+        data += written;
+        offset += written;
+        remaining -= written;
+    }
+
+    if (::fdatasync(segment.fd) != 0) {
+        qDebug() << "同步消息日志失败:" << strerror(errno);
+        return false;
+    }
+    m_syncCount.fetch_add(1, std::memory_order_relaxed);
+    m_appendedBytes.fetch_add(quint64(buffer.size()), std::memory_order_relaxed);
+    segment.size += buffer.size();
+    return true;
+}
+
+void SegmentLogStore::appendBatch(AppendQueue &batch) {
+    qint64 start = ThreadPool::nowNs();
+
+    QVector<BufferedRecord> durable;       // 已同步、可以发布的记录
+    QVector<BufferedRecord> buffered;      // 在缓冲区中等待写入的记录
+    QHash<qint64, qint64> batchLastPos;    // 本批中各会话最后一条记录的位置
+    QHash<qint64, qint64> batchLastSeq;    // 本批中各会话最后分配的序号
+    QByteArray buffer;
+    bool ok = true;
+
+    for (int i = 0; i < int(batch.size()) && ok; ++i) {
+        const PendingAppend &pending = *batch[i];
+
+        // 上一条记录可能在本批中，也可能已在索引中（索引只由本线程修改，读取不需要加锁）
+        auto last = batchLastPos.constFind(pending.conversation);
+        qint64 prevPos = last != batchLastPos.constEnd() ? last.value()
+                                                         : m_index.value(pending.conversation).lastPos;
+        // 序号接在会话的最后一个序号之后；写入失败的记录不会进入索引，序号之后会被重新分配，保持连续
+        qint64 seq = batchLastSeq.value(pending.conversation, m_index.value(pending.conversation).lastSeq) + 1;
+        qint64 id = m_nextId;
+        QByteArray record = encodeRecord(id, seq, pending, prevPos);
+
+        Segment *segment = m_segments.last();
+        if (segment->size + buffer.size() + record.size() > segment->capacity) {
+            // 当前分段写满：先写入并同步缓冲区，再切换到新分段
+            ok = flushBuffer(*segment, buffer);
+            if (ok) {
+                durable += buffered;
+                ok = rollSegment(record.size());
+            }
+            buffered.clear();
+            buffer.clear();
+            if (!ok) {
+                break;
+            }
+            segment = m_segments.last();
+        }
+
+        qint64 pos = makePos(m_segments.size() - 1, segment->size + buffer.size());
+        buffer.append(record);
+        buffered.append(BufferedRecord{i, pending.conversation, id, seq, pos});
+        batchLastPos.insert(pending.conversation, pos);
+        batchLastSeq.insert(pending.conversation, seq);
+        ++m_nextId;
+    }
+
+    if (ok && flushBuffer(*m_segments.last(), buffer)) {
+        durable += buffered;
+    }
+
+    // 同步完成后才更新索引，读取历史只会看到已落盘的记录
+    {
+        WriteLocker locker(&m_lock);
+        for (const BufferedRecord &record : std::as_const(durable)) {
+            indexRecord(record.conversation, record.id, record.seq, record.pos);
+        }
+    }
+
+    QVector<SavedMessage> results(int(batch.size()));
+    for (const BufferedRecord &record : std::as_const(durable)) {
+        results[record.batchIndex].id = record.id;
+        results[record.batchIndex].seq = record.seq;
+    }
+    int failed = 0;
+    for (int i = 0; i < int(batch.size()); ++i) {
+        if (results[i].id < 0) {
+            ++failed;
+        }
+        batch[i]->promise.addResult(results[i]);
+        batch[i]->promise.finish();
+    }
+
+    m_appendLatency.record(quint64(ThreadPool::nowNs() - start));
+    m_appendedRecords.fetch_add(quint64(durable.size()), std::memory_order_relaxed);
+    m_failedRecords.fetch_add(quint64(failed), std::memory_order_relaxed);
+}
+
+void SegmentLogStore::walkBackward(qint64 pos, bool bySeq, qint64 lower, qint64 upper, int maxCount,
+                                   QList<StoredMessage> &rows) const {
+    Record record;
+    while (pos >= 0 && rows.size() < maxCount) {
+        if (!readRecord(pos, record)) {
+            break;
+        }
+        qint64 key = bySeq ? record.message.seq : record.id;
+        if (key <= lower) {
+            break;
+        }
+        if (key < upper) {
+            rows.append(record.message);
+        }
+        pos = record.prevPos;
+    }
+}
+
+QList<StoredMessage> SegmentLogStore::readHistory(qint64 conversation, const HistoryPage &page, bool &hasMore) const {
+    qint64 start = ThreadPool::nowNs();
+    QList<StoredMessage> rows;
+    hasMore = false;
+
+    ReadLocker locker(&m_lock);
+    auto it = m_index.constFind(conversation);
+    if (it == m_index.constEnd()) {
+        return rows;
+    }
+    const ConversationIndex &index = it.value();
+    const QVector<SparseEntry> &sparse = index.sparse;
+    int want = page.fetchLimit();
+    qint64 anchor = page.anchor();
+    bool bySeq = page.anchorIsSeq();
+
+    // 游标按序号或消息 id 比较，同一会话中两者的顺序相同
+    auto keyOf = [bySeq](const SparseEntry &e) { return bySeq ? e.seq : e.id; };
+    // 第一个键不小于 / 大于 anchor 的索引点
+    auto firstAtLeast = [&sparse, &keyOf](qint64 key) {
+        return int(std::lower_bound(sparse.begin(), sparse.end(), key,
+                                    [&keyOf](const SparseEntry &e, qint64 v) { return keyOf(e) < v; }) - sparse.begin());
+    };
+
+    switch (page.direction()) {
+    case HistoryPage::Latest:
+        walkBackward(index.lastPos, bySeq, 0, std::numeric_limits<qint64>::max(), want, rows);
+        break;
+    case HistoryPage::Before: {
+        // 从 anchor 之后最近的索引点出发，跳过不超过 indexInterval 条记录
+        int j = firstAtLeast(anchor);
+        qint64 startPos = j < sparse.size() ? sparse[j].pos : index.lastPos;
+        walkBackward(startPos, bySeq, 0, anchor, want, rows);
+        break;
+    }
+    case HistoryPage::After: {
+        // 链表只能向前走：按索引点分段，每段从段尾向前读到上一段的末尾，再翻转为升序
+        qint64 lower = anchor;
+        for (int j = firstAtLeast(anchor + 1); rows.size() < want; ++j) {
+            bool tail = j >= sparse.size();
+            qint64 endPos = tail ? index.lastPos : sparse[j].pos;
+            qint64 endKey = tail ? (bySeq ? index.lastSeq : index.lastId) : keyOf(sparse[j]);
+
+            QList<StoredMessage> chunk;
+            walkBackward(endPos, bySeq, lower, std::numeric_limits<qint64>::max(), std::numeric_limits<int>::max(), chunk);
+            std::reverse(chunk.begin(), chunk.end());
+            rows += chunk;
+
+            if (tail) {
+                break;
+            }
+            lower = endKey;
+        }
+        break;
+    }
+    }
+    locker.unlock();
+
+    page.finish(rows, hasMore);
+    m_readLatency.record(quint64(ThreadPool::nowNs() - start));
+    return rows;
+}
+
+QList<StoredMessage> SegmentLogStore::getChatHistory(qint64 userId1, qint64 userId2,
+                                                     const HistoryPage &page, bool &hasMore) {
+    return readHistory(Conversation::privateKey(userId1, userId2), page, hasMore);
+}
+
+QList<StoredMessage> SegmentLogStore::getGroupChatHistory(int groupId, const HistoryPage &page, bool &hasMore) {
+    return readHistory(Conversation::groupKey(groupId), page, hasMore);
+}
+
+QString SegmentLogStore::statsReport() const {
+    int segments = 0;
+    int conversations = 0;
+    {
+        ReadLocker locker(&m_lock);
+        segments = m_segments.size();
+        conversations = m_index.size();
+    }
+    return QString("[message_store] engine=segmentlog records=%1 bytes=%2 syncs=%3 failed=%4 queue=%5 "
+                   "segments=%6 conversations=%7\n"
+                   "  append_latency: %8\n"
+                   "  read_latency: %9")
+        .arg(appendedRecords())
+        .arg(m_appendedBytes.load(std::memory_order_relaxed))
+        .arg(syncCount())
+        .arg(m_failedRecords.load(std::memory_order_relaxed))
+        .arg(m_queueLength.load(std::memory_order_relaxed))
+        .arg(segments)
+        .arg(conversations)
+        .arg(m_appendLatency.snapshot().toString())
+        .arg(m_readLatency.snapshot().toString());
+}
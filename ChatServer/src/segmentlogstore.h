@@ -0,0 +1,179 @@
+#ifndef SEGMENTLOGSTORE_H
+#define SEGMENTLOGSTORE_H
+
+#include <QThread>
+#include <QHash>
+#include <QMutex>
+#include <QPromise>
+#include <QVector>
+#include <QWaitCondition>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include "messagestore.h"
+#include "readwritelock.h"
+#include "latencyhistogram.h"
+
+// 分段日志消息存储
+// 消息按到达顺序追加到分段文件（seg_00000001.log ...），每个分段预分配固定大小，写满后切换到新分段。
+// 每条记录带 CRC32 校验，并保存同一会话上一条记录的位置，同一会话的记录组成一条向前的链表。
+// 每条记录带会话内序号（写线程按会话的最后一个序号加一分配）。
+// 内存中为每个会话保存最后一条记录的位置，以及每隔 indexInterval 条记录一个的稀疏索引，
+// 读取历史时从最近的索引点沿链表向前走，每页最多多走 indexInterval 条。
+// 分段文件以只读方式内存映射，读取历史直接访问映射，不需要系统调用。
+// 写入由专用写线程组提交：一批记录一次写入、一次 fdatasync，同步完成后才更新索引并完成 future。
+// 启动时扫描所有分段重建索引，遇到校验失败的记录即认为是崩溃时写了一半，从该处截断。
+class SegmentLogStore : public QThread, public MessageStore {
+    Q_OBJECT
+public:
+    explicit SegmentLogStore(QObject *parent = nullptr);
+    ~SegmentLogStore();
+
+    // 设置写线程启动时执行的初始化函数（绑定 CPU 等），必须在 init() 之前调用
+    void setThreadInitializer(const std::function<void()> &initializer) { m_threadInitializer = initializer; }
+
+    // 打开日志目录：恢复已有分段、重建索引并启动写线程
+    bool init(const QString &dirPath, qint64 segmentBytes, int indexInterval,
+              int maxBatchRows, int batchWindowMs);
+
+    // 停止写线程（队列中剩余的消息会先写入）
+    void stop();
+
+    // 日志不在 SQLite 中，不能与离线收件箱一起提交，忽略 inbox（queuedOffline 为 false），由调用者另行放入收件箱
+    QFuture<SavedMessage> saveChatMessage(qint64 fromId, qint64 toId,
+                                          const MessageContent &content, qint64 sentAt,
+                                          const InboxPayload &inbox = InboxPayload()) override;
+    QFuture<SavedMessage> saveGroupChatMessage(int groupId, qint64 fromId,
+                                               const MessageContent &content, qint64 sentAt) override;
+    QList<StoredMessage> getChatHistory(qint64 userId1, qint64 userId2,
+                                        const HistoryPage &page, bool &hasMore) override;
+    QList<StoredMessage> getGroupChatHistory(int groupId, const HistoryPage &page, bool &hasMore) override;
+
+    QString engineName() const override { return "segmentlog"; }
+    QString statsReport() const override;
+
+    // 统计
+    quint64 appendedRecords() const { return m_appendedRecords.load(std::memory_order_relaxed); }
+    quint64 syncCount() const { return m_syncCount.load(std::memory_order_relaxed); }
+    int segmentCount() const;
+
+protected:
+    void run() override;
+
+private:
+    // 一个分段文件及其只读映射
+    struct Segment {
+        int sequence = 0;
+        int fd = -1;
+        uchar *data = nullptr;
+        qint64 capacity = 0;    // 预分配的文件大小（映射大小）
+        qint64 size = 0;        // 已写入的有效数据长度（只由写线程访问）
+    };
+
+    // 稀疏索引点：会话中某条记录的 id、序号和位置
+    struct SparseEntry {
+        qint64 id;
+        qint64 seq;
+        qint64 pos;
+    };
+
+    // 一个会话的索引
+    struct ConversationIndex {
+        qint64 lastPos = -1;    // 最后一条记录的位置，-1 表示没有记录
+        qint64 lastId = 0;
+        qint64 lastSeq = 0;
+        qint64 count = 0;
+        QVector<SparseEntry> sparse;    // 按 id（也即序号）升序
+    };
+
+    // 解码后的记录
+    struct Record {
+        qint64 id = 0;
+        qint64 conversation = 0;
+        qint64 prevPos = -1;
+        StoredMessage message;
+    };
+
+    struct PendingAppend {
+        qint64 conversation;
+        qint64 fromId;
+        qint64 toId;
+        MessageContent content;
+        qint64 sentAt;
+        QPromise<SavedMessage> promise;
+    };
+    typedef std::deque<std::unique_ptr<PendingAppend>> AppendQueue;
+
+    // 已写入缓冲区、等待同步的记录
+    struct BufferedRecord {
+        int batchIndex;
+        qint64 conversation;
+        qint64 id;
+        qint64 seq;
+        qint64 pos;
+    };
+
+    // 位置编码：高 32 位为分段下标，低 32 位为分段内偏移
+    static qint64 makePos(int segment, qint64 offset) { return (qint64(segment) << 32) | offset; }
+
+    QFuture<SavedMessage> append(qint64 conversation, qint64 fromId, qint64 toId,
+                                 const MessageContent &content, qint64 sentAt);
+
+    // 启动时扫描所有分段，重建索引并截断末尾不完整的记录
+    bool recover();
+    bool openSegment(const QString &path, int sequence, qint64 minCapacity, Segment &segment);
+    void closeSegment(Segment &segment);
+
+    // 创建新分段并设为当前写入分段（只在写线程或初始化时调用）
+    bool rollSegment(qint64 minCapacity);
+
+    // 写入并同步一批记录
+    void appendBatch(AppendQueue &batch);
+    bool flushBuffer(Segment &segment, const QByteArray &buffer);
+
+    // 编码 / 解码一条记录，解码时校验魔数、长度和 CRC
+    static QByteArray encodeRecord(qint64 id, qint64 seq, const PendingAppend &append, qint64 prevPos);
+    bool decodeRecord(const Segment &segment, qint64 offset, Record &record, qint64 *recordBytes) const;
+    bool readRecord(qint64 pos, Record &record) const;
+
+    // 索引中加入一条记录（调用者持有写锁，或在启动恢复时调用）
+    void indexRecord(qint64 conversation, qint64 id, qint64 seq, qint64 pos);
+
+    // 从 pos 开始沿链表向前，收集 lower < 键 < upper 的记录（按键降序），最多 maxCount 条
+    // 键为序号（bySeq）或消息 id，同一会话中两者的顺序相同
+    void walkBackward(qint64 pos, bool bySeq, qint64 lower, qint64 upper, int maxCount,
+                      QList<StoredMessage> &rows) const;
+
+    // 读取会话的一页历史
+    QList<StoredMessage> readHistory(qint64 conversation, const HistoryPage &page, bool &hasMore) const;
+
+    QString m_dirPath;
+    qint64 m_segmentBytes;
+    int m_indexInterval;
+    int m_maxBatchRows;
+    int m_batchWindowMs;
+    std::function<void()> m_threadInitializer;
+
+    // 分段列表和会话索引，读取历史时持有读锁，写线程更新时持有写锁
+    mutable ReadWriteLock m_lock;
+    QVector<Segment*> m_segments;
+    QHash<qint64, ConversationIndex> m_index;
+    qint64 m_nextId;    // 只由写线程访问
+
+    QMutex m_mutex;
+    QWaitCondition m_condition;
+    AppendQueue m_queue;
+    bool m_stop;
+    bool m_openOk;
+
+    std::atomic<int> m_queueLength;
+    std::atomic<quint64> m_appendedRecords;
+    std::atomic<quint64> m_appendedBytes;
+    std::atomic<quint64> m_syncCount;
+    std::atomic<quint64> m_failedRecords;
+    LatencyHistogram m_appendLatency;   // 从开始写入一批到同步完成的时间
+    mutable LatencyHistogram m_readLatency;     // 读取一页历史的时间
+};
+
+#endif // SEGMENTLOGSTORE_H
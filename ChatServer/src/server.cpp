@@ -7,15 +7,65 @@
 #include <QSqlError>
 #include <QCryptographicHash>
 #include <QDir>
+#include <QSaveFile>
 #include "../Common/config.h"
+#include "conversation.h"
+#include "messagetime.h"
 #include <QThread>
 
-Server::Server(QObject *parent) : QObject(parent) {
-    // 初始化线程池
+// 转发给接收者的私聊消息，与历史记录中的格式相同
+static QJsonObject privateMessageJson(qint64 id, const QString &from, const QString &to, const QString &content,
+                                      qint64 sentAt, qint64 seq) {
+    QJsonObject message;
+    message["id"] = id;
+    message["from"] = from;
+    message["to"] = to;
+    message["content"] = content;
+    MessageTime::write(message, sentAt, seq);
+    return message;
+}
+
+Server::Server(CpuPlacement::Layout cpuLayout, MessageStore::Engine storeEngine, int archiveAfterDays, QObject *parent)
+    : QObject(parent), m_archiveAfterDays(archiveAfterDays) {
+    // 读取CPU拓扑，按启动参数绑定I/O线程和各线程池的工作线程
+    CpuTopology topology;
+    topology.load();
+    CpuPlacement placement(topology, cpuLayout);
+    qDebug() << "CPU拓扑：" << topology.describe() << "，线程放置策略：" << CpuPlacement::layoutName(cpuLayout);
+    placement.pinIoThread();
+
+    // 初始化线程池（工作线程分布在所有节点上）
     m_threadPool = new ThreadPool(this);
+    m_threadPool->setName("handler");
+    placement.placePool(m_threadPool, QThread::idealThreadCount(), CpuPlacement::SpreadNodes);
     m_threadPool->init(QThread::idealThreadCount());
+    m_requestTaskClass = m_threadPool->registerTaskClass("request");
     qDebug() << "线程池已初始化，线程数：" << m_threadPool->size();
 
+    // 初始化数据库执行器和文件 I/O 执行器，处理协程在这里等待数据库和文件操作
+    // 两者与I/O线程放在同一节点，SQLite页缓存和socket缓冲区不跨节点访问
+    m_dbPool = new ThreadPool(this);
+    m_dbPool->setName("db");
+    placement.placePool(m_dbPool, Config::DbExecutorThreads, placement.homeNode());
+    m_dbPool->init(Config::DbExecutorThreads);
+    m_ioPool = new ThreadPool(this);
+    m_ioPool->setName("io");
+    placement.placePool(m_ioPool, Config::IoExecutorThreads, placement.homeNode());
+    m_ioPool->init(Config::IoExecutorThreads);
+
+    // 图片处理执行器：缩放图片是计算密集的任务，线程分布在所有节点上
+    m_imagePool = new ThreadPool(this);
+    m_imagePool->setName("image");
+    placement.placePool(m_imagePool, Config::ImageExecutorThreads, CpuPlacement::SpreadNodes);
+    m_imagePool->init(Config::ImageExecutorThreads);
+
+    // 定时输出线程池统计（排队等待、执行时间、工作线程利用率）
+    m_statsTimer = new QTimer(this);
+    connect(m_statsTimer, &QTimer::timeout, this, &Server::reportStats);
+    if (Config::StatsReportIntervalMs > 0) {
+        m_statsTimer->start(Config::StatsReportIntervalMs);
+    }
+
     // 初始化数据库访问信号量
     m_dbSemaphore = new Semaphore(this);
     m_dbSemaphore->create("db_semaphore", 1);
@@ -34,6 +84,15 @@ Server::Server(QObject *parent) : QObject(parent) {
     m_sharedMemory = new SharedMemory(this);
     m_sharedMemory->create("/tmp/chat_server", 1024 * 1024); // 1MB
 
+    // 初始化在线会话注册表
+    m_sessions = new SessionRegistry(this);
+
+    // 初始化出站消息队列（在主线程中创建，由主线程事件循环负责写socket）
+    m_outboundQueue = new OutboundQueue(this);
+    if (!m_outboundQueue->init()) {
+        qDebug() << "Failed to initialize outbound queue";
+    }
+
     // 初始化进程管理器
     m_processManager = new ProcessManager(this);
 
@@ -43,6 +102,8 @@ Server::Server(QObject *parent) : QObject(parent) {
     // 初始化图片存储路径
     m_imageStoragePath = QCoreApplication::applicationDirPath() + "/../chat_images/";
     QDir().mkpath(m_imageStoragePath);
+    m_imageStore = new ImageStore(m_imageStoragePath);
+    m_blobCache = new BlobCache(Config::BlobCacheBytes, Config::BlobCacheShards, Config::BlobCacheAdmission, this);
     qDebug() << "图片存储路径：" << m_imageStoragePath;
 
     // 初始化TCP服务器
@@ -50,16 +111,104 @@ Server::Server(QObject *parent) : QObject(parent) {
     connect(tcpServer, &QTcpServer::newConnection, this, &Server::handleNewConnection);
 
     // 初始化数据库
+    m_userIds = new UserIdTable(this);
+    m_userDirectory = new UserDirectory(this);
+    m_userDirectory->setMergeExecutor(m_threadPool);
+    m_avatars = new AvatarTable(this);
     if (!initDatabase()) {
         qDebug() << "Failed to initialize database";
         QCoreApplication::quit();
     }
+
+    // 加载昵称与用户 ID 的映射（需在建表和迁移之后）
+    if (!m_userIds->load(db)) {
+        qDebug() << "Failed to load user ids";
+        QCoreApplication::quit();
+    }
+    if (!m_userDirectory->load(db)) {
+        qDebug() << "Failed to load user directory";
+        QCoreApplication::quit();
+    }
+    if (!m_avatars->load(db)) {
+        qDebug() << "Failed to load avatar versions";
+        QCoreApplication::quit();
+    }
+
+    // 初始化数据库写线程和读连接池（需在建表之后启动）
+    QString dbPath = QCoreApplication::applicationDirPath() + "/../users.db";
+    // 写线程由已绑定的I/O线程创建，按放置策略重新绑定到主节点，不与I/O线程争用同一CPU
+    m_dbWriter = new DbWriter(this);
+    m_dbWriter->setThreadInitializer(placement.threadInitializer("db_writer", placement.homeNode()));
+    if (!m_dbWriter->init(dbPath, Config::DbWriterBatchRows, Config::DbWriterBatchWindowMs)) {
+        qDebug() << "Failed to initialize database writer";
+        QCoreApplication::quit();
+    }
+    m_dbConnections = new DbConnectionPool(this);
+    m_dbConnections->init(dbPath, Config::DbReadConnections, Config::DbConnectionWaitMs);
+
+    // 群成员缓存，在线成员由会话注册表的登录 / 登出回调维护
+    m_groupMembers = new GroupMembership(m_sessions, m_userIds, this);
+    m_sessions->setListener(m_groupMembers);
+
+    // 并行加载好友关系图，加载线程可在所有节点的CPU上运行
+    m_friendGraph = new FriendGraph(this);
+    if (!m_friendGraph->load(dbPath, Config::DbExecutorThreads,
+                             placement.threadInitializer("friend_graph", CpuPlacement::SpreadNodes))) {
+        qDebug() << "Failed to load friend graph";
+        QCoreApplication::quit();
+    }
+
+    // 初始化消息存储（默认使用 SQLite，可选分段日志）
+    if (storeEngine == MessageStore::SegmentLog) {
+        SegmentLogStore *log = new SegmentLogStore();
+        log->setThreadInitializer(placement.threadInitializer("message_log", placement.homeNode()));
+        QString logPath = QCoreApplication::applicationDirPath() + "/../message_log";
+        if (!log->init(logPath, Config::MessageLogSegmentBytes, Config::MessageLogIndexInterval,
+                       Config::DbWriterBatchRows, Config::DbWriterBatchWindowMs)) {
+            qDebug() << "Failed to open message log";
+            QCoreApplication::quit();
+        }
+        m_messageStore = log;
+    } else {
+        // 旧消息的会话键已在启动迁移中与序号一起补齐
+        m_messageStore = new SqliteMessageStore(m_dbWriter, m_dbConnections);
+        // 旧消息的 content 字符串在后台分批拆分到内容列，完成前读取时兼容未拆分的行
+        if (SchemaMigration::contentBackfillPending(db)) {
+            backfillMessageContent();
+        }
+        // 已有消息的全文索引在后台分批补建，完成前搜索结果只包含已索引的消息
+        if (m_searchEnabled && MessageSearch::backfillPending(db)) {
+            backfillSearchIndex();
+        }
+        // 过期的消息定时移入冷消息归档，热表只保留近期的消息
+        if (m_archiveAfterDays > 0) {
+            m_archiveTimer = new QTimer(this);
+            connect(m_archiveTimer, &QTimer::timeout, this, [this]() { archiveMessages(); });
+            m_archiveTimer->start(Config::ArchiveIntervalMs);
+            archiveMessages();
+        }
+    }
+    qDebug() << "消息存储引擎：" << m_messageStore->engineName();
+
+    // 热点会话缓存（最近访问的会话的最后 N 条消息）
+    m_historyCache = new HistoryCache(Config::HistoryCacheBytes, Config::HistoryCacheMessages, this);
 }
 
 Server::~Server() {
+    // 关闭消息存储（分段日志先写完队列中的消息）
+    delete m_messageStore;
+
+    // 停止数据库写线程（队列中的写操作先提交）
+    m_dbWriter->stop();
+    m_dbWriter->wait();
+
     // 关闭数据库
     db.close();
 
+    // 等待正在生成的图片版本完成后再释放图片存储
+    m_imagePool->waitForDone();
+    delete m_imageStore;
+
     // 终止所有子进程
     m_processManager->terminateAllChildProcesses();
 
@@ -89,14 +238,8 @@ void Server::handleNewConnection() {
     QTcpSocket *clientSocket = tcpServer->nextPendingConnection();
     qDebug() << "New client connected from" << clientSocket->peerAddress().toString() << ":" << clientSocket->peerPort();
 
-    // 使用互斥锁保护clients列表
-    {
-        QMutexLocker locker(&m_clientsMutex);
-        ClientInfo clientInfo;
-        clientInfo.socket = clientSocket;
-        clientInfo.isLoggedIn = false;
-        clients.append(clientInfo);
-    }
+    // 注册会话
+    m_sessions->add(clientSocket);
 
     connect(clientSocket, &QTcpSocket::readyRead, this, &Server::handleClientData);
     connect(clientSocket, &QTcpSocket::disconnected, this, &Server::handleClientDisconnection);
@@ -120,161 +263,68 @@ void Server::handleClientData() {
     QTcpSocket *clientSocket = qobject_cast<QTcpSocket*>(sender());
     if (!clientSocket) return;
 
-    // 读取所有可用数据
-    QByteArray data = clientSocket->readAll();
+    SessionPtr session = m_sessions->findBySocket(clientSocket);
+    if (!session) return;
 
-    // 检查数据是否完整
-    if (data.isEmpty()) {
-        qDebug() << "收到空数据包";
-        return;
-    }
-
-    // 尝试解析JSON
-    QJsonParseError parseError;
-    QJsonDocument doc = QJsonDocument::fromJson(data, &parseError);
-
-    if (parseError.error != QJsonParseError::NoError) {
-        qDebug() << "JSON解析错误:" << parseError.errorString() << "，位置:" << parseError.offset;
-        qDebug() << "数据大小:" << data.size() << "字节";
-
-        // 尝试查找消息类型，特别处理分块图片上传
-        if (data.contains("\"type\":30") || data.contains("\"type\": 30")) {
-            // 这可能是一个ChunkedImageChunk消息
-            // 尝试提取tempId和chunk_index
-            int tempIdPos = data.indexOf("\"temp_id\"");
-            int chunkIndexPos = data.indexOf("\"chunk_index\"");
-            int chunkDataPos = data.indexOf("\"chunk_data\"");
-
-            if (tempIdPos > 0 && chunkIndexPos > 0 && chunkDataPos > 0) {
-                // 尝试提取tempId
-                int tempIdStart = data.indexOf("\"", tempIdPos + 10) + 1;
-                int tempIdEnd = data.indexOf("\"", tempIdStart);
-                QString tempId = QString::fromUtf8(data.mid(tempIdStart, tempIdEnd - tempIdStart));
-
-                // 尝试提取chunk_index
-                int chunkIndexStart = chunkIndexPos + 14;
-                int chunkIndexEnd = data.indexOf(",", chunkIndexStart);
-                if (chunkIndexEnd < 0) chunkIndexEnd = data.indexOf("}", chunkIndexStart);
-                QString chunkIndexStr = QString::fromUtf8(data.mid(chunkIndexStart, chunkIndexEnd - chunkIndexStart));
-                int chunkIndex = chunkIndexStr.trimmed().toInt();
-
-                // 尝试提取chunk_data (Base64)
-                int chunkDataStart = data.indexOf("\"", chunkDataPos + 13) + 1;
-                int chunkDataEnd = data.lastIndexOf("\"");
-                QByteArray chunkDataBase64 = data.mid(chunkDataStart, chunkDataEnd - chunkDataStart);
-
-                // 解码Base64数据
-                QByteArray chunkData = QByteArray::fromBase64(chunkDataBase64);
-
-                // 检查是否存在对应的分块上传记录
-                if (m_pendingChunkedImages.contains(tempId)) {
-                    // 获取分块上传记录
-                    ChunkedImageData &chunkedData = m_pendingChunkedImages[tempId];
-
-                    // 添加到图片数据中
-                    chunkedData.imageData.append(chunkData);
-                    chunkedData.receivedChunks++;
-
-                    qDebug() << "手动解析接收到图片数据块:" << chunkIndex + 1 << "/" << chunkedData.totalChunks
-                             << "，大小:" << chunkData.size() << "字节";
-
-                    return;
-                }
-            }
-        }
+    // 一次读取可能包含多条消息或半条消息（如分块图片），交给会话的分帧器切分
+    MessageFramer &framer = session->framer();
+    framer.append(clientSocket->readAll());
 
-        // 如果数据太大，可能需要分片处理
-        if (data.size() > 1024 * 1024) { // 大于1MB的数据
-            qDebug() << "数据过大，可能需要分片处理";
-        }
-        return;
+    // 使用线程池处理每条完整的客户端请求
+    QByteArray data;
+    while (framer.next(data)) {
+        m_threadPool->addTask([this, clientSocket, data]() {
+            this->processClientData(clientSocket, data);
+        }, m_requestTaskClass);
     }
+}
 
-    // 使用线程池处理客户端请求
-    m_threadPool->addTask([this, clientSocket, data]() {
-        this->processClientData(clientSocket, data);
-    });
+void Server::reportStats() {
+    // 协程恢复执行计入 handler 线程池的 default 类别
+    qInfo().noquote() << "线程池统计：\n" + m_threadPool->statsReport()
+                         + "\n" + m_dbPool->statsReport()
+                         + "\n" + m_ioPool->statsReport()
+                         + "\n" + m_imagePool->statsReport()
+                         + "\n" + m_dbWriter->statsReport()
+                         + "\n" + m_messageStore->statsReport()
+                         + "\n" + m_historyCache->statsReport()
+                         + "\n" + m_blobCache->statsReport()
+                         + "\n" + m_groupMembers->statsReport();
+    qInfo() << "在线会话：" << m_sessions->onlineCount() << "，连接数：" << m_sessions->connectionCount()
+            << "，出站消息：" << m_outboundQueue->deliveredCount();
 }
 
 void Server::sendResponseToClient(QTcpSocket *clientSocket, const QByteArray &response) {
-    // 这个方法在主线程中执行，可以安全地操作QTcpSocket
-    if (clientSocket && clientSocket->isOpen()) {
-        clientSocket->write(response);
-        clientSocket->flush();
-    }
+    // 可在任意线程调用：消息进入出站队列，由主线程批量写入QTcpSocket
+    m_outboundQueue->push(clientSocket, response);
 }
 
-QSqlDatabase Server::getThreadLocalDatabase() {
-    // 获取当前线程ID作为连接名
-    QString connectionName = QString("connection_%1").arg((quintptr)QThread::currentThreadId());
-
-    // 检查当前线程是否已有数据库连接
-    if (QSqlDatabase::contains(connectionName)) {
-        QSqlDatabase db = QSqlDatabase::database(connectionName);
-
-        // 检查连接是否有效
-        if (!db.isOpen()) {
-            qDebug() << "数据库连接已存在但未打开，尝试重新打开";
-            if (!db.open()) {
-                qDebug() << "重新打开数据库连接失败:" << db.lastError().text();
-            } else {
-                qDebug() << "成功重新打开数据库连接";
-            }
-        }
-
-        return db;
-    }
-
-    // 为当前线程创建新的数据库连接
-    QString dbPath = QCoreApplication::applicationDirPath() + "/../users.db";
-
-    // 使用互斥锁保护数据库连接创建过程
-    static QMutex connectionMutex;
-    QMutexLocker locker(&connectionMutex);
-
-    QSqlDatabase threadDb;
-    if (QSqlDatabase::contains(connectionName)) {
-        // 双重检查，避免在获取锁的过程中其他线程已创建连接
-        threadDb = QSqlDatabase::database(connectionName);
-    } else {
-        threadDb = QSqlDatabase::addDatabase("QSQLITE", connectionName);
-        threadDb.setDatabaseName(dbPath);
-    }
-
-    if (!threadDb.isOpen() && !threadDb.open()) {
-        qDebug() << "Error: Failed to open database for thread:" << threadDb.lastError().text();
-    } else {
-        qDebug() << "Successfully opened database connection for thread" << QThread::currentThreadId();
+bool Server::sendToUser(const QString &nickname, const QByteArray &data) {
+    SessionPtr session = m_sessions->findByNickname(nickname);
+    if (!session) {
+        return false;
     }
-
-    return threadDb;
+    sendResponseToClient(session->socket(), data);
+    return true;
 }
 
-void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data) {
-    // 获取线程本地数据库连接
-    QSqlDatabase threadDb = getThreadLocalDatabase();
-
+AsyncTask Server::processClientData(QTcpSocket *clientSocket, QByteArray data) {
     // 解析消息
     MessageType type;
     QJsonObject msgData;
 
     if (!MessageProtocol::parseMessage(data, type, msgData)) {
         qDebug() << "解析消息失败!";
-        return;
+        co_return;
     }
 
     qDebug() << "收到消息类型:" << static_cast<int>(type) << " - " << MessageProtocol::messageTypeToString(type);
 
-    // 获取对应的客户端信息
-    ClientInfo *clientInfo = nullptr;
-    {
-        QMutexLocker locker(&m_clientsMutex); // 保护clients列表的互斥锁
-        for (ClientInfo &info : clients) {
-            if (info.socket == clientSocket) {
-                clientInfo = &info;
-                break;
-            }
-        }
+    // 获取对应的客户端会话（引用计数句柄，连接断开后依然有效）
+    SessionPtr clientInfo = m_sessions->findBySocket(clientSocket);
+    if (!clientInfo) {
+        qDebug() << "连接已断开，丢弃消息";
+        co_return;
     }
 
     // 根据消息类型处理
@@ -286,20 +336,19 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
         qDebug() << "Register request: email=" << email << ", nickname=" << nickname;
         if (email.isEmpty() || nickname.isEmpty() || password.isEmpty()) {
             QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Register, {{"status", "failed"}, {"reason", "Empty email, nickname, or password"}})).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
-            return;
+            sendResponseToClient(clientSocket, response);
+            co_return;
         }
-        if (registerUser(email, nickname, password)) {
+        // 等待注册提交，不占用数据库执行器
+        qint64 userId = co_await onCommit(registerUser(email, nickname, password));
+        if (userId > 0) {
             qDebug() << "Registration successful for" << nickname;
             QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Register, {{"status", "success"}})).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
+            sendResponseToClient(clientSocket, response);
         } else {
             qDebug() << "Registration failed for" << nickname;
             QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Register, {{"status", "failed"}, {"reason", "Email or nickname already exists"}})).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
+            sendResponseToClient(clientSocket, response);
         }
         break;
     }
@@ -309,218 +358,262 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
         qDebug() << "Login request: nickname=" << nickname;
         if (nickname.isEmpty() || password.isEmpty()) {
             QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Login, {{"status", "failed"}, {"reason", "Empty nickname or password"}})).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
-            return;
+            sendResponseToClient(clientSocket, response);
+            co_return;
         }
-        QString loginResult = loginUser(nickname, password, *clientInfo);
+        QString loginResult = co_await onDb([&]() { return loginUser(nickname, password); });
         if (loginResult == "success") {
             qDebug() << "Login successful for" << nickname;
-            clientInfo->isLoggedIn = true;
-            clientInfo->nickname = nickname;
+            // 更新在线状态和最后登录时间，提交后再通知好友
+            co_await onCommit(updateUserStatus(nickname, true));
+            notifyFriendsStatusChange(nickname, true);
+            m_sessions->login(clientInfo, nickname);
             QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Login, {{"status", "success"}})).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
+            sendResponseToClient(clientSocket, response);
+            // 补发离线期间收到的私聊消息（第一批）
+            deliverOfflineMessages(clientSocket, m_userIds->idOf(nickname), 0);
         } else {
             qDebug() << "Login failed for" << nickname << ":" << loginResult;
             QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Login, {{"status", "failed"}, {"reason", loginResult}})).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
+            sendResponseToClient(clientSocket, response);
         }
         break;
     }
     case MessageType::Message:
-        if (!clientInfo->isLoggedIn) {
+        if (!clientInfo->isLoggedIn()) {
             QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Message, {{"status", "failed"}, {"reason", "Please login first"}})).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
-            return;
+            sendResponseToClient(clientSocket, response);
+            co_return;
         }
         {
             QString to = msgData["to"].toString();
             QString content = msgData["content"].toString();
 
-            // 获取线程本地数据库连接
-            QSqlDatabase threadDb = getThreadLocalDatabase();
-
-            // 确保数据库连接有效
-            if (!threadDb.isOpen()) {
-                qDebug() << "数据库连接未打开，尝试重新打开";
-                if (!threadDb.open()) {
-                    qDebug() << "无法打开数据库连接:" << threadDb.lastError().text();
-                    QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Message, {{"status", "failed"}, {"reason", "Database error"}})).toJson();
-                    QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                             Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
-                    return;
-                }
+            // 昵称只在协议中出现，存储使用用户 ID
+            qint64 toId = m_userIds->idOf(to);
+            if (toId == 0) {
+                QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Message, {{"status", "failed"}, {"reason", "User not found"}})).toJson();
+                sendResponseToClient(clientSocket, response);
+                co_return;
             }
 
-            // 检查content是否已经是JSON格式
-            QJsonDocument contentDoc = QJsonDocument::fromJson(content.toUtf8());
-            QString finalContent;
-
-            if (contentDoc.isNull() || !contentDoc.isObject()) {
-                // 如果不是有效的JSON，则将其包装为文本消息JSON
-                QJsonObject textMsg;
-                textMsg["type"] = "text";
-                textMsg["text"] = content;
-                finalContent = QString::fromUtf8(QJsonDocument(textMsg).toJson(QJsonDocument::Compact));
-            } else {
-                // 已经是JSON格式，直接使用
-                finalContent = content;
+            // 解析、校验并规范化内容（只在这里解析一次），转发和保存都使用规范化后的内容
+            MessageContent messageContent;
+            QString invalidReason;
+            if (!MessageContent::parse(content, messageContent, &invalidReason)) {
+                QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Message, {{"status", "failed"}, {"reason", invalidReason}})).toJson();
+                sendResponseToClient(clientSocket, response);
+                co_return;
             }
-
-            // 保存消息到数据库
-            QSqlQuery query(threadDb);
-            query.prepare("INSERT INTO messages (from_nickname, to_nickname, content, timestamp) VALUES (?, ?, ?, ?)");
-            query.addBindValue(clientInfo->nickname);
-            query.addBindValue(to);
-            query.addBindValue(finalContent);
-            query.addBindValue(QDateTime::currentDateTime().toString(Qt::ISODate));
-
-            bool saveSuccess = query.exec();
-            if (!saveSuccess) {
-                qDebug() << "保存消息失败:" << query.lastError().text();
+            QString finalContent = messageContent.toWireString();
+
+            // 交给消息存储保存（存储分配会话内序号），持久化后再转发和确认
+            // 发送时间只取一次，格式化只在生成协议消息时进行
+            qint64 sentAt = MessageTime::nowUs();
+            qint64 fromId = m_userIds->idOf(clientInfo->nickname());
+            // 接收者不在线时，离线收件箱的条目与消息在同一个事务中提交，不会只保存了消息而丢失离线副本
+            MessageStore::InboxPayload inbox;
+            if (!m_sessions->findByNickname(to)) {
+                QString from = clientInfo->nickname();
+                inbox = [from, to, finalContent, sentAt](const SavedMessage &saved) {
+                    QJsonObject payload = privateMessageJson(saved.id, from, to, finalContent, sentAt, saved.seq);
+                    return QString::fromUtf8(QJsonDocument(payload).toJson(QJsonDocument::Compact));
+                };
+            }
+            SavedMessage saved = co_await onCommit(m_messageStore->saveChatMessage(fromId, toId, messageContent, sentAt, inbox));
+            if (saved.id < 0) {
                 QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Message, {{"status", "failed"}, {"reason", "Failed to save message"}})).toJson();
-                QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                         Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
-                return;
+                sendResponseToClient(clientSocket, response);
+                co_return;
             }
 
-            // 发送消息给目标用户
-            QJsonObject privateMsg;
-            privateMsg["from"] = clientInfo->nickname;
-            privateMsg["to"] = to;
-            privateMsg["content"] = finalContent;
-            privateMsg["timestamp"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+            // 转发的消息与历史记录中的格式相同，同时写入热点会话缓存
+            QJsonObject privateMsg = privateMessageJson(saved.id, clientInfo->nickname(), to, finalContent, sentAt, saved.seq);
+            m_historyCache->append(Conversation::privateKey(fromId, toId), saved.id, privateMsg);
+            if (messageContent.kind() == MessageContent::Text) {
+                MessageSearch::Document document;
+                document.messageId = saved.id;
+                document.fromId = fromId;
+                document.toId = toId;
+                document.seq = saved.seq;
+                document.sentAt = sentAt;
+                document.text = messageContent.text();
+                indexMessage(document);
+            }
+            referenceImage(messageContent);
             QByteArray message = QJsonDocument(MessageProtocol::createMessage(MessageType::Message, privateMsg)).toJson();
 
-            // 在主线程中发送消息给目标用户
-            QMutexLocker locker(&m_clientsMutex);
-            for (ClientInfo &c : clients) {
-                if (c.isLoggedIn && c.nickname == to) {
-                    QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                             Q_ARG(QTcpSocket*, c.socket), Q_ARG(QByteArray, message));
-                    break;
+            // 发送消息给目标用户；不在线时消息已在离线收件箱中，登录后补发
+            bool queued = saved.queuedOffline;
+            if (!queued && !sendToUser(to, message)) {
+                // 保存时接收者在线、转发前已下线，或存储引擎不能与收件箱一起提交，单独放入收件箱
+                QString payload = QString::fromUtf8(QJsonDocument(privateMsg).toJson(QJsonDocument::Compact));
+                qint64 messageId = saved.id;
+                qint64 pushed = co_await onCommit(m_dbWriter->submit([toId, messageId, payload](DbConnection &conn) {
+                    return OfflineInbox::push(conn, toId, messageId, payload);
+                }));
+                if (pushed < 0) {
+                    qDebug() << "离线消息保存失败，接收者只能从历史记录中看到:" << to << messageId;
+                } else {
+                    queued = true;
                 }
             }
+            if (queued && m_sessions->findByNickname(to)) {
+                // 排队期间接收者上线时，登录时的补发可能早于这条消息提交，作为离线消息再发一次，
+                // 客户端按消息 ID 去重并确认，确认后收件箱中的条目被删除
+                QJsonObject batch;
+                batch["status"] = "success";
+                batch["messages"] = QJsonArray{privateMsg};
+                batch["has_more"] = false;
+                sendToUser(to, QJsonDocument(MessageProtocol::createMessage(MessageType::OfflineMessages, batch)).toJson());
+            }
+
+            // 确认发送者的消息已持久化
+            QJsonObject ack;
+            ack["status"] = "success";
+            ack["to"] = to;
+            ack["message_id"] = saved.id;
+            MessageTime::write(ack, sentAt, saved.seq);
+            QByteArray ackData = QJsonDocument(MessageProtocol::createMessage(MessageType::MessageAck, ack)).toJson();
+            sendResponseToClient(clientSocket, ackData);
         }
         break;
     case MessageType::SearchUser:
         {
             QString query = msgData["query"].toString();
-            QString nickname = searchUser(query);
-            if (!nickname.isEmpty()) {
-                QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::SearchUser, {{"status", "success"}, {"nickname", nickname}})).toJson();
-                QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                         Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
+            int offset = qMax(0, msgData["offset"].toInt(0));
+            int limit = msgData["limit"].toInt(Config::UserSearchPageSize);
+            if (limit <= 0 || limit > Config::UserSearchMaxPageSize) {
+                limit = Config::UserSearchPageSize;
+            }
+            // 用户目录在内存中，直接在当前线程查找
+            bool hasMore = false;
+            QStringList nicknames = searchUsers(query, offset, limit, hasMore);
+            if (!nicknames.isEmpty()) {
+                QJsonObject response;
+                response["status"] = "success";
+                // nickname 为排名第一的用户，兼容只读取一个结果的客户端
+                response["nickname"] = nicknames.first();
+                response["users"] = QJsonArray::fromStringList(nicknames);
+                response["offset"] = offset;
+                response["has_more"] = hasMore;
+                QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(MessageType::SearchUser, response)).toJson();
+                sendResponseToClient(clientSocket, responseData);
             } else {
                 QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::SearchUser, {{"status", "failed"}})).toJson();
-                QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                         Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
+                sendResponseToClient(clientSocket, response);
             }
         }
         break;
     case MessageType::AddFriend:
-        if (!clientInfo->isLoggedIn) {
+        if (!clientInfo->isLoggedIn()) {
             QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Message, {{"status", "failed"}, {"reason", "Please login first"}})).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
-            return;
+            sendResponseToClient(clientSocket, response);
+            co_return;
         }
         {
             QString friendName = msgData["friend"].toString();
-            if (addFriend(clientInfo->nickname, friendName)) {
+            bool added = co_await onCommit(addFriend(clientInfo->nickname(), friendName)) > 0;
+            if (added) {
                 QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::AddFriend, {{"status", "success"}})).toJson();
-                QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                         Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
+                sendResponseToClient(clientSocket, response);
             } else {
                 QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::AddFriend, {{"status", "failed"}, {"reason", "Friend not found or already added"}})).toJson();
-                QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                         Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
+                sendResponseToClient(clientSocket, response);
             }
         }
         break;
     case MessageType::FriendList:
-        if (!clientInfo->isLoggedIn) {
+        if (!clientInfo->isLoggedIn()) {
             QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Message, {{"status", "failed"}, {"reason", "Please login first"}})).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
-            return;
+            sendResponseToClient(clientSocket, response);
+            co_return;
         }
         {
-            QStringList friends = getFriendList(clientInfo->nickname);
-            QJsonArray friendArray;
-            for (const QString &f : friends) {
-                friendArray.append(f);
-            }
-            QJsonObject response;
-            response["status"] = "success";
-            response["friends"] = friendArray;
+            QJsonObject response = friendListResponse(clientInfo->nickname());
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(MessageType::FriendList, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+            sendResponseToClient(clientSocket, responseData);
         }
         break;
     case MessageType::ChatHistory:
-        if (!clientInfo->isLoggedIn) {
+        if (!clientInfo->isLoggedIn()) {
             QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Message, {{"status", "failed"}, {"reason", "Please login first"}})).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
-            return;
+            sendResponseToClient(clientSocket, response);
+            co_return;
         }
         {
             QString friendName = msgData["friend"].toString(); // 修复变量名，避免使用 C++ 关键字 "friend"
+            HistoryPage page = HistoryPage::fromRequest(msgData);
+            bool hasMore = false;
             QJsonObject response;
             response["status"] = "success";
-            response["messages"] = getChatHistory(clientInfo->nickname, friendName);
+            response["friend"] = friendName;
+
+            // 最新一页优先从热点会话缓存读取
+            qint64 friendId = m_userIds->idOf(friendName);
+            bool cacheable = page.direction() == HistoryPage::Latest && friendId != 0;
+            qint64 conversation = Conversation::privateKey(m_userIds->idOf(clientInfo->nickname()), friendId);
+            QJsonArray messages;
+            if (!cacheable || !m_historyCache->latestPage(conversation, page.limit(), messages, hasMore)) {
+                if (cacheable) {
+                    m_historyCache->beginFill(conversation);
+                }
+                messages = co_await onDb([&]() { return getChatHistory(clientInfo->nickname(), friendName, page, hasMore); });
+                if (cacheable) {
+                    m_historyCache->fill(conversation, messages, hasMore);
+                }
+            }
+            response["messages"] = messages;
+            page.writeResponse(response, hasMore);
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(MessageType::ChatHistory, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+            sendResponseToClient(clientSocket, responseData);
         }
         break;
     case MessageType::Logout:
-        if (!clientInfo->isLoggedIn) {
+        if (!clientInfo->isLoggedIn()) {
             QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Message, {{"status", "failed"}, {"reason", "Not logged in"}})).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
-            return;
+            sendResponseToClient(clientSocket, response);
+            co_return;
         }
         handleLogout(clientInfo);
         break;
     case MessageType::FriendRequest:
-        if (!clientInfo->isLoggedIn) {
+        if (!clientInfo->isLoggedIn()) {
             QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Message, {{"status", "failed"}, {"reason", "Please login first"}})).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
-            return;
+            sendResponseToClient(clientSocket, response);
+            co_return;
         }
         {
             QString to = msgData["to"].toString();
-            if (sendFriendRequest(clientInfo->nickname, to)) {
+            bool sent = co_await onCommit(sendFriendRequest(clientInfo->nickname(), to)) > 0;
+            if (sent) {
+                qDebug() << "好友请求已添加到数据库";
                 QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::FriendRequest, {{"status", "success"}})).toJson();
-                QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                         Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
+                sendResponseToClient(clientSocket, response);
+
+                // 请求提交后再通知对方（如果在线）
+                bool notified = notifyFriendRequest(to, clientInfo->nickname());
+                qDebug() << "通知状态：" << (notified ? "已通知" : "未通知（对方可能不在线）");
             } else {
                 QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::FriendRequest, {{"status", "failed"}, {"reason", "Request already sent or users are already friends"}})).toJson();
-                QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                         Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
+                sendResponseToClient(clientSocket, response);
             }
         }
         break;
     case MessageType::AcceptFriend:
         qDebug() << "收到接受好友请求消息: " << MessageProtocol::messageTypeToString(type) << " - " << msgData;
-        if (!clientInfo->isLoggedIn) {
+        if (!clientInfo->isLoggedIn()) {
             qDebug() << "未登录用户尝试接受好友请求";
             QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Message, {{"status", "failed"}, {"reason", "Please login first"}})).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
-            return;
+            sendResponseToClient(clientSocket, response);
+            co_return;
         }
         {
             QString from = msgData["from"].toString();
-            qDebug() << "处理接受好友请求：" << from << "到" << clientInfo->nickname;
-            if (acceptFriendRequest(from, clientInfo->nickname)) {
+            qDebug() << "处理接受好友请求：" << from << "到" << clientInfo->nickname();
+            bool accepted = co_await onCommit(acceptFriendRequest(from, clientInfo->nickname())) > 0;
+            if (accepted) {
+                qDebug() << "成功处理好友请求：" << from << "和" << clientInfo->nickname() << "已成为好友";
                 qDebug() << "接受好友请求成功，发送响应";
 
                 // 发送成功响应给接受者
@@ -528,33 +621,18 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
                 accepterResponse["status"] = "success";
                 QByteArray accepterMsg = QJsonDocument(MessageProtocol::createMessage(
                     MessageType::AcceptFriend, accepterResponse)).toJson();
-                QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                         Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, accepterMsg));
+                // 等待响应写入socket后再发送后续消息，等待期间不占用工作线程
+                co_await sendAndWait(clientSocket, accepterMsg);
                 qDebug() << "已发送响应给接受者：" << accepterMsg;
 
-                // 等待一小段时间确保消息被处理
-                QThread::msleep(50);
-
-                // 刷新接受者的好友列表
-                QStringList accepterFriends = getFriendList(clientInfo->nickname);
-                QJsonArray accepterFriendArray;
-                for (const QString &f : accepterFriends) {
-                    accepterFriendArray.append(f);
-                }
-                QJsonObject friendsResponse;
-                friendsResponse["status"] = "success";
-                friendsResponse["friends"] = accepterFriendArray;
+                // 刷新接受者的好友列表和好友请求列表
+                QJsonObject friendsResponse = friendListResponse(clientInfo->nickname());
+                QStringList requests = co_await onDb([&]() { return getFriendRequests(clientInfo->nickname()); });
                 QByteArray friendsMsg = QJsonDocument(MessageProtocol::createMessage(
                     MessageType::FriendList, friendsResponse)).toJson();
-                QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                         Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, friendsMsg));
+                co_await sendAndWait(clientSocket, friendsMsg);
                 qDebug() << "已发送好友列表给接受者：" << friendsResponse;
 
-                // 等待一小段时间确保消息被处理
-                QThread::msleep(50);
-
-                // 刷新接受者的好友请求列表
-                QStringList requests = getFriendRequests(clientInfo->nickname);
                 QJsonArray requestArray;
                 for (const QString &r : requests) {
                     requestArray.append(r);
@@ -564,47 +642,32 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
                 refreshRequestsResponse["requests"] = requestArray;
                 QByteArray refreshRequestsMsg = QJsonDocument(MessageProtocol::createMessage(
                     MessageType::FriendRequestList, refreshRequestsResponse)).toJson();
-                QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                         Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, refreshRequestsMsg));
+                sendResponseToClient(clientSocket, refreshRequestsMsg);
                 qDebug() << "已发送好友请求列表给接受者：" << refreshRequestsResponse;
 
                 // 通知发送请求的用户
                 bool notified = false;
-                for (const ClientInfo &client : clients) {
-                    if (client.isLoggedIn && client.nickname == from) {
-                        qDebug() << "找到请求发送者" << from << "，发送通知";
-
-                        // 发送接受通知
-                        QJsonObject senderResponse;
-                        senderResponse["status"] = "success";
-                        senderResponse["friend"] = clientInfo->nickname;
-                        QByteArray senderMsg = QJsonDocument(MessageProtocol::createMessage(
-                            MessageType::AcceptFriend, senderResponse)).toJson();
-                        QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                                 Q_ARG(QTcpSocket*, client.socket), Q_ARG(QByteArray, senderMsg));
-                        qDebug() << "已发送通知给请求发送者：" << senderMsg;
-
-                        // 等待一小段时间确保消息被处理
-                        QThread::msleep(100);
-
-                        // 刷新发送者的好友列表
-                        QStringList senderFriends = getFriendList(from);
-                        QJsonArray senderFriendArray;
-                        for (const QString &f : senderFriends) {
-                            senderFriendArray.append(f);
-                        }
-                        QJsonObject senderFriendsResponse;
-                        senderFriendsResponse["status"] = "success";
-                        senderFriendsResponse["friends"] = senderFriendArray;
-                        QByteArray senderFriendsMsg = QJsonDocument(MessageProtocol::createMessage(
-                            MessageType::FriendList, senderFriendsResponse)).toJson();
-                        QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                                 Q_ARG(QTcpSocket*, client.socket), Q_ARG(QByteArray, senderFriendsMsg));
-                        qDebug() << "已发送好友列表给请求发送者：" << senderFriendsResponse;
-
-                        notified = true;
-                        break;
-                    }
+                SessionPtr sender = m_sessions->findByNickname(from);
+                if (sender) {
+                    qDebug() << "找到请求发送者" << from << "，发送通知";
+
+                    // 发送接受通知
+                    QJsonObject senderResponse;
+                    senderResponse["status"] = "success";
+                    senderResponse["friend"] = clientInfo->nickname();
+                    QByteArray senderMsg = QJsonDocument(MessageProtocol::createMessage(
+                        MessageType::AcceptFriend, senderResponse)).toJson();
+                    co_await sendAndWait(sender->socket(), senderMsg);
+                    qDebug() << "已发送通知给请求发送者：" << senderMsg;
+
+                    // 刷新发送者的好友列表
+                    QJsonObject senderFriendsResponse = friendListResponse(from);
+                    QByteArray senderFriendsMsg = QJsonDocument(MessageProtocol::createMessage(
+                        MessageType::FriendList, senderFriendsResponse)).toJson();
+                    sendResponseToClient(sender->socket(), senderFriendsMsg);
+                    qDebug() << "已发送好友列表给请求发送者：" << senderFriendsResponse;
+
+                    notified = true;
                 }
                 if (!notified) {
                     qDebug() << "请求发送者" << from << "不在线，无法通知";
@@ -616,54 +679,43 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
                 errorResponse["reason"] = "Request not found or already processed";
                 QByteArray errorMsg = QJsonDocument(MessageProtocol::createMessage(
                     MessageType::AcceptFriend, errorResponse)).toJson();
-                QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                         Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, errorMsg));
+                sendResponseToClient(clientSocket, errorMsg);
                 qDebug() << "已发送错误响应：" << errorMsg;
             }
         }
         break;
     case MessageType::DeleteFriend:
-        if (!clientInfo->isLoggedIn) {
+        if (!clientInfo->isLoggedIn()) {
             QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Message, {{"status", "failed"}, {"reason", "Please login first"}})).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
-            return;
+            sendResponseToClient(clientSocket, response);
+            co_return;
         }
         {
             QString friendName = msgData["friend"].toString();
-            if (deleteFriend(clientInfo->nickname, friendName)) {
+            bool deleted = co_await onCommit(deleteFriend(clientInfo->nickname(), friendName)) > 0;
+            if (deleted) {
                 QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::DeleteFriend, {{"status", "success"}})).toJson();
-                QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                         Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
+                sendResponseToClient(clientSocket, response);
 
                 // 通知被删除的好友
-                QMutexLocker locker(&m_clientsMutex);
-                for (const ClientInfo &client : clients) {
-                    if (client.isLoggedIn && client.nickname == friendName) {
-                        QByteArray notifyMsg = QJsonDocument(MessageProtocol::createMessage(MessageType::DeleteFriend, {{"status", "success"}, {"friend", clientInfo->nickname}})).toJson();
-                        QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                                 Q_ARG(QTcpSocket*, client.socket), Q_ARG(QByteArray, notifyMsg));
-                        break;
-                    }
-                }
+                QByteArray notifyMsg = QJsonDocument(MessageProtocol::createMessage(MessageType::DeleteFriend, {{"status", "success"}, {"friend", clientInfo->nickname()}})).toJson();
+                sendToUser(friendName, notifyMsg);
             } else {
                 QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::DeleteFriend, {{"status", "failed"}, {"reason", "Friend not found"}})).toJson();
-                QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                         Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
+                sendResponseToClient(clientSocket, response);
             }
         }
         break;
     case MessageType::FriendRequestList:
-        if (!clientInfo->isLoggedIn) {
+        if (!clientInfo->isLoggedIn()) {
             qDebug() << "未登录用户尝试获取好友请求列表";
             QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Message, {{"status", "failed"}, {"reason", "Please login first"}})).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
-            return;
+            sendResponseToClient(clientSocket, response);
+            co_return;
         }
         {
-            qDebug() << "处理获取好友请求列表请求，用户：" << clientInfo->nickname;
-            QStringList requests = getFriendRequests(clientInfo->nickname);
+            qDebug() << "处理获取好友请求列表请求，用户：" << clientInfo->nickname();
+            QStringList requests = co_await onDb([&]() { return getFriendRequests(clientInfo->nickname()); });
             QJsonArray requestArray;
             for (const QString &r : requests) {
                 requestArray.append(r);
@@ -673,21 +725,19 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
             response["requests"] = requestArray;
             QByteArray responseMsg = QJsonDocument(MessageProtocol::createMessage(MessageType::FriendRequestList, response)).toJson();
             qDebug() << "发送好友请求列表响应：" << response;
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseMsg));
+            sendResponseToClient(clientSocket, responseMsg);
         }
         break;
     case MessageType::DeleteFriendRequest: {
         qDebug() << "收到删除好友请求消息: " << MessageProtocol::messageTypeToString(type) << " - " << msgData;
-        if (!clientInfo->isLoggedIn) {
+        if (!clientInfo->isLoggedIn()) {
             qDebug() << "未登录用户尝试删除好友请求";
             QJsonObject errorResponse;
             errorResponse["status"] = "failed";
             errorResponse["reason"] = "请先登录";
             QByteArray errorMsg = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::DeleteFriendRequest, errorResponse)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientInfo->socket), Q_ARG(QByteArray, errorMsg));
+            sendResponseToClient(clientInfo->socket(), errorMsg);
             qDebug() << "已发送错误响应：" << errorMsg;
             break;
         }
@@ -700,25 +750,27 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
             errorResponse["reason"] = "无效的好友请求";
             QByteArray errorMsg = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::DeleteFriendRequest, errorResponse)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientInfo->socket), Q_ARG(QByteArray, errorMsg));
+            sendResponseToClient(clientInfo->socket(), errorMsg);
             qDebug() << "已发送错误响应：" << errorMsg;
             break;
         }
 
-        qDebug() << "处理删除好友请求，从" << from << "到" << clientInfo->nickname;
-        if (deleteFriendRequest(from, clientInfo->nickname)) {
+        qDebug() << "处理删除好友请求，从" << from << "到" << clientInfo->nickname();
+        bool deleted = co_await onCommit(deleteFriendRequest(from, clientInfo->nickname())) > 0;
+        if (deleted) {
+            qDebug() << "成功删除好友请求，从" << from << "到" << clientInfo->nickname();
+            // 删除已提交，重新读取的请求列表不再包含它
+            QStringList requests = co_await onDb([&]() { return getFriendRequests(clientInfo->nickname()); });
+
             // 发送成功响应
             QJsonObject response;
             response["status"] = "success";
             QByteArray responseMsg = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::DeleteFriendRequest, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientInfo->socket), Q_ARG(QByteArray, responseMsg));
+            sendResponseToClient(clientInfo->socket(), responseMsg);
             qDebug() << "已发送删除好友请求成功响应：" << responseMsg;
 
             // 刷新好友请求列表
-            QStringList requests = getFriendRequests(clientInfo->nickname);
             QJsonArray requestArray;
             for (const QString &r : requests) {
                 requestArray.append(r);
@@ -728,8 +780,7 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
             refreshResponse["requests"] = requestArray;
             QByteArray refreshMsg = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::FriendRequestList, refreshResponse)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientInfo->socket), Q_ARG(QByteArray, refreshMsg));
+            sendResponseToClient(clientInfo->socket(), refreshMsg);
             qDebug() << "已发送刷新好友请求列表响应：" << refreshResponse;
         } else {
             // 发送失败响应
@@ -738,16 +789,16 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
             errorResponse["reason"] = "删除好友请求失败";
             QByteArray errorMsg = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::DeleteFriendRequest, errorResponse)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientInfo->socket), Q_ARG(QByteArray, errorMsg));
+            sendResponseToClient(clientInfo->socket(), errorMsg);
             qDebug() << "已发送错误响应：" << errorMsg;
         }
         break;
     }
     case MessageType::CreateGroup:
-        if (!clientInfo->isLoggedIn) {
-            clientSocket->write(QJsonDocument(MessageProtocol::createMessage(MessageType::Message, {{"status", "failed"}, {"reason", "Please login first"}})).toJson());
-            return;
+        if (!clientInfo->isLoggedIn()) {
+            QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Message, {{"status", "failed"}, {"reason", "Please login first"}})).toJson();
+            sendResponseToClient(clientSocket, response);
+            co_return;
         }
         {
             QString groupName = msgData["group_name"].toString();
@@ -760,38 +811,44 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
             }
 
             // 确保创建者也在群聊中
-            if (!members.contains(clientInfo->nickname)) {
-                members << clientInfo->nickname;
+            if (!members.contains(clientInfo->nickname())) {
+                members << clientInfo->nickname();
             }
 
             qDebug() << "创建群聊请求：" << groupName << "，成员：" << members.join(", ");
 
-            if (createGroup(clientInfo->nickname, groupName, members)) {
+            qint64 groupId = co_await onCommit(createGroup(clientInfo->nickname(), groupName, members));
+            if (groupId > 0) {
+                // 提交后通知在线成员已被加入群聊
+                for (const QString &member : members) {
+                    if (member != clientInfo->nickname()) {
+                        notifyGroupCreation(member, int(groupId), groupName, clientInfo->nickname());
+                    }
+                }
+                qDebug() << "成功创建群聊：" << groupName << "，ID：" << groupId << "，创建者：" << clientInfo->nickname();
+
                 QJsonObject response;
                 response["status"] = "success";
                 response["group_name"] = groupName;
                 QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(MessageType::CreateGroup, response)).toJson();
-                QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                         Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+                sendResponseToClient(clientSocket, responseData);
             } else {
                 QJsonObject response;
                 response["status"] = "failed";
                 response["reason"] = "创建群聊失败";
                 QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(MessageType::CreateGroup, response)).toJson();
-                QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                         Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+                sendResponseToClient(clientSocket, responseData);
             }
         }
         break;
     case MessageType::GroupList:
-        if (!clientInfo->isLoggedIn) {
+        if (!clientInfo->isLoggedIn()) {
             QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Message, {{"status", "failed"}, {"reason", "Please login first"}})).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
-            return;
+            sendResponseToClient(clientSocket, response);
+            co_return;
         }
         {
-            QStringList groups = getGroupList(clientInfo->nickname);
+            QStringList groups = co_await onDb([&]() { return getGroupList(clientInfo->nickname()); });
             QJsonArray groupArray;
             for (const QString &g : groups) {
                 groupArray.append(g);
@@ -800,28 +857,30 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
             response["status"] = "success";
             response["groups"] = groupArray;
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(MessageType::GroupList, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+            sendResponseToClient(clientSocket, responseData);
 
             // 打印调试信息
-            qDebug() << "发送群聊列表给用户" << clientInfo->nickname << "，群聊数量：" << groups.size();
+            qDebug() << "发送群聊列表给用户" << clientInfo->nickname() << "，群聊数量：" << groups.size();
             for (const QString &g : groups) {
                 qDebug() << "  群聊：" << g;
             }
         }
         break;
     case MessageType::GroupMembers:
-        if (!clientInfo->isLoggedIn) {
+        if (!clientInfo->isLoggedIn()) {
             QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Message, {{"status", "failed"}, {"reason", "Please login first"}})).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
-            return;
+            sendResponseToClient(clientSocket, response);
+            co_return;
         }
         {
             int groupId = msgData["group_id"].toInt();
-            QStringList members = getGroupMembers(groupId);
+            // 缓存只查找一次：命中时不访问数据库，未命中时在数据库执行器上读取并填充缓存
+            QList<qint64> memberIds;
+            if (!m_groupMembers->members(groupId, memberIds)) {
+                memberIds = co_await onDb([&]() { return loadGroupMembers(groupId); });
+            }
             QJsonArray memberArray;
-            for (const QString &m : members) {
+            for (const QString &m : m_userIds->nicknamesOf(memberIds)) {
                 memberArray.append(m);
             }
             QJsonObject response;
@@ -829,124 +888,201 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
             response["group_id"] = groupId;
             response["members"] = memberArray;
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(MessageType::GroupMembers, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+            sendResponseToClient(clientSocket, responseData);
         }
         break;
     case MessageType::GroupChat:
-        if (!clientInfo->isLoggedIn) {
+        if (!clientInfo->isLoggedIn()) {
             QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Message, {{"status", "failed"}, {"reason", "Please login first"}})).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
-            return;
+            sendResponseToClient(clientSocket, response);
+            co_return;
         }
         {
             int groupId = msgData["group_id"].toInt();
             QString content = msgData["content"].toString();
 
-            // 获取线程本地数据库连接
-            QSqlDatabase threadDb = getThreadLocalDatabase();
-
-            // 确保数据库连接有效
-            if (!threadDb.isOpen()) {
-                qDebug() << "数据库连接未打开，尝试重新打开";
-                if (!threadDb.open()) {
-                    qDebug() << "无法打开数据库连接:" << threadDb.lastError().text();
-                    QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::GroupChat, {{"status", "failed"}, {"reason", "Database error"}})).toJson();
-                    QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                             Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
-                    return;
-                }
+            // 解析、校验并规范化内容（只在这里解析一次）
+            MessageContent messageContent;
+            QString invalidReason;
+            if (!MessageContent::parse(content, messageContent, &invalidReason)) {
+                QJsonObject response;
+                response["status"] = "failed";
+                response["reason"] = invalidReason;
+                QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(MessageType::GroupChat, response)).toJson();
+                sendResponseToClient(clientSocket, responseData);
+                co_return;
             }
+            QString finalContent = messageContent.toWireString();
+
+            // 交给消息存储保存（存储分配群内序号），持久化后再通知其他群成员
+            QString saveError;
+            qint64 sentAt = MessageTime::nowUs();
+            qint64 fromId = m_userIds->idOf(clientInfo->nickname());
+            SavedMessage saved = co_await onCommit(m_messageStore->saveGroupChatMessage(groupId, fromId, messageContent, sentAt));
+            bool saveSuccess = saved.id >= 0;
+            if (saveSuccess) {
+                // 通知的消息与群聊历史记录中的格式相同，同时写入热点会话缓存
+                QJsonObject groupMsg;
+                groupMsg["id"] = saved.id;
+                groupMsg["from"] = clientInfo->nickname();
+                groupMsg["group_id"] = groupId;
+                groupMsg["content"] = finalContent;
+                MessageTime::write(groupMsg, sentAt, saved.seq);
+                m_historyCache->append(Conversation::groupKey(groupId), saved.id, groupMsg);
+                if (messageContent.kind() == MessageContent::Text) {
+                    MessageSearch::Document document;
+                    document.messageId = saved.id;
+                    document.groupId = groupId;
+                    document.fromId = fromId;
+                    document.seq = saved.seq;
+                    document.sentAt = sentAt;
+                    document.text = messageContent.text();
+                    indexMessage(document);
+                }
+                referenceImage(messageContent);
 
-            // 检查content是否已经是JSON格式
-            QJsonDocument contentDoc = QJsonDocument::fromJson(content.toUtf8());
-            QString finalContent;
-
-            if (contentDoc.isNull() || !contentDoc.isObject()) {
-                // 如果不是有效的JSON，则将其包装为文本消息JSON
-                QJsonObject textMsg;
-                textMsg["type"] = "text";
-                textMsg["text"] = content;
-                finalContent = QJsonDocument(textMsg).toJson(QJsonDocument::Compact);
+                // 在线成员只查找一次，群成员未缓存时先在数据库执行器上加载成员
+                QList<SessionPtr> recipients;
+                if (!m_groupMembers->onlineMembers(groupId, fromId, recipients)) {
+                    co_await onDb([&]() { loadGroupMembers(groupId); });
+                    m_groupMembers->onlineMembers(groupId, fromId, recipients);
+                }
+                notifyGroupMessage(recipients, groupMsg);
             } else {
-                // 已经是JSON格式，直接使用
-                finalContent = content;
+                saveError = "数据库写入失败";
             }
-
-            // 保存消息到数据库
-            QSqlQuery query(threadDb);
-            query.prepare("INSERT INTO group_messages (group_id, from_nickname, content) VALUES (?, ?, ?)");
-            query.addBindValue(groupId);
-            query.addBindValue(clientInfo->nickname);
-            query.addBindValue(finalContent);
-
-            bool saveSuccess = query.exec();
             if (saveSuccess) {
-                // 通知其他群成员
-                notifyGroupMessage(groupId, clientInfo->nickname, content);
-
                 // 发送成功响应给发送者
                 QJsonObject response;
                 response["status"] = "success";
+                response["message_id"] = saved.id;
+                MessageTime::write(response, sentAt, saved.seq);
                 QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(MessageType::GroupChat, response)).toJson();
-                QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                         Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+                sendResponseToClient(clientSocket, responseData);
             } else {
-                qDebug() << "保存群聊消息失败:" << query.lastError().text();
                 QJsonObject response;
                 response["status"] = "failed";
-                response["reason"] = "发送群消息失败: " + query.lastError().text();
+                response["reason"] = "发送群消息失败: " + saveError;
                 QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(MessageType::GroupChat, response)).toJson();
-                QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                         Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+                sendResponseToClient(clientSocket, responseData);
             }
         }
         break;
     case MessageType::GroupChatHistory:
-        if (!clientInfo->isLoggedIn) {
+        if (!clientInfo->isLoggedIn()) {
             QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::Message, {{"status", "failed"}, {"reason", "Please login first"}})).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, response));
-            return;
+            sendResponseToClient(clientSocket, response);
+            co_return;
         }
         {
             int groupId = msgData["group_id"].toInt();
-            QJsonArray chatHistory = getGroupChatHistory(groupId);
+            HistoryPage page = HistoryPage::fromRequest(msgData);
+            bool hasMore = false;
+
+            // 最新一页优先从热点会话缓存读取
+            bool cacheable = page.direction() == HistoryPage::Latest;
+            qint64 conversation = Conversation::groupKey(groupId);
+            QJsonArray chatHistory;
+            if (!cacheable || !m_historyCache->latestPage(conversation, page.limit(), chatHistory, hasMore)) {
+                if (cacheable) {
+                    m_historyCache->beginFill(conversation);
+                }
+                chatHistory = co_await onDb([&]() { return getGroupChatHistory(groupId, page, hasMore); });
+                if (cacheable) {
+                    m_historyCache->fill(conversation, chatHistory, hasMore);
+                }
+            }
             QJsonObject response;
             response["status"] = "success";
             response["group_id"] = groupId;
             response["messages"] = chatHistory;
+            page.writeResponse(response, hasMore);
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(MessageType::GroupChatHistory, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+            sendResponseToClient(clientSocket, responseData);
+        }
+        break;
+    case MessageType::SearchMessages:
+        if (!clientInfo->isLoggedIn()) {
+            QByteArray response = QJsonDocument(MessageProtocol::createMessage(MessageType::SearchMessages, {{"status", "failed"}, {"reason", "Please login first"}})).toJson();
+            sendResponseToClient(clientSocket, response);
+            co_return;
+        }
+        {
+            QString query = msgData["query"].toString();
+            int limit = msgData["limit"].toInt(Config::SearchPageSize);
+            if (limit <= 0 || limit > Config::SearchMaxPageSize) {
+                limit = Config::SearchPageSize;
+            }
+            qint64 before = msgData["before"].toInteger(0);
+            QJsonObject response;
+            if (!m_searchEnabled) {
+                response["status"] = "failed";
+                response["reason"] = "Search unavailable";
+            } else {
+                response = co_await onDb([&]() { return searchMessages(clientInfo->nickname(), query, before, limit); });
+            }
+            response["query"] = query;
+            QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(MessageType::SearchMessages, response)).toJson();
+            sendResponseToClient(clientSocket, responseData);
+        }
+        break;
+    case MessageType::AckDelivery:
+        if (!clientInfo->isLoggedIn()) {
+            co_return;
+        }
+        {
+            QList<qint64> messageIds;
+            qint64 lastId = 0;
+            const QJsonArray ids = msgData["message_ids"].toArray();
+            for (const QJsonValue &value : ids) {
+                if (messageIds.size() == Config::OfflineInboxMaxAckIds) {
+                    break;
+                }
+                qint64 messageId = value.toInteger();
+                if (messageId > 0) {
+                    messageIds.append(messageId);
+                    lastId = qMax(lastId, messageId);
+                }
+            }
+            if (messageIds.isEmpty()) {
+                co_return;
+            }
+
+            // 一批确认在一个写操作中删除
+            qint64 userId = m_userIds->idOf(clientInfo->nickname());
+            qint64 deleted = co_await onCommit(m_dbWriter->submit([userId, messageIds](DbConnection &conn) {
+                return OfflineInbox::acknowledge(conn, userId, messageIds);
+            }));
+            if (deleted < 0) {
+                co_return;
+            }
+            // 继续发送已确认位置之后的下一批（没有时不发送）
+            deliverOfflineMessages(clientSocket, userId, lastId);
         }
         break;
     case MessageType::GetUserProfile: {
-        if (!clientInfo || !clientInfo->isLoggedIn) {
+        if (!clientInfo || !clientInfo->isLoggedIn()) {
             QJsonObject response;
             response["status"] = "error";
             response["reason"] = "Not logged in";
 
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::GetUserProfile, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
-            return;
+            sendResponseToClient(clientSocket, responseData);
+            co_return;
         }
 
         QString nickname = msgData.value("nickname").toString();
         if (nickname.isEmpty()) {
-            nickname = clientInfo->nickname; // 默认查询自己的资料
+            nickname = clientInfo->nickname(); // 默认查询自己的资料
         }
 
-        QJsonObject userProfile = getUserProfile(nickname);
+        QJsonObject userProfile = co_await onDb([&]() { return getUserProfile(nickname); });
         if (!userProfile.isEmpty()) {
             userProfile["status"] = "success";
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::GetUserProfile, userProfile)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+            sendResponseToClient(clientSocket, responseData);
         } else {
             QJsonObject response;
             response["status"] = "error";
@@ -954,47 +1090,44 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
 
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::GetUserProfile, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+            sendResponseToClient(clientSocket, responseData);
         }
         break;
     }
     case MessageType::UpdateUserProfile: {
-        if (!clientInfo || !clientInfo->isLoggedIn) {
+        if (!clientInfo || !clientInfo->isLoggedIn()) {
             QJsonObject response;
             response["status"] = "error";
             response["reason"] = "Not logged in";
 
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::UpdateUserProfile, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
-            return;
+            sendResponseToClient(clientSocket, responseData);
+            co_return;
         }
 
         // 确保用户只能更新自己的资料
         QString nickname = msgData.value("nickname").toString();
-        if (nickname != clientInfo->nickname) {
+        if (nickname != clientInfo->nickname()) {
             QJsonObject response;
             response["status"] = "error";
             response["reason"] = "Cannot update profile of other users";
 
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::UpdateUserProfile, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
-            return;
+            sendResponseToClient(clientSocket, responseData);
+            co_return;
         }
 
         // 更新用户资料
-        if (updateUserProfile(nickname, msgData)) {
+        bool updated = co_await onCommit(updateUserProfile(nickname, msgData)) > 0;
+        if (updated) {
             QJsonObject response;
             response["status"] = "success";
 
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::UpdateUserProfile, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+            sendResponseToClient(clientSocket, responseData);
         } else {
             QJsonObject response;
             response["status"] = "error";
@@ -1002,36 +1135,33 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
 
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::UpdateUserProfile, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+            sendResponseToClient(clientSocket, responseData);
         }
         break;
     }
     case MessageType::UploadAvatar: {
-        if (!clientInfo || !clientInfo->isLoggedIn) {
+        if (!clientInfo || !clientInfo->isLoggedIn()) {
             QJsonObject response;
             response["status"] = "error";
             response["reason"] = "Not logged in";
 
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::UploadAvatar, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
-            return;
+            sendResponseToClient(clientSocket, responseData);
+            co_return;
         }
 
         // 确保用户只能更新自己的头像
         QString nickname = msgData.value("nickname").toString();
-        if (nickname != clientInfo->nickname) {
+        if (nickname != clientInfo->nickname()) {
             QJsonObject response;
             response["status"] = "error";
             response["reason"] = "Cannot upload avatar for other users";
 
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::UploadAvatar, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
-            return;
+            sendResponseToClient(clientSocket, responseData);
+            co_return;
         }
 
         // 获取Base64编码的头像数据
@@ -1043,20 +1173,36 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
 
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::UploadAvatar, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
-            return;
+            sendResponseToClient(clientSocket, responseData);
+            co_return;
+        }
+
+        // 头像文件名由用户 ID 和内容哈希组成，内容改变时文件名随之改变，文件名即头像版本
+        qint64 userId = m_userIds->idOf(nickname);
+        QString avatarVersion = userId != 0 ? AvatarTable::fileNameOf(userId, avatarData) : QString();
+        QString previousVersion = m_avatars->versionOf(userId);
+        if (!avatarVersion.isEmpty() && avatarVersion != previousVersion) {
+            // 先在文件 I/O 执行器上写入文件，再等待数据库提交新的头像版本
+            bool written = co_await onIo([&]() { return writeAvatarFile(avatarVersion, avatarData); });
+            qint64 updated = -1;
+            if (written) {
+                updated = co_await onCommit(updateAvatar(userId, avatarVersion));
+            }
+            // 失败时删除新文件，成功时删除旧版本的头像文件和缓存
+            QString obsolete = updated > 0 ? previousVersion : avatarVersion;
+            co_await onIo([&]() { removeAvatarFile(obsolete, nickname); });
+            if (updated <= 0) {
+                avatarVersion.clear();
+            }
         }
-
-        // 保存头像
-        if (saveAvatar(nickname, avatarData)) {
+        if (!avatarVersion.isEmpty()) {
             QJsonObject response;
             response["status"] = "success";
+            response["avatar_version"] = avatarVersion;
 
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::UploadAvatar, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+            sendResponseToClient(clientSocket, responseData);
         } else {
             QJsonObject response;
             response["status"] = "error";
@@ -1064,8 +1210,7 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
 
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::UploadAvatar, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+            sendResponseToClient(clientSocket, responseData);
         }
         break;
     }
@@ -1078,22 +1223,38 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
 
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::GetAvatar, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
-            return;
+            sendResponseToClient(clientSocket, responseData);
+            co_return;
+        }
+
+        // 头像版本在内存中；客户端已缓存的版本与当前版本相同时只返回 not_modified，不传输头像
+        QString avatarVersion = m_avatars->versionOf(m_userIds->idOf(nickname));
+        if (!avatarVersion.isEmpty() && msgData.value("if_none_match").toString() == avatarVersion) {
+            QJsonObject response;
+            response["status"] = "not_modified";
+            response["nickname"] = nickname;
+            response["avatar_version"] = avatarVersion;
+
+            QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
+                MessageType::GetAvatar, response)).toJson();
+            sendResponseToClient(clientSocket, responseData);
+            co_return;
         }
 
-        QByteArray avatarData = getAvatar(nickname);
+        QByteArray avatarData;
+        if (!avatarVersion.isEmpty()) {
+            avatarData = co_await onIo([&]() { return getAvatar(avatarVersion, nickname); });
+        }
         if (!avatarData.isEmpty()) {
             QJsonObject response;
             response["status"] = "success";
             response["nickname"] = nickname;
+            response["avatar_version"] = avatarVersion;
             response["avatar_data"] = QString::fromLatin1(avatarData.toBase64());
 
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::GetAvatar, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+            sendResponseToClient(clientSocket, responseData);
         } else {
             QJsonObject response;
             response["status"] = "error";
@@ -1101,21 +1262,19 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
 
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::GetAvatar, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+            sendResponseToClient(clientSocket, responseData);
         }
         break;
     }
     case MessageType::UploadImageRequest: {
-        if (!clientInfo->isLoggedIn) {
+        if (!clientInfo->isLoggedIn()) {
             QJsonObject response;
             response["status"] = "failed";
             response["reason"] = "Please login first";
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::UploadImageResponse, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
-            return;
+            sendResponseToClient(clientSocket, responseData);
+            co_return;
         }
 
         // 从请求中获取图片数据和文件扩展名
@@ -1123,6 +1282,7 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
         QString fileExtension = msgData["file_extension"].toString();
         QString tempId = msgData["temp_id"].toString();
 
+        fileExtension = ImageStore::normalizeExtension(fileExtension);
         if (imageDataBase64.isEmpty() || fileExtension.isEmpty()) {
             QJsonObject response;
             response["status"] = "failed";
@@ -1132,19 +1292,25 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
             }
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::UploadImageResponse, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
-            return;
+            sendResponseToClient(clientSocket, responseData);
+            co_return;
         }
 
         // 解码Base64数据
         QByteArray imageData = QByteArray::fromBase64(imageDataBase64.toLatin1());
 
-        // 生成唯一的图片ID
-        QString imageId = generateUniqueImageId(fileExtension);
-
-        // 保存图片
-        if (saveImage(imageId, imageData)) {
+        // 按内容保存图片（已有相同内容时不再写入），记录后图片 ID 由哈希和扩展名组成
+        QString hash = co_await onIo([&]() { return saveImage(imageData); });
+        qint64 imageSize = imageData.size();
+        bool saved = false;
+        if (!hash.isEmpty()) {
+            saved = co_await onCommit(m_dbWriter->submit([hash, imageSize](DbConnection &conn) {
+                return ImageStore::record(conn, hash, imageSize);
+            })) >= 0;
+        }
+        QString imageId = ImageStore::imageIdOf(hash, fileExtension);
+        if (saved) {
+            generateImageVariants(hash, imageData);
             QJsonObject response;
             response["status"] = "success";
             response["imageId"] = imageId;
@@ -1153,8 +1319,7 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
             }
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::UploadImageResponse, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+            sendResponseToClient(clientSocket, responseData);
             qDebug() << "图片上传成功，ID:" << imageId << "，临时ID:" << tempId;
         } else {
             QJsonObject response;
@@ -1165,67 +1330,62 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
             }
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::UploadImageResponse, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+            sendResponseToClient(clientSocket, responseData);
             qDebug() << "图片上传失败，临时ID:" << tempId;
         }
         break;
     }
 
     case MessageType::ChunkedImageStart: {
-        if (!clientInfo->isLoggedIn) {
+        if (!clientInfo->isLoggedIn()) {
             QJsonObject response;
             response["status"] = "failed";
             response["reason"] = "Please login first";
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::ChunkedImageResponse, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
-            return;
+            sendResponseToClient(clientSocket, responseData);
+            co_return;
         }
         handleChunkedImageStart(clientSocket, msgData, clientInfo);
         break;
     }
 
     case MessageType::ChunkedImageChunk: {
-        if (!clientInfo->isLoggedIn) {
+        if (!clientInfo->isLoggedIn()) {
             QJsonObject response;
             response["status"] = "failed";
             response["reason"] = "Please login first";
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::ChunkedImageResponse, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
-            return;
+            sendResponseToClient(clientSocket, responseData);
+            co_return;
         }
         handleChunkedImageChunk(clientSocket, msgData, clientInfo);
         break;
     }
 
     case MessageType::ChunkedImageEnd: {
-        if (!clientInfo->isLoggedIn) {
+        if (!clientInfo->isLoggedIn()) {
             QJsonObject response;
             response["status"] = "failed";
             response["reason"] = "Please login first";
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::ChunkedImageResponse, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
-            return;
+            sendResponseToClient(clientSocket, responseData);
+            co_return;
         }
         handleChunkedImageEnd(clientSocket, msgData, clientInfo);
         break;
     }
     case MessageType::DownloadImageRequest: {
-        if (!clientInfo->isLoggedIn) {
+        if (!clientInfo->isLoggedIn()) {
             QJsonObject response;
             response["status"] = "failed";
             response["reason"] = "Please login first";
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::DownloadImageResponse, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
-            return;
+            sendResponseToClient(clientSocket, responseData);
+            co_return;
         }
 
         // 从请求中获取图片ID
@@ -1238,13 +1398,18 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
             response["imageId"] = imageId; // 返回原始imageId，方便客户端匹配
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::DownloadImageResponse, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
-            return;
+            sendResponseToClient(clientSocket, responseData);
+            co_return;
+        }
+
+        // 可以指定下载的版本（缩略图、中等尺寸），不存在时返回原图；响应中的图片 ID 与请求相同
+        ImageStore::Variant variant = ImageStore::Original;
+        if (!ImageStore::parseVariant(msgData["variant"].toString(), variant)) {
+            qDebug() << "未知的图片版本，返回原图:" << msgData["variant"].toString();
         }
 
         // 获取图片数据
-        QByteArray imageData = getImage(imageId);
+        QByteArray imageData = co_await onIo([&]() { return readImage(imageId, variant); });
 
         if (!imageData.isEmpty()) {
             // 直接使用二进制格式，不发送JSON预告
@@ -1281,12 +1446,8 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
             qDebug() << "二进制数据包总大小:" << binaryPacket.size() << "字节，图片ID长度:" << imageIdLength
                      << "，图片数据长度:" << imageDataLength;
 
-            // 直接发送二进制数据包，不使用QueuedConnection
-            clientSocket->write(binaryPacket);
-            clientSocket->flush();
-
-            // 确保数据发送完成
-            clientSocket->waitForBytesWritten(5000);
+            // 二进制数据包同样经出站队列发送，保证与其他响应的顺序一致
+            sendResponseToClient(clientSocket, binaryPacket);
 
             qDebug() << "图片下载成功，ID:" << imageId << "，大小:" << imageData.size() << "字节，使用二进制模式发送";
         } else {
@@ -1296,12 +1457,49 @@ void Server::processClientData(QTcpSocket *clientSocket, const QByteArray &data)
             response["imageId"] = imageId; // 返回原始imageId，方便客户端匹配
             QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
                 MessageType::DownloadImageResponse, response)).toJson();
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+            sendResponseToClient(clientSocket, responseData);
             qDebug() << "图片下载失败，ID:" << imageId;
         }
         break;
     }
+    case MessageType::CheckImage: {
+        QJsonObject response;
+        response["temp_id"] = msgData["temp_id"].toString();
+        if (!clientInfo->isLoggedIn()) {
+            response["status"] = "failed";
+            response["reason"] = "Please login first";
+            QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
+                MessageType::CheckImage, response)).toJson();
+            sendResponseToClient(clientSocket, responseData);
+            co_return;
+        }
+
+        QString hash = msgData["sha256"].toString().toLower();
+        QString fileExtension = ImageStore::normalizeExtension(msgData["file_extension"].toString());
+        if (!ImageStore::isHash(hash) || fileExtension.isEmpty()) {
+            response["status"] = "failed";
+            response["reason"] = "Invalid hash or file extension";
+            QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
+                MessageType::CheckImage, response)).toJson();
+            sendResponseToClient(clientSocket, responseData);
+            co_return;
+        }
+
+        // 图片表中有记录时文件已经完整写入，客户端直接使用返回的图片 ID 发送消息，不再上传
+        bool exists = co_await onDb([&]() {
+            DbConnection *conn = m_dbConnections->connection();
+            return conn && ImageStore::contains(*conn, hash);
+        });
+        response["status"] = "success";
+        response["exists"] = exists;
+        if (exists) {
+            response["image_id"] = ImageStore::imageIdOf(hash, fileExtension);
+        }
+        QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
+            MessageType::CheckImage, response)).toJson();
+        sendResponseToClient(clientSocket, responseData);
+        break;
+    }
     default:
         qDebug() << "未处理的消息类型:" << static_cast<int>(type);
         break;
@@ -1312,78 +1510,186 @@ void Server::handleClientDisconnection() {
     QTcpSocket *clientSocket = qobject_cast<QTcpSocket*>(sender());
     if (!clientSocket) return;
 
-    // 使用互斥锁保护clients列表
-    {
-        QMutexLocker locker(&m_clientsMutex);
-        for (int i = 0; i < clients.size(); ++i) {
-            if (clients[i].socket == clientSocket) {
-                if (clients[i].isLoggedIn) {
-                    // 在锁内调用handleLogout可能会导致死锁，所以先保存信息
-                    QString nickname = clients[i].nickname;
-                    bool isLoggedIn = clients[i].isLoggedIn;
-
-                    // 先从列表中移除
-                    clients.removeAt(i);
-
-                    // 释放锁后再处理登出逻辑
-                    locker.unlock();
-
-                    if (isLoggedIn) {
-                        // 更新用户状态
-                        updateUserStatus(nickname, false);
-                        notifyFriendsStatusChange(nickname, false);
-                    }
-
-                    break;
-                } else {
-                    // 如果未登录，直接移除
-                    clients.removeAt(i);
-                    break;
-                }
-            }
-        }
+    // 从注册表中移除会话，已登录的用户需要更新状态并通知好友
+    SessionPtr session = m_sessions->remove(clientSocket);
+    QString nickname = m_sessions->logout(session);
+    if (!nickname.isEmpty()) {
+        // 数据库操作在数据库执行器上进行，不阻塞主线程
+        handleUserOffline(nickname);
     }
 
     clientSocket->deleteLater();
 }
 
-void Server::handleLogout(ClientInfo *clientInfo) {
-    if (!clientInfo || !clientInfo->isLoggedIn) return;
+AsyncTask Server::handleUserOffline(QString nickname) {
+    co_await onCommit(updateUserStatus(nickname, false));
+    notifyFriendsStatusChange(nickname, false);
+}
+
+AsyncTask Server::backfillMessageContent() {
+    qDebug() << "开始回填消息内容列";
+    qint64 total = 0;
+    const QStringList tables = {"messages", "group_messages"};
+    for (const QString &table : tables) {
+        while (true) {
+            // 每批作为一个写操作排队，与正常消息写入交替执行
+            int batchRows = Config::MigrationBatchRows;
+            qint64 updated = co_await onCommit(m_dbWriter->submit([table, batchRows](DbConnection &conn) {
+                return SchemaMigration::backfillMessageContent(conn, table, batchRows);
+            }));
+            if (updated < 0) {
+                qDebug() << "回填消息内容失败，已回填" << total << "行，历史查询继续兼容旧数据";
+                co_return;
+            }
+            if (updated == 0) {
+                break;
+            }
+            total += updated;
+        }
+    }
+    qDebug() << "消息内容列回填完成，共" << total << "行";
+}
 
-    updateUserStatus(clientInfo->nickname, false);
-    notifyFriendsStatusChange(clientInfo->nickname, false);
+AsyncTask Server::deliverOfflineMessages(QTcpSocket *clientSocket, qint64 userId, qint64 afterId) {
+    bool hasMore = false;
+    QJsonArray messages = co_await onDb([&]() {
+        DbConnection *conn = m_dbConnections->connection();
+        return conn ? OfflineInbox::fetch(*conn, userId, afterId, Config::OfflineInboxPageSize, hasMore) : QJsonArray();
+    });
+    if (messages.isEmpty()) {
+        co_return;
+    }
 
-    // 发送登出成功消息给客户端
     QJsonObject response;
     response["status"] = "success";
-    QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(MessageType::Logout, response)).toJson();
-    QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                             Q_ARG(QTcpSocket*, clientInfo->socket), Q_ARG(QByteArray, responseData));
+    response["messages"] = messages;
+    response["has_more"] = hasMore;
+    QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(MessageType::OfflineMessages, response)).toJson();
+    sendResponseToClient(clientSocket, responseData);
+}
 
-    clientInfo->isLoggedIn = false;
-    clientInfo->nickname.clear();
+AsyncTask Server::archiveMessages() {
+    if (m_archiving.exchange(true)) {
+        co_return;
+    }
+    qint64 cutoff = MessageTime::nowUs() - qint64(m_archiveAfterDays) * 24 * 3600 * 1000000LL;
+    qint64 total = 0;
+    const QList<bool> tables = {false, true};
+    for (bool group : tables) {
+        // 跳过的消息（会话只剩一条、尚未回填）由游标越过，本轮不再检查
+        std::shared_ptr<qint64> cursor = std::make_shared<qint64>(0);
+        while (true) {
+            // 每块作为一个写操作排队，与正常消息写入交替执行
+            int blockRows = Config::ArchiveBlockRows;
+            qint64 processed = co_await onCommit(m_dbWriter->submit([group, cutoff, blockRows, cursor](DbConnection &conn) {
+                return MessageArchive::archiveBlock(conn, group, cutoff, blockRows, *cursor);
+            }));
+            if (processed < 0) {
+                qDebug() << "归档消息失败，本轮已处理" << total << "条，下次定时继续";
+                m_archiving = false;
+                co_return;
+            }
+            if (processed == 0) {
+                break;
+            }
+            total += processed;
+        }
+    }
+    m_archiving = false;
+    if (total > 0) {
+        qDebug() << "冷消息归档完成，本轮处理" << total << "条";
+    }
 }
 
-void Server::updateUserStatus(const QString &nickname, bool isOnline) {
-    // 获取线程本地数据库连接
-    QSqlDatabase threadDb = getThreadLocalDatabase();
-    QSqlQuery query(threadDb);
+AsyncTask Server::backfillSearchIndex() {
+    qDebug() << "开始补建消息全文索引";
+    qint64 total = 0;
+    const QStringList tables = {"messages", "group_messages"};
+    for (const QString &table : tables) {
+        while (true) {
+            // 每批作为一个写操作排队，与正常消息写入交替执行
+            int batchRows = Config::MigrationBatchRows;
+            qint64 indexed = co_await onCommit(m_dbWriter->submit([table, batchRows](DbConnection &conn) {
+                return MessageSearch::backfill(conn, table, batchRows);
+            }));
+            if (indexed < 0) {
+                qDebug() << "补建消息索引失败，已处理" << total << "行，下次启动时继续";
+                co_return;
+            }
+            if (indexed == 0) {
+                break;
+            }
+            total += indexed;
+        }
+    }
+    qDebug() << "消息全文索引补建完成，共处理" << total << "行";
+}
 
-    if (isOnline) {
-        // 用户上线，只更新在线状态
-        query.prepare("UPDATE users SET is_online = 1 WHERE nickname = ?");
-        query.addBindValue(nickname);
-    } else {
-        // 用户下线，更新在线状态和最后登录时间
-        QDateTime currentTime = QDateTime::currentDateTime();
-        query.prepare("UPDATE users SET is_online = 0, last_login_time = ? WHERE nickname = ?");
-        query.addBindValue(currentTime.toString(Qt::ISODate));
-        query.addBindValue(nickname);
+void Server::referenceImage(const MessageContent &content) {
+    if (content.kind() != MessageContent::Image) {
+        return;
+    }
+    // 旧的图片 ID 不在图片表中，不计数
+    QString hash = ImageStore::hashOfImageId(content.imageId());
+    if (hash.isEmpty()) {
+        return;
     }
+    m_dbWriter->submit([hash](DbConnection &conn) {
+        return ImageStore::addReference(conn, hash);
+    });
+}
 
-    if (!query.exec()) {
-        qDebug() << "Error updating user status:" << query.lastError().text();
+void Server::indexMessage(const MessageSearch::Document &document) {
+    if (!m_searchEnabled || document.text.isEmpty()) {
+        return;
     }
+    // 索引与消息写入分开排队，不等待提交，也不影响消息的确认
+    m_dbWriter->submit([document](DbConnection &conn) {
+        return MessageSearch::index(conn, document);
+    });
+}
+
+AsyncTask Server::handleLogout(SessionPtr clientInfo) {
+    if (!clientInfo) co_return;
+
+    QString nickname = m_sessions->logout(clientInfo);
+    if (nickname.isEmpty()) co_return;
+
+    co_await onCommit(updateUserStatus(nickname, false));
+    notifyFriendsStatusChange(nickname, false);
+
+    // 发送登出成功消息给客户端
+    QJsonObject response;
+    response["status"] = "success";
+    QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(MessageType::Logout, response)).toJson();
+    sendResponseToClient(clientInfo->socket(), responseData);
+}
+
+QFuture<qint64> Server::updateUserStatus(const QString &nickname, bool isOnline) {
+    QString timestamp = QDateTime::currentDateTime().toString(Qt::ISODate);
+    qint64 userId = m_userIds->idOf(nickname);
+    return m_dbWriter->submit([userId, isOnline, timestamp](DbConnection &conn) -> qint64 {
+        if (isOnline) {
+            // 用户上线，更新在线状态和最后登录时间
+            QSqlQuery &query = conn.prepare("UPDATE users SET is_online = 1, last_login_time = ? WHERE id = ?");
+            query.addBindValue(timestamp);
+            query.addBindValue(userId);
+            if (!query.exec()) {
+                qDebug() << "Error updating user status:" << query.lastError().text();
+                return -1;
+            }
+        } else {
+            // 用户下线，更新在线状态和最后登录时间
+            QSqlQuery &query = conn.prepare("UPDATE users SET is_online = 0, last_login_time = ? WHERE id = ?");
+            query.addBindValue(timestamp);
+            query.addBindValue(userId);
+            if (!query.exec()) {
+                qDebug() << "Error updating user status:" << query.lastError().text();
+                return -1;
+            }
+        }
+        return 1;
+    });
 }
 
 void Server::notifyFriendsStatusChange(const QString &nickname, bool isOnline) {
@@ -1394,12 +1700,9 @@ void Server::notifyFriendsStatusChange(const QString &nickname, bool isOnline) {
     statusMsg["nickname"] = nickname;  // 添加nickname字段，确保客户端能正确识别
     QByteArray message = QJsonDocument(MessageProtocol::createMessage(MessageType::FriendStatus, statusMsg)).toJson();
 
-    QMutexLocker locker(&m_clientsMutex);
-    for (const ClientInfo &client : clients) {
-        if (client.isLoggedIn && friends.contains(client.nickname)) {
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, client.socket), Q_ARG(QByteArray, message));
-        }
+    // 只查找好友的会话，代价与好友数量相关而与在线人数无关
+    for (const QString &friendName : friends) {
+        sendToUser(friendName, message);
     }
 }
 
@@ -1430,6 +1733,11 @@ bool Server::initDatabase() {
         return false;
     }
 
+    // 切换到 WAL 模式（写入数据库文件，之后打开的读写连接都使用 WAL）
+    if (!DbConnection::applyPragmas(db, DbConnection::Writer)) {
+        qDebug() << "Warning: Failed to configure database, continuing with default settings";
+    }
+
     // 确保图片存储目录存在
     QDir imageDir(m_imageStoragePath);
     if (!imageDir.exists()) {
@@ -1447,126 +1755,18 @@ bool Server::initDatabase() {
     // dropQuery.exec("DROP TABLE IF EXISTS messages");
     // dropQuery.exec("DROP TABLE IF EXISTS friend_requests");
 
-    QSqlQuery query;
-    QString createUsersTable = R"(
-        CREATE TABLE IF NOT EXISTS users (
-            email TEXT PRIMARY KEY,
-            nickname TEXT UNIQUE,
-            password TEXT NOT NULL,
-            is_online INTEGER DEFAULT 0,
-            signature TEXT DEFAULT '',
-            avatar TEXT DEFAULT '',
-            gender TEXT DEFAULT '',
-            birthday TEXT DEFAULT '',
-            location TEXT DEFAULT '',
-            phone TEXT DEFAULT '',
-            register_time DATETIME DEFAULT CURRENT_TIMESTAMP,
-            last_login_time DATETIME,
-            friend_count INTEGER DEFAULT 0,
-            group_count INTEGER DEFAULT 0,
-            reserved1 TEXT DEFAULT '',
-            reserved2 TEXT DEFAULT ''
-        )
-    )";
-    if (!query.exec(createUsersTable)) {
-        qDebug() << "Error: Failed to create users table:" << query.lastError().text();
-        return false;
-    }
-
-    QString createFriendsTable = R"(
-        CREATE TABLE IF NOT EXISTS friends (
-            user_nickname TEXT,
-            friend_nickname TEXT,
-            PRIMARY KEY (user_nickname, friend_nickname),
-            FOREIGN KEY (user_nickname) REFERENCES users(nickname),
-            FOREIGN KEY (friend_nickname) REFERENCES users(nickname)
-        )
-    )";
-    if (!query.exec(createFriendsTable)) {
-        qDebug() << "Error: Failed to create friends table:" << query.lastError().text();
-        return false;
-    }
-
-    QString createMessagesTable = R"(
-        CREATE TABLE IF NOT EXISTS messages (
-            id INTEGER PRIMARY KEY AUTOINCREMENT,
-            from_nickname TEXT,
-            to_nickname TEXT,
-            content TEXT,
-            timestamp DATETIME DEFAULT CURRENT_TIMESTAMP,
-            FOREIGN KEY (from_nickname) REFERENCES users(nickname),
-            FOREIGN KEY (to_nickname) REFERENCES users(nickname)
-        )
-    )";
-    if (!query.exec(createMessagesTable)) {
-        qDebug() << "Error: Failed to create messages table:" << query.lastError().text();
-        return false;
-    }
-
-    QString createFriendRequestsTable = R"(
-        CREATE TABLE IF NOT EXISTS friend_requests (
-            from_nickname TEXT,
-            to_nickname TEXT,
-            status TEXT DEFAULT 'pending',
-            timestamp DATETIME DEFAULT CURRENT_TIMESTAMP,
-            PRIMARY KEY (from_nickname, to_nickname),
-            FOREIGN KEY (from_nickname) REFERENCES users(nickname),
-            FOREIGN KEY (to_nickname) REFERENCES users(nickname)
-        )
-    )";
-    if (!query.exec(createFriendRequestsTable)) {
-        qDebug() << "Error: Failed to create friend_requests table:" << query.lastError().text();
-        return false;
-    }
-
-    // 创建群聊表
-    QString createGroupsTable = R"(
-        CREATE TABLE IF NOT EXISTS groups (
-            id INTEGER PRIMARY KEY AUTOINCREMENT,
-            name TEXT NOT NULL,
-            creator_nickname TEXT,
-            create_time DATETIME DEFAULT CURRENT_TIMESTAMP,
-            FOREIGN KEY (creator_nickname) REFERENCES users(nickname)
-        )
-    )";
-    if (!query.exec(createGroupsTable)) {
-        qDebug() << "Error: Failed to create groups table:" << query.lastError().text();
-        return false;
-    }
-
-    // 创建群成员表
-    QString createGroupMembersTable = R"(
-        CREATE TABLE IF NOT EXISTS group_members (
-            group_id INTEGER,
-            member_nickname TEXT,
-            join_time DATETIME DEFAULT CURRENT_TIMESTAMP,
-            PRIMARY KEY (group_id, member_nickname),
-            FOREIGN KEY (group_id) REFERENCES groups(id),
-            FOREIGN KEY (member_nickname) REFERENCES users(nickname)
-        )
-    )";
-    if (!query.exec(createGroupMembersTable)) {
-        qDebug() << "Error: Failed to create group_members table:" << query.lastError().text();
+    // 建表，并升级已有数据库的结构（整数用户 ID、会话键和历史查询索引）
+    if (!SchemaMigration::upgrade(db)) {
+        qDebug() << "Error: Failed to upgrade database schema";
+        m_dbSemaphore->post();
+        m_dbFileLock->unlock();
         return false;
     }
 
-    // 创建群消息表
-    QString createGroupMessagesTable = R"(
-        CREATE TABLE IF NOT EXISTS group_messages (
-            id INTEGER PRIMARY KEY AUTOINCREMENT,
-            group_id INTEGER,
-            from_nickname TEXT,
-            content TEXT,
-            timestamp DATETIME DEFAULT CURRENT_TIMESTAMP,
-            FOREIGN KEY (group_id) REFERENCES groups(id),
-            FOREIGN KEY (from_nickname) REFERENCES users(nickname)
-        )
-    )";
-    if (!query.exec(createGroupMessagesTable)) {
-        qDebug() << "Error: Failed to create group_messages table:" << query.lastError().text();
-        return false;
-    }
+    // 消息全文索引（SQLite 不支持 FTS5 时只禁用搜索）
+    m_searchEnabled = MessageSearch::createIndex(db);
 
+    QSqlQuery query(db);
     // 创建测试账号 (111-999)
     for (int i = 1; i <= 9; i++) {
         QString username = QString("%1%1%1").arg(i);
@@ -1603,55 +1803,58 @@ QString Server::hashPassword(const QString &password) {
     return QString(QCryptographicHash::hash(saltedPassword.toUtf8(), QCryptographicHash::Sha256).toHex());
 }
 
-bool Server::registerUser(const QString &email, const QString &nickname, const QString &password) {
-    QSqlQuery query(db);
-    query.prepare("SELECT email, nickname FROM users WHERE email = ? OR nickname = ?");
-    query.addBindValue(email);
-    query.addBindValue(nickname);
-    if (!query.exec() || query.next()) {
-        return false;
-    }
-
+QFuture<qint64> Server::registerUser(const QString &email, const QString &nickname, const QString &password) {
     // 使用当前时间作为注册时间
-    QDateTime currentTime = QDateTime::currentDateTime();
-
-    query.prepare("INSERT INTO users (email, nickname, password, is_online, register_time, last_login_time) "
-                  "VALUES (?, ?, ?, 0, ?, ?)");
-    query.addBindValue(email);
-    query.addBindValue(nickname);
-    query.addBindValue(hashPassword(password));
-    query.addBindValue(currentTime.toString(Qt::ISODate));
-    query.addBindValue(currentTime.toString(Qt::ISODate)); // 初始登录时间与注册时间相同
-    return query.exec();
+    QString timestamp = QDateTime::currentDateTime().toString(Qt::ISODate);
+    QString hashedPassword = hashPassword(password);
+
+    // 检查和插入在同一个写操作中完成，避免并发注册同一昵称，返回新用户的 ID
+    // 提交后在写线程中把新用户加入内存表，注册成功的响应发出前新用户已可以登录和被搜索
+    return m_dbWriter->submit([email, nickname, hashedPassword, timestamp](DbConnection &conn) -> qint64 {
+        QSqlQuery &check = conn.prepare("SELECT email, nickname FROM users WHERE email = ? OR nickname = ?");
+        check.addBindValue(email);
+        check.addBindValue(nickname);
+        if (!check.exec()) {
+            return -1;
+        }
+        if (check.next()) {
+            return 0;
+        }
+
+        QSqlQuery &query = conn.prepare("INSERT INTO users (email, nickname, password, is_online, register_time, last_login_time) "
+                                        "VALUES (?, ?, ?, 0, ?, ?)");
+        query.addBindValue(email);
+        query.addBindValue(nickname);
+        query.addBindValue(hashedPassword);
+        query.addBindValue(timestamp);
+        query.addBindValue(timestamp); // 初始登录时间与注册时间相同
+        return query.exec() ? query.lastInsertId().toLongLong() : -1;
+    }, [this, email, nickname](qint64 userId) {
+        if (userId > 0) {
+            m_userIds->insert(userId, nickname);
+            m_userDirectory->insert(userId, nickname, email);
+        }
+    });
 }
 
-QString Server::loginUser(const QString &nickname, const QString &password, ClientInfo &client) {
-    // 获取线程本地数据库连接
-    QSqlDatabase threadDb = getThreadLocalDatabase();
-    QSqlQuery query(threadDb);
+QString Server::loginUser(const QString &nickname, const QString &password) {
+    DbConnection *conn = m_dbConnections->connection();
+    if (!conn) {
+        return "Database unavailable";
+    }
 
-    query.prepare("SELECT password FROM users WHERE nickname = ?");
-    query.addBindValue(nickname);
+    qint64 userId = m_userIds->idOf(nickname);
+    if (userId == 0) {
+        return "User not found";
+    }
+
+    QSqlQuery &query = conn->prepare("SELECT password FROM users WHERE id = ?");
+    query.addBindValue(userId);
     if (!query.exec() || !query.next()) {
         return "User not found";
     }
     QString storedPassword = query.value("password").toString();
     if (storedPassword == hashPassword(password)) {
-        // 更新用户在线状态
-        updateUserStatus(nickname, true);
-
-        // 更新最后登录时间
-        QDateTime currentTime = QDateTime::currentDateTime();
-        QSqlQuery updateQuery(threadDb);
-        updateQuery.prepare("UPDATE users SET last_login_time = ? WHERE nickname = ?");
-        updateQuery.addBindValue(currentTime.toString(Qt::ISODate));
-        updateQuery.addBindValue(nickname);
-        if (!updateQuery.exec()) {
-            qDebug() << "Error updating last login time:" << updateQuery.lastError().text();
-        }
-
-        notifyFriendsStatusChange(nickname, true);
-
         // 登录时检查是否有待处理的好友请求，但这里不发送给客户端
         // 客户端登录成功后会主动请求好友请求列表
         QStringList pendingRequests = getFriendRequests(nickname);
@@ -1664,341 +1867,295 @@ QString Server::loginUser(const QString &nickname, const QString &password, Clie
     return "Invalid password";
 }
 
-bool Server::addFriend(const QString &user, const QString &friendName) {
-    // 获取线程本地数据库连接
-    QSqlDatabase threadDb = getThreadLocalDatabase();
-    QSqlQuery query(threadDb);
-
-    query.prepare("SELECT nickname FROM users WHERE nickname = :friend");
-    query.bindValue(":friend", friendName);
-    if (!query.exec() || !query.next()) {
-        return false;
-    }
-
-    // 开始事务以确保数据一致性
-    threadDb.transaction();
-
-    // 添加好友关系
-    query.prepare("INSERT OR IGNORE INTO friends (user_nickname, friend_nickname) VALUES (:user, :friend)");
-    query.bindValue(":user", user);
-    query.bindValue(":friend", friendName);
-    bool success = query.exec();
-
-    if (success && query.numRowsAffected() > 0) {
-        // 更新用户的好友数量
-        query.prepare("UPDATE users SET friend_count = friend_count + 1 WHERE nickname = :user");
-        query.bindValue(":user", user);
-        success = query.exec() && success;
-
-        // 更新好友的好友数量
-        query.prepare("UPDATE users SET friend_count = friend_count + 1 WHERE nickname = :friend");
-        query.bindValue(":friend", friendName);
-        success = query.exec() && success;
-    }
-
-    // 根据操作结果提交或回滚事务
-    if (success) {
-        threadDb.commit();
-    } else {
-        threadDb.rollback();
-        qDebug() << "添加好友失败:" << query.lastError().text();
-    }
-
-    return success;
+QFuture<qint64> Server::addFriend(const QString &user, const QString &friendName) {
+    // 对方必须是已注册用户
+    qint64 userId = m_userIds->idOf(user);
+    qint64 friendId = m_userIds->idOf(friendName);
+    if (userId == 0 || friendId == 0) {
+        return DbWriter::finished(0);
+    }
+
+    // 整个写操作在写线程的保存点中执行，失败时自动回滚
+    return m_dbWriter->submit([userId, friendId](DbConnection &conn) -> qint64 {
+        // 添加好友关系
+        QSqlQuery &insert = conn.prepare("INSERT OR IGNORE INTO friends (user_id, friend_id) VALUES (:user, :friend)");
+        insert.bindValue(":user", userId);
+        insert.bindValue(":friend", friendId);
+        if (!insert.exec()) {
+            qDebug() << "添加好友失败:" << insert.lastError().text();
+            return -1;
+        }
+
+        if (insert.numRowsAffected() > 0) {
+            // 更新双方的好友数量
+            QSqlQuery &count = conn.prepare("UPDATE users SET friend_count = friend_count + 1 WHERE id = ?");
+            for (qint64 id : {userId, friendId}) {
+                count.addBindValue(id);
+                if (!count.exec()) {
+                    qDebug() << "添加好友失败:" << count.lastError().text();
+                    return -1;
+                }
+            }
+        }
+        return 1;
+    }, [this, userId, friendId](qint64) {
+        m_friendGraph->addFriend(userId, friendId);
+    });
 }
 
 QStringList Server::getFriendList(const QString &user) {
-    QStringList friends;
-
-    // 获取线程本地数据库连接
-    QSqlDatabase threadDb = getThreadLocalDatabase();
-    QSqlQuery query(threadDb);
-
-    query.prepare("SELECT friend_nickname FROM friends WHERE user_nickname = :user");
-    query.bindValue(":user", user);
-    if (query.exec()) {
-        while (query.next()) {
-            friends << query.value("friend_nickname").toString();
-        }
-    }
-    return friends;
+    // 好友关系和昵称都在内存中，不访问数据库
+    return m_userIds->nicknamesOf(m_friendGraph->friendsOf(m_userIds->idOf(user)));
 }
 
-bool Server::saveChatMessage(const QString &from, const QString &to, const QString &content) {
-    // 使用写锁保护聊天历史的写入
-    WriteLocker locker(m_chatHistoryLock);
-    if (!locker.isLocked()) {
-        qDebug() << "Failed to acquire write lock for chat history";
-        return false;
-    }
-
-    // 使用数据库信号量控制数据库访问
-    if (!m_dbSemaphore->wait()) {
-        qDebug() << "Failed to acquire database semaphore";
-        return false;
-    }
-
-    // 检查content是否已经是JSON格式
-    QJsonDocument contentDoc = QJsonDocument::fromJson(content.toUtf8());
-    QString finalContent;
-
-    if (contentDoc.isNull() || !contentDoc.isObject()) {
-        // 如果不是有效的JSON，则将其包装为文本消息JSON
-        QJsonObject textMsg;
-        textMsg["type"] = "text";
-        textMsg["text"] = content;
-        finalContent = QString::fromUtf8(QJsonDocument(textMsg).toJson(QJsonDocument::Compact));
-    } else {
-        // 已经是JSON格式，直接使用
-        finalContent = content;
-    }
-
-    QSqlQuery query;
-    query.prepare("INSERT INTO messages (from_nickname, to_nickname, content, timestamp) VALUES (:from, :to, :content, :timestamp)");
-    query.bindValue(":from", from);
-    query.bindValue(":to", to);
-    query.bindValue(":content", finalContent);
-    query.bindValue(":timestamp", QDateTime::currentDateTime().toString(Qt::ISODate));
-    bool result = query.exec();
-
-    // 释放数据库信号量
-    m_dbSemaphore->post();
-
-    // 将消息添加到共享内存，以便其他进程可以访问
-    if (result) {
-        QJsonObject msgObj;
-        msgObj["from"] = from;
-        msgObj["to"] = to;
-        msgObj["content"] = finalContent;
-        msgObj["timestamp"] = QDateTime::currentDateTime().toString(Qt::ISODate);
-
-        QJsonDocument doc(msgObj);
-        QByteArray jsonData = doc.toJson(QJsonDocument::Compact);
-
-        // 写入共享内存
-        m_sharedMemory->write(jsonData);
-
-        // 将消息添加到消息队列，以便其他线程可以处理
-        m_messageQueue->enqueue(jsonData);
+QJsonObject Server::friendListResponse(const QString &user) {
+    // 附带好友的头像版本，客户端缓存的头像版本相同时不再请求头像
+    QList<qint64> friendIds = m_friendGraph->friendsOf(m_userIds->idOf(user));
+    QHash<qint64, QString> versions = m_avatars->versionsOf(friendIds);
+    QJsonArray friendArray;
+    QJsonObject avatarVersions;
+    for (qint64 friendId : friendIds) {
+        QString friendName = m_userIds->nicknameOf(friendId);
+        if (friendName.isEmpty()) {
+            continue;
+        }
+        friendArray.append(friendName);
+        auto version = versions.constFind(friendId);
+        if (version != versions.constEnd()) {
+            avatarVersions[friendName] = version.value();
+        }
     }
-
-    return result;
+    QJsonObject response;
+    response["status"] = "success";
+    response["friends"] = friendArray;
+    response["avatar_versions"] = avatarVersions;
+    return response;
 }
 
-QJsonArray Server::getChatHistory(const QString &user1, const QString &user2) {
+QJsonArray Server::getChatHistory(const QString &user1, const QString &user2, const HistoryPage &page, bool &hasMore) {
     QJsonArray messages;
+    hasMore = false;
 
-    // 使用读写锁保护聊天历史的读取
-    ReadLocker locker(m_chatHistoryLock);
-    if (!locker.isLocked()) {
-        qDebug() << "Failed to acquire read lock for chat history";
-        return messages;
-    }
-
-    // 使用数据库信号量控制数据库访问
-    if (!m_dbSemaphore->wait()) {
-        qDebug() << "Failed to acquire database semaphore";
+    qint64 userId1 = m_userIds->idOf(user1);
+    qint64 userId2 = m_userIds->idOf(user2);
+    if (userId1 == 0 || userId2 == 0) {
         return messages;
     }
 
-    // 获取线程本地数据库连接
-    QSqlDatabase threadDb = getThreadLocalDatabase();
+    const QList<StoredMessage> rows = m_messageStore->getChatHistory(userId1, userId2, page, hasMore);
+    for (const StoredMessage &row : rows) {
+        QJsonObject msg;
+        msg["id"] = row.id;
+        // 会话只涉及两个用户，不需要查表
+        msg["from"] = row.fromId == userId1 ? user1 : user2;
+        msg["to"] = row.toId == userId1 ? user1 : user2;
+        // 内容由类型化的字段直接生成，不需要解析
+        msg["content"] = row.content.toWireString();
+        MessageTime::write(msg, row.sentAt, row.seq);
 
-    // 确保数据库连接有效
-    if (!threadDb.isOpen()) {
-        qDebug() << "数据库连接未打开，尝试重新打开";
-        if (!threadDb.open()) {
-            qDebug() << "无法打开数据库连接:" << threadDb.lastError().text();
-            m_dbSemaphore->post();
-            return messages;
-        }
+        messages.append(msg);
     }
 
-    QSqlQuery query(threadDb);
-    query.prepare("SELECT from_nickname, to_nickname, content, timestamp FROM messages WHERE (from_nickname = :user1 AND to_nickname = :user2) OR (from_nickname = :user2 AND to_nickname = :user1) ORDER BY timestamp");
-    query.bindValue(":user1", user1);
-    query.bindValue(":user2", user2);
-    if (query.exec()) {
-        while (query.next()) {
-            QJsonObject msg;
-            QString fromNickname = query.value("from_nickname").toString();
-            QString toNickname = query.value("to_nickname").toString();
-            msg["from"] = fromNickname;
-            msg["to"] = toNickname;
-
-            // 获取content，可能是JSON字符串
-            QString contentStr = query.value("content").toString();
-            QJsonDocument contentDoc = QJsonDocument::fromJson(contentStr.toUtf8());
-
-            if (!contentDoc.isNull() && contentDoc.isObject()) {
-                // 如果是有效的JSON对象，直接使用
-                msg["content"] = contentStr; // 保持原始JSON字符串格式
-            } else {
-                // 如果不是有效的JSON，则将其包装为文本消息JSON
-                QJsonObject textMsg;
-                textMsg["type"] = "text";
-                textMsg["text"] = contentStr;
-                // 将JSON转为字符串，然后赋值给content
-                msg["content"] = QString::fromUtf8(QJsonDocument(textMsg).toJson(QJsonDocument::Compact));
-            }
-
-            // 添加时间戳
-            msg["timestamp"] = query.value("timestamp").toString();
+    return messages;
+}
 
-            messages.append(msg);
+QJsonObject Server::searchMessages(const QString &user, const QString &query, qint64 before, int limit) {
+    QJsonObject response;
+    response["status"] = "failed";
+
+    qint64 userId = m_userIds->idOf(user);
+    DbConnection *conn = m_dbConnections->connection();
+    if (userId == 0 || !conn) {
+        response["reason"] = "Search failed";
+        return response;
+    }
+
+    // 可搜索的范围：本人参与的私聊和所在的群
+    QList<int> groupIds;
+    QSqlQuery &groupQuery = conn->prepare("SELECT group_id FROM group_members WHERE member_id = ?");
+    groupQuery.addBindValue(userId);
+    if (!groupQuery.exec()) {
+        qDebug() << "获取用户群聊列表失败：" << groupQuery.lastError().text();
+        response["reason"] = "Search failed";
+        return response;
+    }
+    while (groupQuery.next()) {
+        groupIds.append(groupQuery.value(0).toInt());
+    }
+    groupQuery.finish();
+
+    QString match = MessageSearch::buildQuery(query, userId, groupIds);
+    if (match.isEmpty()) {
+        response["reason"] = "No search terms";
+        return response;
+    }
+
+    bool hasMore = false;
+    const QList<MessageSearch::Hit> hits = MessageSearch::search(*conn, match, before, limit, hasMore);
+    QJsonArray results;
+    for (const MessageSearch::Hit &hit : hits) {
+        const MessageSearch::Document &document = hit.document;
+        QJsonObject result;
+        result["message_id"] = document.messageId;
+        result["from"] = m_userIds->nicknameOf(document.fromId);
+        if (document.groupId != 0) {
+            result["group_id"] = document.groupId;
+        } else {
+            result["to"] = m_userIds->nicknameOf(document.toId);
         }
-    } else {
-        qDebug() << "获取聊天历史失败:" << query.lastError().text();
+        MessageTime::write(result, document.sentAt, document.seq);
+        result["snippet"] = hit.snippet;
+        results.append(result);
     }
 
-    // 释放数据库信号量
-    m_dbSemaphore->post();
-
-    return messages;
-}
-
-QString Server::searchUser(const QString &query) {
-    QSqlQuery sqlQuery(db);
-    sqlQuery.prepare("SELECT nickname FROM users WHERE nickname LIKE ? OR email LIKE ?");
-    sqlQuery.addBindValue("%" + query + "%");
-    sqlQuery.addBindValue("%" + query + "%");
-    if (sqlQuery.exec() && sqlQuery.next()) {
-        return sqlQuery.value("nickname").toString();
+    response["status"] = "success";
+    response["results"] = results;
+    response["has_more"] = hasMore;
+    // 下一页从最后一条结果之前继续
+    if (hasMore && !hits.isEmpty()) {
+        response["next_before"] = hits.last().cursor;
     }
-    return QString();
+    return response;
 }
 
-bool Server::sendFriendRequest(const QString &from, const QString &to) {
-    // 获取线程本地数据库连接
-    QSqlDatabase threadDb = getThreadLocalDatabase();
-    QSqlQuery query(threadDb);
+QStringList Server::searchUsers(const QString &query, int offset, int limit, bool &hasMore) {
+    QList<qint64> ids = m_userDirectory->search(query, offset, limit, Config::UserSearchMaxScan, hasMore);
+    return m_userIds->nicknamesOf(ids);
+}
 
+QFuture<qint64> Server::sendFriendRequest(const QString &from, const QString &to) {
     qDebug() << "处理来自" << from << "向" << to << "发送的好友请求";
 
-    // 检查是否已经是好友
-    query.prepare("SELECT 1 FROM friends WHERE (user_nickname = ? AND friend_nickname = ?) OR (user_nickname = ? AND friend_nickname = ?)");
-    query.addBindValue(from);
-    query.addBindValue(to);
-    query.addBindValue(to);
-    query.addBindValue(from);
-    if (query.exec() && query.next()) {
-        qDebug() << "已经是好友关系，无需发送请求";
-        return false; // 已经是好友
-    }
-
-    // 检查是否已经有待处理的请求
-    query.prepare("SELECT 1 FROM friend_requests WHERE from_nickname = ? AND to_nickname = ? AND status = 'pending'");
-    query.addBindValue(from);
-    query.addBindValue(to);
-    if (query.exec() && query.next()) {
-        qDebug() << "已经存在待处理的请求";
-        return false; // 已经有待处理的请求
-    }
-
-    // 添加好友请求
-    query.prepare("INSERT INTO friend_requests (from_nickname, to_nickname, status) VALUES (?, ?, 'pending')");
-    query.addBindValue(from);
-    query.addBindValue(to);
-    if (query.exec()) {
-        qDebug() << "好友请求已添加到数据库";
-
-        // 尝试立即通知对方（如果在线）
-        bool notified = notifyFriendRequest(to, from);
-        qDebug() << "通知状态：" << (notified ? "已通知" : "未通知（对方可能不在线）");
-
-        return true;
-    } else {
-        qDebug() << "添加好友请求失败：" << query.lastError().text();
-        return false;
-    }
+    qint64 fromId = m_userIds->idOf(from);
+    qint64 toId = m_userIds->idOf(to);
+    if (fromId == 0 || toId == 0) {
+        qDebug() << "好友请求的用户不存在";
+        return DbWriter::finished(0);
+    }
+
+    return m_dbWriter->submit([fromId, toId](DbConnection &conn) -> qint64 {
+        // 检查是否已经是好友
+        QSqlQuery &friends = conn.prepare("SELECT 1 FROM friends WHERE (user_id = ? AND friend_id = ?) OR (user_id = ? AND friend_id = ?)");
+        friends.addBindValue(fromId);
+        friends.addBindValue(toId);
+        friends.addBindValue(toId);
+        friends.addBindValue(fromId);
+        if (friends.exec() && friends.next()) {
+            qDebug() << "已经是好友关系，无需发送请求";
+            return 0; // 已经是好友
+        }
+
+        // 检查是否已经有待处理的请求
+        QSqlQuery &pending = conn.prepare("SELECT 1 FROM friend_requests WHERE from_id = ? AND to_id = ? AND status = 'pending'");
+        pending.addBindValue(fromId);
+        pending.addBindValue(toId);
+        if (pending.exec() && pending.next()) {
+            qDebug() << "已经存在待处理的请求";
+            return 0; // 已经有待处理的请求
+        }
+
+        // 添加好友请求
+        QSqlQuery &insert = conn.prepare("INSERT INTO friend_requests (from_id, to_id, status) VALUES (?, ?, 'pending')");
+        insert.addBindValue(fromId);
+        insert.addBindValue(toId);
+        if (!insert.exec()) {
+            qDebug() << "添加好友请求失败：" << insert.lastError().text();
+            return -1;
+        }
+        return 1;
+    });
 }
 
-bool Server::acceptFriendRequest(const QString &from, const QString &to) {
-    // 获取线程本地数据库连接
-    QSqlDatabase threadDb = getThreadLocalDatabase();
-    QSqlQuery query(threadDb);
-
+QFuture<qint64> Server::acceptFriendRequest(const QString &from, const QString &to) {
     qDebug() << "处理接受好友请求函数：" << from << "->" << to;
 
-    // 检查请求是否存在
-    query.prepare("SELECT 1 FROM friend_requests WHERE from_nickname = ? AND to_nickname = ? AND status = 'pending'");
-    query.addBindValue(from);
-    query.addBindValue(to);
-    if (!query.exec()) {
-        qDebug() << "查询好友请求失败：" << query.lastError().text();
-        return false;
-    }
-    if (!query.next()) {
-        qDebug() << "未找到待处理的好友请求";
-        return false;
-    }
-
-    // 开始事务
-    qDebug() << "开始数据库事务";
-    if (!threadDb.transaction()) {
-        qDebug() << "开始事务失败：" << threadDb.lastError().text();
-        return false;
-    }
-
-    // 删除好友请求（不再是更新状态，而是直接删除）
-    query.prepare("DELETE FROM friend_requests WHERE from_nickname = ? AND to_nickname = ?");
-    query.addBindValue(from);
-    query.addBindValue(to);
-    if (!query.exec()) {
-        qDebug() << "删除好友请求失败：" << query.lastError().text();
-        threadDb.rollback();
-        return false;
-    }
-
-    // 添加好友关系（双向）
-    query.prepare("INSERT INTO friends (user_nickname, friend_nickname) VALUES (?, ?), (?, ?)");
-    query.addBindValue(from);
-    query.addBindValue(to);
-    query.addBindValue(to);
-    query.addBindValue(from);
-    if (!query.exec()) {
-        qDebug() << "添加好友关系失败：" << query.lastError().text();
-        threadDb.rollback();
-        return false;
-    }
-
-    qDebug() << "提交事务";
-    if (!threadDb.commit()) {
-        qDebug() << "提交事务失败：" << threadDb.lastError().text();
-        threadDb.rollback();
-        return false;
-    }
-
-    qDebug() << "成功处理好友请求：" << from << "和" << to << "已成为好友";
-    return true;
+    qint64 fromId = m_userIds->idOf(from);
+    qint64 toId = m_userIds->idOf(to);
+    if (fromId == 0 || toId == 0) {
+        qDebug() << "好友请求的用户不存在";
+        return DbWriter::finished(0);
+    }
+
+    // 删除请求和添加好友关系在同一个保存点中执行，任一步失败都会回滚
+    return m_dbWriter->submit([fromId, toId](DbConnection &conn) -> qint64 {
+        // 检查请求是否存在
+        QSqlQuery &check = conn.prepare("SELECT 1 FROM friend_requests WHERE from_id = ? AND to_id = ? AND status = 'pending'");
+        check.addBindValue(fromId);
+        check.addBindValue(toId);
+        if (!check.exec()) {
+            qDebug() << "查询好友请求失败：" << check.lastError().text();
+            return -1;
+        }
+        if (!check.next()) {
+            qDebug() << "未找到待处理的好友请求";
+            return 0;
+        }
+
+        // 删除好友请求（不再是更新状态，而是直接删除）
+        QSqlQuery &remove = conn.prepare("DELETE FROM friend_requests WHERE from_id = ? AND to_id = ?");
+        remove.addBindValue(fromId);
+        remove.addBindValue(toId);
+        if (!remove.exec()) {
+            qDebug() << "删除好友请求失败：" << remove.lastError().text();
+            return -1;
+        }
+
+        // 添加好友关系（双向）
+        QSqlQuery &insert = conn.prepare("INSERT INTO friends (user_id, friend_id) VALUES (?, ?), (?, ?)");
+        insert.addBindValue(fromId);
+        insert.addBindValue(toId);
+        insert.addBindValue(toId);
+        insert.addBindValue(fromId);
+        if (!insert.exec()) {
+            qDebug() << "添加好友关系失败：" << insert.lastError().text();
+            return -1;
+        }
+        return 1;
+    }, [this, fromId, toId](qint64 result) {
+        if (result > 0) {
+            m_friendGraph->addFriend(fromId, toId);
+            m_friendGraph->addFriend(toId, fromId);
+        }
+    });
 }
 
-bool Server::deleteFriend(const QString &user, const QString &friendName) {
-    // 获取线程本地数据库连接
-    QSqlDatabase threadDb = getThreadLocalDatabase();
-    QSqlQuery query(threadDb);
-
-    query.prepare("DELETE FROM friends WHERE (user_nickname = ? AND friend_nickname = ?) OR (user_nickname = ? AND friend_nickname = ?)");
-    query.addBindValue(user);
-    query.addBindValue(friendName);
-    query.addBindValue(friendName);
-    query.addBindValue(user);
-    return query.exec();
+QFuture<qint64> Server::deleteFriend(const QString &user, const QString &friendName) {
+    qint64 userId = m_userIds->idOf(user);
+    qint64 friendId = m_userIds->idOf(friendName);
+    if (userId == 0 || friendId == 0) {
+        return DbWriter::finished(0);
+    }
+
+    return m_dbWriter->submit([userId, friendId](DbConnection &conn) -> qint64 {
+        QSqlQuery &query = conn.prepare("DELETE FROM friends WHERE (user_id = ? AND friend_id = ?) OR (user_id = ? AND friend_id = ?)");
+        query.addBindValue(userId);
+        query.addBindValue(friendId);
+        query.addBindValue(friendId);
+        query.addBindValue(userId);
+        return query.exec() ? 1 : -1;
+    }, [this, userId, friendId](qint64) {
+        m_friendGraph->removeFriend(userId, friendId);
+        m_friendGraph->removeFriend(friendId, userId);
+    });
 }
 
 QStringList Server::getFriendRequests(const QString &user) {
     QStringList requests;
 
-    // 获取线程本地数据库连接
-    QSqlDatabase threadDb = getThreadLocalDatabase();
-    QSqlQuery query(threadDb);
+    DbConnection *conn = m_dbConnections->connection();
+    if (!conn) {
+        return requests;
+    }
 
     qDebug() << "获取用户" << user << "的好友请求列表";
-    query.prepare("SELECT from_nickname FROM friend_requests WHERE to_nickname = ? AND status = 'pending'");
-    query.addBindValue(user);
+    QSqlQuery &query = conn->prepare("SELECT from_id FROM friend_requests WHERE to_id = ? AND status = 'pending'");
+    query.addBindValue(m_userIds->idOf(user));
     if (query.exec()) {
         while (query.next()) {
-            QString from = query.value("from_nickname").toString();
+            QString from = m_userIds->nicknameOf(query.value(0).toLongLong());
+            if (from.isEmpty()) {
+                continue;
+            }
             requests << from;
             qDebug() << "找到来自" << from << "的好友请求";
         }
@@ -2014,128 +2171,95 @@ bool Server::notifyFriendRequest(const QString &to, const QString &from) {
     notification["from"] = from;
     QByteArray message = QJsonDocument(MessageProtocol::createMessage(MessageType::FriendRequest, notification)).toJson();
 
-    // 遍历所有客户端，找到目标用户并发送通知
-    bool notified = false;
-    QMutexLocker locker(&m_clientsMutex);
-    for (auto it = clients.begin(); it != clients.end(); ++it) {
-        if (it->isLoggedIn && it->nickname == to) {
-            qDebug() << "Sending friend request notification from" << from << "to" << to;
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, it->socket), Q_ARG(QByteArray, message));
-            notified = true;
-            break;
-        }
+    // 找到目标用户的会话并发送通知
+    bool notified = sendToUser(to, message);
+    if (notified) {
+        qDebug() << "Sending friend request notification from" << from << "to" << to;
     }
 
     return notified; // 返回是否成功通知对方
 }
 
-bool Server::deleteFriendRequest(const QString &from, const QString &to)
+QFuture<qint64> Server::deleteFriendRequest(const QString &from, const QString &to)
 {
-    // 获取线程本地数据库连接
-    QSqlDatabase threadDb = getThreadLocalDatabase();
-    QSqlQuery query(threadDb);
-
-    query.prepare("DELETE FROM friend_requests WHERE from_nickname = ? AND to_nickname = ?");
-    query.addBindValue(from);
-    query.addBindValue(to);
-    if (!query.exec()) {
-        qDebug() << "删除好友请求失败：" << query.lastError().text();
-        return false;
-    }
-    qDebug() << "成功删除好友请求，从" << from << "到" << to;
-    return true;
+    qint64 fromId = m_userIds->idOf(from);
+    qint64 toId = m_userIds->idOf(to);
+    return m_dbWriter->submit([fromId, toId](DbConnection &conn) -> qint64 {
+        QSqlQuery &query = conn.prepare("DELETE FROM friend_requests WHERE from_id = ? AND to_id = ?");
+        query.addBindValue(fromId);
+        query.addBindValue(toId);
+        if (!query.exec()) {
+            qDebug() << "删除好友请求失败：" << query.lastError().text();
+            return -1;
+        }
+        return 1;
+    });
 }
 
-bool Server::createGroup(const QString &creator, const QString &groupName, const QStringList &members) {
-    // 获取线程本地数据库连接
-    QSqlDatabase threadDb = getThreadLocalDatabase();
-    QSqlQuery query(threadDb);
-
-    // 开始事务
-    if (!threadDb.transaction()) {
-        qDebug() << "创建群聊事务开始失败：" << threadDb.lastError().text();
-        return false;
-    }
-
-    // 创建群聊
-    query.prepare("INSERT INTO groups (name, creator_nickname) VALUES (?, ?)");
-    query.addBindValue(groupName);
-    query.addBindValue(creator);
-
-    if (!query.exec()) {
-        qDebug() << "创建群聊失败：" << query.lastError().text();
-        threadDb.rollback();
-        return false;
-    }
-
-    // 获取新创建的群聊ID
-    int groupId = query.lastInsertId().toInt();
-    if (groupId <= 0) {
-        qDebug() << "获取群聊ID失败";
-        threadDb.rollback();
-        return false;
+QFuture<qint64> Server::createGroup(const QString &creator, const QString &groupName, const QStringList &members) {
+    // 创建者和其他成员的用户 ID（跳过未注册的昵称）
+    qint64 creatorId = m_userIds->idOf(creator);
+    if (creatorId == 0) {
+        return DbWriter::finished(0);
     }
-
-    // 添加创建者为群成员
-    query.prepare("INSERT INTO group_members (group_id, member_nickname) VALUES (?, ?)");
-    query.addBindValue(groupId);
-    query.addBindValue(creator);
-
-    if (!query.exec()) {
-        qDebug() << "添加创建者到群成员失败：" << query.lastError().text();
-        threadDb.rollback();
-        return false;
-    }
-
-    // 添加其他成员
-    bool allMembersAdded = true;
+    QList<qint64> memberIds;
+    memberIds << creatorId;
     for (const QString &member : members) {
         // 跳过创建者（已添加）
-        if (member == creator) continue;
-
-        query.prepare("INSERT INTO group_members (group_id, member_nickname) VALUES (?, ?)");
-        query.addBindValue(groupId);
-        query.addBindValue(member);
-
-        if (!query.exec()) {
-            qDebug() << "添加成员" << member << "到群聊失败：" << query.lastError().text();
-            allMembersAdded = false;
-            break;
+        qint64 memberId = m_userIds->idOf(member);
+        if (memberId == 0) {
+            qDebug() << "群成员" << member << "不存在，已跳过";
+        } else if (!memberIds.contains(memberId)) {
+            memberIds << memberId;
+        }
+    }
+
+    // 创建群聊和添加成员在同一个保存点中执行，任一步失败都会回滚
+    return m_dbWriter->submit([creatorId, groupName, memberIds](DbConnection &conn) -> qint64 {
+        // 创建群聊
+        QSqlQuery &insertGroup = conn.prepare("INSERT INTO groups (name, creator_id) VALUES (?, ?)");
+        insertGroup.addBindValue(groupName);
+        insertGroup.addBindValue(creatorId);
+        if (!insertGroup.exec()) {
+            qDebug() << "创建群聊失败：" << insertGroup.lastError().text();
+            return -1;
+        }
+
+        // 获取新创建的群聊ID
+        qint64 id = insertGroup.lastInsertId().toLongLong();
+        if (id <= 0) {
+            qDebug() << "获取群聊ID失败";
+            return -1;
+        }
+
+        // 添加创建者和其他成员
+        QSqlQuery &insertMember = conn.prepare("INSERT INTO group_members (group_id, member_id) VALUES (?, ?)");
+        for (qint64 memberId : memberIds) {
+            insertMember.addBindValue(id);
+            insertMember.addBindValue(memberId);
+            if (!insertMember.exec()) {
+                qDebug() << "添加成员" << memberId << "到群聊失败：" << insertMember.lastError().text();
+                return -1;
+            }
         }
-
-        // 通知在线成员已被加入群聊
-        notifyGroupCreation(member, groupId, groupName, creator);
-    }
-
-    if (!allMembersAdded) {
-        qDebug() << "添加群成员失败，回滚事务";
-        threadDb.rollback();
-        return false;
-    }
-
-    // 提交事务
-    if (!threadDb.commit()) {
-        qDebug() << "创建群聊提交事务失败：" << threadDb.lastError().text();
-        threadDb.rollback();
-        return false;
-    }
-
-    qDebug() << "成功创建群聊：" << groupName << "，ID：" << groupId << "，创建者：" << creator;
-    return true;
+        return id;
+    }, [this](qint64 id) {
+        m_groupMembers->invalidate(int(id));
+    });
 }
 
 QStringList Server::getGroupList(const QString &user) {
     QStringList groups;
 
-    // 获取线程本地数据库连接
-    QSqlDatabase threadDb = getThreadLocalDatabase();
-    QSqlQuery query(threadDb);
+    DbConnection *conn = m_dbConnections->connection();
+    if (!conn) {
+        return groups;
+    }
 
-    query.prepare("SELECT g.id, g.name FROM groups g "
-                 "JOIN group_members gm ON g.id = gm.group_id "
-                 "WHERE gm.member_nickname = ?");
-    query.addBindValue(user);
+    QSqlQuery &query = conn->prepare("SELECT g.id, g.name FROM groups g "
+                                     "JOIN group_members gm ON g.id = gm.group_id "
+                                     "WHERE gm.member_id = ?");
+    query.addBindValue(m_userIds->idOf(user));
 
     if (query.exec()) {
         while (query.next()) {
@@ -2149,151 +2273,60 @@ QStringList Server::getGroupList(const QString &user) {
     return groups;
 }
 
-QStringList Server::getGroupMembers(int groupId) {
-    QStringList members;
+QList<qint64> Server::loadGroupMembers(int groupId) {
+    QList<qint64> memberIds;
 
-    // 获取线程本地数据库连接
-    QSqlDatabase threadDb = getThreadLocalDatabase();
-    QSqlQuery query(threadDb);
+    DbConnection *conn = m_dbConnections->connection();
+    if (!conn) {
+        return memberIds;
+    }
 
-    query.prepare("SELECT member_nickname FROM group_members WHERE group_id = ?");
+    // 先取版本再读取，读取期间有成员变更时不填充缓存
+    quint64 version = m_groupMembers->version();
+    QSqlQuery &query = conn->prepare("SELECT member_id FROM group_members WHERE group_id = ?");
     query.addBindValue(groupId);
 
-    if (query.exec()) {
-        while (query.next()) {
-            members << query.value("member_nickname").toString();
-        }
-    } else {
+    if (!query.exec()) {
         qDebug() << "获取群成员列表失败：" << query.lastError().text();
+        return memberIds;
     }
-
-    return members;
-}
-
-bool Server::saveGroupChatMessage(int groupId, const QString &from, const QString &content) {
-    // 获取线程本地数据库连接
-    QSqlDatabase threadDb = getThreadLocalDatabase();
-    QSqlQuery query(threadDb);
-
-    // 检查content是否已经是JSON格式
-    QJsonDocument contentDoc = QJsonDocument::fromJson(content.toUtf8());
-    QString finalContent;
-
-    if (contentDoc.isNull() || !contentDoc.isObject()) {
-        // 如果不是有效的JSON，则将其包装为文本消息JSON
-        QJsonObject textMsg;
-        textMsg["type"] = "text";
-        textMsg["text"] = content;
-        finalContent = QString::fromUtf8(QJsonDocument(textMsg).toJson(QJsonDocument::Compact));
-    } else {
-        // 已经是JSON格式，直接使用
-        finalContent = content;
+    while (query.next()) {
+        memberIds << query.value(0).toLongLong();
     }
-
-    QString timestamp = QDateTime::currentDateTime().toString(Qt::ISODate);
-    query.prepare("INSERT INTO group_messages (group_id, from_nickname, content, timestamp) VALUES (?, ?, ?, ?)");
-    query.addBindValue(groupId);
-    query.addBindValue(from);
-    query.addBindValue(finalContent);
-    query.addBindValue(timestamp);
-
-    if (!query.exec()) {
-        qDebug() << "保存群聊消息失败：" << query.lastError().text();
-        return false;
+    if (!memberIds.isEmpty()) {
+        m_groupMembers->fill(groupId, memberIds, version);
     }
-
-    return true;
+    return memberIds;
 }
 
-QJsonArray Server::getGroupChatHistory(int groupId) {
+QJsonArray Server::getGroupChatHistory(int groupId, const HistoryPage &page, bool &hasMore) {
     QJsonArray messages;
+    hasMore = false;
 
-    // 获取线程本地数据库连接
-    QSqlDatabase threadDb = getThreadLocalDatabase();
-
-    // 确保数据库连接有效
-    if (!threadDb.isOpen()) {
-        qDebug() << "数据库连接未打开，尝试重新打开";
-        if (!threadDb.open()) {
-            qDebug() << "无法打开数据库连接:" << threadDb.lastError().text();
-            return messages;
-        }
-    }
-
-    QSqlQuery query(threadDb);
-
-    query.prepare("SELECT from_nickname, content, timestamp FROM group_messages "
-                 "WHERE group_id = ? ORDER BY timestamp");
-    query.addBindValue(groupId);
-
-    if (query.exec()) {
-        while (query.next()) {
-            QJsonObject msg;
-            msg["from"] = query.value("from_nickname").toString();
-            msg["group_id"] = groupId;
-
-            // 获取content，可能是JSON字符串
-            QString contentStr = query.value("content").toString();
-            QJsonDocument contentDoc = QJsonDocument::fromJson(contentStr.toUtf8());
-
-            if (!contentDoc.isNull() && contentDoc.isObject()) {
-                // 如果是有效的JSON对象，直接使用原始字符串
-                msg["content"] = contentStr; // 保持原始JSON字符串格式
-            } else {
-                // 如果不是有效的JSON，则将其包装为文本消息JSON
-                QJsonObject textMsg;
-                textMsg["type"] = "text";
-                textMsg["text"] = contentStr;
-                // 将JSON转为字符串，然后赋值给content
-                msg["content"] = QString::fromUtf8(QJsonDocument(textMsg).toJson(QJsonDocument::Compact));
-            }
-
-            msg["timestamp"] = query.value("timestamp").toString();
-            messages.append(msg);
-        }
-    } else {
-        qDebug() << "获取群聊历史记录失败：" << query.lastError().text();
+    const QList<StoredMessage> rows = m_messageStore->getGroupChatHistory(groupId, page, hasMore);
+    for (const StoredMessage &row : rows) {
+        QJsonObject msg;
+        msg["id"] = row.id;
+        msg["from"] = m_userIds->nicknameOf(row.fromId);
+        msg["group_id"] = groupId;
+        // 内容由类型化的字段直接生成，不需要解析
+        msg["content"] = row.content.toWireString();
+        MessageTime::write(msg, row.sentAt, row.seq);
+        messages.append(msg);
     }
 
     return messages;
 }
 
-bool Server::notifyGroupMessage(int groupId, const QString &from, const QString &content) {
-    // 获取群成员
-    QStringList members = getGroupMembers(groupId);
+bool Server::notifyGroupMessage(const QList<SessionPtr> &recipients, const QJsonObject &msgData) {
     bool anyNotified = false;
 
-    // 检查content是否已经是JSON格式
-    QJsonDocument contentDoc = QJsonDocument::fromJson(content.toUtf8());
-    QString finalContent;
-
-    if (!contentDoc.isNull() && contentDoc.isObject()) {
-        // 如果是有效的JSON对象，直接使用原始字符串
-        finalContent = content;
-    } else {
-        // 如果不是有效的JSON，则将其包装为文本消息JSON
-        QJsonObject textMsg;
-        textMsg["type"] = "text";
-        textMsg["text"] = content;
-        finalContent = QString::fromUtf8(QJsonDocument(textMsg).toJson(QJsonDocument::Compact));
-    }
-
-    QJsonObject msgData;
-    msgData["group_id"] = groupId;
-    msgData["from"] = from;
-    msgData["content"] = finalContent;
-    msgData["timestamp"] = QDateTime::currentDateTime().toString(Qt::ISODate);
-
     QByteArray message = QJsonDocument(MessageProtocol::createMessage(MessageType::GroupChat, msgData)).toJson();
 
-    // 遍历所有在线客户端，发送消息给在线群成员
-    QMutexLocker locker(&m_clientsMutex);
-    for (const ClientInfo &client : clients) {
-        if (client.isLoggedIn && members.contains(client.nickname) && client.nickname != from) {
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, client.socket), Q_ARG(QByteArray, message));
-            anyNotified = true;
-        }
+    // 只遍历在线成员，代价与在线成员数相关
+    for (const SessionPtr &session : std::as_const(recipients)) {
+        sendResponseToClient(session->socket(), message);
+        anyNotified = true;
     }
 
     return anyNotified;
@@ -2301,24 +2334,17 @@ bool Server::notifyGroupMessage(int groupId, const QString &from, const QString
 
 bool Server::notifyGroupCreation(const QString &member, int groupId, const QString &groupName, const QString &creator) {
     // 查找在线的群成员
-    bool notified = false;
-
-    QMutexLocker locker(&m_clientsMutex);
-    for (const ClientInfo &client : clients) {
-        if (client.isLoggedIn && client.nickname == member) {
-            QJsonObject notification;
-            notification["group_id"] = groupId;
-            notification["group_name"] = groupName;
-            notification["creator"] = creator;
+    QJsonObject notification;
+    notification["group_id"] = groupId;
+    notification["group_name"] = groupName;
+    notification["creator"] = creator;
 
-            QByteArray message = QJsonDocument(MessageProtocol::createMessage(
-                MessageType::CreateGroup, notification)).toJson();
+    QByteArray message = QJsonDocument(MessageProtocol::createMessage(
+        MessageType::CreateGroup, notification)).toJson();
 
-            QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                     Q_ARG(QTcpSocket*, client.socket), Q_ARG(QByteArray, message));
-            qDebug() << "已通知用户" << member << "被加入群聊" << groupName;
-            notified = true;
-        }
+    bool notified = sendToUser(member, message);
+    if (notified) {
+        qDebug() << "已通知用户" << member << "被加入群聊" << groupName;
     }
 
     return notified;
@@ -2327,20 +2353,23 @@ bool Server::notifyGroupCreation(const QString &member, int groupId, const QStri
 QJsonObject Server::getUserProfile(const QString &nickname) {
     QJsonObject profile;
 
-    // 获取线程本地数据库连接
-    QSqlDatabase threadDb = getThreadLocalDatabase();
-    QSqlQuery query(threadDb);
+    DbConnection *conn = m_dbConnections->connection();
+    if (!conn) {
+        return profile;
+    }
 
-    query.prepare("SELECT email, nickname, signature, avatar, gender, birthday, location, phone, "
-                 "register_time, last_login_time, friend_count, group_count "
-                 "FROM users WHERE nickname = ?");
-    query.addBindValue(nickname);
+    QSqlQuery &query = conn->prepare("SELECT email, nickname, signature, avatar, gender, birthday, location, phone, "
+                                     "register_time, last_login_time, friend_count, group_count "
+                                     "FROM users WHERE id = ?");
+    query.addBindValue(m_userIds->idOf(nickname));
 
     if (query.exec() && query.next()) {
         profile["email"] = query.value("email").toString();
         profile["nickname"] = query.value("nickname").toString();
         profile["signature"] = query.value("signature").toString();
         profile["avatar"] = query.value("avatar").toString();
+        // 头像文件名随内容变化，即头像版本
+        profile["avatar_version"] = profile["avatar"];
         profile["gender"] = query.value("gender").toString();
         profile["birthday"] = query.value("birthday").toString();
         profile["location"] = query.value("location").toString();
@@ -2356,11 +2385,7 @@ QJsonObject Server::getUserProfile(const QString &nickname) {
     return profile;
 }
 
-bool Server::updateUserProfile(const QString &nickname, const QJsonObject &profileData) {
-    // 获取线程本地数据库连接
-    QSqlDatabase threadDb = getThreadLocalDatabase();
-    QSqlQuery query(threadDb);
-
+QFuture<qint64> Server::updateUserProfile(const QString &nickname, const QJsonObject &profileData) {
     // 构建更新语句
     QString updateQuery = "UPDATE users SET ";
     QStringList updateFields;
@@ -2394,28 +2419,30 @@ bool Server::updateUserProfile(const QString &nickname, const QJsonObject &profi
 
     // 如果没有要更新的字段，直接返回成功
     if (updateFields.isEmpty()) {
-        return true;
+        return DbWriter::finished(1);
     }
 
     // 完成更新语句
-    updateQuery += updateFields.join(", ") + " WHERE nickname = ?";
-    values << nickname;
-
-    // 准备并执行查询
-    query.prepare(updateQuery);
-    for (const QVariant &value : values) {
-        query.addBindValue(value);
-    }
+    updateQuery += updateFields.join(", ") + " WHERE id = ?";
+    values << m_userIds->idOf(nickname);
 
-    if (!query.exec()) {
-        qDebug() << "更新用户资料失败：" << query.lastError().text();
-        return false;
-    }
+    // 准备并执行查询（字段组合不固定，不放入预编译语句缓存）
+    return m_dbWriter->submit([updateQuery, values](DbConnection &conn) -> qint64 {
+        QSqlQuery query(conn.database());
+        query.prepare(updateQuery);
+        for (const QVariant &value : values) {
+            query.addBindValue(value);
+        }
 
-    return true;
+        if (!query.exec()) {
+            qDebug() << "更新用户资料失败：" << query.lastError().text();
+            return -1;
+        }
+        return 1;
+    });
 }
 
-bool Server::saveAvatar(const QString &nickname, const QByteArray &avatarData) {
+bool Server::writeAvatarFile(const QString &avatarFileName, const QByteArray &avatarData) {
     // 创建用户头像目录
     QString avatarDir = QCoreApplication::applicationDirPath() + "/../avatars/";
     QDir dir(avatarDir);
@@ -2423,129 +2450,118 @@ bool Server::saveAvatar(const QString &nickname, const QByteArray &avatarData) {
         dir.mkpath(".");
     }
 
-    // 生成头像文件名（使用用户昵称作为文件名）
-    QString avatarFileName = nickname + ".png";
-    QString avatarPath = avatarDir + avatarFileName;
-
-    // 保存头像文件
-    QFile file(avatarPath);
+    // 保存头像文件（先写临时文件再改名，不会留下不完整的文件）
+    QSaveFile file(avatarDir + avatarFileName);
     if (!file.open(QIODevice::WriteOnly)) {
         qDebug() << "无法打开头像文件进行写入：" << file.errorString();
         return false;
     }
 
-    if (file.write(avatarData) == -1) {
+    if (file.write(avatarData) != avatarData.size() || !file.commit()) {
         qDebug() << "写入头像文件失败：" << file.errorString();
-        file.close();
-        return false;
-    }
-
-    file.close();
-
-    // 更新数据库中的头像路径
-    // 获取线程本地数据库连接
-    QSqlDatabase threadDb = getThreadLocalDatabase();
-    QSqlQuery query(threadDb);
-
-    query.prepare("UPDATE users SET avatar = ? WHERE nickname = ?");
-    query.addBindValue(avatarFileName);
-    query.addBindValue(nickname);
-
-    if (!query.exec()) {
-        qDebug() << "更新用户头像路径失败：" << query.lastError().text();
+        file.cancelWriting();
         return false;
     }
-
     return true;
 }
 
-QByteArray Server::getAvatar(const QString &nickname) {
-    // 首先从数据库获取头像文件名
-    // 获取线程本地数据库连接
-    QSqlDatabase threadDb = getThreadLocalDatabase();
-    QSqlQuery query(threadDb);
+QFuture<qint64> Server::updateAvatar(qint64 userId, const QString &avatarFileName) {
+    // 更新数据库中的头像文件名，提交后在写线程中更新内存中的头像版本
+    return m_dbWriter->submit([userId, avatarFileName](DbConnection &conn) -> qint64 {
+        QSqlQuery &query = conn.prepare("UPDATE users SET avatar = ? WHERE id = ?");
+        query.addBindValue(avatarFileName);
+        query.addBindValue(userId);
 
-    query.prepare("SELECT avatar FROM users WHERE nickname = ?");
-    query.addBindValue(nickname);
+        if (!query.exec()) {
+            qDebug() << "更新用户头像路径失败：" << query.lastError().text();
+            return -1;
+        }
+        return 1;
+    }, [this, userId, avatarFileName](qint64) {
+        m_avatars->set(userId, avatarFileName);
+    });
+}
 
-    if (!query.exec() || !query.next()) {
-        qDebug() << "获取用户头像信息失败：" << query.lastError().text();
-        return QByteArray();
+void Server::removeAvatarFile(const QString &avatarFileName, const QString &nickname) {
+    // 头像文件名来自数据库，作为路径使用前仍然校验
+    if (!AvatarTable::isValidFileName(avatarFileName, nickname)) {
+        return;
     }
+    QString avatarPath = QCoreApplication::applicationDirPath() + "/../avatars/" + avatarFileName;
+    m_blobCache->remove(avatarPath);
+    QFile::remove(avatarPath);
+}
 
-    QString avatarFileName = query.value("avatar").toString();
-    if (avatarFileName.isEmpty()) {
-        qDebug() << "用户" << nickname << "没有设置头像";
+QByteArray Server::getAvatar(const QString &avatarFileName, const QString &nickname) {
+    // 头像文件名来自数据库，作为路径使用前仍然校验
+    if (!AvatarTable::isValidFileName(avatarFileName, nickname)) {
         return QByteArray();
     }
 
-    // 读取头像文件
+    // 读取头像文件（优先从缓存读取）
     QString avatarPath = QCoreApplication::applicationDirPath() + "/../avatars/" + avatarFileName;
+    QByteArray avatarData;
+    if (m_blobCache->get(avatarPath, avatarData)) {
+        return avatarData;
+    }
     QFile file(avatarPath);
     if (!file.exists() || !file.open(QIODevice::ReadOnly)) {
         qDebug() << "无法打开头像文件：" << file.errorString();
         return QByteArray();
     }
 
-    QByteArray avatarData = file.readAll();
+    avatarData = file.readAll();
     file.close();
+    m_blobCache->put(avatarPath, avatarData);
 
     return avatarData;
 }
 
-QString Server::generateUniqueImageId(const QString &fileExtension) {
-    // 生成唯一的图片ID，使用UUID加上原始扩展名
-    QString uuid = QUuid::createUuid().toString(QUuid::WithoutBraces);
-    return uuid + "." + fileExtension;
-}
-
-bool Server::saveImage(const QString &imageId, const QByteArray &imageData) {
-    // 确保图片存储目录存在
-    QDir dir(m_imageStoragePath);
-    if (!dir.exists()) {
-        if (!dir.mkpath(".")) {
-            qDebug() << "Error: Failed to create image storage directory:" << m_imageStoragePath;
-            return false;
-        }
-    }
-
-    // 保存图片文件
-    QString imagePath = m_imageStoragePath + imageId;
-    QFile file(imagePath);
-    if (!file.open(QIODevice::WriteOnly)) {
-        qDebug() << "Error: Failed to open image file for writing:" << file.errorString();
-        return false;
+QString Server::saveImage(const QByteArray &imageData) {
+    if (imageData.isEmpty()) {
+        return QString();
     }
-
-    if (file.write(imageData) == -1) {
-        qDebug() << "Error: Failed to write image data:" << file.errorString();
-        file.close();
-        return false;
+    QString hash = ImageStore::hashOf(imageData);
+    if (!m_imageStore->write(hash, imageData)) {
+        return QString();
     }
-
-    file.close();
-    qDebug() << "Image saved successfully:" << imagePath;
-    return true;
+    qDebug() << "Image saved successfully:" << hash << imageData.size() << "bytes";
+    return hash;
 }
 
-QByteArray Server::getImage(const QString &imageId) {
-    // 读取图片文件
-    QString imagePath = m_imageStoragePath + imageId;
-    QFile file(imagePath);
-    if (!file.exists() || !file.open(QIODevice::ReadOnly)) {
-        qDebug() << "Error: Failed to open image file for reading:" << file.errorString();
-        return QByteArray();
+QByteArray Server::readImage(const QString &imageId, ImageStore::Variant variant) {
+    // 每个版本是一个文件，以各自的路径为键缓存，生成缩小版本后不会继续返回缓存中的原图
+    const QList<ImageStore::Variant> order = variant == ImageStore::Original
+        ? QList<ImageStore::Variant>{ImageStore::Original}
+        : QList<ImageStore::Variant>{variant, ImageStore::Original};
+    for (ImageStore::Variant candidate : order) {
+        QString path = m_imageStore->pathOf(imageId, candidate);
+        if (path.isEmpty()) {
+            continue;
+        }
+        QByteArray data;
+        if (m_blobCache->get(path, data)) {
+            return data;
+        }
+        data = m_imageStore->read(imageId, candidate);
+        if (!data.isEmpty()) {
+            m_blobCache->put(path, data);
+            return data;
+        }
     }
+    return QByteArray();
+}
 
-    QByteArray imageData = file.readAll();
-    file.close();
-    return imageData;
+void Server::generateImageVariants(const QString &hash, const QByteArray &imageData) {
+    m_imagePool->addTask([this, hash, imageData]() {
+        m_imageStore->writeVariants(hash, imageData);
+    });
 }
 
 // 处理分块图片上传开始请求
-void Server::handleChunkedImageStart(QTcpSocket *clientSocket, const QJsonObject &msgData, ClientInfo *clientInfo) {
+void Server::handleChunkedImageStart(QTcpSocket *clientSocket, const QJsonObject &msgData, const SessionPtr &clientInfo) {
     QString tempId = msgData["temp_id"].toString();
-    QString fileExtension = msgData["file_extension"].toString();
+    QString fileExtension = ImageStore::normalizeExtension(msgData["file_extension"].toString());
     int totalChunks = msgData["total_chunks"].toInt();
     int totalSize = msgData["total_size"].toInt();
     int width = msgData["width"].toInt();
@@ -2564,8 +2580,7 @@ void Server::handleChunkedImageStart(QTcpSocket *clientSocket, const QJsonObject
 
         QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
             MessageType::ChunkedImageResponse, response)).toJson();
-        QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                 Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+        sendResponseToClient(clientSocket, responseData);
         return;
     }
 
@@ -2580,13 +2595,14 @@ void Server::handleChunkedImageStart(QTcpSocket *clientSocket, const QJsonObject
     chunkedData.height = height;
 
     // 存储到待处理映射中
+    QMutexLocker locker(&m_chunkedImagesMutex);
     m_pendingChunkedImages[tempId] = chunkedData;
 
     qDebug() << "分块图片上传初始化成功，等待接收数据块";
 }
 
 // 处理分块图片上传数据块
-void Server::handleChunkedImageChunk(QTcpSocket *clientSocket, const QJsonObject &msgData, ClientInfo *clientInfo) {
+void Server::handleChunkedImageChunk(QTcpSocket *clientSocket, const QJsonObject &msgData, const SessionPtr &clientInfo) {
     QString tempId = msgData["temp_id"].toString();
     int chunkIndex = msgData["chunk_index"].toInt();
     QString chunkDataBase64 = msgData["chunk_data"].toString();
@@ -2600,13 +2616,17 @@ void Server::handleChunkedImageChunk(QTcpSocket *clientSocket, const QJsonObject
 
         QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
             MessageType::ChunkedImageResponse, response)).toJson();
-        QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                 Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+        sendResponseToClient(clientSocket, responseData);
         return;
     }
 
+    // 解码数据块
+    QByteArray chunkData = QByteArray::fromBase64(chunkDataBase64.toLatin1());
+
     // 检查是否存在对应的分块上传记录
+    QMutexLocker locker(&m_chunkedImagesMutex);
     if (!m_pendingChunkedImages.contains(tempId)) {
+        locker.unlock();
         QJsonObject response;
         response["status"] = "failed";
         response["reason"] = "No active upload found for this ID";
@@ -2614,17 +2634,13 @@ void Server::handleChunkedImageChunk(QTcpSocket *clientSocket, const QJsonObject
 
         QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
             MessageType::ChunkedImageResponse, response)).toJson();
-        QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                 Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+        sendResponseToClient(clientSocket, responseData);
         return;
     }
 
     // 获取分块上传记录
     ChunkedImageData &chunkedData = m_pendingChunkedImages[tempId];
 
-    // 解码数据块
-    QByteArray chunkData = QByteArray::fromBase64(chunkDataBase64.toLatin1());
-
     // 添加到图片数据中
     chunkedData.imageData.append(chunkData);
     chunkedData.receivedChunks++;
@@ -2634,7 +2650,7 @@ void Server::handleChunkedImageChunk(QTcpSocket *clientSocket, const QJsonObject
 }
 
 // 处理分块图片上传结束请求
-void Server::handleChunkedImageEnd(QTcpSocket *clientSocket, const QJsonObject &msgData, ClientInfo *clientInfo) {
+AsyncTask Server::handleChunkedImageEnd(QTcpSocket *clientSocket, QJsonObject msgData, SessionPtr clientInfo) {
     QString tempId = msgData["temp_id"].toString();
 
     // 验证参数
@@ -2646,13 +2662,22 @@ void Server::handleChunkedImageEnd(QTcpSocket *clientSocket, const QJsonObject &
 
         QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
             MessageType::ChunkedImageResponse, response)).toJson();
-        QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                 Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
-        return;
+        sendResponseToClient(clientSocket, responseData);
+        co_return;
     }
 
-    // 检查是否存在对应的分块上传记录
-    if (!m_pendingChunkedImages.contains(tempId)) {
+    // 取出分块上传记录
+    ChunkedImageData chunkedData;
+    bool found;
+    {
+        QMutexLocker locker(&m_chunkedImagesMutex);
+        found = m_pendingChunkedImages.contains(tempId);
+        if (found) {
+            chunkedData = m_pendingChunkedImages.take(tempId);
+        }
+    }
+
+    if (!found) {
         QJsonObject response;
         response["status"] = "failed";
         response["reason"] = "No active upload found for this ID";
@@ -2660,14 +2685,10 @@ void Server::handleChunkedImageEnd(QTcpSocket *clientSocket, const QJsonObject &
 
         QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
             MessageType::ChunkedImageResponse, response)).toJson();
-        QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                 Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
-        return;
+        sendResponseToClient(clientSocket, responseData);
+        co_return;
     }
 
-    // 获取分块上传记录
-    ChunkedImageData chunkedData = m_pendingChunkedImages.take(tempId);
-
     // 检查是否接收到足够的数据块
     // 允许一定的容错，只要接收到了大部分数据块就认为是成功的
     if (chunkedData.receivedChunks < chunkedData.totalChunks * 0.9) { // 至少接收到90%的数据块
@@ -2680,12 +2701,11 @@ void Server::handleChunkedImageEnd(QTcpSocket *clientSocket, const QJsonObject &
 
         QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
             MessageType::ChunkedImageResponse, response)).toJson();
-        QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                 Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+        sendResponseToClient(clientSocket, responseData);
 
         qDebug() << "分块图片上传失败，接收到的块数不足:" << chunkedData.receivedChunks
                  << "/" << chunkedData.totalChunks;
-        return;
+        co_return;
     }
 
     // 如果接收到的块数不等于总块数，但超过了90%，记录日志但继续处理
@@ -2694,11 +2714,18 @@ void Server::handleChunkedImageEnd(QTcpSocket *clientSocket, const QJsonObject &
                  << chunkedData.receivedChunks << "/" << chunkedData.totalChunks;
     }
 
-    // 生成唯一的图片ID
-    QString imageId = generateUniqueImageId(chunkedData.fileExtension);
-
-    // 保存图片
-    if (saveImage(imageId, chunkedData.imageData)) {
+    // 在文件 I/O 执行器上按内容保存图片，再记录到图片表
+    QString hash = co_await onIo([&]() { return saveImage(chunkedData.imageData); });
+    qint64 imageSize = chunkedData.imageData.size();
+    bool saved = false;
+    if (!hash.isEmpty()) {
+        saved = co_await onCommit(m_dbWriter->submit([hash, imageSize](DbConnection &conn) {
+            return ImageStore::record(conn, hash, imageSize);
+        })) >= 0;
+    }
+    QString imageId = ImageStore::imageIdOf(hash, chunkedData.fileExtension);
+    if (saved) {
+        generateImageVariants(hash, chunkedData.imageData);
         QJsonObject response;
         response["status"] = "success";
         response["image_id"] = imageId;
@@ -2706,8 +2733,7 @@ void Server::handleChunkedImageEnd(QTcpSocket *clientSocket, const QJsonObject &
 
         QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
             MessageType::ChunkedImageResponse, response)).toJson();
-        QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                 Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+        sendResponseToClient(clientSocket, responseData);
 
         qDebug() << "分块图片上传成功，ID:" << imageId
                  << "，临时ID:" << tempId
@@ -2720,8 +2746,7 @@ void Server::handleChunkedImageEnd(QTcpSocket *clientSocket, const QJsonObject &
 
         QByteArray responseData = QJsonDocument(MessageProtocol::createMessage(
             MessageType::ChunkedImageResponse, response)).toJson();
-        QMetaObject::invokeMethod(this, "sendResponseToClient", Qt::QueuedConnection,
-                                 Q_ARG(QTcpSocket*, clientSocket), Q_ARG(QByteArray, responseData));
+        sendResponseToClient(clientSocket, responseData);
 
         qDebug() << "分块图片上传失败，临时ID:" << tempId;
     }
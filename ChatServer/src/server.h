@@ -6,6 +6,8 @@
 #include <QJsonObject>
 #include <QSqlDatabase>
 #include <QMutex>
+#include <QTimer>
+#include <atomic>
 #include "../Common/messageprotocol.h"
 #include "threadpool.h"
 #include "semaphore.h"
@@ -14,11 +16,36 @@
 #include "threadmessagequeue.h"
 #include "sharedmemory.h"
 #include "processmanager.h"
+#include "outboundqueue.h"
+#include "sessionregistry.h"
+#include "asynctask.h"
+#include "cputopology.h"
+#include "dbconnection.h"
+#include "dbwriter.h"
+#include "schemamigration.h"
+#include "historypage.h"
+#include "useridtable.h"
+#include "avatartable.h"
+#include "userdirectory.h"
+#include "friendgraph.h"
+#include "groupmembership.h"
+#include "messagestore.h"
+#include "sqlitemessagestore.h"
+#include "segmentlogstore.h"
+#include "historycache.h"
+#include "messagesearch.h"
+#include "offlineinbox.h"
+#include "messagearchive.h"
+#include "imagestore.h"
+#include "blobcache.h"
 
 class Server : public QObject {
     Q_OBJECT
 public:
-    explicit Server(QObject *parent = nullptr);
+    // archiveAfterDays 为冷消息归档的保留期限（天），0 为不归档（只对 SQLite 引擎有效）
+    explicit Server(CpuPlacement::Layout cpuLayout = CpuPlacement::None,
+                    MessageStore::Engine storeEngine = MessageStore::Sqlite, int archiveAfterDays = 0,
+                    QObject *parent = nullptr);
     ~Server();
     void start();
 
@@ -26,35 +53,115 @@ private slots:
     void handleNewConnection();
     void handleClientData();
     void handleClientDisconnection();
+    void reportStats();
 
-    // 在主线程中发送响应给客户端
+private:
+    // 发送响应给客户端（任意线程可调用，经出站队列由主线程写入）
     void sendResponseToClient(QTcpSocket *clientSocket, const QByteArray &response);
 
-private:
-    // 处理客户端数据的线程函数
-    void processClientData(QTcpSocket *clientSocket, const QByteArray &data);
+    // 处理客户端请求的协程（参数按值传递，协程挂起后依然有效）
+    AsyncTask processClientData(QTcpSocket *clientSocket, QByteArray data);
 
-    // 为当前线程创建数据库连接
-    QSqlDatabase getThreadLocalDatabase();
+    // 在数据库执行器上运行 fn（使用执行器线程的读连接），完成后在线程池上恢复协程
+    // fn 返回时结束读连接上的语句，下一个任务读取新的快照
+    template<typename Fn>
+    auto onDb(Fn fn) {
+        auto task = [this, fn = std::move(fn)]() mutable {
+            DbReadScope scope(m_dbConnections);
+            return fn();
+        };
+        return ExecutorAwaitable<decltype(task)>(m_dbPool, m_threadPool, std::move(task));
+    }
 
-private:
-    struct ClientInfo {
-        QTcpSocket *socket;
-        bool isLoggedIn = false;
-        QString nickname;
-    };
+    // 在文件 I/O 执行器上运行 fn，完成后在线程池上恢复协程
+    template<typename Fn>
+    ExecutorAwaitable<Fn> onIo(Fn fn) {
+        return ExecutorAwaitable<Fn>(m_ioPool, m_threadPool, std::move(fn));
+    }
 
+    // 等待数据库写线程提交完成，完成后在线程池上恢复协程
+    template<typename T>
+    FutureAwaitable<T> onCommit(const QFuture<T> &future) {
+        return FutureAwaitable<T>(future, m_threadPool);
+    }
+
+    // 发送数据并等待其写入socket，用于需要保证先后顺序的多条消息
+    SendAwaitable sendAndWait(QTcpSocket *clientSocket, const QByteArray &data) {
+        return SendAwaitable(m_outboundQueue, m_threadPool, clientSocket, data);
+    }
+
+    // 发送消息给指定的在线用户，用户不在线时返回false
+    bool sendToUser(const QString &nickname, const QByteArray &data);
+
+private:
     QTcpServer *tcpServer;
-    QList<ClientInfo> clients;
-    QMutex m_clientsMutex;  // 保护clients列表的互斥锁
     QSqlDatabase db;
 
+    // 在线会话注册表
+    SessionRegistry *m_sessions;
+
     // 图片存储路径
     QString m_imageStoragePath;
 
-    // 线程池
+    // 内容寻址的图片存储（按 SHA-256 去重，两级目录）
+    ImageStore *m_imageStore;
+
+    // 图片和头像的内存缓存（以文件路径为键）
+    BlobCache *m_blobCache;
+
+    // 线程池（解析请求、运行处理协程）
     ThreadPool *m_threadPool;
 
+    // 数据库执行器
+    ThreadPool *m_dbPool;
+
+    // 文件 I/O 执行器
+    ThreadPool *m_ioPool;
+
+    // 图片处理执行器（上传后生成图片的缩小版本，不阻塞文件 I/O）
+    ThreadPool *m_imagePool;
+
+    // 数据库读连接池（每个数据库执行器线程一个读连接）
+    DbConnectionPool *m_dbConnections;
+
+    // 数据库写线程（唯一的写连接，组提交所有写操作）
+    DbWriter *m_dbWriter;
+
+    // 用户 ID 表（昵称与整数用户 ID 的映射，数据库内部只使用用户 ID）
+    UserIdTable *m_userIds;
+
+    // 用户目录（昵称和邮箱的前缀索引，用户搜索不访问数据库）
+    UserDirectory *m_userDirectory;
+
+    // 头像版本表（用户 ID 到头像文件名的映射，好友列表和条件获取头像不访问数据库）
+    AvatarTable *m_avatars;
+
+    // 好友关系图（friends 表的内存副本，好友查询不访问数据库）
+    FriendGraph *m_friendGraph;
+
+    // 群成员缓存（群消息分发只遍历在线成员）
+    GroupMembership *m_groupMembers;
+
+    // 消息存储（私聊和群聊消息的保存与历史读取）
+    MessageStore *m_messageStore;
+
+    // 热点会话缓存（历史记录第一页）
+    HistoryCache *m_historyCache;
+
+    // 消息全文搜索是否可用（SQLite 支持 FTS5 且索引表已创建）
+    bool m_searchEnabled = false;
+
+    // 冷消息归档：保留期限（天）、定时器和是否正在归档
+    int m_archiveAfterDays = 0;
+    QTimer *m_archiveTimer = nullptr;
+    std::atomic<bool> m_archiving{false};
+
+    // 客户端请求的任务类别（用于线程池统计）
+    int m_requestTaskClass;
+
+    // 定时输出线程池统计
+    QTimer *m_statsTimer;
+
     // 数据库访问信号量
     Semaphore *m_dbSemaphore;
 
@@ -73,49 +180,88 @@ private:
     // 进程管理器
     ProcessManager *m_processManager;
 
+    // 出站消息队列
+    OutboundQueue *m_outboundQueue;
+
     bool initDatabase();
     QString hashPassword(const QString &password);
-    bool registerUser(const QString &email, const QString &nickname, const QString &password);
-    QString loginUser(const QString &nickname, const QString &password, ClientInfo &client);
-    bool addFriend(const QString &user, const QString &friendName);
-    bool sendFriendRequest(const QString &from, const QString &to);
-    bool acceptFriendRequest(const QString &from, const QString &to);
-    bool deleteFriend(const QString &user, const QString &friendName);
+    // 以下写操作提交给数据库写线程并返回提交结果（大于 0 为成功），处理协程用 onCommit 等待
+    // 注册成功时结果为新用户的 ID
+    QFuture<qint64> registerUser(const QString &email, const QString &nickname, const QString &password);
+    // 校验密码（在数据库执行器中调用），成功时返回 "success"
+    QString loginUser(const QString &nickname, const QString &password);
+    QFuture<qint64> addFriend(const QString &user, const QString &friendName);
+    QFuture<qint64> sendFriendRequest(const QString &from, const QString &to);
+    QFuture<qint64> acceptFriendRequest(const QString &from, const QString &to);
+    QFuture<qint64> deleteFriend(const QString &user, const QString &friendName);
     QStringList getFriendList(const QString &user);
+    // FriendList 响应：好友昵称和已设置头像的好友的头像版本
+    QJsonObject friendListResponse(const QString &user);
     QStringList getFriendRequests(const QString &user);
-    bool saveChatMessage(const QString &from, const QString &to, const QString &content);
-    QJsonArray getChatHistory(const QString &user1, const QString &user2);
-    QString searchUser(const QString &query);
-    void updateUserStatus(const QString &nickname, bool isOnline);
-    void handleLogout(ClientInfo *clientInfo);
+    QJsonArray getChatHistory(const QString &user1, const QString &user2, const HistoryPage &page, bool &hasMore);
+    // 按昵称或邮箱前缀搜索用户，返回排序后的一页昵称
+    QStringList searchUsers(const QString &query, int offset, int limit, bool &hasMore);
+    // 在用户可见的消息中搜索文本，返回 SearchMessages 响应（在数据库执行器中调用）
+    QJsonObject searchMessages(const QString &user, const QString &query, qint64 before, int limit);
+    QFuture<qint64> updateUserStatus(const QString &nickname, bool isOnline);
+    AsyncTask handleLogout(SessionPtr clientInfo);
+    AsyncTask handleUserOffline(QString nickname);
+    // 发送离线收件箱中消息 ID 大于 afterId 的一批消息（没有时不发送）
+    AsyncTask deliverOfflineMessages(QTcpSocket *clientSocket, qint64 userId, qint64 afterId);
+
+    // 在线把旧消息的 content 字符串拆分到内容列，完成前历史查询兼容未拆分的行
+    AsyncTask backfillMessageContent();
+
+    // 把发送时间早于保留期限的消息分块移入冷消息归档（定时执行，上一轮未结束时跳过）
+    AsyncTask archiveMessages();
+
+    // 在线为已有的文本消息补建全文索引
+    AsyncTask backfillSearchIndex();
+    // 新保存的文本消息提交给数据库写线程建立索引（不等待提交）
+    void indexMessage(const MessageSearch::Document &document);
+    // 图片消息保存后增加图片的引用计数（不等待提交）
+    void referenceImage(const MessageContent &content);
     void notifyFriendsStatusChange(const QString &nickname, bool isOnline);
     bool notifyFriendRequest(const QString &to, const QString &from);
-    bool deleteFriendRequest(const QString &from, const QString &to);
+    QFuture<qint64> deleteFriendRequest(const QString &from, const QString &to);
 
     // 用户个人信息相关函数
     QJsonObject getUserProfile(const QString &nickname);
-    bool updateUserProfile(const QString &nickname, const QJsonObject &profileData);
-    bool saveAvatar(const QString &nickname, const QByteArray &avatarData);
-    QByteArray getAvatar(const QString &nickname);
+    QFuture<qint64> updateUserProfile(const QString &nickname, const QJsonObject &profileData);
+    // 写入指定版本的头像文件（在文件 I/O 执行器中调用）
+    bool writeAvatarFile(const QString &avatarFileName, const QByteArray &avatarData);
+    // 提交用户的新头像版本，提交后更新内存中的头像表
+    QFuture<qint64> updateAvatar(qint64 userId, const QString &avatarFileName);
+    // 删除指定版本的头像文件和缓存（在文件 I/O 执行器中调用），nickname 为头像所属的用户，用于校验旧格式的文件名
+    void removeAvatarFile(const QString &avatarFileName, const QString &nickname);
+    // 读取指定版本的头像文件（优先从缓存读取），在文件 I/O 执行器中调用，nickname 同上
+    QByteArray getAvatar(const QString &avatarFileName, const QString &nickname);
 
     // 群聊相关函数
-    bool createGroup(const QString &creator, const QString &groupName, const QStringList &members);
+    // 创建成功时结果为新群聊的 ID
+    QFuture<qint64> createGroup(const QString &creator, const QString &groupName, const QStringList &members);
     QStringList getGroupList(const QString &user);
-    QStringList getGroupMembers(int groupId);
-    bool saveGroupChatMessage(int groupId, const QString &from, const QString &content);
-    QJsonArray getGroupChatHistory(int groupId);
-    bool notifyGroupMessage(int groupId, const QString &from, const QString &content);
+    // 从数据库读取群成员并填充群成员缓存（在数据库执行器中调用）
+    QList<qint64> loadGroupMembers(int groupId);
+    QJsonArray getGroupChatHistory(int groupId, const HistoryPage &page, bool &hasMore);
+    // msgData 为完整的群消息（格式与群聊历史记录中的消息相同）
+    // 把群消息发送给在线成员的会话（由调用者从群成员缓存中取得）
+    bool notifyGroupMessage(const QList<SessionPtr> &recipients, const QJsonObject &msgData);
     bool notifyGroupCreation(const QString &member, int groupId, const QString &groupName, const QString &creator);
 
     // 图片处理相关函数
-    bool saveImage(const QString &imageId, const QByteArray &imageData);
-    QByteArray getImage(const QString &imageId);
-    QString generateUniqueImageId(const QString &fileExtension);
+    // 计算图片的哈希并写入内容寻址存储，返回哈希（失败时为空字符串）；在文件 I/O 执行器中调用，
+    // 写入后还要由数据库写线程记录（ImageStore::record），之后上传前的查询才能找到该图片
+    QString saveImage(const QByteArray &imageData);
+    // 提交给图片处理执行器生成缩小版本（不等待）
+    void generateImageVariants(const QString &hash, const QByteArray &imageData);
+    // 读取图片的指定版本，没有该版本时读取原图，优先从缓存读取；在文件 I/O 执行器中调用
+    QByteArray readImage(const QString &imageId, ImageStore::Variant variant);
 
     // 分块图片上传相关函数
-    void handleChunkedImageStart(QTcpSocket *clientSocket, const QJsonObject &msgData, ClientInfo *clientInfo);
-    void handleChunkedImageChunk(QTcpSocket *clientSocket, const QJsonObject &msgData, ClientInfo *clientInfo);
-    void handleChunkedImageEnd(QTcpSocket *clientSocket, const QJsonObject &msgData, ClientInfo *clientInfo);
+    void handleChunkedImageStart(QTcpSocket *clientSocket, const QJsonObject &msgData, const SessionPtr &clientInfo);
+    void handleChunkedImageChunk(QTcpSocket *clientSocket, const QJsonObject &msgData, const SessionPtr &clientInfo);
+    AsyncTask handleChunkedImageEnd(QTcpSocket *clientSocket, QJsonObject msgData, SessionPtr clientInfo);
 
     // 临时存储分块上传的图片数据
     struct ChunkedImageData {
@@ -128,6 +274,7 @@ private:
         int height;
     };
     QMap<QString, ChunkedImageData> m_pendingChunkedImages;
+    QMutex m_chunkedImagesMutex;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,144 @@
+#include "sessionregistry.h"
+#include <QDebug>
+
+Session::Session(quint64 id, QTcpSocket *socket)
+    : m_id(id), m_socket(socket), m_isLoggedIn(false) {
+}
+
+bool Session::isLoggedIn() const {
+    QMutexLocker locker(&m_mutex);
+    return m_isLoggedIn;
+}
+
+QString Session::nickname() const {
+    QMutexLocker locker(&m_mutex);
+    return m_nickname;
+}
+
+SessionRegistry::SessionRegistry(QObject *parent)
+    : QObject(parent), m_listener(nullptr), m_nextId(1), m_connectionCount(0), m_onlineCount(0) {
+    for (int i = 0; i < ShardCount; ++i) {
+        m_socketShards[i].lock.init();
+        m_nicknameShards[i].lock.init();
+    }
+}
+
+SessionRegistry::~SessionRegistry() {
+}
+
+SessionRegistry::SocketShard &SessionRegistry::socketShard(QTcpSocket *socket) const {
+    return m_socketShards[qHash(reinterpret_cast<quintptr>(socket)) % ShardCount];
+}
+
+SessionRegistry::NicknameShard &SessionRegistry::nicknameShard(const QString &nickname) const {
+    return m_nicknameShards[qHash(nickname) % ShardCount];
+}
+
+SessionPtr SessionRegistry::add(QTcpSocket *socket) {
+    SessionPtr session(new Session(m_nextId.fetch_add(1, std::memory_order_relaxed), socket));
+
+    SocketShard &shard = socketShard(socket);
+    WriteLocker locker(&shard.lock);
+    shard.sessions.insert(socket, session);
+    m_connectionCount.fetch_add(1, std::memory_order_relaxed);
+    return session;
+}
+
+SessionPtr SessionRegistry::remove(QTcpSocket *socket) {
+    SessionPtr session;
+    {
+        SocketShard &shard = socketShard(socket);
+        WriteLocker locker(&shard.lock);
+        session = shard.sessions.take(socket);
+    }
+
+    if (session) {
+        m_connectionCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return session;
+}
+
+SessionPtr SessionRegistry::findBySocket(QTcpSocket *socket) const {
+    SocketShard &shard = socketShard(socket);
+    ReadLocker locker(&shard.lock);
+    return shard.sessions.value(socket);
+}
+
+SessionPtr SessionRegistry::findByNickname(const QString &nickname) const {
+    NicknameShard &shard = nicknameShard(nickname);
+    ReadLocker locker(&shard.lock);
+    return shard.sessions.value(nickname);
+}
+
+void SessionRegistry::login(const SessionPtr &session, const QString &nickname) {
+    if (!session) return;
+
+    QString previousNickname;
+    bool wasLoggedIn;
+    {
+        QMutexLocker locker(&session->m_mutex);
+        wasLoggedIn = session->m_isLoggedIn;
+        previousNickname = session->m_nickname;
+        session->m_isLoggedIn = true;
+        session->m_nickname = nickname;
+    }
+
+    // 同一连接切换账号时先解除旧昵称的绑定
+    if (wasLoggedIn && previousNickname != nickname) {
+        unbindNickname(session, previousNickname);
+    }
+
+    {
+        NicknameShard &shard = nicknameShard(nickname);
+        WriteLocker locker(&shard.lock);
+        // 同一用户再次登录时替换旧会话的绑定，在线人数不变
+        auto it = shard.sessions.find(nickname);
+        if (it == shard.sessions.end()) {
+            shard.sessions.insert(nickname, session);
+            m_onlineCount.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            it.value() = session;
+        }
+    }
+
+    if (m_listener) {
+        m_listener->sessionBound(nickname, session);
+    }
+}
+
+QString SessionRegistry::logout(const SessionPtr &session) {
+    if (!session) return QString();
+
+    QString nickname;
+    {
+        QMutexLocker locker(&session->m_mutex);
+        if (!session->m_isLoggedIn) {
+            return QString();
+        }
+        nickname = session->m_nickname;
+        session->m_isLoggedIn = false;
+        session->m_nickname.clear();
+    }
+
+    unbindNickname(session, nickname);
+    return nickname;
+}
+
+void SessionRegistry::unbindNickname(const SessionPtr &session, const QString &nickname) {
+    bool unbound = false;
+    {
+        NicknameShard &shard = nicknameShard(nickname);
+        WriteLocker locker(&shard.lock);
+        auto it = shard.sessions.find(nickname);
+        // 昵称已被同一用户的新会话绑定时保留新会话
+        if (it != shard.sessions.end() && it.value() == session) {
+            shard.sessions.erase(it);
+            m_onlineCount.fetch_sub(1, std::memory_order_relaxed);
+            unbound = true;
+        }
+    }
+
+    if (unbound && m_listener) {
+        m_listener->sessionUnbound(nickname, session);
+    }
+}
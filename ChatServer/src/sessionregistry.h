@@ -0,0 +1,116 @@
+#ifndef SESSIONREGISTRY_H
+#define SESSIONREGISTRY_H
+
+#include <QObject>
+#include <QHash>
+#include <QMutex>
+#include <QPointer>
+#include <QSharedPointer>
+#include <QString>
+#include <QTcpSocket>
+#include <atomic>
+#include "../Common/messageframer.h"
+#include "readwritelock.h"
+
+// 客户端会话，通过引用计数的句柄（SessionPtr）访问，连接断开后句柄依然有效
+class Session {
+public:
+    Session(quint64 id, QTcpSocket *socket);
+
+    quint64 id() const { return m_id; }
+    // socket 被销毁后返回 nullptr
+    QTcpSocket *socket() const { return m_socket.data(); }
+
+    bool isLoggedIn() const;
+    QString nickname() const;
+
+    // 入站数据分帧器，只能在 I/O 线程中访问
+    MessageFramer &framer() { return m_framer; }
+
+private:
+    friend class SessionRegistry;
+
+    const quint64 m_id;
+    const QPointer<QTcpSocket> m_socket;
+    MessageFramer m_framer;
+
+    // 登录状态由 SessionRegistry 修改，读取可在任意线程进行
+    mutable QMutex m_mutex;
+    bool m_isLoggedIn;
+    QString m_nickname;
+};
+
+typedef QSharedPointer<Session> SessionPtr;
+
+// 会话在线状态的监听者
+// 昵称绑定到会话（登录）或解除绑定（登出、断开）后，在调用 login / logout 的线程中调用，调用时不持有注册表的锁
+class SessionListener {
+public:
+    virtual ~SessionListener() {}
+    virtual void sessionBound(const QString &nickname, const SessionPtr &session) = 0;
+    virtual void sessionUnbound(const QString &nickname, const SessionPtr &session) = 0;
+};
+
+// 在线会话注册表
+// 按 socket 和昵称分别建立分片哈希表，每个分片一把读写锁，查找代价为 O(1)，与在线人数无关
+class SessionRegistry : public QObject {
+    Q_OBJECT
+public:
+    explicit SessionRegistry(QObject *parent = nullptr);
+    ~SessionRegistry();
+
+    // 新连接建立时注册会话
+    SessionPtr add(QTcpSocket *socket);
+
+    // 连接断开时移除会话，返回被移除的会话（调用者需再调用 logout() 解除昵称绑定）
+    SessionPtr remove(QTcpSocket *socket);
+
+    // 按 socket 查找会话
+    SessionPtr findBySocket(QTcpSocket *socket) const;
+
+    // 按昵称查找已登录的会话
+    SessionPtr findByNickname(const QString &nickname) const;
+
+    // 标记会话已登录并绑定昵称（同一昵称重复登录时，以最新的会话为准）
+    void login(const SessionPtr &session, const QString &nickname);
+
+    // 标记会话已登出并解除昵称绑定，返回登出前的昵称（未登录时返回空字符串）
+    QString logout(const SessionPtr &session);
+
+    // 设置在线状态监听者（启动时、接受连接之前设置）
+    void setListener(SessionListener *listener) { m_listener = listener; }
+
+    // 当前连接数 / 在线用户数（已绑定的昵称数，同一用户重复登录只计一次）
+    int connectionCount() const { return m_connectionCount.load(std::memory_order_relaxed); }
+    int onlineCount() const { return m_onlineCount.load(std::memory_order_relaxed); }
+
+private:
+    static const int ShardCount = 64;
+
+    struct SocketShard {
+        ReadWriteLock lock;
+        QHash<QTcpSocket*, SessionPtr> sessions;
+    };
+
+    struct NicknameShard {
+        ReadWriteLock lock;
+        QHash<QString, SessionPtr> sessions;
+    };
+
+    SocketShard &socketShard(QTcpSocket *socket) const;
+    NicknameShard &nicknameShard(const QString &nickname) const;
+
+    // 解除昵称绑定（仅当该昵称当前绑定的就是此会话时）
+    void unbindNickname(const SessionPtr &session, const QString &nickname);
+
+    mutable SocketShard m_socketShards[ShardCount];
+    mutable NicknameShard m_nicknameShards[ShardCount];
+
+    SessionListener *m_listener;
+
+    std::atomic<quint64> m_nextId;
+    std::atomic<int> m_connectionCount;
+    std::atomic<int> m_onlineCount;
+};
+
+#endif // SESSIONREGISTRY_H
@@ -0,0 +1,222 @@
+#include "sqlitemessagestore.h"
+#include "conversation.h"
+#include "dbconnection.h"
+#include "dbwriter.h"
+#include "messagearchive.h"
+#include "offlineinbox.h"
+#include <QDebug>
+#include <QSqlError>
+#include <QVariant>
+#include <limits>
+#include <memory>
+
+// 查询的内容列，顺序与 readContent 对应
+static const char *const ContentColumns = "kind, text, image_id, width, height, content";
+
+// 从 first 列开始读取内容列；尚未回填内容列的旧数据（kind 为 NULL）才解析 content 字符串
+static MessageContent readContent(const QSqlQuery &query, int first) {
+    QVariant kind = query.value(first);
+    if (kind.isNull()) {
+        return MessageContent::fromLegacy(query.value(first + 5).toString());
+    }
+    return MessageContent::fromColumns(kind.toInt(), query.value(first + 1).toString(), query.value(first + 2).toString(),
+                                       query.value(first + 3).toInt(), query.value(first + 4).toInt());
+}
+
+SqliteMessageStore::SqliteMessageStore(DbWriter *writer, DbConnectionPool *connections)
+    : m_writer(writer), m_connections(connections) {
+}
+
+// 写线程在完成 id 的 future 之前写入序号，在完成的线程中同步转换为保存结果
+static QFuture<SavedMessage> toSaved(const QFuture<qint64> &id, const std::shared_ptr<qint64> &seq,
+                                     bool queuedOffline = false) {
+    return id.then(QtFuture::Launch::Sync, [seq, queuedOffline](qint64 messageId) {
+        SavedMessage saved;
+        saved.id = messageId;
+        saved.seq = messageId < 0 ? 0 : *seq;
+        saved.queuedOffline = messageId >= 0 && queuedOffline;
+        return saved;
+    });
+}
+
+QFuture<SavedMessage> SqliteMessageStore::saveChatMessage(qint64 fromId, qint64 toId,
+                                                          const MessageContent &content, qint64 sentAt,
+                                                          const InboxPayload &inbox) {
+    std::shared_ptr<qint64> seq = std::make_shared<qint64>(0);
+    DbWriter::InsertFollowup followup;
+    if (inbox) {
+        // 离线收件箱的条目与消息在同一个保存点中写入，一起提交或回滚
+        followup = [toId, inbox](DbConnection &conn, qint64 id, qint64 seq) {
+            SavedMessage saved;
+            saved.id = id;
+            saved.seq = seq;
+            return OfflineInbox::push(conn, toId, id, inbox(saved));
+        };
+    }
+    return toSaved(m_writer->insertMessage(fromId, toId, content, sentAt, seq, followup), seq, bool(inbox));
+}
+
+QFuture<SavedMessage> SqliteMessageStore::saveGroupChatMessage(int groupId, qint64 fromId,
+                                                               const MessageContent &content, qint64 sentAt) {
+    std::shared_ptr<qint64> seq = std::make_shared<qint64>(0);
+    return toSaved(m_writer->insertGroupMessage(groupId, fromId, content, sentAt, seq), seq);
+}
+
+QList<StoredMessage> SqliteMessageStore::getChatHistory(qint64 userId1, qint64 userId2,
+                                                        const HistoryPage &page, bool &hasMore) {
+    QList<StoredMessage> rows;
+    hasMore = false;
+
+    // WAL 模式下读连接读取一致的快照，不再需要读写锁和数据库信号量串行化读取
+    DbConnection *conn = m_connections->connection();
+    if (!conn || !conn->isOpen()) {
+        qDebug() << "无法获取数据库读连接";
+        return rows;
+    }
+
+    // 按会话键走 (conversation_id, seq) 索引的范围扫描
+    QString where = "conversation_id = :conversation";
+    qint64 conversation = Conversation::privateKey(userId1, userId2);
+    auto readHot = [&](const HistoryPage &hotPage) {
+        rows.clear();
+        QSqlQuery &query = conn->prepare(hotPage.buildQuery(QString("id, from_id, to_id, seq, sent_at, %1").arg(ContentColumns), "messages", where));
+        query.bindValue(":conversation", conversation);
+        if (hotPage.direction() != HistoryPage::Latest) {
+            query.bindValue(":anchor", hotPage.anchor());
+        }
+        query.bindValue(":limit", hotPage.fetchLimit());
+
+        if (!query.exec()) {
+            qDebug() << "获取聊天历史失败:" << query.lastError().text();
+            return false;
+        }
+        while (query.next()) {
+            StoredMessage message;
+            message.id = query.value(0).toLongLong();
+            message.fromId = query.value(1).toLongLong();
+            message.toId = query.value(2).toLongLong();
+            message.seq = query.value(3).toLongLong();
+            message.sentAt = query.value(4).toLongLong();
+            message.content = readContent(query, 5);
+            rows.append(message);
+        }
+        return true;
+    };
+    if (!readHot(page)) {
+        return rows;
+    }
+    readArchive(*conn, "messages", conversation, page, readHot, rows);
+    page.finish(rows, hasMore);
+    return rows;
+}
+
+QList<StoredMessage> SqliteMessageStore::getGroupChatHistory(int groupId, const HistoryPage &page, bool &hasMore) {
+    QList<StoredMessage> rows;
+    hasMore = false;
+
+    DbConnection *conn = m_connections->connection();
+    if (!conn || !conn->isOpen()) {
+        qDebug() << "无法获取数据库读连接";
+        return rows;
+    }
+
+    // 群 ID 即会话键，走 (group_id, seq) 索引的范围扫描
+    auto readHot = [&](const HistoryPage &hotPage) {
+        rows.clear();
+        QSqlQuery &query = conn->prepare(hotPage.buildQuery(QString("id, from_id, seq, sent_at, %1").arg(ContentColumns),
+                                                            "group_messages", "group_id = :group"));
+        query.bindValue(":group", groupId);
+        if (hotPage.direction() != HistoryPage::Latest) {
+            query.bindValue(":anchor", hotPage.anchor());
+        }
+        query.bindValue(":limit", hotPage.fetchLimit());
+
+        if (!query.exec()) {
+            qDebug() << "获取群聊历史记录失败：" << query.lastError().text();
+            return false;
+        }
+        while (query.next()) {
+            StoredMessage message;
+            message.id = query.value(0).toLongLong();
+            message.fromId = query.value(1).toLongLong();
+            message.toId = groupId;
+            message.seq = query.value(2).toLongLong();
+            message.sentAt = query.value(3).toLongLong();
+            message.content = readContent(query, 4);
+            rows.append(message);
+        }
+        return true;
+    };
+    if (!readHot(page)) {
+        return rows;
+    }
+    readArchive(*conn, "group_messages", Conversation::groupKey(groupId), page, readHot, rows);
+    page.finish(rows, hasMore);
+    return rows;
+}
+
+void SqliteMessageStore::readArchive(DbConnection &conn, const QString &table, qint64 conversation, const HistoryPage &page,
+                                     const std::function<bool(const HistoryPage &)> &readHot,
+                                     QList<StoredMessage> &rows) {
+    // 同一会话中归档的序号都小于热表中的序号
+    int wanted = page.fetchLimit();
+    HistoryPage effective = page;
+    if (rows.isEmpty() && page.direction() != HistoryPage::Latest && !page.anchorIsSeq()) {
+        // 热表中没有结果时把消息 id 游标换算为序号（游标可能已归档，或是热表中最早 / 最新的一条），再重新读取
+        qint64 seq = 0;
+        QSqlQuery &anchor = conn.prepare(QString("SELECT seq FROM %1 WHERE id = ?").arg(table));
+        anchor.addBindValue(page.anchor());
+        if (anchor.exec() && anchor.next()) {
+            seq = anchor.value(0).toLongLong();
+        }
+        anchor.finish();
+        if (seq == 0) {
+            seq = MessageArchive::seqOf(conn, conversation, page.anchor());
+        }
+        if (seq == 0) {
+            return;
+        }
+        effective = page.withSeqAnchor(seq);
+        if (effective.direction() == HistoryPage::After && !readHot(effective)) {
+            return;
+        }
+    }
+
+    if (effective.direction() == HistoryPage::After) {
+        // 游标在热表中时归档里没有更晚的消息；否则先取归档中游标之后的消息，再接上热表
+        if (!effective.anchorIsSeq()) {
+            return;
+        }
+        QList<StoredMessage> archived;
+        if (!MessageArchive::readAfter(conn, conversation, effective.anchor(), wanted, archived) || archived.isEmpty()) {
+            return;
+        }
+        archived.append(rows);
+        if (archived.size() > wanted) {
+            archived.erase(archived.begin() + wanted, archived.end());
+        }
+        rows = archived;
+        return;
+    }
+
+    // 热表不足一页时从归档中接着往前读（热表的一页已满时不访问归档）
+    if (rows.size() >= wanted) {
+        return;
+    }
+    qint64 beforeSeq;
+    if (!rows.isEmpty()) {
+        beforeSeq = rows.last().seq;
+    } else if (effective.direction() == HistoryPage::Latest) {
+        beforeSeq = std::numeric_limits<qint64>::max();
+    } else if (effective.anchorIsSeq()) {
+        beforeSeq = effective.anchor();
+    } else {
+        return;
+    }
+    MessageArchive::readBefore(conn, conversation, beforeSeq, wanted - int(rows.size()), rows);
+}
+
+QString SqliteMessageStore::statsReport() const {
+    // 写入统计由数据库写线程输出
+    return QString("[message_store] engine=sqlite");
+}
@@ -0,0 +1,39 @@
+#ifndef SQLITEMESSAGESTORE_H
+#define SQLITEMESSAGESTORE_H
+
+#include <functional>
+#include "messagestore.h"
+
+class DbWriter;
+class DbConnection;
+class DbConnectionPool;
+
+// SQLite 消息存储（默认引擎）
+// 写入交给数据库写线程组提交，读取使用调用线程的读连接，
+// 历史记录走 (conversation_id, seq) / (group_id, seq) 索引的范围扫描，热表不足一页时接着读取冷消息归档（见 MessageArchive）。
+class SqliteMessageStore : public MessageStore {
+public:
+    SqliteMessageStore(DbWriter *writer, DbConnectionPool *connections);
+
+    QFuture<SavedMessage> saveChatMessage(qint64 fromId, qint64 toId,
+                                          const MessageContent &content, qint64 sentAt,
+                                          const InboxPayload &inbox = InboxPayload()) override;
+    QFuture<SavedMessage> saveGroupChatMessage(int groupId, qint64 fromId,
+                                               const MessageContent &content, qint64 sentAt) override;
+    QList<StoredMessage> getChatHistory(qint64 userId1, qint64 userId2,
+                                        const HistoryPage &page, bool &hasMore) override;
+    QList<StoredMessage> getGroupChatHistory(int groupId, const HistoryPage &page, bool &hasMore) override;
+
+    QString engineName() const override { return "sqlite"; }
+    QString statsReport() const override;
+
+private:
+    // 合并归档中的消息：rows 为热表按扫描方向取出的结果，readHot 按给定分页重新读取热表
+    static void readArchive(DbConnection &conn, const QString &table, qint64 conversation, const HistoryPage &page,
+                            const std::function<bool(const HistoryPage &)> &readHot, QList<StoredMessage> &rows);
+
+    DbWriter *m_writer;
+    DbConnectionPool *m_connections;
+};
+
+#endif // SQLITEMESSAGESTORE_H
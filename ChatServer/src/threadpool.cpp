@@ -1,7 +1,10 @@
 #include "threadpool.h"
 #include <QDebug>
+#include <QStringList>
+#include <time.h>
 
-Worker::Worker(QObject *parent) : QThread(parent), m_taskQueue(nullptr), m_mutex(nullptr), m_condition(nullptr), m_stop(false) {
+Worker::Worker(ThreadPool *pool, int index, QObject *parent)
+    : QThread(parent), m_pool(pool), m_index(index), m_stop(false), m_busyNs(0), m_idleNs(0), m_taskCount(0) {
 }
 
 Worker::~Worker() {
@@ -9,65 +12,60 @@ Worker::~Worker() {
     wait();
 }
 
-void Worker::setTaskQueue(QQueue<std::function<void()>> *taskQueue, QMutex *mutex, QWaitCondition *condition) {
-    m_taskQueue = taskQueue;
-    m_mutex = mutex;
-    m_condition = condition;
-}
-
 void Worker::stop() {
-    QMutexLocker locker(m_mutex);
+    QMutexLocker locker(&m_pool->m_mutex);
     m_stop = true;
-    m_condition->wakeAll();
+    m_pool->m_condition.wakeAll();
 }
 
 void Worker::run() {
     qDebug() << "Worker thread started:" << QThread::currentThreadId();
-    
-    while (true) {
-        std::function<void()> task;
-        
-        {
-            QMutexLocker locker(m_mutex);
-            
-            // 等待任务或停止信号
-            while (!m_stop && m_taskQueue->isEmpty()) {
-                m_condition->wait(m_mutex);
-            }
-            
-            // 检查是否需要停止
-            if (m_stop) {
-                break;
-            }
-            
-            // 获取任务
-            if (!m_taskQueue->isEmpty()) {
-                task = m_taskQueue->dequeue();
-            }
-        }
-        
+
+    if (m_pool->m_threadInitializer) {
+        m_pool->m_threadInitializer(m_index);
+    }
+
+    qint64 idleStart = ThreadPool::nowNs();
+    PoolTask task;
+    while (m_pool->takeTask(m_stop, task)) {
+        qint64 start = ThreadPool::nowNs();
+        m_idleNs.fetch_add(start - idleStart, std::memory_order_relaxed);
+
         // 执行任务
-        if (task) {
-            try {
-                task();
-            } catch (const std::exception &e) {
-                qDebug() << "Exception in worker thread:" << e.what();
-            } catch (...) {
-                qDebug() << "Unknown exception in worker thread";
-            }
+        try {
+            task.fn();
+        } catch (const std::exception &e) {
+            qDebug() << "Exception in worker thread:" << e.what();
+        } catch (...) {
+            qDebug() << "Unknown exception in worker thread";
         }
+
+        qint64 end = ThreadPool::nowNs();
+        m_busyNs.fetch_add(end - start, std::memory_order_relaxed);
+        m_taskCount.fetch_add(1, std::memory_order_relaxed);
+        m_pool->finishTask(task, start, end);
+
+        // 尽早释放任务持有的资源
+        task.fn = nullptr;
+        idleStart = end;
     }
-    
+
     qDebug() << "Worker thread stopped:" << QThread::currentThreadId();
 }
 
-ThreadPool::ThreadPool(QObject *parent) : QObject(parent), m_stop(false) {
+ThreadPool::ThreadPool(QObject *parent)
+    : QObject(parent), m_name("pool"), m_stop(false), m_pendingCount(0), m_activeCount(0),
+      m_highWaterMark(0), m_taskClassCount(1) {
+    m_taskClasses[0].name = "default";
 }
 
 ThreadPool::~ThreadPool() {
-    m_stop = true;
-    m_condition.wakeAll();
-    
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stop = true;
+        m_condition.wakeAll();
+    }
+
     for (Worker *worker : m_workers) {
         worker->stop();
         worker->wait();
@@ -80,39 +78,170 @@ bool ThreadPool::init(int threadCount) {
         qDebug() << "Invalid thread count:" << threadCount;
         return false;
     }
-    
+
     // 创建工作线程
     for (int i = 0; i < threadCount; ++i) {
-        Worker *worker = new Worker(this);
-        worker->setTaskQueue(&m_taskQueue, &m_mutex, &m_condition);
+        Worker *worker = new Worker(this, i, this);
         m_workers.append(worker);
         worker->start();
     }
-    
+
     qDebug() << "Thread pool initialized with" << threadCount << "threads";
     return true;
 }
 
-void ThreadPool::addTask(const std::function<void()> &task) {
+int ThreadPool::registerTaskClass(const QString &name) {
     QMutexLocker locker(&m_mutex);
-    
+
+    int count = m_taskClassCount.load(std::memory_order_relaxed);
+    for (int i = 0; i < count; ++i) {
+        if (m_taskClasses[i].name == name) {
+            return i;
+        }
+    }
+
+    if (count >= MaxTaskClasses) {
+        qDebug() << "Too many task classes, using default for:" << name;
+        return 0;
+    }
+
+    m_taskClasses[count].name = name;
+    m_taskClassCount.store(count + 1, std::memory_order_release);
+    return count;
+}
+
+void ThreadPool::addTask(const std::function<void()> &task, int taskClass) {
+    PoolTask poolTask;
+    poolTask.fn = task;
+    poolTask.enqueueNs = nowNs();
+    poolTask.taskClass = (taskClass >= 0 && taskClass < MaxTaskClasses) ? taskClass : 0;
+
+    QMutexLocker locker(&m_mutex);
+
     // 添加任务到队列
-    m_taskQueue.enqueue(task);
-    
+    m_taskQueue.enqueue(std::move(poolTask));
+
+    int pending = m_taskQueue.size();
+    m_pendingCount.store(pending, std::memory_order_relaxed);
+    if (pending > m_highWaterMark.load(std::memory_order_relaxed)) {
+        m_highWaterMark.store(pending, std::memory_order_relaxed);
+    }
+
     // 唤醒一个等待的线程
     m_condition.wakeOne();
 }
 
-void ThreadPool::waitForDone() {
+bool ThreadPool::takeTask(const bool &stop, PoolTask &task) {
     QMutexLocker locker(&m_mutex);
-    
-    // 等待任务队列为空
-    while (!m_taskQueue.isEmpty()) {
+
+    // 等待任务或停止信号
+    while (!stop && m_taskQueue.isEmpty()) {
         m_condition.wait(&m_mutex);
     }
+
+    // 检查是否需要停止
+    if (stop) {
+        return false;
+    }
+
+    // 获取任务
+    task = m_taskQueue.dequeue();
+    m_pendingCount.store(m_taskQueue.size(), std::memory_order_relaxed);
+    m_activeCount.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void ThreadPool::finishTask(const PoolTask &task, qint64 startNs, qint64 endNs) {
+    TaskClass &taskClass = m_taskClasses[task.taskClass];
+    taskClass.queueWait.record(quint64(startNs - task.enqueueNs));
+    taskClass.runTime.record(quint64(endNs - startNs));
+
+    // 最后一个任务完成时唤醒 waitForDone()
+    if (m_activeCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        QMutexLocker locker(&m_mutex);
+        m_doneCondition.wakeAll();
+    }
 }
 
-int ThreadPool::pendingTaskCount() {
+void ThreadPool::waitForDone() {
     QMutexLocker locker(&m_mutex);
-    return m_taskQueue.size();
+
+    // 等待任务队列为空且所有正在执行的任务完成
+    while (!m_taskQueue.isEmpty() || m_activeCount.load(std::memory_order_acquire) > 0) {
+        m_doneCondition.wait(&m_mutex);
+    }
+}
+
+QList<ThreadPool::TaskClassStats> ThreadPool::taskClassStats() const {
+    QList<TaskClassStats> result;
+    int count = m_taskClassCount.load(std::memory_order_acquire);
+    for (int i = 0; i < count; ++i) {
+        TaskClassStats stats;
+        stats.name = m_taskClasses[i].name;
+        stats.queueWait = m_taskClasses[i].queueWait.snapshot();
+        stats.runTime = m_taskClasses[i].runTime.snapshot();
+        result.append(stats);
+    }
+    return result;
+}
+
+QList<ThreadPool::WorkerStats> ThreadPool::workerStats() const {
+    QList<WorkerStats> result;
+    for (const Worker *worker : m_workers) {
+        WorkerStats stats;
+        stats.busyNs = worker->busyNs();
+        stats.idleNs = worker->idleNs();
+        stats.taskCount = worker->taskCount();
+        result.append(stats);
+    }
+    return result;
+}
+
+QString ThreadPool::statsReport() const {
+    QStringList lines;
+    lines << QString("[%1] threads=%2 pending=%3 active=%4 high_water=%5")
+                 .arg(m_name)
+                 .arg(size())
+                 .arg(pendingTaskCount())
+                 .arg(activeTaskCount())
+                 .arg(highWaterMark());
+
+    for (const TaskClassStats &stats : taskClassStats()) {
+        if (stats.runTime.count == 0) {
+            continue;
+        }
+        lines << QString("  %1 queue_wait: %2").arg(stats.name, stats.queueWait.toString());
+        lines << QString("  %1 run_time:   %2").arg(stats.name, stats.runTime.toString());
+    }
+
+    QList<WorkerStats> workers = workerStats();
+    for (int i = 0; i < workers.size(); ++i) {
+        const WorkerStats &stats = workers[i];
+        quint64 total = stats.busyNs + stats.idleNs;
+        double utilization = total ? 100.0 * stats.busyNs / total : 0.0;
+        lines << QString("  worker %1: tasks=%2 busy=%3 idle=%4 util=%5%")
+                     .arg(i)
+                     .arg(stats.taskCount)
+                     .arg(LatencyHistogram::formatNs(stats.busyNs))
+                     .arg(LatencyHistogram::formatNs(stats.idleNs))
+                     .arg(utilization, 0, 'f', 1);
+    }
+
+    return lines.join('\n');
+}
+
+void ThreadPool::resetStats() {
+    int count = m_taskClassCount.load(std::memory_order_acquire);
+    for (int i = 0; i < count; ++i) {
+        m_taskClasses[i].queueWait.reset();
+        m_taskClasses[i].runTime.reset();
+    }
+    m_highWaterMark.store(pendingTaskCount(), std::memory_order_relaxed);
+}
+
+qint64 ThreadPool::nowNs() {
+    // CLOCK_MONOTONIC 经 vDSO 读取，开销约 20ns
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
 }
@@ -7,59 +7,149 @@
 #include <QWaitCondition>
 #include <QQueue>
 #include <QList>
+#include <QString>
+#include <atomic>
 #include <functional>
+#include "latencyhistogram.h"
+
+class ThreadPool;
+
+// 线程池任务
+struct PoolTask {
+    std::function<void()> fn;
+    qint64 enqueueNs = 0;   // 入队时间（单调时钟，纳秒）
+    int taskClass = 0;      // 任务类别，用于分类统计
+};
 
 // 工作线程类
 class Worker : public QThread {
     Q_OBJECT
 public:
-    Worker(QObject *parent = nullptr);
+    Worker(ThreadPool *pool, int index, QObject *parent = nullptr);
     ~Worker();
 
-    // 设置任务队列和相关同步对象
-    void setTaskQueue(QQueue<std::function<void()>> *taskQueue, QMutex *mutex, QWaitCondition *condition);
-    
     // 停止线程
     void stop();
 
+    // 累计忙碌 / 空闲时间（纳秒）和已执行任务数，运行中可随时读取
+    quint64 busyNs() const { return m_busyNs.load(std::memory_order_relaxed); }
+    quint64 idleNs() const { return m_idleNs.load(std::memory_order_relaxed); }
+    quint64 taskCount() const { return m_taskCount.load(std::memory_order_relaxed); }
+
 protected:
     void run() override;
 
 private:
-    QQueue<std::function<void()>> *m_taskQueue;
-    QMutex *m_mutex;
-    QWaitCondition *m_condition;
+    ThreadPool *m_pool;
+    int m_index;
     bool m_stop;
+
+    std::atomic<quint64> m_busyNs;
+    std::atomic<quint64> m_idleNs;
+    std::atomic<quint64> m_taskCount;
 };
 
 // 线程池类
+// 内置统计：每个任务记录入队时间，按任务类别统计排队等待时间和执行时间的直方图，
+// 同时统计每个工作线程的忙碌/空闲时间和任务队列的最高水位。统计数据运行中可随时读取。
 class ThreadPool : public QObject {
     Q_OBJECT
 public:
+    // 最多支持的任务类别数，类别 0 为默认类别
+    static const int MaxTaskClasses = 16;
+
+    // 单个任务类别的统计
+    struct TaskClassStats {
+        QString name;
+        LatencyHistogram::Snapshot queueWait;   // 排队等待时间
+        LatencyHistogram::Snapshot runTime;     // 执行时间
+    };
+
+    // 单个工作线程的统计
+    struct WorkerStats {
+        quint64 busyNs;
+        quint64 idleNs;
+        quint64 taskCount;
+    };
+
     explicit ThreadPool(QObject *parent = nullptr);
     ~ThreadPool();
 
     // 初始化线程池
     bool init(int threadCount = QThread::idealThreadCount());
-    
+
+    // 设置线程池名称（用于统计输出）
+    void setName(const QString &name) { m_name = name; }
+    QString name() const { return m_name; }
+
+    // 设置工作线程启动时执行的初始化函数（参数为工作线程序号），必须在 init() 之前调用
+    // 用于绑定 CPU 等只能在线程内部完成的设置
+    void setThreadInitializer(const std::function<void(int index)> &initializer) { m_threadInitializer = initializer; }
+
+    // 注册任务类别，返回类别编号；类别数已满时返回默认类别 0
+    int registerTaskClass(const QString &name);
+
     // 添加任务到线程池
-    void addTask(const std::function<void()> &task);
-    
-    // 等待所有任务完成
+    void addTask(const std::function<void()> &task, int taskClass = 0);
+
+    // 等待所有任务完成（队列为空且没有正在执行的任务）
     void waitForDone();
-    
+
     // 获取线程池大小
     int size() const { return m_workers.size(); }
-    
-    // 获取等待中的任务数量
-    int pendingTaskCount();
+
+    // 获取等待中的任务数量（无锁读取）
+    int pendingTaskCount() const { return m_pendingCount.load(std::memory_order_relaxed); }
+
+    // 获取正在执行的任务数量
+    int activeTaskCount() const { return m_activeCount.load(std::memory_order_relaxed); }
+
+    // 任务队列的最高水位
+    int highWaterMark() const { return m_highWaterMark.load(std::memory_order_relaxed); }
+
+    // 读取统计数据
+    QList<TaskClassStats> taskClassStats() const;
+    QList<WorkerStats> workerStats() const;
+
+    // 生成多行统计报告
+    QString statsReport() const;
+
+    // 清空统计数据
+    void resetStats();
+
+    // 单调时钟（纳秒）
+    static qint64 nowNs();
 
 private:
+    friend class Worker;
+
+    // 每个任务类别一组直方图
+    struct TaskClass {
+        QString name;
+        LatencyHistogram queueWait;
+        LatencyHistogram runTime;
+    };
+
+    // 工作线程取任务，线程池停止时返回 false
+    bool takeTask(const bool &stop, PoolTask &task);
+    // 工作线程完成任务后调用
+    void finishTask(const PoolTask &task, qint64 startNs, qint64 endNs);
+
+    QString m_name;
+    std::function<void(int index)> m_threadInitializer;
     QList<Worker*> m_workers;
-    QQueue<std::function<void()>> m_taskQueue;
+    QQueue<PoolTask> m_taskQueue;
     QMutex m_mutex;
     QWaitCondition m_condition;
+    QWaitCondition m_doneCondition;
     bool m_stop;
+
+    std::atomic<int> m_pendingCount;
+    std::atomic<int> m_activeCount;
+    std::atomic<int> m_highWaterMark;
+
+    TaskClass m_taskClasses[MaxTaskClasses];
+    std::atomic<int> m_taskClassCount;
 };
 
 #endif // THREADPOOL_H
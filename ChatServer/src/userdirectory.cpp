@@ -0,0 +1,307 @@
+#include "userdirectory.h"
+#include "threadpool.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariant>
+#include <algorithm>
+
+// 增量表达到 max(MinMergeUsers, 已有用户数 / MergeRatio) 时归并，归并的均摊代价与用户数无关
+static const int MinMergeUsers = 1024;
+static const int MergeRatio = 32;
+
+static std::string_view viewOf(const QByteArray &key) {
+    return std::string_view(key.constData(), size_t(key.size()));
+}
+
+void UserDirectory::SortedKeys::append(std::string_view key, qint64 userId) {
+    Entry entry;
+    entry.userId = userId;
+    entry.offset = quint32(pool.size());
+    entry.length = quint32(key.size());
+    pool.insert(pool.end(), key.begin(), key.end());
+    entries.push_back(entry);
+}
+
+void UserDirectory::SortedKeys::sort() {
+    std::sort(entries.begin(), entries.end(), [this](const Entry &a, const Entry &b) {
+        int order = keyOf(a).compare(keyOf(b));
+        return order != 0 ? order < 0 : a.userId < b.userId;
+    });
+}
+
+UserDirectory::SortedKeys UserDirectory::SortedKeys::merged(const std::vector<std::pair<QByteArray, qint64>> &added) const {
+    SortedKeys result;
+    size_t addedBytes = 0;
+    for (const auto &key : added) {
+        addedBytes += size_t(key.first.size());
+    }
+    result.pool.reserve(pool.size() + addedBytes);
+    result.entries.reserve(entries.size() + added.size());
+
+    size_t i = 0;
+    size_t j = 0;
+    while (i < entries.size() || j < added.size()) {
+        bool takeAdded = i == entries.size()
+                         || (j < added.size() && viewOf(added[j].first) < keyOf(entries[i]));
+        if (takeAdded) {
+            result.append(viewOf(added[j].first), added[j].second);
+            ++j;
+        } else {
+            result.append(keyOf(entries[i]), entries[i].userId);
+            ++i;
+        }
+    }
+    return result;
+}
+
+UserDirectory::UserDirectory(QObject *parent)
+    : QObject(parent), m_index(std::make_shared<Index>()), m_mergeExecutor(nullptr), m_mergeTaskClass(0),
+      m_mergeQueued(false) {
+    m_lock.init();
+}
+
+UserDirectory::~UserDirectory() {
+    m_lock.destroy();
+}
+
+void UserDirectory::setMergeExecutor(ThreadPool *executor) {
+    m_mergeExecutor = executor;
+    m_mergeTaskClass = executor ? executor->registerTaskClass("directory_merge") : 0;
+}
+
+QByteArray UserDirectory::normalize(const QString &text) {
+    return text.toCaseFolded().toUtf8();
+}
+
+bool UserDirectory::load(QSqlDatabase &db) {
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT id, nickname, email FROM users")) {
+        qDebug() << "加载用户目录失败:" << query.lastError().text();
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    load([&query](qint64 &id, QString &nickname, QString &email) {
+        if (!query.next()) {
+            return false;
+        }
+        id = query.value(0).toLongLong();
+        nickname = query.value(1).toString();
+        email = query.value(2).toString();
+        return true;
+    });
+    qDebug() << "用户目录已加载，共" << size() << "个用户，" << memoryBytes() / 1024 << "KB，耗时"
+             << timer.elapsed() << "ms";
+    return true;
+}
+
+void UserDirectory::load(const UserSource &next) {
+    std::shared_ptr<Index> index = std::make_shared<Index>();
+    qint64 id = 0;
+    QString nickname;
+    QString email;
+    while (next(id, nickname, email)) {
+        if (!nickname.isEmpty()) {
+            index->nicknames.append(viewOf(normalize(nickname)), id);
+        }
+        if (!email.isEmpty()) {
+            index->emails.append(viewOf(normalize(email)), id);
+        }
+        ++index->users;
+    }
+    for (SortedKeys *keys : {&index->nicknames, &index->emails}) {
+        keys->sort();
+        keys->pool.shrink_to_fit();
+        keys->entries.shrink_to_fit();
+    }
+
+    QMutexLocker mergeLocker(&m_mergeMutex);
+    WriteLocker locker(&m_lock);
+    m_index = index;
+    m_pending.clear();
+    m_pendingNicknames.clear();
+    m_pendingEmails.clear();
+}
+
+void UserDirectory::insert(qint64 id, const QString &nickname, const QString &email) {
+    PendingUser user;
+    user.id = id;
+    user.nickname = normalize(nickname);
+    user.email = normalize(email);
+
+    bool full = false;
+    {
+        WriteLocker locker(&m_lock);
+        m_pending.append(user);
+        if (!user.nickname.isEmpty()) {
+            m_pendingNicknames.insert(user.nickname, id);
+        }
+        if (!user.email.isEmpty()) {
+            m_pendingEmails.insert(user.email, id);
+        }
+        full = m_pending.size() >= qMax(MinMergeUsers, m_index->users / MergeRatio);
+    }
+    if (!full) {
+        return;
+    }
+    if (!m_mergeExecutor) {
+        merge();
+    } else if (!m_mergeQueued.exchange(true)) {
+        // 插入可能来自数据库写线程的提交回调，归并交给线程池，不在这里等待
+        m_mergeExecutor->addTask([this]() {
+            m_mergeQueued.store(false);
+            merge();
+        }, m_mergeTaskClass);
+    }
+}
+
+void UserDirectory::merge() {
+    // 已有线程在归并时不等待，新用户留在增量表中，下一次归并时处理
+    if (!m_mergeMutex.tryLock()) {
+        return;
+    }
+
+    std::shared_ptr<const Index> base;
+    QList<PendingUser> pending;
+    {
+        ReadLocker locker(&m_lock);
+        base = m_index;
+        pending = m_pending;
+    }
+
+    std::vector<std::pair<QByteArray, qint64>> nicknames;
+    std::vector<std::pair<QByteArray, qint64>> emails;
+    for (const PendingUser &user : std::as_const(pending)) {
+        if (!user.nickname.isEmpty()) {
+            nicknames.emplace_back(user.nickname, user.id);
+        }
+        if (!user.email.isEmpty()) {
+            emails.emplace_back(user.email, user.id);
+        }
+    }
+    std::sort(nicknames.begin(), nicknames.end());
+    std::sort(emails.begin(), emails.end());
+
+    // 在锁外生成新的有序数组，搜索继续使用旧快照和增量表
+    std::shared_ptr<Index> index = std::make_shared<Index>();
+    index->nicknames = base->nicknames.merged(nicknames);
+    index->emails = base->emails.merged(emails);
+    index->users = base->users + int(pending.size());
+
+    {
+        // 归并期间只会有新用户追加到增量表末尾，前 pending.size() 个就是已归并的用户
+        WriteLocker locker(&m_lock);
+        m_index = index;
+        for (const PendingUser &user : std::as_const(pending)) {
+            m_pendingNicknames.remove(user.nickname, user.id);
+            m_pendingEmails.remove(user.email, user.id);
+        }
+        m_pending.remove(0, pending.size());
+    }
+    m_mergeMutex.unlock();
+}
+
+QList<qint64> UserDirectory::search(const QString &prefix, int offset, int limit, int maxScan, bool &hasMore) const {
+    hasMore = false;
+    QByteArray key = normalize(prefix.trimmed());
+    if (key.isEmpty() || offset < 0 || limit <= 0) {
+        return QList<qint64>();
+    }
+    std::string_view wanted = viewOf(key);
+
+    // 每个用户只保留排序最靠前的一个匹配
+    struct Candidate {
+        qint64 userId;
+        bool exact;
+        int field;
+        quint32 length;
+    };
+    auto ranksBefore = [](const Candidate &a, const Candidate &b) {
+        if (a.exact != b.exact) {
+            return a.exact;
+        }
+        if (a.field != b.field) {
+            return a.field < b.field;
+        }
+        if (a.length != b.length) {
+            return a.length < b.length;
+        }
+        return a.userId < b.userId;
+    };
+    QHash<qint64, Candidate> best;
+    int scanned = 0;
+    auto consider = [&](qint64 userId, int field, size_t length) {
+        ++scanned;
+        Candidate candidate{userId, length == wanted.size(), field, quint32(length)};
+        auto it = best.find(userId);
+        if (it == best.end()) {
+            best.insert(userId, candidate);
+        } else if (ranksBefore(candidate, it.value())) {
+            it.value() = candidate;
+        }
+    };
+    auto scanPending = [&](const QMultiMap<QByteArray, qint64> &keys, int field) {
+        for (auto it = keys.lowerBound(key); it != keys.cend() && scanned < maxScan; ++it) {
+            if (!it.key().startsWith(key)) {
+                break;
+            }
+            consider(it.value(), field, size_t(it.key().size()));
+        }
+    };
+    auto scanSorted = [&](const SortedKeys &keys, int field) {
+        auto it = std::lower_bound(keys.entries.begin(), keys.entries.end(), wanted,
+                                   [&keys](const SortedKeys::Entry &entry, std::string_view value) {
+                                       return keys.keyOf(entry) < value;
+                                   });
+        for (; it != keys.entries.end() && scanned < maxScan; ++it) {
+            std::string_view matched = keys.keyOf(*it);
+            if (!matched.starts_with(wanted)) {
+                break;
+            }
+            consider(it->userId, field, matched.size());
+        }
+    };
+
+    {
+        // 昵称匹配排在邮箱匹配之前，先扫描昵称
+        ReadLocker locker(&m_lock);
+        scanPending(m_pendingNicknames, 0);
+        scanSorted(m_index->nicknames, 0);
+        scanPending(m_pendingEmails, 1);
+        scanSorted(m_index->emails, 1);
+    }
+
+    std::vector<Candidate> candidates;
+    candidates.reserve(best.size());
+    for (auto it = best.cbegin(); it != best.cend(); ++it) {
+        candidates.push_back(it.value());
+    }
+    size_t end = qMin(candidates.size(), size_t(offset) + size_t(limit));
+    std::partial_sort(candidates.begin(), candidates.begin() + end, candidates.end(), ranksBefore);
+
+    QList<qint64> ids;
+    for (size_t i = size_t(offset); i < end; ++i) {
+        ids.append(candidates[i].userId);
+    }
+    hasMore = candidates.size() > end;
+    return ids;
+}
+
+int UserDirectory::size() const {
+    ReadLocker locker(&m_lock);
+    return m_index->users + int(m_pending.size());
+}
+
+qint64 UserDirectory::memoryBytes() const {
+    ReadLocker locker(&m_lock);
+    qint64 bytes = 0;
+    for (const SortedKeys *keys : {&m_index->nicknames, &m_index->emails}) {
+        bytes += qint64(keys->pool.capacity()) + qint64(keys->entries.capacity() * sizeof(SortedKeys::Entry));
+    }
+    return bytes;
+}
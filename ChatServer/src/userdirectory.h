@@ -0,0 +1,109 @@
+#ifndef USERDIRECTORY_H
+#define USERDIRECTORY_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QSqlDatabase>
+#include <QString>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include "readwritelock.h"
+
+class ThreadPool;
+
+// 用户目录（用户搜索的前缀索引）
+// 昵称和邮箱分别折叠大小写后编码为 UTF-8，按字节序排成两个有序数组：所有键连续存放在一块内存中，
+// 数组元素只记录键的偏移、长度和用户 ID。前缀查找先二分定位，再顺序扫描相邻的元素，不访问数据库。
+// 注册的新用户先进入一个小的增量表，增量表超过阈值时在后台线程池中与有序数组归并成新的快照再替换，
+// 归并期间搜索照常使用旧快照和增量表，插入不等待归并。
+// 排序规则：完全匹配优先，其次昵称匹配优先于邮箱匹配，再按匹配键的长度（越短越接近查询），最后按用户 ID。
+class UserDirectory : public QObject {
+    Q_OBJECT
+public:
+    explicit UserDirectory(QObject *parent = nullptr);
+    ~UserDirectory();
+
+    // 逐个取出用户，没有更多用户时返回 false
+    typedef std::function<bool(qint64 &id, QString &nickname, QString &email)> UserSource;
+
+    // 从 users 表加载（启动时在建表和迁移之后调用）
+    bool load(QSqlDatabase &db);
+
+    // 从任意来源加载（替换已有内容）
+    void load(const UserSource &next);
+
+    // 设置执行归并的线程池（未设置时在插入线程中归并）
+    void setMergeExecutor(ThreadPool *executor);
+
+    // 注册成功后加入新用户
+    void insert(qint64 id, const QString &nickname, const QString &email);
+
+    // 按前缀搜索，返回排序后第 offset 条起的最多 limit 个用户 ID；
+    // 每次最多检查 maxScan 个匹配的键（很短的前缀只在前 maxScan 个匹配中排序）
+    QList<qint64> search(const QString &prefix, int offset, int limit, int maxScan, bool &hasMore) const;
+
+    int size() const;
+
+    // 有序数组占用的内存（字节）
+    qint64 memoryBytes() const;
+
+    // 搜索使用的规范形式：折叠大小写后的 UTF-8
+    static QByteArray normalize(const QString &text);
+
+private:
+    // 一个字段（昵称或邮箱）的有序数组
+    struct SortedKeys {
+        struct Entry {
+            qint64 userId;
+            quint32 offset;
+            quint32 length;
+        };
+
+        std::string_view keyOf(const Entry &entry) const {
+            return std::string_view(pool.data() + entry.offset, entry.length);
+        }
+        void append(std::string_view key, qint64 userId);
+        void sort();
+        // 与按键排序的 added 归并成新的有序数组
+        SortedKeys merged(const std::vector<std::pair<QByteArray, qint64>> &added) const;
+
+        std::vector<char> pool;
+        std::vector<Entry> entries;
+    };
+
+    struct Index {
+        SortedKeys nicknames;
+        SortedKeys emails;
+        int users = 0;
+    };
+
+    struct PendingUser {
+        qint64 id;
+        QByteArray nickname;
+        QByteArray email;
+    };
+
+    // 把当前待归并的用户并入有序数组（在锁外生成新快照）
+    void merge();
+
+    mutable ReadWriteLock m_lock;
+    std::shared_ptr<const Index> m_index;
+    // 尚未归并的新用户（按注册顺序）及其键
+    QList<PendingUser> m_pending;
+    QMultiMap<QByteArray, qint64> m_pendingNicknames;
+    QMultiMap<QByteArray, qint64> m_pendingEmails;
+    // 同一时间只有一次归并
+    QMutex m_mergeMutex;
+    ThreadPool *m_mergeExecutor;
+    int m_mergeTaskClass;
+    // 已有归并任务在排队时不再提交
+    std::atomic<bool> m_mergeQueued;
+};
+
+#endif // USERDIRECTORY_H
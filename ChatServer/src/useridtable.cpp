@@ -0,0 +1,72 @@
+#include "useridtable.h"
+#include <QDebug>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariant>
+
+UserIdTable::UserIdTable(QObject *parent) : QObject(parent) {
+    m_lock.init();
+}
+
+UserIdTable::~UserIdTable() {
+    m_lock.destroy();
+}
+
+bool UserIdTable::load(QSqlDatabase &db) {
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT id, nickname FROM users WHERE nickname IS NOT NULL")) {
+        qDebug() << "加载用户 ID 表失败:" << query.lastError().text();
+        return false;
+    }
+
+    QHash<QString, qint64> ids;
+    QHash<qint64, QString> nicknames;
+    while (query.next()) {
+        qint64 id = query.value(0).toLongLong();
+        QString nickname = query.value(1).toString();
+        ids.insert(nickname, id);
+        nicknames.insert(id, nickname);
+    }
+
+    WriteLocker locker(&m_lock);
+    m_ids.swap(ids);
+    m_nicknames.swap(nicknames);
+    qDebug() << "用户 ID 表已加载，共" << m_ids.size() << "个用户";
+    return true;
+}
+
+qint64 UserIdTable::idOf(const QString &nickname) const {
+    ReadLocker locker(&m_lock);
+    return m_ids.value(nickname, 0);
+}
+
+QString UserIdTable::nicknameOf(qint64 id) const {
+    ReadLocker locker(&m_lock);
+    return m_nicknames.value(id);
+}
+
+QStringList UserIdTable::nicknamesOf(const QList<qint64> &ids) const {
+    QStringList nicknames;
+    nicknames.reserve(ids.size());
+
+    ReadLocker locker(&m_lock);
+    for (qint64 id : ids) {
+        auto it = m_nicknames.constFind(id);
+        if (it != m_nicknames.constEnd()) {
+            nicknames << it.value();
+        }
+    }
+    return nicknames;
+}
+
+void UserIdTable::insert(qint64 id, const QString &nickname) {
+    WriteLocker locker(&m_lock);
+    m_ids.insert(nickname, id);
+    m_nicknames.insert(id, nickname);
+}
+
+int UserIdTable::size() const {
+    ReadLocker locker(&m_lock);
+    return m_ids.size();
+}
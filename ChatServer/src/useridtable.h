@@ -0,0 +1,45 @@
+#ifndef USERIDTABLE_H
+#define USERIDTABLE_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+#include "readwritelock.h"
+
+// 用户 ID 表（昵称驻留）
+// 数据库内部统一以整数用户 ID（users.id）作为键，昵称只出现在协议层。
+// 启动时从 users 表加载全部 昵称↔ID 映射，注册新用户时追加。
+// 昵称注册后不会改变，映射只增不改，解析昵称或 ID 只需一次哈希表查找。
+class UserIdTable : public QObject {
+    Q_OBJECT
+public:
+    explicit UserIdTable(QObject *parent = nullptr);
+    ~UserIdTable();
+
+    // 从 users 表加载映射（启动时在建表和迁移之后调用）
+    bool load(QSqlDatabase &db);
+
+    // 昵称对应的用户 ID，未注册的昵称返回 0
+    qint64 idOf(const QString &nickname) const;
+
+    // 用户 ID 对应的昵称，未知 ID 返回空字符串
+    QString nicknameOf(qint64 id) const;
+
+    // 批量把用户 ID 转换为昵称（跳过未知 ID），只加一次读锁
+    QStringList nicknamesOf(const QList<qint64> &ids) const;
+
+    // 注册成功后加入新用户
+    void insert(qint64 id, const QString &nickname);
+
+    int size() const;
+
+private:
+    mutable ReadWriteLock m_lock;
+    QHash<QString, qint64> m_ids;
+    QHash<qint64, QString> m_nicknames;
+};
+
+#endif // USERIDTABLE_H
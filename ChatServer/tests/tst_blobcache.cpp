@@ -0,0 +1,108 @@
+#include <QtTest>
+#include <QByteArray>
+#include "blobcache.h"
+
+// 图片缓存：按 LRU 淘汰、过大的文件不缓存、准入过滤保护经常访问的文件、覆盖和移除
+class TestBlobCache : public QObject {
+    Q_OBJECT
+private slots:
+    void evictsLeastRecentlyUsed();
+    void skipsEmptyAndOversizedFiles();
+    void admissionKeepsFrequentFiles();
+    void putReplacesAndRemoveDrops();
+
+private:
+    // 一个分片，容量 4 个文件；单个文件最多占分片的四分之一
+    static const qint64 CacheBytes = 4000;
+    static const int FileBytes = 1000;
+
+    static QByteArray fileOf(const QString &key) { return QByteArray(FileBytes, key.at(0).toLatin1()); }
+    static bool cached(BlobCache &cache, const QString &key) {
+        QByteArray data;
+        return cache.get(key, data) && data == fileOf(key);
+    }
+};
+
+void TestBlobCache::evictsLeastRecentlyUsed() {
+    BlobCache cache(CacheBytes, 1, false);
+    for (const QString &key : {"a", "b", "c", "d"}) {
+        cache.put(key, fileOf(key));
+    }
+    QVERIFY(cached(cache, "a"));
+
+    // a 刚被访问，最久未访问的是 b
+    cache.put("e", fileOf("e"));
+    QVERIFY(!cached(cache, "b"));
+    for (const QString &key : {"a", "c", "d", "e"}) {
+        QVERIFY2(cached(cache, key), qPrintable(key));
+    }
+    QCOMPARE(cache.hits(), quint64(5));
+    QCOMPARE(cache.misses(), quint64(1));
+    QCOMPARE(cache.bytesSaved(), quint64(5 * FileBytes));
+}
+
+void TestBlobCache::skipsEmptyAndOversizedFiles() {
+    BlobCache cache(CacheBytes, 1, false);
+    cache.put("a", fileOf("a"));
+    cache.put("big", QByteArray(FileBytes + 1, 'x'));
+    cache.put("empty", QByteArray());
+
+    QByteArray data;
+    QVERIFY(!cache.get("big", data));
+    QVERIFY(!cache.get("empty", data));
+    // 没有放入缓存的文件也不会淘汰已缓存的文件
+    QVERIFY(cached(cache, "a"));
+}
+
+void TestBlobCache::admissionKeepsFrequentFiles() {
+    BlobCache cache(CacheBytes, 1, true);
+    QByteArray data;
+    // 经常访问的头像：每次下载先查缓存，未命中时从磁盘读取后放入
+    for (const QString &key : {"a", "b", "c", "d"}) {
+        QVERIFY(!cache.get(key, data));
+        cache.put(key, fileOf(key));
+        for (int i = 0; i < 4; ++i) {
+            QVERIFY(cached(cache, key));
+        }
+    }
+
+    // 只下载一次的文件比将被淘汰的文件访问少，不放入缓存
+    QVERIFY(!cache.get("x", data));
+    cache.put("x", fileOf("x"));
+    QVERIFY(!cached(cache, "x"));
+    for (const QString &key : {"a", "b", "c", "d"}) {
+        QVERIFY2(cached(cache, key), qPrintable(key));
+    }
+
+    // 之后被频繁访问的文件访问次数超过最久未访问的文件（a），替换它
+    for (int i = 0; i < 12; ++i) {
+        QVERIFY(!cache.get("x", data));
+    }
+    cache.put("x", fileOf("x"));
+    QVERIFY(cached(cache, "x"));
+    QVERIFY(!cached(cache, "a"));
+    for (const QString &key : {"b", "c", "d"}) {
+        QVERIFY2(cached(cache, key), qPrintable(key));
+    }
+}
+
+void TestBlobCache::putReplacesAndRemoveDrops() {
+    BlobCache cache(CacheBytes, 1, true);
+    cache.put("a", QByteArray(FileBytes, 'o'));
+    // 文件被覆盖后重新读取放入，替换旧内容（不占用两份空间）
+    cache.put("a", fileOf("a"));
+    for (const QString &key : {"b", "c", "d"}) {
+        cache.put(key, fileOf(key));
+    }
+    for (const QString &key : {"a", "b", "c", "d"}) {
+        QVERIFY2(cached(cache, key), qPrintable(key));
+    }
+
+    cache.remove("a");
+    QByteArray data;
+    QVERIFY(!cache.get("a", data));
+    QVERIFY(cached(cache, "b"));
+}
+
+QTEST_GUILESS_MAIN(TestBlobCache)
+#include "tst_blobcache.moc"
@@ -0,0 +1,130 @@
+#include <QtTest>
+#include <QJsonArray>
+#include <QJsonObject>
+#include "historycache.h"
+
+// 热点会话缓存：填充、按 id 顺序追加、填充与追加交错时不重复、不缓存过时的读取结果
+class TestHistoryCache : public QObject {
+    Q_OBJECT
+private slots:
+    void fillServesLatestPage();
+    void appendKeepsIdOrder();
+    void appendSkipsMessageReadByFill();
+    void appendDuringFillDiscardsFill();
+    void appendTrimsToLimit();
+
+private:
+    static const qint64 Key = 42;
+
+    static QJsonObject message(qint64 id) {
+        return QJsonObject{{"id", id}, {"content", QString("message %1").arg(id)}};
+    }
+    static QJsonArray messages(const QList<qint64> &ids) {
+        QJsonArray array;
+        for (qint64 id : ids) {
+            array.append(message(id));
+        }
+        return array;
+    }
+    static QList<qint64> idsOf(const QJsonArray &array) {
+        QList<qint64> ids;
+        for (const QJsonValue &value : array) {
+            ids.append(value.toObject()["id"].toInteger());
+        }
+        return ids;
+    }
+    // 模拟一次未命中后的填充
+    static void fillWith(HistoryCache &cache, const QList<qint64> &ids, bool hasMore) {
+        cache.beginFill(Key);
+        cache.fill(Key, messages(ids), hasMore);
+    }
+};
+
+void TestHistoryCache::fillServesLatestPage() {
+    HistoryCache cache(1024 * 1024, 50);
+    QJsonArray page;
+    bool hasMore = false;
+    QVERIFY(!cache.latestPage(Key, 3, page, hasMore));
+
+    fillWith(cache, {1, 2, 3, 4, 5}, false);
+
+    QVERIFY(cache.latestPage(Key, 3, page, hasMore));
+    QCOMPARE(idsOf(page), QList<qint64>({3, 4, 5}));
+    QVERIFY(hasMore);
+
+    // 会话的全部消息都在缓存中，超过消息数的一页也能命中
+    page = QJsonArray();
+    QVERIFY(cache.latestPage(Key, 10, page, hasMore));
+    QCOMPARE(idsOf(page), QList<qint64>({1, 2, 3, 4, 5}));
+    QVERIFY(!hasMore);
+    QCOMPARE(cache.hits(), quint64(2));
+    QCOMPARE(cache.misses(), quint64(1));
+}
+
+void TestHistoryCache::appendKeepsIdOrder() {
+    HistoryCache cache(1024 * 1024, 50);
+    fillWith(cache, {1, 2, 4}, false);
+
+    // 持久化完成的顺序与 id 顺序不同
+    cache.append(Key, 5, message(5));
+    cache.append(Key, 3, message(3));
+
+    QJsonArray page;
+    bool hasMore = false;
+    QVERIFY(cache.latestPage(Key, 10, page, hasMore));
+    QCOMPARE(idsOf(page), QList<qint64>({1, 2, 3, 4, 5}));
+}
+
+void TestHistoryCache::appendSkipsMessageReadByFill() {
+    HistoryCache cache(1024 * 1024, 50);
+    // 消息 3 提交之后、追加之前开始的填充已经从存储读到了它
+    fillWith(cache, {1, 2, 3}, false);
+    cache.append(Key, 3, message(3));
+    cache.append(Key, 2, message(2));
+
+    QJsonArray page;
+    bool hasMore = false;
+    QVERIFY(cache.latestPage(Key, 10, page, hasMore));
+    QCOMPARE(idsOf(page), QList<qint64>({1, 2, 3}));
+
+    cache.append(Key, 4, message(4));
+    page = QJsonArray();
+    QVERIFY(cache.latestPage(Key, 10, page, hasMore));
+    QCOMPARE(idsOf(page), QList<qint64>({1, 2, 3, 4}));
+}
+
+void TestHistoryCache::appendDuringFillDiscardsFill() {
+    HistoryCache cache(1024 * 1024, 50);
+    // 读取存储期间有新消息写入，读到的一页可能不包含它
+    cache.beginFill(Key);
+    cache.append(Key, 4, message(4));
+    cache.fill(Key, messages({1, 2, 3}), false);
+
+    QJsonArray page;
+    bool hasMore = false;
+    QVERIFY(!cache.latestPage(Key, 10, page, hasMore));
+
+    // 下一次填充不受影响
+    fillWith(cache, {1, 2, 3, 4}, false);
+    QVERIFY(cache.latestPage(Key, 10, page, hasMore));
+    QCOMPARE(idsOf(page), QList<qint64>({1, 2, 3, 4}));
+}
+
+void TestHistoryCache::appendTrimsToLimit() {
+    HistoryCache cache(1024 * 1024, 3);
+    fillWith(cache, {1, 2, 3}, false);
+    cache.append(Key, 4, message(4));
+
+    QJsonArray page;
+    bool hasMore = false;
+    QVERIFY(cache.latestPage(Key, 3, page, hasMore));
+    QCOMPARE(idsOf(page), QList<qint64>({2, 3, 4}));
+    QVERIFY(hasMore);
+
+    // 最早的消息已被丢弃，缓存不再是完整的会话，更大的一页需要读取存储
+    page = QJsonArray();
+    QVERIFY(!cache.latestPage(Key, 4, page, hasMore));
+}
+
+QTEST_GUILESS_MAIN(TestHistoryCache)
+#include "tst_historycache.moc"
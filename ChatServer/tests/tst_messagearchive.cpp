@@ -0,0 +1,261 @@
+#include <QtTest>
+#include <QJsonObject>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QTemporaryDir>
+#include <memory>
+#include "conversation.h"
+#include "dbconnection.h"
+#include "messagearchive.h"
+#include "schemamigration.h"
+#include "sqlitemessagestore.h"
+
+// 冷消息归档：块的编码往返、按会话从最早一端归档，以及读取历史记录时从热表接着读归档（两个方向的翻页）
+class TestMessageArchive : public QObject {
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void encodeDecodeRoundTrip();
+    void archivesOldestRunPerConversation();
+    void latestPageContinuesIntoArchive();
+    void beforePagesWalkWholeConversation();
+    void beforeIdAnchorAtOldestHotMessage();
+    void afterPagesCrossIntoHotTable();
+
+private:
+    // 会话 A（用户 1 和 2）共 25 条消息，序号 1..20 已过期，21..25 未过期
+    // 会话 B（用户 1 和 3）共 5 条消息，全部过期，写入时间早于会话 A
+    static const qint64 CutoffUs = 1000;
+    static const int BlockRows = 10;
+
+    static QString textOf(qint64 seq) { return QString("message %1").arg(seq); }
+
+    bool insertMessage(qint64 id, qint64 fromId, qint64 toId, qint64 seq, qint64 sentAt);
+    QList<StoredMessage> page(const QJsonObject &request, bool &hasMore);
+    static QList<qint64> seqsOf(const QList<StoredMessage> &rows);
+    static QList<qint64> range(qint64 first, qint64 last);
+
+    std::unique_ptr<QTemporaryDir> m_dir;
+    std::unique_ptr<DbConnection> m_writer;
+    std::unique_ptr<DbConnectionPool> m_readers;
+    std::unique_ptr<SqliteMessageStore> m_store;
+};
+
+void TestMessageArchive::initTestCase() {
+    m_dir.reset(new QTemporaryDir());
+    QVERIFY(m_dir->isValid());
+    QString dbPath = m_dir->filePath("chat.db");
+    m_writer.reset(new DbConnection("tst_archive_writer", dbPath, DbConnection::Writer));
+    QVERIFY(m_writer->isOpen());
+    QVERIFY(SchemaMigration::upgrade(m_writer->database()));
+
+    qint64 id = 0;
+    for (qint64 seq = 1; seq <= 5; ++seq) {
+        QVERIFY(insertMessage(++id, 1, 3, seq, seq));
+    }
+    for (qint64 seq = 1; seq <= 25; ++seq) {
+        // 两个用户交替发送，发送时间不单调（归档块对差分使用 zigzag 编码）
+        qint64 sentAt = seq <= 20 ? 100 + (seq * 37) % 200 : CutoffUs + seq;
+        QVERIFY(insertMessage(++id, seq % 2 ? 1 : 2, seq % 2 ? 2 : 1, seq, sentAt));
+    }
+
+    // 读取在写入完成后进行，历史记录只通过存储接口读取（不需要数据库写线程）
+    m_readers.reset(new DbConnectionPool());
+    QVERIFY(m_readers->init(dbPath, 1, 1000));
+    m_store.reset(new SqliteMessageStore(nullptr, m_readers.get()));
+}
+
+void TestMessageArchive::cleanupTestCase() {
+    m_store.reset();
+    m_readers.reset();
+    m_writer.reset();
+    m_dir.reset();
+}
+
+bool TestMessageArchive::insertMessage(qint64 id, qint64 fromId, qint64 toId, qint64 seq, qint64 sentAt) {
+    QSqlQuery query(m_writer->database());
+    query.prepare("INSERT INTO messages (id, from_id, to_id, conversation_id, seq, sent_at, kind, text) "
+                  "VALUES (?, ?, ?, ?, ?, ?, ?, ?)");
+    query.addBindValue(id);
+    query.addBindValue(fromId);
+    query.addBindValue(toId);
+    query.addBindValue(Conversation::privateKey(fromId, toId));
+    query.addBindValue(seq);
+    query.addBindValue(sentAt);
+    query.addBindValue(int(MessageContent::Text));
+    query.addBindValue(textOf(seq));
+    if (!query.exec()) {
+        qWarning() << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+QList<StoredMessage> TestMessageArchive::page(const QJsonObject &request, bool &hasMore) {
+    DbReadScope scope(m_readers.get());
+    return m_store->getChatHistory(2, 1, HistoryPage::fromRequest(request), hasMore);
+}
+
+QList<qint64> TestMessageArchive::seqsOf(const QList<StoredMessage> &rows) {
+    QList<qint64> seqs;
+    for (const StoredMessage &row : rows) {
+        seqs.append(row.seq);
+    }
+    return seqs;
+}
+
+QList<qint64> TestMessageArchive::range(qint64 first, qint64 last) {
+    QList<qint64> values;
+    for (qint64 value = first; value <= last; ++value) {
+        values.append(value);
+    }
+    return values;
+}
+
+void TestMessageArchive::encodeDecodeRoundTrip() {
+    qint64 conversation = Conversation::privateKey(7, 70000);
+    QList<StoredMessage> rows;
+    const MessageContent contents[] = {
+        MessageContent::text("hello"),
+        MessageContent::image("a1b2c3.png", 640, 480),
+        MessageContent::text(QString::fromUtf8("你好，世界")),
+        MessageContent::text(QString()),
+    };
+    for (int i = 0; i < 4; ++i) {
+        StoredMessage row;
+        row.id = 1000 + i * 37;
+        row.seq = 50 + i;
+        row.fromId = i % 2 ? 70000 : 7;
+        row.toId = i % 2 ? 7 : 70000;
+        row.sentAt = 1700000000000000LL - i * 5 + (i == 2 ? 1000 : 0);
+        row.content = contents[i];
+        rows.append(row);
+    }
+
+    QList<StoredMessage> decoded;
+    QVERIFY(MessageArchive::decode(MessageArchive::encode(rows), conversation, decoded));
+    QCOMPARE(decoded.size(), rows.size());
+    for (int i = 0; i < rows.size(); ++i) {
+        QCOMPARE(decoded[i].id, rows[i].id);
+        QCOMPARE(decoded[i].seq, rows[i].seq);
+        QCOMPARE(decoded[i].fromId, rows[i].fromId);
+        QCOMPARE(decoded[i].toId, rows[i].toId);
+        QCOMPARE(decoded[i].sentAt, rows[i].sentAt);
+        QCOMPARE(decoded[i].content.kind(), rows[i].content.kind());
+        QCOMPARE(decoded[i].content.text(), rows[i].content.text());
+        QCOMPARE(decoded[i].content.imageId(), rows[i].content.imageId());
+        QCOMPARE(decoded[i].content.width(), rows[i].content.width());
+        QCOMPARE(decoded[i].content.height(), rows[i].content.height());
+    }
+
+    // 群聊块的接收者还原为群 ID
+    QVERIFY(MessageArchive::decode(MessageArchive::encode(rows), Conversation::groupKey(12), decoded));
+    QCOMPARE(decoded.first().toId, qint64(12));
+
+    // 损坏的块解码失败，不返回部分结果
+    QByteArray block = MessageArchive::encode(rows);
+    block.chop(3);
+    QList<StoredMessage> broken;
+    QVERIFY(!MessageArchive::decode(block, conversation, broken));
+    QVERIFY(broken.isEmpty());
+}
+
+void TestMessageArchive::archivesOldestRunPerConversation() {
+    // 会话 B：前 4 条归档，最新一条留在热表（跳过）；会话 A：两块各 10 条，之后遇到未过期的消息结束
+    QList<qint64> results;
+    qint64 cursor = 0;
+    qint64 result;
+    do {
+        result = MessageArchive::archiveBlock(*m_writer, false, CutoffUs, BlockRows, cursor);
+        results.append(result);
+    } while (result > 0);
+    QCOMPARE(results, QList<qint64>({4, 1, 10, 10, 0}));
+
+    QSqlQuery query(m_writer->database());
+    QVERIFY(query.exec("SELECT conversation_id, first_seq, last_seq, row_count FROM message_archive ORDER BY id"));
+    QList<QList<qint64>> blocks;
+    while (query.next()) {
+        blocks.append({query.value(0).toLongLong(), query.value(1).toLongLong(),
+                       query.value(2).toLongLong(), query.value(3).toLongLong()});
+    }
+    qint64 a = Conversation::privateKey(1, 2);
+    qint64 b = Conversation::privateKey(1, 3);
+    QCOMPARE(blocks, QList<QList<qint64>>({{b, 1, 4, 4}, {a, 1, 10, 10}, {a, 11, 20, 10}}));
+
+    QVERIFY(query.exec("SELECT COUNT(*) FROM messages"));
+    QVERIFY(query.next());
+    QCOMPARE(query.value(0).toLongLong(), qint64(6));
+
+    // 归档的消息 id 仍能换算为序号
+    QCOMPARE(MessageArchive::seqOf(*m_writer, a, 5 + 15), qint64(15));
+    QCOMPARE(MessageArchive::seqOf(*m_writer, a, 5 + 21), qint64(0));
+}
+
+void TestMessageArchive::latestPageContinuesIntoArchive() {
+    bool hasMore = false;
+    QList<StoredMessage> rows = page(QJsonObject{{"limit", 8}}, hasMore);
+    QCOMPARE(seqsOf(rows), range(18, 25));
+    QVERIFY(hasMore);
+
+    // 归档中读出的消息与热表中的消息格式相同
+    for (const StoredMessage &row : rows) {
+        QCOMPARE(row.id, 5 + row.seq);
+        QCOMPARE(row.fromId, row.seq % 2 ? qint64(1) : qint64(2));
+        QCOMPARE(row.toId, row.seq % 2 ? qint64(2) : qint64(1));
+        QCOMPARE(row.content.text(), textOf(row.seq));
+    }
+}
+
+void TestMessageArchive::beforePagesWalkWholeConversation() {
+    // 从最新一页开始向上翻页，跨过热表和两个归档块，每条消息恰好读到一次
+    QList<qint64> seen;
+    bool hasMore = false;
+    QList<StoredMessage> rows = page(QJsonObject{{"limit", 7}}, hasMore);
+    seen = seqsOf(rows);
+    while (hasMore) {
+        rows = page(QJsonObject{{"limit", 7}, {"before_seq", rows.first().seq}}, hasMore);
+        QVERIFY(!rows.isEmpty());
+        seen = seqsOf(rows) + seen;
+    }
+    QCOMPARE(seen, range(1, 25));
+
+    rows = page(QJsonObject{{"limit", 8}, {"before_seq", 18}}, hasMore);
+    QCOMPARE(seqsOf(rows), range(10, 17));
+    QVERIFY(hasMore);
+    rows = page(QJsonObject{{"limit", 8}, {"before_seq", 2}}, hasMore);
+    QCOMPARE(seqsOf(rows), QList<qint64>({1}));
+    QVERIFY(!hasMore);
+}
+
+void TestMessageArchive::beforeIdAnchorAtOldestHotMessage() {
+    // 游标是热表中最早的一条（序号 21），热表中没有更早的消息，换算为序号后从归档读取
+    bool hasMore = false;
+    QList<StoredMessage> rows = page(QJsonObject{{"limit", 8}, {"before_id", 5 + 21}}, hasMore);
+    QCOMPARE(seqsOf(rows), range(13, 20));
+    QVERIFY(hasMore);
+
+    // 游标本身已归档
+    rows = page(QJsonObject{{"limit", 4}, {"before_id", 5 + 12}}, hasMore);
+    QCOMPARE(seqsOf(rows), range(8, 11));
+    QVERIFY(hasMore);
+}
+
+void TestMessageArchive::afterPagesCrossIntoHotTable() {
+    bool hasMore = false;
+    QList<StoredMessage> rows = page(QJsonObject{{"limit", 8}, {"after_seq", 0}}, hasMore);
+    QCOMPARE(seqsOf(rows), range(1, 8));
+    QVERIFY(hasMore);
+
+    // 归档中游标之后的消息在前，接上热表
+    rows = page(QJsonObject{{"limit", 8}, {"after_seq", 16}}, hasMore);
+    QCOMPARE(seqsOf(rows), range(17, 24));
+    QVERIFY(hasMore);
+
+    rows = page(QJsonObject{{"limit", 8}, {"after_id", 5 + 19}}, hasMore);
+    QCOMPARE(seqsOf(rows), range(20, 25));
+    QVERIFY(!hasMore);
+}
+
+QTEST_GUILESS_MAIN(TestMessageArchive)
+#include "tst_messagearchive.moc"
@@ -0,0 +1,131 @@
+#include <QtTest>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <memory>
+#include "dbconnection.h"
+#include "offlineinbox.h"
+#include "schemamigration.h"
+
+// 离线收件箱：重复放入忽略、按消息 ID 分批取出、确认后删除，未确认的消息下次登录重新取出
+class TestOfflineInbox : public QObject {
+    Q_OBJECT
+private slots:
+    void init();
+    void cleanup();
+    void pushIgnoresDuplicates();
+    void fetchPagesByMessageId();
+    void acknowledgedBatchesAreNotRedelivered();
+
+private:
+    static QString payload(qint64 messageId) {
+        QJsonObject message{{"id", messageId}, {"content", QString("message %1").arg(messageId)}};
+        return QString::fromUtf8(QJsonDocument(message).toJson(QJsonDocument::Compact));
+    }
+    static QList<qint64> idsOf(const QJsonArray &array) {
+        QList<qint64> ids;
+        for (const QJsonValue &value : array) {
+            ids.append(value.toObject()["id"].toInteger());
+        }
+        return ids;
+    }
+    // 放入 messageIds 中的消息，返回是否全部成功
+    bool pushAll(qint64 userId, const QList<qint64> &messageIds);
+
+    std::unique_ptr<QTemporaryDir> m_dir;
+    std::unique_ptr<DbConnection> m_conn;
+};
+
+void TestOfflineInbox::init() {
+    m_dir.reset(new QTemporaryDir());
+    QVERIFY(m_dir->isValid());
+    m_conn.reset(new DbConnection("tst_offline_inbox", m_dir->filePath("chat.db"), DbConnection::Writer));
+    QVERIFY(m_conn->isOpen());
+    QVERIFY(SchemaMigration::upgrade(m_conn->database()));
+}
+
+void TestOfflineInbox::cleanup() {
+    m_conn.reset();
+    m_dir.reset();
+}
+
+bool TestOfflineInbox::pushAll(qint64 userId, const QList<qint64> &messageIds) {
+    for (qint64 messageId : messageIds) {
+        if (OfflineInbox::push(*m_conn, userId, messageId, payload(messageId)) != 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void TestOfflineInbox::pushIgnoresDuplicates() {
+    QCOMPARE(OfflineInbox::push(*m_conn, 1, 10, payload(10)), qint64(1));
+    // 同一条消息再次放入（例如消息保存与补发重叠）不产生第二个条目
+    QCOMPARE(OfflineInbox::push(*m_conn, 1, 10, payload(10)), qint64(0));
+
+    bool hasMore = true;
+    QJsonArray messages = OfflineInbox::fetch(*m_conn, 1, 0, 10, hasMore);
+    QCOMPARE(idsOf(messages), QList<qint64>({10}));
+    QVERIFY(!hasMore);
+}
+
+void TestOfflineInbox::fetchPagesByMessageId() {
+    // 放入顺序与消息 ID 顺序不同，另一个用户的消息不会被取出
+    QVERIFY(pushAll(1, {13, 10, 14, 12, 11}));
+    QVERIFY(pushAll(2, {15}));
+
+    bool hasMore = false;
+    QJsonArray messages = OfflineInbox::fetch(*m_conn, 1, 0, 2, hasMore);
+    QCOMPARE(idsOf(messages), QList<qint64>({10, 11}));
+    QVERIFY(hasMore);
+
+    messages = OfflineInbox::fetch(*m_conn, 1, 11, 2, hasMore);
+    QCOMPARE(idsOf(messages), QList<qint64>({12, 13}));
+    QVERIFY(hasMore);
+
+    messages = OfflineInbox::fetch(*m_conn, 1, 13, 2, hasMore);
+    QCOMPARE(idsOf(messages), QList<qint64>({14}));
+    QVERIFY(!hasMore);
+}
+
+void TestOfflineInbox::acknowledgedBatchesAreNotRedelivered() {
+    QVERIFY(pushAll(1, {10, 11, 12, 13, 14}));
+    QVERIFY(pushAll(2, {15}));
+
+    // 第一批确认时带上一个不在收件箱中的 ID，只删除实际存在的条目
+    bool hasMore = false;
+    QJsonArray messages = OfflineInbox::fetch(*m_conn, 1, 0, 2, hasMore);
+    QCOMPARE(idsOf(messages), QList<qint64>({10, 11}));
+    QCOMPARE(OfflineInbox::acknowledge(*m_conn, 1, {10, 11, 99}), qint64(2));
+
+    // 第二批没有确认（连接断开），下次登录从头取出时重新发送
+    messages = OfflineInbox::fetch(*m_conn, 1, 0, 2, hasMore);
+    QCOMPARE(idsOf(messages), QList<qint64>({12, 13}));
+    messages = OfflineInbox::fetch(*m_conn, 1, 0, 2, hasMore);
+    QCOMPARE(idsOf(messages), QList<qint64>({12, 13}));
+    QVERIFY(hasMore);
+
+    // 按服务器的方式逐批发送：确认一批后从确认的最后一个 ID 之后取下一批，直到收件箱为空
+    QList<qint64> delivered;
+    qint64 afterId = 0;
+    do {
+        messages = OfflineInbox::fetch(*m_conn, 1, afterId, 2, hasMore);
+        QList<qint64> ids = idsOf(messages);
+        QCOMPARE(OfflineInbox::acknowledge(*m_conn, 1, ids), qint64(ids.size()));
+        delivered += ids;
+        afterId = ids.isEmpty() ? afterId : ids.last();
+    } while (hasMore);
+    QCOMPARE(delivered, QList<qint64>({12, 13, 14}));
+
+    messages = OfflineInbox::fetch(*m_conn, 1, 0, 2, hasMore);
+    QVERIFY(messages.isEmpty());
+    QVERIFY(!hasMore);
+
+    // 其他用户的收件箱不受影响
+    messages = OfflineInbox::fetch(*m_conn, 2, 0, 2, hasMore);
+    QCOMPARE(idsOf(messages), QList<qint64>({15}));
+}
+
+QTEST_GUILESS_MAIN(TestOfflineInbox)
+#include "tst_offlineinbox.moc"
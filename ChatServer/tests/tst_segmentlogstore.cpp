@@ -0,0 +1,146 @@
+#include <QtTest>
+#include <QFile>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <memory>
+#include "segmentlogstore.h"
+
+// 分段日志存储的恢复：重新打开后重建索引、截断末尾写了一半的记录、丢弃校验失败的记录
+class TestSegmentLogStore : public QObject {
+    Q_OBJECT
+private slots:
+    void init();
+    void reopenRestoresIndex();
+    void truncatesTornTail();
+    void rejectsRecordWithBadChecksum();
+
+private:
+    // 记录格式见 segmentlogstore.cpp：头部 12 字节，固定负载 71 字节，之后是文本
+    // 测试消息的文本都是 10 字节（"message 00"），每条记录长度相同
+    static const qint64 TextOffset = 12 + 71;
+    static const qint64 RecordBytes = TextOffset + 10;
+
+    static QString textOf(int index) { return QString("message %1").arg(index, 2, 10, QChar('0')); }
+
+    std::unique_ptr<SegmentLogStore> openStore();
+    // 在用户 1 和 2 的会话中追加 count 条消息，编号从 first 开始，返回是否全部保存成功
+    bool appendMessages(SegmentLogStore &store, int first, int count);
+    QList<StoredMessage> readAll(SegmentLogStore &store);
+    // 覆盖第一个分段文件中 offset 处的内容，模拟崩溃或磁盘损坏
+    bool overwrite(qint64 offset, const QByteArray &bytes);
+
+    std::unique_ptr<QTemporaryDir> m_dir;
+};
+
+void TestSegmentLogStore::init() {
+    m_dir.reset(new QTemporaryDir());
+    QVERIFY(m_dir->isValid());
+}
+
+std::unique_ptr<SegmentLogStore> TestSegmentLogStore::openStore() {
+    std::unique_ptr<SegmentLogStore> store(new SegmentLogStore());
+    if (!store->init(m_dir->path(), 1024 * 1024, 4, 16, 0)) {
+        return nullptr;
+    }
+    return store;
+}
+
+bool TestSegmentLogStore::appendMessages(SegmentLogStore &store, int first, int count) {
+    for (int i = first; i < first + count; ++i) {
+        SavedMessage saved = store.saveChatMessage(1, 2, MessageContent::text(textOf(i)), i + 1).result();
+        if (saved.id <= 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QList<StoredMessage> TestSegmentLogStore::readAll(SegmentLogStore &store) {
+    bool hasMore = false;
+    return store.getChatHistory(1, 2, HistoryPage::fromRequest(QJsonObject{{"limit", 100}}), hasMore);
+}
+
+bool TestSegmentLogStore::overwrite(qint64 offset, const QByteArray &bytes) {
+    QFile file(m_dir->filePath("seg_00000001.log"));
+    return file.open(QIODevice::ReadWrite) && file.seek(offset) && file.write(bytes) == bytes.size();
+}
+
+void TestSegmentLogStore::reopenRestoresIndex() {
+    {
+        std::unique_ptr<SegmentLogStore> store = openStore();
+        QVERIFY(store);
+        QVERIFY(appendMessages(*store, 0, 10));
+    }
+
+    std::unique_ptr<SegmentLogStore> store = openStore();
+    QVERIFY(store);
+    QList<StoredMessage> messages = readAll(*store);
+    QCOMPARE(messages.size(), 10);
+    for (int i = 0; i < messages.size(); ++i) {
+        QCOMPARE(messages[i].id, qint64(i + 1));
+        QCOMPARE(messages[i].seq, qint64(i + 1));
+        QCOMPARE(messages[i].sentAt, qint64(i + 1));
+        QCOMPARE(messages[i].content.text(), textOf(i));
+    }
+
+    // 恢复后的 id 和序号接着已有的记录分配
+    SavedMessage saved = store->saveChatMessage(2, 1, MessageContent::text(textOf(10)), 11).result();
+    QCOMPARE(saved.id, qint64(11));
+    QCOMPARE(saved.seq, qint64(11));
+}
+
+void TestSegmentLogStore::truncatesTornTail() {
+    {
+        std::unique_ptr<SegmentLogStore> store = openStore();
+        QVERIFY(store);
+        QVERIFY(appendMessages(*store, 0, 10));
+    }
+    // 最后一条记录只写入了前半部分
+    qint64 last = 9 * RecordBytes;
+    QVERIFY(overwrite(last + RecordBytes / 2, QByteArray(int(RecordBytes - RecordBytes / 2), '\0')));
+
+    {
+        std::unique_ptr<SegmentLogStore> store = openStore();
+        QVERIFY(store);
+        QList<StoredMessage> messages = readAll(*store);
+        QCOMPARE(messages.size(), 9);
+        QCOMPARE(messages.last().id, qint64(9));
+
+        // 截断处继续写入，新记录取代写了一半的记录
+        SavedMessage saved = store->saveChatMessage(1, 2, MessageContent::text(textOf(10)), 11).result();
+        QCOMPARE(saved.id, qint64(10));
+        QCOMPARE(saved.seq, qint64(10));
+    }
+
+    // 再次打开时新记录完整可读，没有残留的半条记录
+    std::unique_ptr<SegmentLogStore> store = openStore();
+    QVERIFY(store);
+    QList<StoredMessage> messages = readAll(*store);
+    QCOMPARE(messages.size(), 10);
+    QCOMPARE(messages.last().id, qint64(10));
+    QCOMPARE(messages.last().content.text(), textOf(10));
+}
+
+void TestSegmentLogStore::rejectsRecordWithBadChecksum() {
+    {
+        std::unique_ptr<SegmentLogStore> store = openStore();
+        QVERIFY(store);
+        QVERIFY(appendMessages(*store, 0, 10));
+    }
+    // 第 5 条记录的文本被改写，长度字段仍然有效，只有校验和能发现
+    QVERIFY(overwrite(4 * RecordBytes + TextOffset, QByteArray("X")));
+
+    std::unique_ptr<SegmentLogStore> store = openStore();
+    QVERIFY(store);
+    QList<StoredMessage> messages = readAll(*store);
+    QCOMPARE(messages.size(), 4);
+    for (const StoredMessage &message : messages) {
+        QVERIFY(message.id <= 4);
+        QVERIFY(!message.content.text().startsWith('X'));
+    }
+    SavedMessage saved = store->saveChatMessage(1, 2, MessageContent::text(textOf(10)), 11).result();
+    QCOMPARE(saved.id, qint64(5));
+}
+
+QTEST_GUILESS_MAIN(TestSegmentLogStore)
+#include "tst_segmentlogstore.moc"
@@ -0,0 +1,596 @@
+// 服务器性能基准测试工具
+// 用法: ChatServerBench <benchmark> [参数...]
+//   outbound [producers] [messages_per_producer] [payload_bytes]
+//       比较 QMetaObject::invokeMethod 投递与 OutboundQueue 投递的吞吐量
+//   threadpool [threads] [tasks]
+//       测量线程池统计的单任务开销，并输出一次统计报告
+//   numa [buffer_mb]
+//       在每个 NUMA 节点上分配内存，分别从各节点的 CPU 访问，报告本地/跨节点的延迟和带宽
+//   dbwriter [producers] [messages_per_producer]
+//       比较逐条自动提交与 DbWriter 组提交写入消息表的吞吐量（使用临时数据库）
+//   messagestore [messages] [conversations]
+//       比较 SQLite 与分段日志两种消息存储的写入吞吐量和历史记录分页读取延迟
+//   userdirectory [users...]
+//       用随机生成的用户构建用户目录，测量加载时间、内存、不同前缀长度的搜索延迟和注册插入吞吐量
+//   blobcache [cache_mb] [requests]
+//       热点小文件（Zipf 分布）混合只访问一次的大文件，比较纯 LRU 与 TinyLFU 准入过滤的命中率
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTcpSocket>
+#include <QDebug>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include "../src/outboundqueue.h"
+#include "../src/threadpool.h"
+#include "../src/cputopology.h"
+#include "../src/dbwriter.h"
+#include "../src/dbconnection.h"
+#include "../src/latencyhistogram.h"
+#include "../src/sqlitemessagestore.h"
+#include "../src/segmentlogstore.h"
+#include "../src/messagetime.h"
+#include "../src/userdirectory.h"
+#include "../src/blobcache.h"
+#include "../src/schemamigration.h"
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+
+// 模拟原有的“按名字调用 + 投递事件”路径的接收端
+class PostedEventSink : public QObject {
+    Q_OBJECT
+public:
+    explicit PostedEventSink(quint64 expected) : m_expected(expected), m_received(0) {}
+
+public slots:
+    void sendResponseToClient(QTcpSocket *socket, const QByteArray &response) {
+        Q_UNUSED(socket);
+        Q_UNUSED(response);
+        if (++m_received == m_expected) {
+            QCoreApplication::quit();
+        }
+    }
+
+private:
+    quint64 m_expected;
+    quint64 m_received;
+};
+
+static void runProducers(int producers, int perProducer, const std::function<void()> &send) {
+    std::vector<std::thread> threads;
+    for (int i = 0; i < producers; ++i) {
+        threads.emplace_back([perProducer, &send]() {
+            for (int n = 0; n < perProducer; ++n) {
+                send();
+            }
+        });
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+}
+
+static int benchOutbound(const QStringList &args) {
+    int producers = args.value(0, "4").toInt();
+    int perProducer = args.value(1, "250000").toInt();
+    int payloadBytes = args.value(2, "256").toInt();
+    quint64 total = quint64(producers) * perProducer;
+    QByteArray payload(payloadBytes, 'x');
+
+    printf("outbound: producers=%d messages=%llu payload=%dB\n",
+           producers, (unsigned long long)total, payloadBytes);
+
+    // 1. 原有路径：每条消息一次 invokeMethod(Qt::QueuedConnection)
+    {
+        PostedEventSink sink(total);
+        QElapsedTimer timer;
+        timer.start();
+        std::thread feeder([&]() {
+            runProducers(producers, perProducer, [&]() {
+                QMetaObject::invokeMethod(&sink, "sendResponseToClient", Qt::QueuedConnection,
+                                          Q_ARG(QTcpSocket*, nullptr), Q_ARG(QByteArray, payload));
+            });
+        });
+        QCoreApplication::exec();
+        feeder.join();
+        double secs = timer.nsecsElapsed() / 1e9;
+        printf("  invokeMethod   : %10.0f msg/s (%.3f s)\n", total / secs, secs);
+    }
+
+    // 2. 新路径：MPSC 队列 + eventfd 批量唤醒
+    {
+        OutboundQueue queue;
+        if (!queue.init()) {
+            fprintf(stderr, "failed to init outbound queue\n");
+            return 1;
+        }
+        quint64 received = 0;
+        queue.setDeliveryHandler([&](QTcpSocket *, const QByteArray &) {
+            if (++received == total) {
+                QCoreApplication::quit();
+            }
+        });
+
+        QElapsedTimer timer;
+        timer.start();
+        std::thread feeder([&]() {
+            runProducers(producers, perProducer, [&]() {
+                queue.push(nullptr, payload);
+            });
+        });
+        QCoreApplication::exec();
+        feeder.join();
+        double secs = timer.nsecsElapsed() / 1e9;
+        printf("  OutboundQueue  : %10.0f msg/s (%.3f s)\n", total / secs, secs);
+    }
+    return 0;
+}
+
+static int benchThreadPool(const QStringList &args) {
+    int threads = args.value(0, "4").toInt();
+    int tasks = args.value(1, "1000000").toInt();
+
+    printf("threadpool: threads=%d tasks=%d\n", threads, tasks);
+
+    // 1. 统计本身的开销：每个任务三次读时钟 + 两次直方图记录
+    {
+        LatencyHistogram queueWait;
+        LatencyHistogram runTime;
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < tasks; ++i) {
+            qint64 enqueue = ThreadPool::nowNs();
+            qint64 start = ThreadPool::nowNs();
+            qint64 end = ThreadPool::nowNs();
+            queueWait.record(quint64(start - enqueue));
+            runTime.record(quint64(end - start));
+        }
+        double perTask = double(timer.nsecsElapsed()) / tasks;
+        printf("  instrumentation: %6.1f ns/task\n", perTask);
+    }
+
+    // 2. 空任务吞吐量（含入队、唤醒和统计）
+    {
+        ThreadPool pool;
+        pool.setName("bench");
+        pool.init(threads);
+        int taskClass = pool.registerTaskClass("empty");
+        std::atomic<int> done(0);
+
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < tasks; ++i) {
+            pool.addTask([&done]() { done.fetch_add(1, std::memory_order_relaxed); }, taskClass);
+        }
+        pool.waitForDone();
+        double secs = timer.nsecsElapsed() / 1e9;
+        printf("  empty tasks    : %10.0f task/s (%.3f s, completed=%d)\n", tasks / secs, secs, done.load());
+        printf("%s\n", qPrintable(pool.statsReport()));
+    }
+    return 0;
+}
+
+// 指针追逐：每次访问依赖上一次的结果，测得的是访问延迟
+static double chaseLatencyNs(const std::vector<quint64> &buffer, quint64 steps) {
+    quint64 pos = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (quint64 i = 0; i < steps; ++i) {
+        pos = buffer[pos];
+    }
+    qint64 elapsed = timer.nsecsElapsed();
+    // 防止循环被优化掉
+    volatile quint64 sink = pos;
+    Q_UNUSED(sink);
+    return double(elapsed) / steps;
+}
+
+// 顺序扫描：测得的是带宽
+static double scanBandwidthGBs(const std::vector<quint64> &buffer) {
+    QElapsedTimer timer;
+    timer.start();
+    quint64 sum = std::accumulate(buffer.begin(), buffer.end(), quint64(0));
+    qint64 elapsed = timer.nsecsElapsed();
+    volatile quint64 sink = sum;
+    Q_UNUSED(sink);
+    return double(buffer.size() * sizeof(quint64)) / elapsed;
+}
+
+static int benchNuma(const QStringList &args) {
+    int bufferMb = args.value(0, "256").toInt();
+    const quint64 lineWords = 64 / sizeof(quint64);
+    quint64 words = quint64(bufferMb) * 1024 * 1024 / sizeof(quint64);
+    quint64 lines = words / lineWords;
+    if (lines < 2) {
+        fprintf(stderr, "buffer too small\n");
+        return 1;
+    }
+
+    CpuTopology topology;
+    topology.load();
+    printf("numa: %s, buffer=%dMB\n", qPrintable(topology.describe()), bufferMb);
+    printf("  %-8s %-8s %14s %16s\n", "memory", "cpu", "latency(ns)", "bandwidth(GB/s)");
+
+    const QList<int> nodes = topology.nodes();
+    for (int memNode : nodes) {
+        // 在内存节点上分配并首次写入，物理页由首次写入的线程所在节点决定
+        std::vector<quint64> *buffer = nullptr;
+        std::thread allocator([&]() {
+            CpuTopology::pinCurrentThread(topology.cpusOfNode(memNode));
+            buffer = new std::vector<quint64>(words, 0);
+
+            // 随机环形链表，每个缓存行一个节点，硬件预取无法命中
+            std::vector<quint64> order(lines);
+            std::iota(order.begin(), order.end(), quint64(0));
+            std::shuffle(order.begin() + 1, order.end(), std::mt19937_64(42));
+            for (quint64 i = 0; i < lines; ++i) {
+                (*buffer)[order[i] * lineWords] = order[(i + 1) % lines] * lineWords;
+            }
+        });
+        allocator.join();
+
+        for (int cpuNode : nodes) {
+            double latency = 0;
+            double bandwidth = 0;
+            std::thread reader([&]() {
+                CpuTopology::pinCurrentThread(topology.cpusOfNode(cpuNode));
+                latency = chaseLatencyNs(*buffer, qMin<quint64>(lines, 20000000));
+                bandwidth = scanBandwidthGBs(*buffer);
+            });
+            reader.join();
+            printf("  node%-4d node%-4d %14.1f %16.2f%s\n", memNode, cpuNode, latency, bandwidth,
+                   memNode == cpuNode ? "" : "  (remote)");
+        }
+
+        delete buffer;
+    }
+    return 0;
+}
+
+// 创建与服务器相同结构的消息表
+// 用服务器启动时的迁移创建表和索引，基准测试与生产环境使用相同的结构
+static bool createDatabase(const QString &path, const QString &connectionName) {
+    bool ok;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        db.setDatabaseName(path);
+        ok = db.open() && SchemaMigration::upgrade(db);
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+    return ok;
+}
+
+static int benchDbWriter(const QStringList &args) {
+    int producers = args.value(0, "8").toInt();
+    int perProducer = args.value(1, "500").toInt();
+    int total = producers * perProducer;
+
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        fprintf(stderr, "failed to create temporary directory\n");
+        return 1;
+    }
+
+    printf("dbwriter: producers=%d messages=%d\n", producers, total);
+
+    // 1. 原有方式：每个线程一个连接，每条消息一个自动提交事务
+    {
+        QString path = dir.filePath("autocommit.db");
+        if (!createDatabase(path, "bench_setup")) {
+            fprintf(stderr, "failed to create database\n");
+            return 1;
+        }
+        std::atomic<int> failed(0);
+        QElapsedTimer timer;
+        timer.start();
+        runProducers(producers, perProducer, [&]() {
+            thread_local QSqlDatabase db;
+            if (!db.isValid()) {
+                QString name = QString("bench_%1").arg(quintptr(QThread::currentThreadId()));
+                db = QSqlDatabase::addDatabase("QSQLITE", name);
+                db.setDatabaseName(path);
+                db.open();
+            }
+            QSqlQuery query(db);
+            query.prepare("INSERT INTO messages (from_id, to_id, kind, text, sent_at) VALUES (?, ?, ?, ?, ?)");
+            query.addBindValue(1);
+            query.addBindValue(2);
+            query.addBindValue(int(MessageContent::Text));
+            query.addBindValue("hello");
+            query.addBindValue(MessageTime::nowUs());
+            if (!query.exec()) {
+                failed.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+        double secs = timer.nsecsElapsed() / 1e9;
+        printf("  autocommit     : %10.0f msg/s (%.3f s, failed=%d)\n", total / secs, secs, failed.load());
+    }
+
+    // 2. DbWriter：单写连接，组提交
+    {
+        QString path = dir.filePath("groupcommit.db");
+        if (!createDatabase(path, "bench_setup")) {
+            fprintf(stderr, "failed to create database\n");
+            return 1;
+        }
+        DbWriter writer;
+        if (!writer.init(path, 256, 2)) {
+            return 1;
+        }
+        QElapsedTimer timer;
+        timer.start();
+        runProducers(producers, perProducer, [&]() {
+            // 每个生产者等待自己的提交结果，与服务器中协程等待确认的行为一致
+            writer.insertMessage(1, 2, MessageContent::text("hello"), MessageTime::nowUs()).waitForFinished();
+        });
+        double secs = timer.nsecsElapsed() / 1e9;
+        printf("  group commit   : %10.0f msg/s (%.3f s)\n", total / secs, secs);
+        writer.stop();
+        writer.wait();
+        printf("%s\n", qPrintable(writer.statsReport()));
+    }
+    return 0;
+}
+
+// 向消息存储写入 total 条私聊消息，消息轮流分布在 conversations 个会话中
+static double fillMessageStore(MessageStore &store, int producers, int total, int conversations) {
+    std::atomic<int> next(0);
+    QElapsedTimer timer;
+    timer.start();
+    runProducers(producers, total / producers, [&]() {
+        int n = next.fetch_add(1, std::memory_order_relaxed);
+        qint64 user = n % conversations + 2;
+        store.saveChatMessage(1, user, MessageContent::text("hello"), MessageTime::nowUs()).waitForFinished();
+    });
+    return timer.nsecsElapsed() / 1e9;
+}
+
+// 随机读取会话的最新一页和更早的一页，统计每页读取延迟
+static void readMessageStore(MessageStore &store, int conversations, int pages, LatencyHistogram &latency) {
+    std::mt19937 rng(42);
+    for (int i = 0; i < pages; ++i) {
+        qint64 user = rng() % conversations + 2;
+        bool hasMore = false;
+        QElapsedTimer timer;
+        timer.start();
+        QList<StoredMessage> rows = store.getChatHistory(1, user, HistoryPage::fromRequest(QJsonObject()), hasMore);
+        if (!rows.isEmpty() && hasMore) {
+            QJsonObject request;
+            request["before_seq"] = rows.first().seq;
+            store.getChatHistory(1, user, HistoryPage::fromRequest(request), hasMore);
+        }
+        latency.record(timer.nsecsElapsed());
+    }
+}
+
+static int benchMessageStore(const QStringList &args) {
+    int total = args.value(0, "20000").toInt();
+    int conversations = std::max(1, args.value(1, "100").toInt());
+    int producers = 8;
+    int pages = 2000;
+    total = total / producers * producers;
+
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        fprintf(stderr, "failed to create temporary directory\n");
+        return 1;
+    }
+
+    printf("messagestore: messages=%d conversations=%d producers=%d\n", total, conversations, producers);
+
+    // 1. SQLite：数据库写线程组提交，读连接走 (conversation_id, seq) 索引
+    {
+        QString path = dir.filePath("messages.db");
+        if (!createDatabase(path, "bench_setup")) {
+            fprintf(stderr, "failed to create database\n");
+            return 1;
+        }
+
+        DbWriter writer;
+        DbConnectionPool pool;
+        if (!writer.init(path, 256, 2) || !pool.init(path, 1, 5000)) {
+            return 1;
+        }
+        SqliteMessageStore store(&writer, &pool);
+        double secs = fillMessageStore(store, producers, total, conversations);
+        printf("  sqlite write   : %10.0f msg/s (%.3f s)\n", total / secs, secs);
+
+        LatencyHistogram latency;
+        {
+            DbReadScope scope(&pool);
+            readMessageStore(store, conversations, pages, latency);
+        }
+        printf("  sqlite read    : %s\n", qPrintable(latency.snapshot().toString()));
+        writer.stop();
+        writer.wait();
+    }
+
+    // 2. 分段日志：组提交追加写入，内存映射读取
+    {
+        SegmentLogStore store;
+        if (!store.init(dir.filePath("message_log"), 64LL * 1024 * 1024, 32, 256, 2)) {
+            fprintf(stderr, "failed to open message log\n");
+            return 1;
+        }
+        double secs = fillMessageStore(store, producers, total, conversations);
+        printf("  segmentlog write: %9.0f msg/s (%.3f s, syncs=%llu)\n", total / secs, secs,
+               (unsigned long long)store.syncCount());
+
+        LatencyHistogram latency;
+        readMessageStore(store, conversations, pages, latency);
+        printf("  segmentlog read : %s\n", qPrintable(latency.snapshot().toString()));
+        store.stop();
+        store.wait();
+    }
+    return 0;
+}
+
+// 随机昵称：小写字母开头，6~12 个字母或数字
+static QString randomNickname(std::mt19937 &rng) {
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    int length = 6 + int(rng() % 7);
+    QString nickname;
+    nickname.reserve(length);
+    nickname.append(QChar(chars[rng() % 26]));
+    for (int i = 1; i < length; ++i) {
+        nickname.append(QChar(chars[rng() % 36]));
+    }
+    return nickname;
+}
+
+static int benchUserDirectory(const QStringList &args) {
+    QStringList sizes = args.isEmpty() ? QStringList{"1000000", "10000000"} : args;
+    const int searches = 20000;
+    const int inserts = 100000;
+    const int maxScan = 50000;
+    static const char *domains[] = {"example.com", "mail.com", "test.org", "chat.net"};
+
+    for (const QString &size : sizes) {
+        int users = size.toInt();
+        printf("userdirectory: users=%d\n", users);
+
+        UserDirectory directory;
+        std::mt19937 rng(42);
+        int next = 0;
+        QElapsedTimer timer;
+        timer.start();
+        directory.load([&](qint64 &id, QString &nickname, QString &email) {
+            if (next == users) {
+                return false;
+            }
+            id = ++next;
+            // 加上 ID 保证昵称唯一
+            nickname = randomNickname(rng) + QString::number(id);
+            email = nickname + "@" + domains[rng() % 4];
+            return true;
+        });
+        double loadSecs = timer.nsecsElapsed() / 1e9;
+        printf("  load           : %.3f s, %.1f MB\n", loadSecs, directory.memoryBytes() / 1024.0 / 1024.0);
+
+        // 不同长度的随机前缀，前缀越短匹配越多
+        for (int length = 1; length <= 4; ++length) {
+            LatencyHistogram latency;
+            qint64 results = 0;
+            for (int i = 0; i < searches; ++i) {
+                QString prefix = randomNickname(rng).left(length);
+                bool hasMore = false;
+                QElapsedTimer searchTimer;
+                searchTimer.start();
+                results += directory.search(prefix, 0, 20, maxScan, hasMore).size();
+                latency.record(searchTimer.nsecsElapsed());
+            }
+            printf("  prefix len %d   : %s (avg results %.1f)\n", length,
+                   qPrintable(latency.snapshot().toString()), double(results) / searches);
+        }
+
+        // 注册新用户：追加到增量表，定期归并
+        timer.restart();
+        for (int i = 0; i < inserts; ++i) {
+            qint64 id = ++next;
+            QString nickname = randomNickname(rng) + QString::number(id);
+            directory.insert(id, nickname, nickname + "@example.com");
+        }
+        double insertSecs = timer.nsecsElapsed() / 1e9;
+        printf("  insert         : %10.0f user/s (%.3f s)\n", inserts / insertSecs, insertSecs);
+    }
+    return 0;
+}
+
+static int benchBlobCache(const QStringList &args) {
+    qint64 cacheBytes = (args.size() > 0 ? args[0].toLongLong() : 64) * 1024 * 1024;
+    int requests = args.size() > 1 ? args[1].toInt() : 1000000;
+    const int hotFiles = 20000;
+    const int largeFileBytes = 1024 * 1024;
+    // 五分之一的请求是只下载一次的大文件
+    const int scanPercent = 20;
+
+    // 热点文件 16~64 KB（头像、缩略图），访问频率服从 Zipf 分布（s = 0.9）
+    std::mt19937 rng(42);
+    std::vector<QByteArray> hot;
+    std::vector<double> weights;
+    for (int i = 0; i < hotFiles; ++i) {
+        hot.push_back(QByteArray(16 * 1024 + int(rng() % (48 * 1024)), 'h'));
+        weights.push_back(1.0 / std::pow(i + 1, 0.9));
+    }
+    std::discrete_distribution<int> zipf(weights.begin(), weights.end());
+    QByteArray large(largeFileBytes, 'l');
+
+    printf("blobcache: cache=%lld MB, requests=%d, hot files=%d, one-off large=%d%%\n",
+           cacheBytes / 1024 / 1024, requests, hotFiles, scanPercent);
+    for (bool admission : {false, true}) {
+        BlobCache cache(cacheBytes, 16, admission);
+        std::mt19937 workload(7);
+        int scanned = 0;
+        LatencyHistogram latency;
+        for (int i = 0; i < requests; ++i) {
+            QString key;
+            const QByteArray *blob;
+            if (int(workload() % 100) < scanPercent) {
+                key = QString("large/%1").arg(scanned++);
+                blob = &large;
+            } else {
+                int index = zipf(workload);
+                key = QString("hot/%1").arg(index);
+                blob = &hot[index];
+            }
+            QElapsedTimer timer;
+            timer.start();
+            QByteArray data;
+            if (!cache.get(key, data)) {
+                cache.put(key, *blob);
+            }
+            latency.record(timer.nsecsElapsed());
+        }
+        printf("  %-8s: %s\n    %s\n", admission ? "tinylfu" : "lru",
+               qPrintable(cache.statsReport()), qPrintable(latency.snapshot().toString()));
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments().mid(1);
+    QString name = args.isEmpty() ? QString() : args.takeFirst();
+
+    if (name == "outbound") {
+        return benchOutbound(args);
+    }
+    if (name == "threadpool") {
+        return benchThreadPool(args);
+    }
+    if (name == "numa") {
+        return benchNuma(args);
+    }
+    if (name == "dbwriter") {
+        return benchDbWriter(args);
+    }
+    if (name == "messagestore") {
+        return benchMessageStore(args);
+    }
+    if (name == "userdirectory") {
+        return benchUserDirectory(args);
+    }
+    if (name == "blobcache") {
+        return benchBlobCache(args);
+    }
+
+    fprintf(stderr, "usage: %s <benchmark> [args...]\n", argv[0]);
+    fprintf(stderr, "  outbound [producers] [messages_per_producer] [payload_bytes]\n");
+    fprintf(stderr, "  threadpool [threads] [tasks]\n");
+    fprintf(stderr, "  numa [buffer_mb]\n");
+    fprintf(stderr, "  dbwriter [producers] [messages_per_producer]\n");
+    fprintf(stderr, "  messagestore [messages] [conversations]\n");
+    fprintf(stderr, "  userdirectory [users...]\n");
+    fprintf(stderr, "  blobcache [cache_mb] [requests]\n");
+    return 1;
+}
+
+#include "benchmark.moc"
@@ -0,0 +1,892 @@
+// 合成数据生成工具
+// 生成可配置规模的模拟数据，批量写入服务器的数据目录（users.db 和 chat_images/），
+// 用于在接近真实规模的数据（例如 100 万用户、1 亿条消息）上运行存储和服务器基准测试。
+// 用法: ChatServerDatagen [选项]，默认写入服务器使用的数据目录（可执行文件所在目录的上一级），
+// 完整的选项见 --help。生成的数据：
+//   用户：昵称为随机字母加用户 ID，密码与昵称相同（便于登录测试）
+//   好友关系：每个用户的好友数服从幂律分布（少数用户有大量好友），按配置模型随机配对
+//   群聊：群大小服从幂律分布，成员优先从群主的好友中选取
+//   消息：会话的活跃度和文本长度服从对数正态分布，文本为中英文混合，一部分消息为图片，
+//         引用的图片按热度分布；发送时间分布在最近 --days 天内
+//   图片：随机生成的 JPEG，写入内容寻址的图片存储并生成缩小版本，images 表记录引用计数
+// 写入方式：只写入新建的数据库；写入期间关闭回滚日志和同步，按主键顺序插入，
+// 每个事务写入 --batch-rows 行，结束后切换为服务器使用的 WAL 模式。
+// 所有会话的消息按发送时间合并后写入，消息 id 随发送时间递增，与服务器在线写入的数据一致
+// （冷消息归档按 id 顺序扫描过期消息，遇到第一条未过期的消息即停止）。
+// 全文索引不在这里建立：服务器首次启动时创建索引表，并在后台为已有消息补建索引。
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QBuffer>
+#include <QColor>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QLinearGradient>
+#include <QPainter>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariant>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "../src/conversation.h"
+#include "../src/imagestore.h"
+#include "../src/messagecontent.h"
+#include "../src/messagetime.h"
+#include "../src/schemamigration.h"
+
+typedef std::mt19937_64 Rng;
+
+// 好友数幂律分布的指数（平均值为最小值的 (a-1)/(a-2) 倍）
+static const double FriendDegreeAlpha = 2.5;
+// 群大小幂律分布的指数
+static const double GroupSizeAlpha = 2.0;
+static const int MinGroupSize = 3;
+// 会话活跃度（对数正态分布）的离散程度：越大，消息越集中在少数会话中
+static const double ConversationActivitySigma = 1.5;
+// 文本长度（字符数）的对数正态分布：中位数和离散程度
+static const double TextLengthMedian = 16.0;
+static const double TextLengthSigma = 0.9;
+static const int MaxTextLength = 2000;
+// 中文消息的比例（百分比）
+static const int ChineseTextPercent = 60;
+// 同一会话中下一条消息换人发送的概率（连续发送多条是常见情况）
+static const double SwitchSenderProbability = 0.35;
+// 图片热度的偏斜程度（越大，引用越集中在少数图片上）
+static const double ImagePopularitySkew = 3.0;
+// 群聊中发言者的偏斜程度
+static const double GroupSpeakerSkew = 2.5;
+// 生成图片的 JPEG 质量
+static const int ImageJpegQuality = 85;
+
+static const char *const EnglishWords[] = {
+    "ok", "yes", "no", "hello", "hi", "thanks", "the", "a", "to", "is", "are", "we", "you", "i", "it",
+    "meeting", "tomorrow", "today", "tonight", "lunch", "dinner", "project", "deadline", "review", "code",
+    "build", "test", "release", "server", "client", "photo", "call", "later", "sure", "sorry", "great",
+    "good", "nice", "lol", "why", "what", "when", "where", "how", "see", "will", "can", "need", "done",
+    "fix", "bug", "merge", "branch", "weekend", "coffee", "game", "movie", "music", "trip", "home", "work",
+    "office", "bus", "train", "late", "early", "morning", "night", "let's", "go", "now", "soon", "please",
+};
+
+// 常用汉字，按使用频率大致排序（越靠前越常被选中）
+static const QString ChineseChars = QStringLiteral(
+    "的一是在不了有和人这中大为上个我以要他时来用们生到作地于出就分对成会可主发年动同工也能下过子说"
+    "种面而方后多定行学法所得经十三之进着等部度家电力里如水化高自二理起小物现实加量都两体制机当使点"
+    "从业本去把性好应开它合还因由其些然前外天四日那事平形相全表间样与关各重新线内数正心反你明看原又"
+    "么利比或但质气第向道命此变条只没结解问意建月公无系很情者最立代想已通并提直题程展五果料象员位入"
+    "常文总次品式活设及管特件长求老头基资边流路级少图山统接知较将组见计别她手角期根论运指几九区强放"
+    "决西被干做必战先回则任取据处吃饭喝茶开会下班周末电影游戏哈好的吧呢吗啊");
+
+// 与服务器的 Server::hashPassword 相同
+static QString hashPassword(const QString &password) {
+    QString saltedPassword = password + "my_salt";
+    return QString(QCryptographicHash::hash(saltedPassword.toUtf8(), QCryptographicHash::Sha256).toHex());
+}
+
+static double uniform(Rng &rng) {
+    return std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+}
+
+// 幂律分布的整数：P(x) ∝ x^-alpha，x ∈ [minValue, maxValue]（逆变换采样，超过上限的截断）
+static int powerLaw(Rng &rng, double alpha, double minValue, int maxValue) {
+    double x = minValue * std::pow(1.0 - uniform(rng), -1.0 / (alpha - 1.0));
+    return int(std::min<double>(x, maxValue));
+}
+
+// [0, n) 中偏向较小值的下标，skew 越大越集中（用于热度和发言频率）
+static int skewedIndex(Rng &rng, int n, double skew) {
+    return std::min(n - 1, int(n * std::pow(uniform(rng), skew)));
+}
+
+// 随机取整：期望值等于 value
+static qint64 stochasticRound(Rng &rng, double value) {
+    qint64 whole = qint64(value);
+    return whole + (uniform(rng) < value - whole ? 1 : 0);
+}
+
+static QString randomLetters(Rng &rng, int length) {
+    QString letters;
+    letters.reserve(length);
+    for (int i = 0; i < length; ++i) {
+        letters.append(QChar('a' + int(rng() % 26)));
+    }
+    return letters;
+}
+
+static QString randomText(Rng &rng) {
+    static std::lognormal_distribution<double> lengthDistribution(std::log(TextLengthMedian), TextLengthSigma);
+    int length = qBound(1, int(lengthDistribution(rng)), MaxTextLength);
+    QString text;
+    text.reserve(length + 16);
+    if (int(rng() % 100) < ChineseTextPercent) {
+        int chars = ChineseChars.size();
+        for (int i = 0; i < length; ++i) {
+            // 较长的句子中间加标点
+            if (i > 0 && i % 12 == 11) {
+                text.append(QChar(0xFF0C));
+            } else {
+                text.append(ChineseChars[skewedIndex(rng, chars, 2.0)]);
+            }
+        }
+    } else {
+        const int words = int(sizeof(EnglishWords) / sizeof(EnglishWords[0]));
+        while (text.size() < length) {
+            if (!text.isEmpty()) {
+                text.append(' ');
+            }
+            text.append(QLatin1String(EnglishWords[skewedIndex(rng, words, 2.0)]));
+        }
+    }
+    return text;
+}
+
+// 一张随机内容的图片：渐变背景加随机色块，内容各不相同，压缩后的大小与照片接近
+static QByteArray randomImage(Rng &rng, int &width, int &height) {
+    width = 160 + int(rng() % 2240);
+    height = qBound(120, int(width * (0.5 + uniform(rng))), 4000);
+    QImage image(width, height, QImage::Format_RGB32);
+    QPainter painter(&image);
+    QLinearGradient gradient(0, 0, width, height);
+    gradient.setColorAt(0, QColor(int(rng() % 256), int(rng() % 256), int(rng() % 256)));
+    gradient.setColorAt(1, QColor(int(rng() % 256), int(rng() % 256), int(rng() % 256)));
+    painter.fillRect(image.rect(), gradient);
+    for (int i = 0; i < 24; ++i) {
+        QColor color(int(rng() % 256), int(rng() % 256), int(rng() % 256), 64 + int(rng() % 192));
+        painter.fillRect(int(rng() % width), int(rng() % height), 1 + int(rng() % (width / 2)),
+                         1 + int(rng() % (height / 2)), color);
+    }
+    painter.end();
+
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    image.save(&buffer, "JPG", ImageJpegQuality);
+    return data;
+}
+
+// [begin, end) 内 remaining 个均匀分布的随机时间（纪元微秒）中最小的一个（顺序统计量），
+// 每取出一个后以它为新的 begin 继续，逐条得到升序的发送时间，不需要先生成全部再排序
+static qint64 nextTime(Rng &rng, qint64 begin, qint64 end, quint32 remaining) {
+    double fraction = 1.0 - std::pow(1.0 - uniform(rng), 1.0 / remaining);
+    return qBound(begin, begin + qint64(fraction * double(end - begin)), end - 1);
+}
+
+// 批量写入：插入都在大事务中执行，每 batchRows 行提交一次并输出进度
+class BulkWriter {
+public:
+    BulkWriter(QSqlDatabase &db, int batchRows) : m_db(db), m_batchRows(batchRows), m_pending(0), m_rows(0) {}
+
+    // 开始写入一张表
+    bool begin(const QString &table) {
+        m_table = table;
+        m_rows = 0;
+        m_pending = 0;
+        m_timer.start();
+        return transaction();
+    }
+
+    // 执行一条已绑定参数的插入，凑满一批时提交
+    bool exec(QSqlQuery &query) {
+        if (!query.exec()) {
+            qDebug() << "写入" << m_table << "失败:" << query.lastError().text();
+            return false;
+        }
+        ++m_rows;
+        if (++m_pending < m_batchRows) {
+            return true;
+        }
+        if (!commit()) {
+            return false;
+        }
+        printf("  %-16s %12lld rows %10.0f rows/s\r", qPrintable(m_table), m_rows, m_rows / elapsedSecs());
+        fflush(stdout);
+        return transaction();
+    }
+
+    // 提交最后一批并输出这张表的写入速度
+    bool end() {
+        if (!commit()) {
+            return false;
+        }
+        double secs = elapsedSecs();
+        printf("  %-16s %12lld rows %10.0f rows/s (%.1f s)\n", qPrintable(m_table), m_rows,
+               secs > 0 ? m_rows / secs : 0.0, secs);
+        return true;
+    }
+
+private:
+    bool transaction() {
+        if (!m_db.transaction()) {
+            qDebug() << "开始事务失败:" << m_db.lastError().text();
+            return false;
+        }
+        return true;
+    }
+
+    bool commit() {
+        m_pending = 0;
+        if (!m_db.commit()) {
+            qDebug() << "提交事务失败:" << m_table << m_db.lastError().text();
+            return false;
+        }
+        return true;
+    }
+
+    double elapsedSecs() const { return m_timer.nsecsElapsed() / 1e9; }
+
+    QSqlDatabase &m_db;
+    int m_batchRows;
+    int m_pending;
+    qint64 m_rows;
+    QString m_table;
+    QElapsedTimer m_timer;
+};
+
+struct Options {
+    QString dataDir;
+    qint64 users;
+    double avgFriends;
+    int maxFriends;
+    qint64 groups;
+    int maxGroupSize;
+    qint64 messages;
+    double groupMessageRatio;
+    double imageRatio;
+    int images;
+    int days;
+    int batchRows;
+    quint64 seed;
+};
+
+struct GeneratedImage {
+    QString imageId;
+    QString hash;
+    qint64 size;
+    int width;
+    int height;
+    qint64 references;
+};
+
+class DataGenerator {
+public:
+    DataGenerator(const Options &options, QSqlDatabase &db)
+        : m_options(options), m_db(db), m_writer(db, options.batchRows), m_rng(options.seed),
+          m_now(MessageTime::nowUs()), m_messageRows(0) {}
+
+    bool run() {
+        // 先在内存中生成关系，用户行需要好友数和群数
+        generateFriendGraph();
+        generateGroups();
+        return writeUsers() && writeFriends() && writeGroups() && generateImages()
+            && writePrivateMessages() && writeGroupMessages() && writeImages();
+    }
+
+    qint64 friendRows() const { return qint64(m_friendIds.size()); }
+    qint64 groupMemberRows() const { return qint64(m_groupMemberIds.size()); }
+    qint64 messageRows() const { return m_messageRows; }
+
+private:
+    // 配置模型：按幂律分布为每个用户抽取目标好友数，把所有“半条边”随机配对，
+    // 去掉自环和重复的边；结果以 CSR 形式保存（m_friendOffsets[u] 起为用户 u 的好友，按 ID 升序）
+    void generateFriendGraph() {
+        QElapsedTimer timer;
+        timer.start();
+        quint32 users = quint32(m_options.users);
+        int maxDegree = int(qMin<qint64>(m_options.maxFriends, users - 1));
+        double minDegree = qMax(1.0, m_options.avgFriends * (FriendDegreeAlpha - 2.0) / (FriendDegreeAlpha - 1.0));
+
+        std::vector<quint32> stubs;
+        stubs.reserve(size_t(m_options.users * m_options.avgFriends * 1.1));
+        for (quint32 user = 1; user <= users; ++user) {
+            int degree = powerLaw(m_rng, FriendDegreeAlpha, minDegree, maxDegree);
+            stubs.insert(stubs.end(), size_t(degree), user);
+        }
+        std::shuffle(stubs.begin(), stubs.end(), m_rng);
+
+        // 边以 (较小 ID, 较大 ID) 编码，排序后就是私聊会话键的顺序
+        m_edges.reserve(stubs.size() / 2);
+        for (size_t i = 0; i + 1 < stubs.size(); i += 2) {
+            quint32 a = qMin(stubs[i], stubs[i + 1]);
+            quint32 b = qMax(stubs[i], stubs[i + 1]);
+            if (a != b) {
+                m_edges.push_back((quint64(a) << 32) | b);
+            }
+        }
+        std::vector<quint32>().swap(stubs);
+        std::sort(m_edges.begin(), m_edges.end());
+        m_edges.erase(std::unique(m_edges.begin(), m_edges.end()), m_edges.end());
+
+        m_friendOffsets.assign(size_t(users) + 2, 0);
+        for (quint64 edge : m_edges) {
+            ++m_friendOffsets[size_t(edge >> 32) + 1];
+            ++m_friendOffsets[size_t(edge & 0xFFFFFFFF) + 1];
+        }
+        for (size_t i = 1; i < m_friendOffsets.size(); ++i) {
+            m_friendOffsets[i] += m_friendOffsets[i - 1];
+        }
+        m_friendIds.resize(m_edges.size() * 2);
+        std::vector<quint64> fill(m_friendOffsets.begin(), m_friendOffsets.end() - 1);
+        for (quint64 edge : m_edges) {
+            quint32 a = quint32(edge >> 32);
+            quint32 b = quint32(edge & 0xFFFFFFFF);
+            m_friendIds[fill[a]++] = b;
+            m_friendIds[fill[b]++] = a;
+        }
+        // 边已按 (a, b) 排序，但 b 的好友列表中 a 的顺序不保证，逐个排序
+        for (quint32 user = 1; user <= users; ++user) {
+            std::sort(m_friendIds.begin() + qint64(m_friendOffsets[user]),
+                      m_friendIds.begin() + qint64(m_friendOffsets[user + 1]));
+        }
+        printf("  friend graph     %12lld edges, avg %.1f friends (%.1f s)\n", qint64(m_edges.size()),
+               2.0 * m_edges.size() / users, timer.nsecsElapsed() / 1e9);
+    }
+
+    int friendCount(quint32 user) const {
+        return int(m_friendOffsets[user + 1] - m_friendOffsets[user]);
+    }
+
+    // 群大小服从幂律分布；成员先从群主的好友中随机选取，不够时再随机选取其他用户
+    void generateGroups() {
+        quint32 users = quint32(m_options.users);
+        int maxSize = int(qMin<qint64>(m_options.maxGroupSize, users));
+        m_groupCounts.assign(size_t(users) + 1, 0);
+        m_groupOffsets.assign(size_t(m_options.groups) + 2, 0);
+        std::vector<quint32> members;
+        for (qint64 group = 1; group <= m_options.groups; ++group) {
+            int size = qMax(qMin(MinGroupSize, maxSize), powerLaw(m_rng, GroupSizeAlpha, MinGroupSize, maxSize));
+            quint32 creator = 1 + quint32(m_rng() % users);
+            members.clear();
+            members.push_back(creator);
+
+            std::vector<quint32> friends(m_friendIds.begin() + qint64(m_friendOffsets[creator]),
+                                         m_friendIds.begin() + qint64(m_friendOffsets[creator + 1]));
+            std::shuffle(friends.begin(), friends.end(), m_rng);
+            for (size_t i = 0; i < friends.size() && int(members.size()) < size; ++i) {
+                members.push_back(friends[i]);
+            }
+            // 随机补足（大群只有少数成员互为好友），重复的成员最后去掉
+            for (int attempts = 0; int(members.size()) < size && attempts < size * 4; ++attempts) {
+                members.push_back(1 + quint32(m_rng() % users));
+            }
+            std::sort(members.begin(), members.end());
+            members.erase(std::unique(members.begin(), members.end()), members.end());
+
+            m_groupCreators.push_back(creator);
+            for (quint32 member : members) {
+                m_groupMemberIds.push_back(member);
+                ++m_groupCounts[member];
+            }
+            m_groupOffsets[size_t(group) + 1] = m_groupMemberIds.size();
+        }
+        printf("  groups           %12lld groups, avg %.1f members\n", m_options.groups,
+               m_options.groups ? double(m_groupMemberIds.size()) / m_options.groups : 0.0);
+    }
+
+    // 注册时间早于所有消息
+    QString randomRegisterTime() {
+        qint64 daysBefore = m_options.days + qint64(m_rng() % quint64(qMax(1, m_options.days)));
+        qint64 msecs = m_now / 1000 - daysBefore * 24 * 3600 * 1000 - qint64(m_rng() % (24 * 3600 * 1000));
+        return QDateTime::fromMSecsSinceEpoch(msecs).toString(Qt::ISODate);
+    }
+
+    bool writeUsers() {
+        QSqlQuery insert(m_db);
+        insert.prepare("INSERT INTO users (id, email, nickname, password, is_online, register_time, last_login_time, "
+                       "friend_count, group_count) VALUES (?, ?, ?, ?, 0, ?, ?, ?, ?)");
+        static const char *domains[] = {"example.com", "mail.com", "test.org", "chat.net"};
+        if (!m_writer.begin("users")) {
+            return false;
+        }
+        for (quint32 user = 1; user <= quint32(m_options.users); ++user) {
+            // 随机部分只有字母，加上 ID 后昵称不会重复
+            QString nickname = randomLetters(m_rng, 4 + int(m_rng() % 6)) + QString::number(user);
+            QString registerTime = randomRegisterTime();
+            insert.bindValue(0, qint64(user));
+            insert.bindValue(1, nickname + "@" + domains[m_rng() % 4]);
+            insert.bindValue(2, nickname);
+            insert.bindValue(3, hashPassword(nickname));
+            insert.bindValue(4, registerTime);
+            insert.bindValue(5, registerTime);
+            insert.bindValue(6, friendCount(user));
+            insert.bindValue(7, m_groupCounts[user]);
+            if (!m_writer.exec(insert)) {
+                return false;
+            }
+        }
+        return m_writer.end();
+    }
+
+    // 按 (user_id, friend_id) 主键顺序写入双向的好友关系
+    bool writeFriends() {
+        QSqlQuery insert(m_db);
+        insert.prepare("INSERT INTO friends (user_id, friend_id) VALUES (?, ?)");
+        if (!m_writer.begin("friends")) {
+            return false;
+        }
+        for (quint32 user = 1; user <= quint32(m_options.users); ++user) {
+            for (quint64 i = m_friendOffsets[user]; i < m_friendOffsets[user + 1]; ++i) {
+                insert.bindValue(0, qint64(user));
+                insert.bindValue(1, qint64(m_friendIds[i]));
+                if (!m_writer.exec(insert)) {
+                    return false;
+                }
+            }
+        }
+        return m_writer.end();
+    }
+
+    bool writeGroups() {
+        QSqlQuery insertGroup(m_db);
+        insertGroup.prepare("INSERT INTO groups (id, name, creator_id, create_time) VALUES (?, ?, ?, ?)");
+        if (!m_writer.begin("groups")) {
+            return false;
+        }
+        for (qint64 group = 1; group <= m_options.groups; ++group) {
+            insertGroup.bindValue(0, group);
+            insertGroup.bindValue(1, QString("group%1").arg(group));
+            insertGroup.bindValue(2, qint64(m_groupCreators[size_t(group - 1)]));
+            insertGroup.bindValue(3, randomRegisterTime());
+            if (!m_writer.exec(insertGroup)) {
+                return false;
+            }
+        }
+        if (!m_writer.end()) {
+            return false;
+        }
+
+        QSqlQuery insertMember(m_db);
+        insertMember.prepare("INSERT INTO group_members (group_id, member_id) VALUES (?, ?)");
+        if (!m_writer.begin("group_members")) {
+            return false;
+        }
+        for (qint64 group = 1; group <= m_options.groups; ++group) {
+            for (quint64 i = m_groupOffsets[size_t(group)]; i < m_groupOffsets[size_t(group) + 1]; ++i) {
+                insertMember.bindValue(0, group);
+                insertMember.bindValue(1, qint64(m_groupMemberIds[i]));
+                if (!m_writer.exec(insertMember)) {
+                    return false;
+                }
+            }
+        }
+        return m_writer.end();
+    }
+
+    // 生成图片并写入图片存储（与服务器上传后的处理相同：原图和缩小版本）
+    bool generateImages() {
+        if (m_options.images <= 0) {
+            return true;
+        }
+        QElapsedTimer timer;
+        timer.start();
+        ImageStore store(m_options.dataDir + "/chat_images/");
+        qint64 bytes = 0;
+        for (int i = 0; i < m_options.images; ++i) {
+            GeneratedImage image;
+            QByteArray data = randomImage(m_rng, image.width, image.height);
+            image.hash = ImageStore::hashOf(data);
+            image.imageId = ImageStore::imageIdOf(image.hash, "jpg");
+            image.size = data.size();
+            image.references = 0;
+            if (!store.write(image.hash, data)) {
+                return false;
+            }
+            store.writeVariants(image.hash, data);
+            bytes += data.size();
+            m_images.push_back(image);
+            printf("  images           %12d files\r", i + 1);
+            fflush(stdout);
+        }
+        printf("  images           %12d files, %.1f MB (%.1f s)\n", m_options.images, bytes / 1024.0 / 1024.0,
+               timer.nsecsElapsed() / 1e9);
+        return true;
+    }
+
+    MessageContent randomContent() {
+        if (!m_images.empty() && uniform(m_rng) < m_options.imageRatio) {
+            GeneratedImage &image = m_images[size_t(skewedIndex(m_rng, int(m_images.size()), ImagePopularitySkew))];
+            ++image.references;
+            return MessageContent::image(image.imageId, image.width, image.height);
+        }
+        return MessageContent::text(randomText(m_rng));
+    }
+
+    // 会话最早的消息时间：越早开始的会话越少
+    qint64 conversationStart() {
+        qint64 span = qint64(m_options.days) * 24 * 3600 * 1000000LL;
+        double age = uniform(m_rng);
+        return m_now - qint64(span * age * age) - 1;
+    }
+
+    // 按活跃度权重把 total 条消息分配给 count 个会话
+    std::vector<quint32> distribute(size_t count, qint64 total, const std::vector<double> &scale) {
+        std::lognormal_distribution<double> activity(0.0, ConversationActivitySigma);
+        std::vector<double> weights(count);
+        double sum = 0;
+        for (size_t i = 0; i < count; ++i) {
+            weights[i] = activity(m_rng) * (scale.empty() ? 1.0 : scale[i]);
+            sum += weights[i];
+        }
+        std::vector<quint32> counts(count, 0);
+        for (size_t i = 0; sum > 0 && i < count; ++i) {
+            counts[i] = quint32(stochasticRound(m_rng, total * weights[i] / sum));
+        }
+        return counts;
+    }
+
+    // 一个会话中尚未写入的消息，发送时间逐条生成
+    struct MessageStream {
+        qint64 sentAt;          // 下一条消息的发送时间
+        quint32 conversation;   // 好友关系或群的下标
+        quint32 remaining;      // 还未写入的消息数（包括下一条）
+        quint32 seq;            // 下一条消息的会话内序号
+        int state;              // 私聊为当前的发送者，群聊为发言最多的成员的偏移
+    };
+
+    MessageStream startStream(quint32 conversation, quint32 count, int state) {
+        MessageStream stream;
+        stream.sentAt = nextTime(m_rng, conversationStart(), m_now, count);
+        stream.conversation = conversation;
+        stream.remaining = count;
+        stream.seq = 1;
+        stream.state = state;
+        return stream;
+    }
+
+    // 按发送时间合并所有会话的消息，逐条交给 write 写入；内存只与会话数有关
+    template<typename Write>
+    bool mergeStreams(std::vector<MessageStream> &streams, Write write) {
+        auto later = [](const MessageStream &a, const MessageStream &b) {
+            return a.sentAt != b.sentAt ? a.sentAt > b.sentAt : a.conversation > b.conversation;
+        };
+        std::make_heap(streams.begin(), streams.end(), later);
+        while (!streams.empty()) {
+            std::pop_heap(streams.begin(), streams.end(), later);
+            MessageStream &stream = streams.back();
+            if (!write(stream)) {
+                return false;
+            }
+            ++m_messageRows;
+            if (--stream.remaining == 0) {
+                streams.pop_back();
+                continue;
+            }
+            ++stream.seq;
+            stream.sentAt = nextTime(m_rng, stream.sentAt, m_now, stream.remaining);
+            std::push_heap(streams.begin(), streams.end(), later);
+        }
+        return true;
+    }
+
+    // 私聊消息：每条好友关系是一个会话
+    bool writePrivateMessages() {
+        qint64 total = qint64(m_options.messages * (1.0 - m_options.groupMessageRatio));
+        std::vector<quint32> counts = distribute(m_edges.size(), total, std::vector<double>());
+        std::vector<MessageStream> streams;
+        for (size_t e = 0; e < m_edges.size(); ++e) {
+            if (counts[e] > 0) {
+                streams.push_back(startStream(quint32(e), counts[e], int(m_rng() % 2)));
+            }
+        }
+
+        QSqlQuery insert(m_db);
+        insert.prepare("INSERT INTO messages (from_id, to_id, sent_at, conversation_id, seq, "
+                       "kind, text, image_id, width, height) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+        if (!m_writer.begin("messages")) {
+            return false;
+        }
+        bool ok = mergeStreams(streams, [&](MessageStream &stream) {
+            quint64 edge = m_edges[stream.conversation];
+            qint64 users[2] = {qint64(edge >> 32), qint64(edge & 0xFFFFFFFF)};
+            if (stream.seq > 1 && uniform(m_rng) < SwitchSenderProbability) {
+                stream.state = 1 - stream.state;
+            }
+            insert.bindValue(0, users[stream.state]);
+            insert.bindValue(1, users[1 - stream.state]);
+            insert.bindValue(2, stream.sentAt);
+            insert.bindValue(3, Conversation::privateKey(users[0], users[1]));
+            insert.bindValue(4, qint64(stream.seq));
+            bindContent(insert, 5, randomContent());
+            return m_writer.exec(insert);
+        });
+        return ok && m_writer.end();
+    }
+
+    // 群聊消息：大群更活跃，群内少数成员发言最多
+    bool writeGroupMessages() {
+        if (m_options.groups == 0) {
+            return true;
+        }
+        qint64 total = qint64(m_options.messages * m_options.groupMessageRatio);
+        std::vector<double> sizes(size_t(m_options.groups));
+        for (size_t g = 0; g < sizes.size(); ++g) {
+            sizes[g] = double(m_groupOffsets[g + 2] - m_groupOffsets[g + 1]);
+        }
+        std::vector<quint32> counts = distribute(sizes.size(), total, sizes);
+        std::vector<MessageStream> streams;
+        for (size_t g = 0; g < counts.size(); ++g) {
+            if (counts[g] > 0) {
+                // 发言最多的成员在每个群中不同
+                int size = int(m_groupOffsets[g + 2] - m_groupOffsets[g + 1]);
+                streams.push_back(startStream(quint32(g), counts[g], int(m_rng() % quint64(size))));
+            }
+        }
+
+        QSqlQuery insert(m_db);
+        insert.prepare("INSERT INTO group_messages (group_id, from_id, sent_at, seq, "
+                       "kind, text, image_id, width, height) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)");
+        if (!m_writer.begin("group_messages")) {
+            return false;
+        }
+        bool ok = mergeStreams(streams, [&](MessageStream &stream) {
+            qint64 group = qint64(stream.conversation) + 1;
+            quint64 first = m_groupOffsets[size_t(group)];
+            int size = int(m_groupOffsets[size_t(group) + 1] - first);
+            int speaker = (skewedIndex(m_rng, size, GroupSpeakerSkew) + stream.state) % size;
+            insert.bindValue(0, group);
+            insert.bindValue(1, qint64(m_groupMemberIds[first + quint64(speaker)]));
+            insert.bindValue(2, stream.sentAt);
+            insert.bindValue(3, qint64(stream.seq));
+            bindContent(insert, 4, randomContent());
+            return m_writer.exec(insert);
+        });
+        return ok && m_writer.end();
+    }
+
+    // 图片记录在引用计数确定后写入
+    bool writeImages() {
+        if (m_images.empty()) {
+            return true;
+        }
+        QSqlQuery insert(m_db);
+        insert.prepare("INSERT OR IGNORE INTO images (hash, size, ref_count, created_at) VALUES (?, ?, ?, ?)");
+        if (!m_writer.begin("images")) {
+            return false;
+        }
+        for (const GeneratedImage &image : m_images) {
+            insert.bindValue(0, image.hash);
+            insert.bindValue(1, image.size);
+            insert.bindValue(2, image.references);
+            insert.bindValue(3, m_now);
+            if (!m_writer.exec(insert)) {
+                return false;
+            }
+        }
+        return m_writer.end();
+    }
+
+    static void bindContent(QSqlQuery &query, int first, const MessageContent &content) {
+        const QVariantList values = content.columnValues();
+        for (int i = 0; i < values.size(); ++i) {
+            query.bindValue(first + i, values[i]);
+        }
+    }
+
+    const Options &m_options;
+    QSqlDatabase &m_db;
+    BulkWriter m_writer;
+    Rng m_rng;
+    qint64 m_now;
+
+    std::vector<quint64> m_edges;           // 好友关系 (较小 ID << 32 | 较大 ID)，升序
+    std::vector<quint64> m_friendOffsets;   // CSR：用户 u 的好友为 m_friendIds[offsets[u], offsets[u + 1])
+    std::vector<quint32> m_friendIds;
+    std::vector<quint32> m_groupCreators;   // 群 g 的群主为 m_groupCreators[g - 1]
+    std::vector<quint64> m_groupOffsets;    // CSR：群 g 的成员为 m_groupMemberIds[offsets[g], offsets[g + 1])
+    std::vector<quint32> m_groupMemberIds;
+    std::vector<int> m_groupCounts;         // 每个用户加入的群数
+    std::vector<GeneratedImage> m_images;
+    qint64 m_messageRows;
+};
+
+// 只写入新建的数据库：写入期间不记录回滚日志，失败时只能删除重建
+static bool openDatabase(QSqlDatabase &db, const QString &dbPath) {
+    db = QSqlDatabase::addDatabase("QSQLITE");
+    db.setDatabaseName(dbPath);
+    if (!db.open()) {
+        qDebug() << "Error: Failed to open database:" << db.lastError().text();
+        return false;
+    }
+    const QStringList pragmas = {
+        "PRAGMA journal_mode=OFF",
+        "PRAGMA synchronous=OFF",
+        "PRAGMA locking_mode=EXCLUSIVE",
+        "PRAGMA cache_size=-262144",
+        "PRAGMA temp_store=MEMORY",
+    };
+    QSqlQuery query(db);
+    for (const QString &pragma : pragmas) {
+        if (!query.exec(pragma)) {
+            qDebug() << "设置数据库参数失败:" << pragma << query.lastError().text();
+            return false;
+        }
+    }
+    return SchemaMigration::upgrade(db);
+}
+
+// 写入完成后切换为服务器使用的 WAL 模式，并把数据同步到磁盘
+static bool finishDatabase(QSqlDatabase &db) {
+    QSqlQuery query(db);
+    const QStringList pragmas = {
+        "PRAGMA synchronous=FULL",
+        "PRAGMA locking_mode=NORMAL",
+        "PRAGMA journal_mode=WAL",
+    };
+    for (const QString &pragma : pragmas) {
+        if (!query.exec(pragma)) {
+            qDebug() << "设置数据库参数失败:" << pragma << query.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool parseCount(const QCommandLineParser &parser, const QCommandLineOption &option, qint64 minValue, qint64 &value) {
+    bool ok = false;
+    value = parser.value(option).toLongLong(&ok);
+    if (!ok || value < minValue) {
+        fprintf(stderr, "Invalid --%s: %s\n", qPrintable(option.names().first()), qPrintable(parser.value(option)));
+        return false;
+    }
+    return true;
+}
+
+static bool parseRatio(const QCommandLineParser &parser, const QCommandLineOption &option, double &value) {
+    bool ok = false;
+    value = parser.value(option).toDouble(&ok);
+    if (!ok || value < 0.0 || value > 1.0) {
+        fprintf(stderr, "Invalid --%s: %s\n", qPrintable(option.names().first()), qPrintable(parser.value(option)));
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Generate a synthetic chat dataset and bulk-load it into the server's data directory.");
+    parser.addHelpOption();
+    QCommandLineOption dataDirOption("data-dir",
+        "Directory that receives users.db and chat_images/ (the server uses the parent of its binary directory).",
+        "dir", QCoreApplication::applicationDirPath() + "/..");
+    QCommandLineOption usersOption("users", "Number of users.", "n", "100000");
+    QCommandLineOption friendsOption("avg-friends", "Target average number of friends (power-law distributed).", "n", "20");
+    QCommandLineOption maxFriendsOption("max-friends", "Upper bound on friends per user.", "n", "5000");
+    QCommandLineOption groupsOption("groups", "Number of groups (default: users / 20).", "n");
+    QCommandLineOption maxGroupSizeOption("max-group-size", "Upper bound on group size (power-law distributed from 3).", "n", "500");
+    QCommandLineOption messagesOption("messages", "Total number of messages (private and group).", "n", "10000000");
+    QCommandLineOption groupRatioOption("group-ratio", "Fraction of messages sent in groups.", "ratio", "0.3");
+    QCommandLineOption imageRatioOption("image-ratio", "Fraction of messages that are images.", "ratio", "0.02");
+    QCommandLineOption imagesOption("images", "Number of distinct images to generate.", "n", "500");
+    QCommandLineOption daysOption("days", "Messages are spread over this many days before now.", "n", "365");
+    QCommandLineOption batchRowsOption("batch-rows", "Rows per transaction.", "n", "500000");
+    QCommandLineOption seedOption("seed", "Random seed.", "n", "42");
+    QCommandLineOption forceOption("force", "Delete an existing users.db instead of refusing to run.");
+    parser.addOptions({dataDirOption, usersOption, friendsOption, maxFriendsOption, groupsOption, maxGroupSizeOption,
+                       messagesOption, groupRatioOption, imageRatioOption, imagesOption, daysOption, batchRowsOption,
+                       seedOption, forceOption});
+    parser.process(app);
+
+    Options options;
+    qint64 maxFriends = 0;
+    qint64 maxGroupSize = 0;
+    qint64 images = 0;
+    qint64 days = 0;
+    qint64 batchRows = 0;
+    qint64 seed = 0;
+    bool friendsOk = false;
+    options.avgFriends = parser.value(friendsOption).toDouble(&friendsOk);
+    if (!friendsOk || options.avgFriends < 1.0) {
+        fprintf(stderr, "Invalid --avg-friends: %s\n", qPrintable(parser.value(friendsOption)));
+        return 1;
+    }
+    if (!parseCount(parser, usersOption, 2, options.users)
+        || !parseCount(parser, maxFriendsOption, 1, maxFriends)
+        || !parseCount(parser, maxGroupSizeOption, MinGroupSize, maxGroupSize)
+        || !parseCount(parser, messagesOption, 0, options.messages)
+        || !parseRatio(parser, groupRatioOption, options.groupMessageRatio)
+        || !parseRatio(parser, imageRatioOption, options.imageRatio)
+        || !parseCount(parser, imagesOption, 0, images)
+        || !parseCount(parser, daysOption, 1, days)
+        || !parseCount(parser, batchRowsOption, 1, batchRows)
+        || !parseCount(parser, seedOption, 0, seed)) {
+        return 1;
+    }
+    // 用户 ID 以 32 位保存在会话键中
+    if (options.users > 0x7FFFFFFF) {
+        fprintf(stderr, "Invalid --users: %lld (at most %d)\n", options.users, 0x7FFFFFFF);
+        return 1;
+    }
+    options.groups = options.users / 20;
+    if (parser.isSet(groupsOption) && !parseCount(parser, groupsOption, 0, options.groups)) {
+        return 1;
+    }
+    options.maxFriends = int(qMin<qint64>(maxFriends, 1 << 20));
+    options.maxGroupSize = int(qMin<qint64>(maxGroupSize, 1 << 20));
+    options.images = int(qMin<qint64>(images, 1 << 20));
+    options.days = int(qMin<qint64>(days, 36500));
+    options.batchRows = int(qMin<qint64>(batchRows, 1 << 30));
+    options.seed = quint64(seed);
+    options.dataDir = QDir(parser.value(dataDirOption)).absolutePath();
+
+    QString dbPath = options.dataDir + "/users.db";
+    if (QFile::exists(dbPath)) {
+        if (!parser.isSet(forceOption)) {
+            fprintf(stderr, "%s already exists, pass --force to replace it\n", qPrintable(dbPath));
+            return 1;
+        }
+        for (const char *suffix : {"", "-wal", "-shm"}) {
+            QFile::remove(dbPath + suffix);
+        }
+    }
+    if (!QDir().mkpath(options.dataDir + "/chat_images")) {
+        fprintf(stderr, "Failed to create %s/chat_images\n", qPrintable(options.dataDir));
+        return 1;
+    }
+
+    printf("datagen: users=%lld avg_friends=%.1f groups=%lld messages=%lld group_ratio=%.2f image_ratio=%.3f "
+           "images=%d days=%d seed=%llu\n",
+           options.users, options.avgFriends, options.groups, options.messages, options.groupMessageRatio,
+           options.imageRatio, options.images, options.days, options.seed);
+    printf("  output           %s\n", qPrintable(dbPath));
+
+    QElapsedTimer timer;
+    timer.start();
+    bool ok;
+    {
+        QSqlDatabase db;
+        ok = openDatabase(db, dbPath);
+        if (ok) {
+            DataGenerator generator(options, db);
+            ok = generator.run() && finishDatabase(db);
+            if (ok) {
+                double secs = timer.nsecsElapsed() / 1e9;
+                printf("done: %lld users, %lld friend rows, %lld groups, %lld members, %lld messages, %d images "
+                       "in %.1f s\n",
+                       options.users, generator.friendRows(), options.groups, generator.groupMemberRows(),
+                       generator.messageRows(), options.images, secs);
+            }
+        }
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
+
+    if (!ok) {
+        // 写入期间没有回滚日志，失败的数据库不可用
+        fprintf(stderr, "datagen failed, removing incomplete %s\n", qPrintable(dbPath));
+        QFile::remove(dbPath);
+        return 1;
+    }
+    printf("  database size    %.1f MB\n", QFileInfo(dbPath).size() / 1024.0 / 1024.0);
+    printf("  test login: any generated nickname, password = nickname\n");
+    return 0;
+}
@@ -7,6 +7,71 @@ namespace Config {
     // 网络配置
     static const quint16 DefaultPort = 12345;
     static const QString DefaultServerIp = "127.0.0.1";
+
+    // 单条消息的最大长度（字节），超过则认为数据流已损坏
+    static const int MaxMessageSize = 64 * 1024 * 1024;
+
+    // 服务器执行器配置
+    // 数据库执行器线程数（每个线程持有一个数据库连接）
+    static const int DbExecutorThreads = 4;
+    // 文件 I/O 执行器线程数
+    static const int IoExecutorThreads = 2;
+    // 图片处理执行器线程数（生成缩略图等缩小版本）
+    static const int ImageExecutorThreads = 2;
+    // 线程池统计报告输出间隔（毫秒），0 表示不输出
+    static const int StatsReportIntervalMs = 60 * 1000;
+    // 数据库读连接数上限（每个访问数据库的线程占用一个读连接）
+    static const int DbReadConnections = DbExecutorThreads;
+    // 读连接名额用完时的等待超时（毫秒）
+    static const int DbConnectionWaitMs = 5000;
+    // 每个连接的 SQLite 页缓存大小（KB）
+    static const int DbCacheSizeKb = 16 * 1024;
+    // SQLite 内存映射读取的最大字节数
+    static const qint64 DbMmapSizeBytes = 256LL * 1024 * 1024;
+    // 每个连接缓存的预编译语句上限
+    static const int DbStatementCacheSize = 64;
+    // 聊天历史每页默认条数和最大条数
+    static const int HistoryPageSize = 50;
+    static const int HistoryMaxPageSize = 200;
+    // 消息搜索每页默认条数和最大条数
+    static const int SearchPageSize = 20;
+    static const int SearchMaxPageSize = 100;
+    // 用户搜索每页默认条数、最大条数，以及每次搜索最多检查的匹配数
+    static const int UserSearchPageSize = 20;
+    static const int UserSearchMaxPageSize = 100;
+    static const int UserSearchMaxScan = 50000;
+    // 离线消息每批发送的条数，以及一次确认最多包含的消息 ID 数
+    static const int OfflineInboxPageSize = 200;
+    static const int OfflineInboxMaxAckIds = 1000;
+    // 图片缩小版本的长边上限（像素）：缩略图用于消息气泡，中等尺寸用于较大的显示区域
+    static const int ImageThumbnailSize = 320;
+    static const int ImageMediumSize = 1080;
+    // 冷消息归档：默认保留期限（天，0 为不归档）、每块最多条数和检查间隔（毫秒）
+    static const int ArchiveAfterDays = 180;
+    static const int ArchiveBlockRows = 256;
+    static const int ArchiveIntervalMs = 60 * 60 * 1000;
+    // 热点会话缓存：总大小上限（字节）和每个会话保留的最近消息条数
+    static const qint64 HistoryCacheBytes = 64LL * 1024 * 1024;
+    static const int HistoryCacheMessages = 2 * HistoryPageSize;
+    // 图片和头像缓存：总大小上限（字节）、分片数和是否启用准入过滤（TinyLFU）
+    static const qint64 BlobCacheBytes = 128LL * 1024 * 1024;
+    static const int BlobCacheShards = 16;
+    static const bool BlobCacheAdmission = true;
+    // 数据库在线迁移每批处理的行数
+    static const int MigrationBatchRows = 2000;
+    // 启动时为旧消息编号每个事务处理的行数
+    static const int MessageNumberBatchRows = 50000;
+    // 数据库写线程组提交：每批最多行数和凑批等待时间（毫秒）
+    static const int DbWriterBatchRows = 256;
+    static const int DbWriterBatchWindowMs = 2;
+    // 默认线程放置策略：none（不绑定）、node（按NUMA节点绑定）、core（按核心绑定）
+    static const QString DefaultCpuLayout = "none";
+    // 默认消息存储引擎：sqlite（数据库表）或 segmentlog（分段追加日志）
+    static const QString MessageStoreEngine = "sqlite";
+    // 分段日志每个分段文件的预分配大小（字节）
+    static const qint64 MessageLogSegmentBytes = 64LL * 1024 * 1024;
+    // 分段日志稀疏索引间隔：每个会话每隔多少条记录保存一个索引点
+    static const int MessageLogIndexInterval = 32;
     
     // 日志配置
     namespace Logging {
@@ -0,0 +1,151 @@
+#include "messageframer.h"
+#include "config.h"
+#include <QDebug>
+#include <cstring>
+
+static const char BinaryMagic[] = "IMGD";
+static const int BinaryHeaderSize = 12; // 魔数 + 消息类型 + ID长度
+
+MessageFramer::MessageFramer() {
+    resetScan();
+}
+
+void MessageFramer::append(const QByteArray &data) {
+    m_buffer.append(data);
+}
+
+void MessageFramer::clear() {
+    m_buffer.clear();
+    resetScan();
+}
+
+void MessageFramer::resetScan() {
+    m_scanPos = 0;
+    m_depth = 0;
+    m_inString = false;
+    m_escape = false;
+}
+
+void MessageFramer::skipToFrameStart() {
+    int start = 0;
+    while (start < m_buffer.size()) {
+        char c = m_buffer.at(start);
+        if (c == '{' || c == BinaryMagic[0]) {
+            break;
+        }
+        ++start;
+    }
+
+    if (start > 0) {
+        // 帧之间的换行是正常的，其余数据说明流已错位
+        for (int i = 0; i < start; ++i) {
+            char c = m_buffer.at(i);
+            if (c != '\n' && c != '\r' && c != ' ' && c != '\t') {
+                qDebug() << "丢弃无法识别的数据:" << start << "字节";
+                break;
+            }
+        }
+        m_buffer.remove(0, start);
+    }
+}
+
+int MessageFramer::takeBinaryFrame(QByteArray &frame) {
+    if (m_buffer.size() < BinaryHeaderSize) {
+        return 0;
+    }
+
+    qint32 idLength = 0;
+    memcpy(&idLength, m_buffer.constData() + 8, sizeof(qint32));
+    if (idLength <= 0 || idLength > 1024) {
+        return -1;
+    }
+
+    int dataLengthPos = BinaryHeaderSize + idLength;
+    if (m_buffer.size() < dataLengthPos + 4) {
+        return 0;
+    }
+
+    qint32 dataLength = 0;
+    memcpy(&dataLength, m_buffer.constData() + dataLengthPos, sizeof(qint32));
+    if (dataLength < 0 || dataLength > Config::MaxMessageSize) {
+        return -1;
+    }
+
+    int total = dataLengthPos + 4 + dataLength;
+    if (m_buffer.size() < total) {
+        return 0;
+    }
+
+    frame = m_buffer.left(total);
+    m_buffer.remove(0, total);
+    return 1;
+}
+
+bool MessageFramer::next(QByteArray &frame) {
+    while (true) {
+        if (m_scanPos == 0) {
+            skipToFrameStart();
+            if (m_buffer.isEmpty()) {
+                return false;
+            }
+
+            // 二进制图片消息
+            if (m_buffer.at(0) == BinaryMagic[0]) {
+                if (m_buffer.size() < 4) {
+                    return false;
+                }
+                if (m_buffer.startsWith(BinaryMagic)) {
+                    int result = takeBinaryFrame(frame);
+                    if (result > 0) {
+                        return true;
+                    }
+                    if (result == 0) {
+                        return false;
+                    }
+                    qDebug() << "二进制消息头非法，丢弃";
+                }
+                // 不是合法的二进制帧，跳过该字节重新定位
+                m_buffer.remove(0, 1);
+                continue;
+            }
+        }
+
+        // 扫描 JSON 对象，从上次中断的位置继续
+        const char *data = m_buffer.constData();
+        const int size = m_buffer.size();
+        for (int i = m_scanPos; i < size; ++i) {
+            char c = data[i];
+            if (m_inString) {
+                if (m_escape) {
+                    m_escape = false;
+                } else if (c == '\\') {
+                    m_escape = true;
+                } else if (c == '"') {
+                    m_inString = false;
+                }
+                continue;
+            }
+
+            if (c == '"') {
+                m_inString = true;
+            } else if (c == '{') {
+                ++m_depth;
+            } else if (c == '}') {
+                if (--m_depth == 0) {
+                    frame = m_buffer.left(i + 1);
+                    m_buffer.remove(0, i + 1);
+                    resetScan();
+                    return true;
+                }
+            }
+        }
+        m_scanPos = size;
+
+        // 单条消息超过上限，说明数据已损坏
+        if (m_buffer.size() > Config::MaxMessageSize) {
+            qDebug() << "消息超过最大长度，清空缓存:" << m_buffer.size() << "字节";
+            clear();
+        }
+        return false;
+    }
+}
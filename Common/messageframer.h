@@ -0,0 +1,45 @@
+#ifndef MESSAGEFRAMER_H
+#define MESSAGEFRAMER_H
+
+#include <QByteArray>
+
+// 消息分帧器
+// TCP 是字节流，一次 readyRead 可能包含多条消息，也可能只有半条。
+// 分帧器缓存收到的数据，按消息边界切分出完整的帧：
+//   - JSON 消息：以 '{' 开始，括号配平（忽略字符串中的括号）即为一帧
+//   - 二进制图片消息：[4字节魔数"IMGD"][4字节消息类型][4字节ID长度][ID][4字节数据长度][数据]
+class MessageFramer {
+public:
+    MessageFramer();
+
+    // 追加收到的数据
+    void append(const QByteArray &data);
+
+    // 取出下一帧完整消息，没有完整帧时返回false
+    bool next(QByteArray &frame);
+
+    // 清空缓存
+    void clear();
+
+    // 当前缓存的字节数
+    int bufferedBytes() const { return m_buffer.size(); }
+
+private:
+    // 丢弃帧起始位置之前的空白和无法识别的数据
+    void skipToFrameStart();
+
+    // 尝试取出一帧二进制图片消息，返回-1表示数据非法，0表示数据不足，1表示成功
+    int takeBinaryFrame(QByteArray &frame);
+
+    void resetScan();
+
+    QByteArray m_buffer;
+
+    // JSON 扫描状态，数据不完整时下次从断点继续扫描
+    int m_scanPos;
+    int m_depth;
+    bool m_inString;
+    bool m_escape;
+};
+
+#endif // MESSAGEFRAMER_H
@@ -36,12 +36,12 @@ enum MessageType {
     GetUserProfile = 21,    // 获取用户个人资料
     UpdateUserProfile = 22, // 更新用户个人资料
     UploadAvatar = 23,      // 上传头像
-    GetAvatar = 24,         // 获取头像
+    GetAvatar = 24,         // 获取头像 (可选 if_none_match: 已缓存的头像版本，未改变时返回 not_modified)
 
     // 图片消息相关类型
     UploadImageRequest = 25,   // C->S: 请求上传图片 (含 Base64 数据)
     UploadImageResponse = 26,  // S->C: 图片上传结果 (返回 imageId)
-    DownloadImageRequest = 27, // C->S: 请求下载图片 (根据 imageId)
+    DownloadImageRequest = 27, // C->S: 请求下载图片 (根据 imageId, 可选 variant: thumbnail / medium)
     DownloadImageResponse = 28, // S->C: 返回图片数据 (Base64)
 
     // 分块图片传输相关类型
@@ -51,7 +51,20 @@ enum MessageType {
     ChunkedImageResponse = 32, // S->C: 分块图片传输响应 (成功/失败)
 
     // 二进制图片数据传输
-    BinaryImageData = 33       // S->C: 二进制图片数据 (不使用JSON)
+    BinaryImageData = 33,      // S->C: 二进制图片数据 (不使用JSON)
+
+    // 消息确认
+    MessageAck = 34,           // S->C: 私聊消息已持久化 (返回 message_id)
+
+    // 消息搜索
+    SearchMessages = 35,       // C->S: 全文搜索自己的私聊和所在群的消息 / S->C: 搜索结果 (带高亮摘要, 按时间倒序分页)
+
+    // 离线消息
+    OfflineMessages = 36,      // S->C: 离线期间收到的私聊消息 (登录后分批发送, 每批确认后发送下一批)
+    AckDelivery = 37,          // C->S: 确认已收到的离线消息 ID (批量)
+
+    // 图片去重
+    CheckImage = 38            // C->S: 上传前按 SHA-256 查询服务器是否已有该图片 / S->C: 已有时返回图片 ID
 };
 
 class MessageProtocol {
@@ -94,6 +107,11 @@ public:
             case MessageType::ChunkedImageEnd: return "ChunkedImageEnd";
             case MessageType::ChunkedImageResponse: return "ChunkedImageResponse";
             case MessageType::BinaryImageData: return "BinaryImageData";
+            case MessageType::MessageAck: return "MessageAck";
+            case MessageType::SearchMessages: return "SearchMessages";
+            case MessageType::OfflineMessages: return "OfflineMessages";
+            case MessageType::AckDelivery: return "AckDelivery";
+            case MessageType::CheckImage: return "CheckImage";
             default: return "Unknown";
         }
     }